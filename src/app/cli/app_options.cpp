@@ -58,6 +58,7 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_filenameFormat(m_po.add("filename-format").requiresValue("<fmt>").description("Special format to generate filenames"))
 #ifdef ENABLE_SCRIPTING
   , m_script(m_po.add("script").requiresValue("<filename>").description("Execute a specific script"))
+  , m_scriptProfile(m_po.add("script-profile").requiresValue("<filename.json>").description("Profile the next executed scripts and save\nthe report in the given JSON file"))
 #endif
   , m_listLayers(m_po.add("list-layers").description("List layers of the next given sprite\nor include layers in JSON data"))
   , m_listTags(m_po.add("list-tags").description("List tags of the next given sprite\nor include frame tags in JSON data"))
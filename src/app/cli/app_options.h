@@ -72,6 +72,7 @@ public:
   const Option& filenameFormat() const { return m_filenameFormat; }
 #ifdef ENABLE_SCRIPTING
   const Option& script() const { return m_script; }
+  const Option& scriptProfile() const { return m_scriptProfile; }
 #endif
   const Option& listLayers() const { return m_listLayers; }
   const Option& listTags() const { return m_listTags; }
@@ -122,6 +123,7 @@ private:
   Option& m_filenameFormat;
 #ifdef ENABLE_SCRIPTING
   Option& m_script;
+  Option& m_scriptProfile;
 #endif
   Option& m_listLayers;
   Option& m_listTags;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2016  David Capello
+// Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -29,7 +29,8 @@ namespace app {
     virtual void saveFile(const CliOpenFile& cof) { }
     virtual void loadPalette(const CliOpenFile& cof, const std::string& filename) { }
     virtual void exportFiles(DocumentExporter& exporter) { }
-    virtual void execScript(const std::string& filename) { }
+    virtual void execScript(const std::string& filename,
+                            const std::string& profileFilename) { }
   };
 
 } // namespace app
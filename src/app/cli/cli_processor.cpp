@@ -137,6 +137,9 @@ void CliProcessor::process()
     CliOpenFile cof;
     SpriteSheetType sheetType = SpriteSheetType::None;
     app::Document* lastDoc = nullptr;
+#ifdef ENABLE_SCRIPTING
+    std::string scriptProfile;
+#endif
 
     for (const auto& value : m_options.values()) {
       const AppOptions::Option* opt = value.option();
@@ -360,7 +363,11 @@ void CliProcessor::process()
         // --script <filename>
         else if (opt == &m_options.script()) {
           std::string filename = value.value();
-          m_delegate->execScript(filename);
+          m_delegate->execScript(filename, scriptProfile);
+        }
+        // --script-profile <filename.json>
+        else if (opt == &m_options.scriptProfile()) {
+          scriptProfile = value.value();
         }
 #endif
         // --list-layers
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2016  David Capello
+// Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -33,7 +33,8 @@ public:
   void afterOpenFile(const CliOpenFile& cof) override { }
   void saveFile(const CliOpenFile& cof) override { }
   void exportFiles(DocumentExporter& exporter) override { }
-  void execScript(const std::string& filename) override { }
+  void execScript(const std::string& filename,
+                  const std::string& profileFilename) override { }
 
   bool helpWasShown() const { return m_helpWasShown; }
   bool versionWasShown() const { return m_versionWasShown; }
@@ -28,9 +28,13 @@
 
 #ifdef ENABLE_SCRIPTING
   #include "app/script/app_scripting.h"
+  #include "base/fstream_path.h"
+  #include "base/unique_ptr.h"
   #include "script/engine_delegate.h"
+  #include "script/profiler.h"
 #endif
 
+#include <fstream>
 #include <iostream>
 
 namespace app {
@@ -121,12 +125,24 @@ void DefaultCliDelegate::exportFiles(DocumentExporter& exporter)
   LOG("APP: Export sprite sheet: Done\n");
 }
 
-void DefaultCliDelegate::execScript(const std::string& filename)
+void DefaultCliDelegate::execScript(const std::string& filename,
+                                    const std::string& profileFilename)
 {
 #ifdef ENABLE_SCRIPTING
-  script::StdoutEngineDelegate delegate;
-  AppScripting engine(&delegate);
-  engine.evalFile(filename);
+  base::UniquePtr<script::Profiler> profiler;
+  if (!profileFilename.empty())
+    profiler.reset(new script::Profiler);
+
+  {
+    script::StdoutEngineDelegate delegate;
+    AppScripting engine(&delegate, profiler.get());
+    engine.evalFile(filename);
+  }
+
+  if (profiler) {
+    std::ofstream fos(FSTREAM_PATH(profileFilename), std::ios::out);
+    profiler->writeJson(fos);
+  }
 #endif
 }
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2016  David Capello
+// Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -20,7 +20,8 @@ namespace app {
     void saveFile(const CliOpenFile& cof) override;
     void loadPalette(const CliOpenFile& cof, const std::string& filename) override;
     void exportFiles(DocumentExporter& exporter) override;
-    void execScript(const std::string& filename) override;
+    void execScript(const std::string& filename,
+                    const std::string& profileFilename) override;
   };
 
 } // namespace app
@@ -196,9 +196,12 @@ void PreviewCliDelegate::exportFiles(DocumentExporter& exporter)
   }
 }
 
-void PreviewCliDelegate::execScript(const std::string& filename)
+void PreviewCliDelegate::execScript(const std::string& filename,
+                                    const std::string& profileFilename)
 {
   std::cout << "- Run script: '" << filename << "'\n";
+  if (!profileFilename.empty())
+    std::cout << "  - Save profile: '" << profileFilename << "'\n";
 }
 
 void PreviewCliDelegate::showLayersFilter(const CliOpenFile& cof)
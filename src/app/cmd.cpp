@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -90,6 +90,21 @@ size_t Cmd::memSize() const
   return onMemSize();
 }
 
+bool Cmd::compressUndoData()
+{
+  return onCompressUndoData();
+}
+
+bool Cmd::spillUndoData(UndoSpillFile* file)
+{
+  return onSpillUndoData(file);
+}
+
+bool Cmd::dropUndoData()
+{
+  return onDropUndoData();
+}
+
 void Cmd::onExecute()
 {
   // Do nothing
@@ -120,4 +135,19 @@ size_t Cmd::onMemSize() const {
   return sizeof(*this);
 }
 
+bool Cmd::onCompressUndoData()
+{
+  return false;
+}
+
+bool Cmd::onSpillUndoData(UndoSpillFile* file)
+{
+  return false;
+}
+
+bool Cmd::onDropUndoData()
+{
+  return false;
+}
+
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2015  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -16,6 +16,7 @@
 
 namespace app {
   class Context;
+  class UndoSpillFile;
 
   class Cmd : public undo::UndoCommand {
   public:
@@ -34,6 +35,15 @@ namespace app {
 
     Context* context() const { return m_ctx; }
 
+    // Used by DocumentUndo to reduce the memory used by old undo
+    // states. They can be called from a background thread (never
+    // while the command is undone/redone). Each one returns true if
+    // some data was compressed/spilled/dropped. After dropUndoData()
+    // returns true the command cannot be undone/redone anymore.
+    bool compressUndoData();
+    bool spillUndoData(UndoSpillFile* file);
+    bool dropUndoData();
+
   protected:
     virtual void onExecute();
     virtual void onUndo();
@@ -41,6 +51,9 @@ namespace app {
     virtual void onFireNotifications();
     virtual std::string onLabel() const;
     virtual size_t onMemSize() const;
+    virtual bool onCompressUndoData();
+    virtual bool onSpillUndoData(UndoSpillFile* file);
+    virtual bool onDropUndoData();
 
   private:
     Context* m_ctx;
@@ -86,10 +86,10 @@ void ClearMask::clear()
   Cel* cel = this->cel();
   Image* image = m_dstImage->image();
   app::Document* doc = static_cast<app::Document*>(cel->document());
-  Mask* mask = doc->mask();
+  const Mask* mask = doc->mask();
 
-  ASSERT(mask->bitmap());
-  if (!mask->bitmap())
+  ASSERT(!mask->isEmpty());
+  if (mask->isEmpty())
     return;
 
   const LockImageBits<BitmapTraits> maskBits(mask->bitmap());
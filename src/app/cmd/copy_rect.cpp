@@ -33,7 +33,7 @@ CopyRect::CopyRect(Image* dst, const Image* src, const gfx::Clip& clip)
 
   auto it = m_data.begin();
   for (int v=0; v<m_clip.size.h; ++v) {
-    uint8_t* addr = src->getPixelAddress(
+    const uint8_t* addr = src->getPixelConstAddress(
       m_clip.dst.x, m_clip.dst.y+v);
 
     std::copy(addr, addr+lineSize, it);
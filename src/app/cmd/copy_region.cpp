@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -13,6 +13,8 @@
 #include "doc/image.h"
 
 #include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 namespace app {
 namespace cmd {
@@ -22,7 +24,6 @@ CopyRegion::CopyRegion(Image* dst, const Image* src,
                        const gfx::Point& dstPos,
                        bool alreadyCopied)
   : WithImage(dst)
-  , m_size(0)
   , m_alreadyCopied(alreadyCopied)
 {
   // Create region to save/swap later
@@ -39,15 +40,21 @@ CopyRegion::CopyRegion(Image* dst, const Image* src,
   }
 
   // Save region pixels
+  size_t size = 0;
+  for (const auto& rc : m_region)
+    size += rc.h * src->getRowStrideSize(rc.w);
+  m_buffer.resize(size);
+
+  uint8_t* p = m_buffer.data();
   for (const auto& rc : m_region) {
-    for (int y=0; y<rc.h; ++y) {
-      m_stream.write(
-        (const char*)src->getPixelAddress(rc.x-dstPos.x,
-                                          rc.y-dstPos.y+y),
-        src->getRowStrideSize(rc.w));
+    const size_t rowSize = src->getRowStrideSize(rc.w);
+    for (int y=0; y<rc.h; ++y, p+=rowSize) {
+      std::memcpy(p,
+                  src->getPixelConstAddress(rc.x-dstPos.x,
+                                            rc.y-dstPos.y+y),
+                  rowSize);
     }
   }
-  m_size = size_t(m_stream.tellp());
 }
 
 void CopyRegion::onExecute()
@@ -66,32 +73,41 @@ void CopyRegion::onRedo()
   swap();
 }
 
+bool CopyRegion::onCompressUndoData()
+{
+  return m_buffer.compress();
+}
+
+bool CopyRegion::onSpillUndoData(UndoSpillFile* file)
+{
+  return m_buffer.spill(file);
+}
+
+bool CopyRegion::onDropUndoData()
+{
+  return m_buffer.drop();
+}
+
 void CopyRegion::swap()
 {
-  Image* image = this->image();
+  // DocumentUndo doesn't undo/redo states with dropped data
+  ASSERT(!m_buffer.isDropped());
+  if (!m_buffer.load())
+    throw std::runtime_error("Cannot load the undo information of the image");
 
-  // Save current image region in "tmp" stream
-  std::stringstream tmp;
-  for (const auto& rc : m_region)
-    for (int y=0; y<rc.h; ++y)
-      tmp.write(
-        (const char*)image->getPixelAddress(rc.x, rc.y+y),
-        image->getRowStrideSize(rc.w));
+  Image* image = this->image();
 
-  // Restore m_stream into the image
-  m_stream.seekg(0, std::ios_base::beg);
+  // Swap the image region with the saved pixels (row by row, without
+  // a temporary copy of the whole region)
+  uint8_t* p = m_buffer.data();
   for (const auto& rc : m_region) {
-    for (int y=0; y<rc.h; ++y) {
-      m_stream.read(
-        (char*)image->getPixelAddress(rc.x, rc.y+y),
-        image->getRowStrideSize(rc.w));
+    const size_t rowSize = image->getRowStrideSize(rc.w);
+    for (int y=0; y<rc.h; ++y, p+=rowSize) {
+      uint8_t* row = (uint8_t*)image->getPixelAddress(rc.x, rc.y+y);
+      std::swap_ranges(row, row+rowSize, p);
     }
   }
 
-  // TODO use m_stream.swap(tmp) when clang and gcc support it
-  m_stream.str(tmp.str());
-  m_stream.clear();
-
   image->incrementVersion();
 }
 
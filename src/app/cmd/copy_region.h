@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -10,11 +10,10 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_image.h"
+#include "app/undo_buffer.h"
 #include "gfx/point.h"
 #include "gfx/region.h"
 
-#include <sstream>
-
 namespace app {
 namespace cmd {
   using namespace doc;
@@ -36,16 +35,18 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) + m_size;
+      return sizeof(*this) + m_buffer.memSize();
     }
+    bool onCompressUndoData() override;
+    bool onSpillUndoData(UndoSpillFile* file) override;
+    bool onDropUndoData() override;
 
   private:
     void swap();
 
-    size_t m_size;
     bool m_alreadyCopied;
     gfx::Region m_region;
-    std::stringstream m_stream;
+    UndoBuffer m_buffer;
   };
 
 } // namespace cmd
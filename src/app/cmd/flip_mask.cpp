@@ -40,8 +40,8 @@ void FlipMask::swap()
   Document* document = this->document();
   Mask* mask = document->mask();
 
-  ASSERT(mask->bitmap());
-  if (!mask->bitmap())
+  ASSERT(!mask->isEmpty());
+  if (mask->isEmpty())
     return;
 
   mask->freeze();
@@ -28,8 +28,8 @@ FlipMaskedCel::FlipMaskedCel(Cel* cel, doc::algorithm::FlipType flipType)
   color_t bgcolor = doc->bgColor(cel->layer());
   Image* image = cel->image();
   Mask* mask = doc->mask();
-  ASSERT(mask->bitmap());
-  if (!mask->bitmap())
+  ASSERT(!mask->isEmpty());
+  if (mask->isEmpty())
     return;
 
   ImageRef copy(Image::createCopy(image));
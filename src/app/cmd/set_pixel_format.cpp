@@ -23,8 +23,11 @@
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/sprite.h"
+#include "doc/thread_pool.h"
 #include "render/quantization.h"
 
+#include <vector>
+
 namespace app {
 namespace cmd {
 
@@ -40,19 +43,43 @@ SetPixelFormat::SetPixelFormat(Sprite* sprite,
   if (sprite->pixelFormat() == newFormat)
     return;
 
-  for (Cel* cel : sprite->uniqueCels()) {
-    ImageRef old_image = cel->imageRef();
-    ImageRef new_image(
-      render::convert_pixel_format
-      (old_image.get(), NULL, newFormat, m_dithering,
-       sprite->rgbMap(cel->frame()),
-       sprite->palette(cel->frame()),
-       cel->layer()->isBackground(),
-       old_image->maskColor()));
-
-    m_seq.add(new cmd::ReplaceImage(sprite, old_image, new_image));
+  std::vector<Cel*> cels;
+  for (Cel* cel : sprite->uniqueCels())
+    cels.push_back(cel);
+
+  // Images are converted in parallel. Cels are processed in groups
+  // of consecutive cels with the same palette, so all images of each
+  // group can share the same RgbMap.
+  const int ncels = int(cels.size());
+  std::vector<ImageRef> newImages(ncels);
+  for (int i=0; i<ncels; ) {
+    const frame_t frame = cels[i]->frame();
+    const Palette* palette = sprite->palette(frame);
+    const RgbMap* rgbmap = sprite->rgbMap(frame);
+
+    int j = i+1;
+    while (j < ncels && sprite->palette(cels[j]->frame()) == palette)
+      ++j;
+
+    doc::parallel_for(
+      i, j, 1,
+      [&](int from, int to) {
+        for (int k=from; k<to; ++k) {
+          const Image* old_image = cels[k]->image();
+          newImages[k].reset(
+            render::convert_pixel_format
+            (old_image, NULL, newFormat, m_dithering,
+             rgbmap, palette,
+             cels[k]->layer()->isBackground(),
+             old_image->maskColor()));
+        }
+      });
+    i = j;
   }
 
+  for (int k=0; k<ncels; ++k)
+    m_seq.add(new cmd::ReplaceImage(sprite, cels[k]->imageRef(), newImages[k]));
+
   // Set all cels opacity to 100% if we are converting to indexed.
   // TODO remove this
   if (newFormat == IMAGE_INDEXED) {
@@ -42,8 +42,8 @@ void ShiftMaskedCel::shift(int dx, int dy)
   Cel* cel = this->cel();
   Image* image = cel->image();
   Mask* mask = static_cast<app::Document*>(cel->document())->mask();
-  ASSERT(mask->bitmap());
-  if (!mask->bitmap())
+  ASSERT(!mask->isEmpty());
+  if (mask->isEmpty())
     return;
 
   int x = cel->x();
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2015  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -55,6 +55,30 @@ size_t CmdSequence::onMemSize() const
   return size;
 }
 
+bool CmdSequence::onCompressUndoData()
+{
+  bool result = false;
+  for (Cmd* cmd : m_cmds)
+    result |= cmd->compressUndoData();
+  return result;
+}
+
+bool CmdSequence::onSpillUndoData(UndoSpillFile* file)
+{
+  bool result = false;
+  for (Cmd* cmd : m_cmds)
+    result |= cmd->spillUndoData(file);
+  return result;
+}
+
+bool CmdSequence::onDropUndoData()
+{
+  bool result = false;
+  for (Cmd* cmd : m_cmds)
+    result |= cmd->dropUndoData();
+  return result;
+}
+
 void CmdSequence::executeAndAdd(Cmd* cmd)
 {
   cmd->execute(context());
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2015  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -26,6 +26,9 @@ namespace app {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override;
+    bool onCompressUndoData() override;
+    bool onSpillUndoData(UndoSpillFile* file) override;
+    bool onDropUndoData() override;
 
     // Helper to create a CmdSequence in the same onExecute() member
     // function.
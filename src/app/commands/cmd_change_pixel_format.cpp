@@ -55,6 +55,12 @@ void ChangePixelFormatCommand::onLoadParams(const Params& params)
   std::string dithering = params.get("dithering");
   if (dithering == "ordered")
     m_dithering = DitheringMethod::ORDERED;
+  else if (dithering == "floyd-steinberg")
+    m_dithering = DitheringMethod::FLOYD_STEINBERG;
+  else if (dithering == "atkinson")
+    m_dithering = DitheringMethod::ATKINSON;
+  else if (dithering == "sierra")
+    m_dithering = DitheringMethod::SIERRA;
   else
     m_dithering = DitheringMethod::NONE;
 }
@@ -67,7 +73,7 @@ bool ChangePixelFormatCommand::onEnabled(Context* context)
   if (sprite != NULL &&
       sprite->pixelFormat() == IMAGE_INDEXED &&
       m_format == IMAGE_INDEXED &&
-      m_dithering == DitheringMethod::ORDERED)
+      m_dithering != DitheringMethod::NONE)
     return false;
 
   return sprite != NULL;
@@ -81,7 +87,7 @@ bool ChangePixelFormatCommand::onChecked(Context* context)
   if (sprite != NULL &&
       sprite->pixelFormat() == IMAGE_INDEXED &&
       m_format == IMAGE_INDEXED &&
-      m_dithering == DitheringMethod::ORDERED)
+      m_dithering != DitheringMethod::NONE)
     return false;
 
   return
@@ -116,7 +116,7 @@ void FlipCommand::onExecute(Context* context)
           if (flipBounds.isEmpty())
             continue;
 
-          if (mask->bitmap() && !mask->isRectangular())
+          if (!mask->isEmpty() && !mask->isRectangular())
             transaction.execute(new cmd::FlipMaskedCel(cel, m_flipType));
           else
             api.flipImage(image, flipBounds, m_flipType);
@@ -138,7 +138,7 @@ void FlipCommand::onExecute(Context* context)
 
           expand.validateDestCanvas(gfx::Region(flipBounds));
 
-          if (mask->bitmap() && !mask->isRectangular())
+          if (!mask->isEmpty() && !mask->isRectangular())
             doc::algorithm::flip_image_with_mask(
               expand.getDestCanvas(), mask, m_flipType,
               document->bgColor(cel->layer()));
@@ -182,8 +182,7 @@ void FlipCommand::onExecute(Context* context)
     }
 
     // Flip the mask.
-    Image* maskBitmap = mask->bitmap();
-    if (maskBitmap) {
+    if (!mask->isEmpty()) {
       transaction.execute(new cmd::FlipMask(document, m_flipType));
 
       // Flip the mask position because the
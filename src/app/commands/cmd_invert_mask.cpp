@@ -79,7 +79,7 @@ void InvertMaskCommand::onExecute(Context* context)
       maskBounds.y + maskBounds.h-1, 0);
 
     Mask* curMask = document->mask();
-    if (curMask->bitmap()) {
+    if (!curMask->isEmpty()) {
       // Copy the inverted region in the new mask (we just modify the
       // document's mask temporaly here)
       curMask->freeze();
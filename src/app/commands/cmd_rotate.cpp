@@ -131,7 +131,7 @@ protected:
 
     // rotate mask
     if (m_document->isMaskVisible()) {
-      Mask* origMask = m_document->mask();
+      const Mask* origMask = m_document->mask();
       base::UniquePtr<Mask> new_mask(new Mask());
       const gfx::Rect& origBounds = origMask->bounds();
       int x = 0, y = 0;
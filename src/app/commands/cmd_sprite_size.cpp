@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -131,10 +131,11 @@ protected:
 
     // Resize mask
     if (m_document->isMaskVisible()) {
+      const Mask* old_mask = m_document->mask();
       ImageRef old_bitmap
-        (crop_image(m_document->mask()->bitmap(), -1, -1,
-                    m_document->mask()->bitmap()->width()+2,
-                    m_document->mask()->bitmap()->height()+2, 0));
+        (crop_image(old_mask->bitmap(), -1, -1,
+                    old_mask->bitmap()->width()+2,
+                    old_mask->bitmap()->height()+2, 0));
 
       int w = scale_x(old_bitmap->width());
       int h = scale_y(old_bitmap->height());
@@ -184,11 +185,17 @@ public:
 
     static_assert(doc::algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR == 0 &&
                   doc::algorithm::RESIZE_METHOD_BILINEAR == 1 &&
-                  doc::algorithm::RESIZE_METHOD_ROTSPRITE == 2,
+                  doc::algorithm::RESIZE_METHOD_ROTSPRITE == 2 &&
+                  doc::algorithm::RESIZE_METHOD_BOX == 3 &&
+                  doc::algorithm::RESIZE_METHOD_BICUBIC == 4 &&
+                  doc::algorithm::RESIZE_METHOD_LANCZOS == 5,
                   "ResizeMethod enum has changed");
     method()->addItem("Nearest-neighbor");
     method()->addItem("Bilinear");
     method()->addItem("RotSprite");
+    method()->addItem("Box (Area Average)");
+    method()->addItem("Bicubic");
+    method()->addItem("Lanczos");
     method()->setSelectedItemIndex(
       get_config_int("SpriteSize", "Method",
                      doc::algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR));
@@ -301,6 +308,12 @@ void SpriteSizeCommand::onLoadParams(const Params& params)
       m_resizeMethod = doc::algorithm::RESIZE_METHOD_BILINEAR;
     else if (resize_method == "rotsprite")
       m_resizeMethod = doc::algorithm::RESIZE_METHOD_ROTSPRITE;
+    else if (resize_method == "box")
+      m_resizeMethod = doc::algorithm::RESIZE_METHOD_BOX;
+    else if (resize_method == "bicubic")
+      m_resizeMethod = doc::algorithm::RESIZE_METHOD_BICUBIC;
+    else if (resize_method == "lanczos")
+      m_resizeMethod = doc::algorithm::RESIZE_METHOD_LANCZOS;
     else
       m_resizeMethod = doc::algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR;
   }
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -57,6 +57,7 @@ protected:
     // editor. But anyway, we have to re-set the same curve in the
     // filter to regenerate the map used internally by the filter
     // (which is calculated inside setCurve() method).
+    stopPreview();
     m_filter.setCurve(m_editor.getCurve());
 
     restartPreview();
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2015  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -60,6 +60,7 @@ public:
 private:
   void onSizeChange()
   {
+    stopPreview();
     m_filter.setSize(m_widthEntry->textInt(),
                      m_heightEntry->textInt());
     restartPreview();
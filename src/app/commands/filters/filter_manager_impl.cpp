@@ -19,6 +19,7 @@
 #include "app/modules/editors.h"
 #include "app/transaction.h"
 #include "app/ui/editor/editor.h"
+#include "base/clamp.h"
 #include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
 #include "doc/image.h"
@@ -26,12 +27,15 @@
 #include "doc/layer.h"
 #include "doc/mask.h"
 #include "doc/site.h"
+#include "doc/primitives_fast.h"
 #include "doc/sprite.h"
+#include "doc/thread_pool.h"
 #include "filters/filter.h"
 #include "ui/manager.h"
 #include "ui/view.h"
 #include "ui/widget.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <set>
@@ -41,6 +45,121 @@ namespace app {
 using namespace std;
 using namespace ui;
 
+namespace {
+
+// Number of rows processed by each task in applyToTarget()
+const int kRowsPerBand = 16;
+
+// Size of the blocks of pixels in the coarse pass of the preview, and
+// the minimum area to preview (in pixels) to use that coarse pass.
+const int kPreviewCoarseStep = 4;
+const int kPreviewMinCoarseArea = 256*256;
+
+// Adds rows [0,h) with the given step to "rows" in the preview order:
+// starting from "center" and alternating rows below and above it.
+void add_preview_rows(std::vector<int>& rows, int center, int h, int step)
+{
+  int up = center - (center % step);
+  int down = up + step;
+  while (up >= 0 || down < h) {
+    if (up >= 0) {
+      rows.push_back(up);
+      up -= step;
+    }
+    if (down < h) {
+      rows.push_back(down);
+      down += step;
+    }
+  }
+}
+
+// Returns the address of a pixel of the source image without making
+// its pixels writable (they could be shared with the destination
+// image).
+const void* get_source_address(const Image* image, int x, int y)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB: return get_pixel_const_address_fast<RgbTraits>(image, x, y);
+    case IMAGE_GRAYSCALE: return get_pixel_const_address_fast<GrayscaleTraits>(image, x, y);
+    case IMAGE_INDEXED: return get_pixel_const_address_fast<IndexedTraits>(image, x, y);
+  }
+  return image->getPixelConstAddress(x, y);
+}
+
+// FilterManager used by each thread in applyToTarget() to apply the
+// filter to its own rows of an image. It's like the FilterManagerImpl
+// itself (which is used to apply the filter row by row in the
+// preview) but with its own row and mask cursor.
+class RowFilterManager : public FilterManager {
+public:
+  RowFilterManager(FilterIndexedData* indexedData,
+                   const Image* src, Image* dst,
+                   const gfx::Rect& bounds, const Mask* mask,
+                   Target target)
+    : m_indexedData(indexedData)
+    , m_src(src)
+    , m_dst(dst)
+    , m_bounds(bounds)
+    , m_mask(mask)
+    , m_target(target)
+    , m_row(0) {
+  }
+
+  // Prepares the mask cursor for the given row, returns false if
+  // the row is outside the mask (same logic as applyStep()).
+  bool setRow(int row) {
+    m_row = row;
+    if (m_mask && !m_mask->isEmpty()) {
+      int x = m_bounds.x - m_mask->bounds().x;
+      int y = m_bounds.y - m_mask->bounds().y + m_row;
+      if ((x >= m_bounds.w) ||
+          (y >= m_bounds.h))
+        return false;
+
+      m_maskCursor = MaskRunsCursor(
+        get_mask_row_runs(m_mask, y, m_maskRowBuffer), x);
+    }
+    return true;
+  }
+
+  // FilterManager implementation
+  const void* getSourceAddress() override {
+    return get_source_address(m_src, m_bounds.x, m_bounds.y+m_row);
+  }
+  void* getDestinationAddress() override {
+    return m_dst->getPixelAddress(m_bounds.x, m_bounds.y+m_row);
+  }
+  int getWidth() override { return m_bounds.w; }
+  Target getTarget() override { return m_target; }
+  FilterIndexedData* getIndexedData() override { return m_indexedData; }
+  bool skipPixel() override {
+    return (m_mask && !m_mask->isEmpty() && !m_maskCursor.next());
+  }
+  const Image* getSourceImage() override { return m_src; }
+  int x() override { return m_bounds.x; }
+  int y() override { return m_bounds.y+m_row; }
+
+private:
+  FilterIndexedData* m_indexedData;
+  const Image* m_src;
+  Image* m_dst;
+  gfx::Rect m_bounds;
+  const Mask* m_mask;
+  Target m_target;
+  int m_row;
+  MaskRuns::Runs m_maskRowBuffer;
+  MaskRunsCursor m_maskCursor;
+};
+
+} // anonymous namespace
+
+struct FilterManagerImpl::CelJob {
+  Cel* cel;
+  ImageRef src;
+  ImageRef dst;
+  Target target;
+};
+
 FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   : m_context(context)
   , m_site(context->activeSite())
@@ -50,7 +169,14 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   , m_dst(nullptr)
   , m_mask(nullptr)
   , m_previewMask(nullptr)
+  , m_previewCoarseRows(0)
+  , m_previewIndex(0)
+  , m_skipStep(1)
+  , m_col(0)
   , m_progressDelegate(NULL)
+  , m_rowsDone(0)
+  , m_rowsTotal(0)
+  , m_cancelled(false)
 {
   m_row = 0;
   m_targetOrig = TARGET_ALL_CHANNELS;
@@ -110,109 +236,83 @@ void FilterManagerImpl::beginForPreview()
     m_previewMask->replace(m_site.sprite()->bounds());
   }
 
-  m_row = m_nextRowToFlush = 0;
+  m_row = 0;
   m_mask = m_previewMask;
-
-  {
-    Editor* editor = current_editor;
-    Sprite* sprite = m_site.sprite();
-    gfx::Rect vp = View::getView(editor)->viewportBounds();
-    vp = editor->screenToEditor(vp);
-    vp = vp.createIntersection(sprite->bounds());
-
-    if (vp.isEmpty()) {
-      m_previewMask.reset(nullptr);
-      m_row = -1;
-      return;
-    }
-
-    m_previewMask->intersect(vp);
+  m_previewRows.clear();
+  m_previewCoarseRows = 0;
+  m_previewIndex = 0;
+  m_dirtyRows.clear();
+
+  // Only the visible part of the sprite is previewed
+  Editor* editor = current_editor;
+  Sprite* sprite = m_site.sprite();
+  gfx::Rect vp = View::getView(editor)->viewportBounds();
+  vp = editor->screenToEditor(vp);
+  vp = vp.createIntersection(sprite->bounds());
+
+  if (vp.isEmpty()) {
+    m_previewMask.reset(nullptr);
+    m_row = -1;
+    return;
   }
 
+  m_previewMask->intersect(vp);
+
   if (!updateBounds(m_mask)) {
     m_previewMask.reset(nullptr);
     m_row = -1;
     return;
   }
+
+  // Rows are processed from the center of the viewport, which is
+  // probably the area where the user is looking at.
+  const int center = base::clamp(vp.y+vp.h/2-m_bounds.y, 0, m_bounds.h-1);
+  if (m_bounds.w*m_bounds.h >= kPreviewMinCoarseArea) {
+    add_preview_rows(m_previewRows, center, m_bounds.h, kPreviewCoarseStep);
+    m_previewCoarseRows = int(m_previewRows.size());
+  }
+  add_preview_rows(m_previewRows, center, m_bounds.h, 1);
 }
 
 void FilterManagerImpl::end()
 {
-  m_maskBits.unlock();
+  m_maskCursor = MaskRunsCursor();
 }
 
 bool FilterManagerImpl::applyStep()
 {
-  if (m_row < 0 || m_row >= m_bounds.h)
+  if (m_row < 0 || m_previewIndex >= int(m_previewRows.size()))
     return false;
 
-  if (m_mask && m_mask->bitmap()) {
+  const bool coarse = (m_previewIndex < m_previewCoarseRows);
+  m_row = m_previewRows[m_previewIndex++];
+  m_skipStep = (coarse ? kPreviewCoarseStep: 1);
+  m_col = 0;
+
+  if (m_mask && !m_mask->isEmpty()) {
     int x = m_bounds.x - m_mask->bounds().x;
     int y = m_bounds.y - m_mask->bounds().y + m_row;
     if ((x >= m_bounds.w) ||
         (y >= m_bounds.h))
-      return false;
-
-    m_maskBits = m_mask->bitmap()
-      ->lockBits<BitmapTraits>(Image::ReadLock,
-        gfx::Rect(x, y, m_bounds.w - x, m_bounds.h - y));
+      return true;
 
-    m_maskIterator = m_maskBits.begin();
+    m_maskCursor = MaskRunsCursor(
+      get_mask_row_runs(m_mask, y, m_maskRowBuffer), x);
   }
 
-  switch (m_site.sprite()->pixelFormat()) {
-    case IMAGE_RGB:       m_filter->applyToRgba(this); break;
-    case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(this); break;
-    case IMAGE_INDEXED:   m_filter->applyToIndexed(this); break;
-  }
-  ++m_row;
+  applyFilter(this);
 
-  return true;
-}
-
-void FilterManagerImpl::apply(Transaction& transaction)
-{
-  bool cancelled = false;
-
-  begin();
-  while (!cancelled && applyStep()) {
-    if (m_progressDelegate) {
-      // Report progress.
-      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_bounds.h);
-
-      // Does the user cancelled the whole process?
-      cancelled = m_progressDelegate->isCancelled();
-    }
-  }
+  int rows = 1;
+  if (coarse)
+    rows = fillCoarseBlocks();
 
-  if (!cancelled) {
-    gfx::Rect output;
-    if (algorithm::shrink_bounds2(m_src.get(), m_dst.get(),
-                                  m_bounds, output)) {
-      if (m_cel->layer()->isBackground()) {
-        transaction.execute(
-          new cmd::CopyRegion(
-            m_cel->image(),
-            m_dst.get(),
-            gfx::Region(output),
-            position()));
-      }
-      else {
-        // Patch "m_cel"
-        transaction.execute(
-          new cmd::PatchCel(
-            m_cel, m_dst.get(),
-            gfx::Region(output),
-            position()));
-      }
-    }
-  }
+  m_dirtyRows |= gfx::Region(
+    gfx::Rect(m_bounds.x, m_bounds.y+m_row, m_bounds.w, rows));
+  return true;
 }
 
 void FilterManagerImpl::applyToTarget()
 {
-  bool cancelled = false;
-
   ImagesCollector images((m_target & TARGET_ALL_LAYERS ?
                           m_site.sprite()->root():
                           m_site.layer()),
@@ -222,73 +322,78 @@ void FilterManagerImpl::applyToTarget()
   if (images.empty())
     return;
 
+  // Avoid applying the filter two times to the same image
+  std::vector<Cel*> cels;
+  std::set<ObjectId> visited;
+  for (auto& item : images) {
+    if (visited.insert(item.image()->id()).second)
+      cels.push_back(item.cel());
+  }
+
   // Initialize writting operation
   ContextReader reader(m_context);
   ContextWriter writer(reader);
   Transaction transaction(writer.context(), m_filter->getName(), ModifyDocument);
 
-  m_progressBase = 0.0f;
-  m_progressWidth = 1.0f / images.size();
-
-  std::set<ObjectId> visited;
-
-  // For each target image
-  for (auto it = images.begin();
-       it != images.end() && !cancelled;
-       ++it) {
-    Image* image = it->image();
-
-    // Avoid applying the filter two times to the same image
-    if (visited.find(image->id()) == visited.end()) {
-      visited.insert(image->id());
-      applyToCel(transaction, it->cel());
-    }
-
-    // Is there a delegate to know if the process was cancelled by the user?
-    if (m_progressDelegate)
-      cancelled = m_progressDelegate->isCancelled();
+  if (!updateBounds(static_cast<app::Document*>(m_site.document())->mask()))
+    throw InvalidAreaException();
+  begin();
 
-    // Make progress
-    m_progressBase += m_progressWidth;
+  // The RgbMap is generated lazily, so we create it before using it
+  // from several threads.
+  if (m_site.sprite()->pixelFormat() == IMAGE_INDEXED)
+    getRgbMap();
+
+  m_rowsDone = 0;
+  m_rowsTotal = int(cels.size()) * m_bounds.h;
+  m_cancelled = false;
+
+  // Cels are processed in groups (one cel for each thread) to avoid
+  // keeping a copy of all images in memory at the same time.
+  const std::size_t groupSize = doc::ThreadPool::instance()->concurrency();
+  for (std::size_t i=0; i<cels.size() && !m_cancelled; i+=groupSize) {
+    applyToCels(
+      transaction,
+      std::vector<Cel*>(cels.begin()+i,
+                        cels.begin()+std::min(i+groupSize, cels.size())));
   }
 
+  end();
   transaction.commit();
 }
 
 void FilterManagerImpl::flush()
 {
-  int h = m_row - m_nextRowToFlush;
+  if (m_dirtyRows.isEmpty())
+    return;
 
-  if (m_row >= 0 && h > 0) {
-    Editor* editor = current_editor;
+  Editor* editor = current_editor;
+  gfx::Region drawable;
+  editor->getDrawableRegion(drawable, Widget::kCutTopWindows);
 
+  for (const gfx::Rect& rc : m_dirtyRows) {
     // We expand the region one pixel at the top and bottom of the
-    // region [m_row,m_nextRowToFlush) to be updated on the screen to
-    // avoid screen artifacts when we apply filters like convolution
-    // matrices.
+    // processed rows to be updated on the screen to avoid screen
+    // artifacts when we apply filters like convolution matrices.
     gfx::Rect rect(
       editor->editorToScreen(
-        gfx::Point(
-          m_bounds.x,
-          m_bounds.y+m_nextRowToFlush-1)),
+        gfx::Point(rc.x, rc.y-1)),
       gfx::Size(
-        editor->projection().applyX(m_bounds.w),
-        (editor->projection().scaleY() >= 1 ? editor->projection().applyY(h+2):
-                                              editor->projection().removeY(h+2))));
+        editor->projection().applyX(rc.w),
+        (editor->projection().scaleY() >= 1 ? editor->projection().applyY(rc.h+2):
+                                              editor->projection().removeY(rc.h+2))));
 
-    gfx::Region reg1(rect);
-    gfx::Region reg2;
-    editor->getDrawableRegion(reg2, Widget::kCutTopWindows);
-    reg1.createIntersection(reg1, reg2);
-
-    editor->invalidateRegion(reg1);
-    m_nextRowToFlush = m_row+1;
+    gfx::Region reg(rect);
+    reg.createIntersection(reg, drawable);
+    editor->invalidateRegion(reg);
   }
+
+  m_dirtyRows.clear();
 }
 
 const void* FilterManagerImpl::getSourceAddress()
 {
-  return m_src->getPixelAddress(m_bounds.x, m_bounds.y+m_row);
+  return get_source_address(m_src.get(), m_bounds.x, m_bounds.y+m_row);
 }
 
 void* FilterManagerImpl::getDestinationAddress()
@@ -300,13 +405,15 @@ bool FilterManagerImpl::skipPixel()
 {
   bool skip = false;
 
-  if ((m_mask) && (m_mask->bitmap())) {
-    if (!*m_maskIterator)
+  if (m_mask && !m_mask->isEmpty()) {
+    if (!m_maskCursor.next())
       skip = true;
-
-    ++m_maskIterator;
   }
 
+  // Only the first pixel of each block is filtered in the coarse pass
+  if (m_skipStep > 1 && (m_col++ % m_skipStep) != 0)
+    skip = true;
+
   return skip;
 }
 
@@ -344,16 +451,124 @@ void FilterManagerImpl::init(Cel* cel)
     m_target &= ~TARGET_ALPHA_CHANNEL;
 }
 
-void FilterManagerImpl::applyToCel(Transaction& transaction, Cel* cel)
+void FilterManagerImpl::applyToCels(Transaction& transaction,
+                                    const std::vector<Cel*>& cels)
+{
+  std::vector<CelJob> jobs(cels.size());
+  for (std::size_t i=0; i<cels.size(); ++i) {
+    Cel* cel = cels[i];
+    CelJob& job = jobs[i];
+    job.cel = cel;
+    job.src.reset(
+      crop_image(
+        cel->image(),
+        gfx::Rect(m_site.sprite()->bounds()).offset(-cel->position()), 0));
+    job.dst.reset(Image::createCopy(job.src.get()));
+    job.target = m_targetOrig;
+
+    // The alpha channel of the background layer can't be modified
+    if (cel->layer()->isBackground())
+      job.target &= ~TARGET_ALPHA_CHANNEL;
+  }
+
+  // Each task applies the filter to a band of rows of some cel
+  const int bands = (m_bounds.h + kRowsPerBand - 1) / kRowsPerBand;
+  doc::parallel_for(
+    0, int(jobs.size()) * bands, 1,
+    [this, &jobs, bands](int begin, int end) {
+      for (int i=begin; i<end && !m_cancelled; ++i) {
+        const int row = (i % bands) * kRowsPerBand;
+        applyToRows(jobs[i / bands], row,
+                    std::min(row + kRowsPerBand, m_bounds.h));
+      }
+    });
+
+  if (m_cancelled)
+    return;
+
+  for (CelJob& job : jobs) {
+    gfx::Rect output;
+    if (algorithm::shrink_bounds2(job.src.get(), job.dst.get(),
+                                  m_bounds, output)) {
+      if (job.cel->layer()->isBackground()) {
+        transaction.execute(
+          new cmd::CopyRegion(
+            job.cel->image(),
+            job.dst.get(),
+            gfx::Region(output),
+            position()));
+      }
+      else {
+        // Patch the cel
+        transaction.execute(
+          new cmd::PatchCel(
+            job.cel, job.dst.get(),
+            gfx::Region(output),
+            position()));
+      }
+    }
+  }
+}
+
+void FilterManagerImpl::applyToRows(CelJob& job, int row, int rowEnd)
+{
+  RowFilterManager rowMgr(this, job.src.get(), job.dst.get(),
+                          m_bounds, m_mask, job.target);
+
+  for (int y=row; y<rowEnd && !m_cancelled; ++y) {
+    if (!rowMgr.setRow(y))
+      break;
+    applyFilter(&rowMgr);
+  }
+
+  // Report progress
+  m_rowsDone += rowEnd - row;
+  if (m_progressDelegate) {
+    std::lock_guard<std::mutex> lock(m_progressMutex);
+    m_progressDelegate->reportProgress(float(m_rowsDone) / m_rowsTotal);
+    if (m_progressDelegate->isCancelled())
+      m_cancelled = true;
+  }
+}
+
+void FilterManagerImpl::applyFilter(FilterManager* filterMgr)
 {
-  init(cel);
-  apply(transaction);
+  switch (m_site.sprite()->pixelFormat()) {
+    case IMAGE_RGB:       m_filter->applyToRgba(filterMgr); break;
+    case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(filterMgr); break;
+    case IMAGE_INDEXED:   m_filter->applyToIndexed(filterMgr); break;
+  }
+}
+
+// Copies the pixels filtered in the current row of the coarse pass
+// of the preview to the rest of their blocks (only to pixels inside
+// the mask). Returns the number of filled rows.
+int FilterManagerImpl::fillCoarseBlocks()
+{
+  const int step = m_skipStep;
+  const int rows = std::min(step, m_bounds.h - m_row);
+  const int bpp = m_dst->getRowStrideSize(1);
+  const uint8_t* src = m_dst->getPixelConstAddress(m_bounds.x, m_bounds.y+m_row);
+
+  for (int v=0; v<rows; ++v) {
+    const int y = m_bounds.y+m_row+v;
+    uint8_t* dst = m_dst->getPixelAddress(m_bounds.x, y);
+
+    for (int u=0; u<m_bounds.w; ++u, dst+=bpp) {
+      if ((v == 0 && (u % step) == 0) ||
+          (m_mask && !m_mask->containsPoint(m_bounds.x+u, y)))
+        continue;
+
+      std::memcpy(dst, src+(u - (u % step))*bpp, bpp);
+    }
+  }
+  return rows;
 }
 
 bool FilterManagerImpl::updateBounds(doc::Mask* mask)
 {
   gfx::Rect bounds;
-  if (mask && mask->bitmap() && !mask->bounds().isEmpty()) {
+  if (mask && !mask->isEmpty() && !mask->bounds().isEmpty()) {
     bounds = mask->bounds();
     bounds &= m_site.sprite()->bounds();
   }
@@ -12,13 +12,18 @@
 #include "base/unique_ptr.h"
 #include "doc/image_impl.h"
 #include "doc/image_ref.h"
+#include "doc/mask_runs.h"
 #include "doc/pixel_format.h"
 #include "doc/site.h"
 #include "filters/filter_indexed_data.h"
 #include "filters/filter_manager.h"
 #include "gfx/rect.h"
+#include "gfx/region.h"
 
+#include <atomic>
 #include <cstring>
+#include <mutex>
+#include <vector>
 
 namespace doc {
   class Cel;
@@ -56,7 +61,9 @@ namespace app {
                           , public FilterIndexedData {
   public:
     // Interface to report progress to the user and take input from him
-    // to cancel the whole process.
+    // to cancel the whole process. As applyToTarget() processes rows
+    // in several threads, these functions can be called from any of
+    // them (but not at the same time).
     class IProgressDelegate {
     public:
       virtual ~IProgressDelegate() { }
@@ -77,11 +84,15 @@ namespace app {
     void setTarget(Target target);
 
     void begin();
-    void beginForPreview();
     void end();
-    bool applyStep();
     void applyToTarget();
 
+    // Prepares the preview of the filter in the visible area of the
+    // current editor. Then each applyStep() call processes one row of
+    // the preview (returns false when the preview is completed).
+    void beginForPreview();
+    bool applyStep();
+
     app::Document* document();
     doc::Sprite* sprite() { return m_site.sprite(); }
     doc::Layer* layer() { return m_site.layer(); }
@@ -89,7 +100,8 @@ namespace app {
     doc::Image* destinationImage() const { return m_dst.get(); }
     gfx::Point position() const { return gfx::Point(0, 0); }
 
-    // Updates the current editor to show the progress of the preview.
+    // Updates the current editor to show the progress of the preview
+    // (the rows processed by applyStep() since the last flush).
     void flush();
 
     // FilterManager implementation
@@ -108,10 +120,15 @@ namespace app {
     doc::RgbMap* getRgbMap() override;
 
   private:
+    struct CelJob;
+
     void init(doc::Cel* cel);
-    void apply(Transaction& transaction);
-    void applyToCel(Transaction& transaction, doc::Cel* cel);
+    void applyToCels(Transaction& transaction,
+                     const std::vector<doc::Cel*>& cels);
+    void applyToRows(CelJob& job, int row, int rowEnd);
+    void applyFilter(FilterManager* filterMgr);
     bool updateBounds(doc::Mask* mask);
+    int fillCoarseBlocks();
 
     Context* m_context;
     doc::Site m_site;
@@ -120,19 +137,33 @@ namespace app {
     doc::ImageRef m_src;
     doc::ImageRef m_dst;
     int m_row;
-    int m_nextRowToFlush;
     gfx::Rect m_bounds;
     doc::Mask* m_mask;
     base::UniquePtr<doc::Mask> m_previewMask;
-    doc::ImageBits<doc::BitmapTraits> m_maskBits;
-    doc::ImageBits<doc::BitmapTraits>::iterator m_maskIterator;
+    doc::MaskRuns::Runs m_maskRowBuffer;
+    doc::MaskRunsCursor m_maskCursor;
     Target m_targetOrig;          // Original targets
     Target m_target;              // Filtered targets
 
+    // Preview state. Rows are processed from the center of the
+    // editor viewport to its edges, first in a coarse pass (one pixel
+    // of each block is filtered and copied to the whole block) and
+    // then in a full resolution pass.
+    std::vector<int> m_previewRows; // Rows to process in order
+    int m_previewCoarseRows;      // Rows of the coarse pass (first rows of m_previewRows)
+    int m_previewIndex;           // Next element of m_previewRows to process
+    int m_skipStep;               // Size of the block of the current row (1 in the full resolution pass)
+    int m_col;                    // Current column of the row (to skip pixels in the coarse pass)
+    gfx::Region m_dirtyRows;      // Rows to update in the next flush()
+
     // Hooks
-    float m_progressBase;
-    float m_progressWidth;
     IProgressDelegate* m_progressDelegate;
+
+    // Progress of applyToTarget() (rows processed in all threads)
+    std::atomic<int> m_rowsDone;
+    int m_rowsTotal;
+    std::atomic<bool> m_cancelled;
+    std::mutex m_progressMutex;
   };
 
 } // namespace app
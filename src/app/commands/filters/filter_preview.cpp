@@ -31,6 +31,7 @@ FilterPreview::FilterPreview(FilterManagerImpl* filterMgr)
   , m_filterMgr(filterMgr)
   , m_timer(1, this)
   , m_filterThread(nullptr)
+  , m_filterIsDone(true)
 {
   setVisible(false);
 }
@@ -51,6 +52,7 @@ void FilterPreview::stop()
   }
 
   m_timer.stop();
+  m_filterIsDone = true;
 
   if (m_filterThread) {
     m_filterThread->join();
@@ -60,6 +62,9 @@ void FilterPreview::stop()
 
 void FilterPreview::restartPreview()
 {
+  // Rows being processed with old parameters are not useful anymore
+  stop();
+
   base::scoped_lock lock(m_filterMgrMutex);
 
   m_filterMgr->beginForPreview();
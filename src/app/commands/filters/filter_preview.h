@@ -14,6 +14,8 @@
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <atomic>
+
 namespace app {
 
   class FilterManagerImpl;
@@ -24,7 +26,12 @@ namespace app {
     FilterPreview(FilterManagerImpl* filterMgr);
     ~FilterPreview();
 
+    // Stops the preview thread (it finishes the row that is being
+    // processed at this moment). It must be called before modifying
+    // the filter parameters.
     void stop();
+
+    // Cancels the current preview (if any) and starts a new one.
     void restartPreview();
 
   protected:
@@ -37,7 +44,7 @@ namespace app {
     ui::Timer m_timer;
     base::mutex m_filterMgrMutex;
     base::UniquePtr<base::thread> m_filterThread;
-    bool m_filterIsDone;
+    std::atomic<bool> m_filterIsDone;
   };
 
 } // namespace app
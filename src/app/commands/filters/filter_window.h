@@ -43,6 +43,11 @@ namespace app {
     // method each time the user modifies parameters of the Filter.
     void restartPreview();
 
+    // Stops the preview procedure. You should call this method before
+    // modifying parameters of the Filter (as the preview is processed
+    // in a background thread which uses the Filter).
+    void stopPreview();
+
   protected:
     // Changes the target buttons. Used by convolution matrix filter
     // which specified different targets for each matrix.
@@ -62,8 +67,6 @@ namespace app {
     virtual void setupTiledMode(TiledMode tiledMode) { }
 
   private:
-    void stopPreview();
-
     const char* m_cfgSection;
     FilterManagerImpl* m_filterMgr;
     ui::Box m_hbox;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -196,12 +196,12 @@ void Document::setFormatOptions(const base::SharedPtr<FormatOptions>& format_opt
 
 void Document::generateMaskBoundaries(const Mask* mask)
 {
-  m_maskBoundaries.reset();
-
   // No mask specified? Use the current one in the document
   if (!mask) {
-    if (!isMaskVisible())       // The mask is hidden
+    if (!isMaskVisible()) {     // The mask is hidden
+      m_maskBoundaries.reset();
       return;                   // Done, without boundaries
+    }
     else
       mask = this->mask();      // Use the document mask
   }
@@ -209,10 +209,15 @@ void Document::generateMaskBoundaries(const Mask* mask)
   ASSERT(mask);
 
   if (!mask->isEmpty()) {
-    m_maskBoundaries.reset(new MaskBoundaries(mask->bitmap()));
-    m_maskBoundaries->offset(mask->bounds().x,
-                             mask->bounds().y);
+    // Keep the old boundaries to generate only the modified parts
+    if (!m_maskBoundaries)
+      m_maskBoundaries.reset(new MaskBoundaries);
+
+    m_maskBoundaries->regenerate(mask->bitmap(),
+                                 mask->bounds().origin());
   }
+  else
+    m_maskBoundaries.reset();
 
   // TODO move this to the exact place where selection is modified.
   notifySelectionChanged();
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -15,20 +15,53 @@
 #include "app/cmd_transaction.h"
 #include "app/document_undo_observer.h"
 #include "app/pref/preferences.h"
+#include "base/bind.h"
+#include "base/thread.h"
 #include "doc/context.h"
 #include "undo/undo_history.h"
 #include "undo/undo_state.h"
 
+#include <algorithm>
 #include <cassert>
+#include <limits>
 #include <stdexcept>
 
 namespace app {
 
+// Number of states before and after the current one that are never
+// compressed/spilled/dropped (they are the next ones to be
+// undone/redone).
+static const int kKeepStates = 2;
+
 DocumentUndo::DocumentUndo()
   : m_ctx(NULL)
   , m_savedCounter(0)
   , m_savedStateIsLost(false)
+  , m_compactExit(false)
+  , m_compactPaused(false)
+  , m_compactCanDrop(false)
+  , m_compactDropStopped(false)
+  , m_compactLimit(std::numeric_limits<size_t>::max())
+  , m_totalSize(0)
+  , m_compactingState(nullptr)
+  , m_lastDroppedState(nullptr)
+{
+  for (int phase=0; phase<kCompactPhases; ++phase) {
+    m_compactCursor[phase] = nullptr;
+    m_compactSkipped[phase] = nullptr;
+  }
+}
+
+DocumentUndo::~DocumentUndo()
 {
+  if (m_compactThread) {
+    {
+      std::lock_guard<std::mutex> lock(m_compactMutex);
+      m_compactExit = true;
+    }
+    m_compactCond.notify_all();
+    m_compactThread->join();
+  }
 }
 
 void DocumentUndo::setContext(doc::Context* ctx)
@@ -46,13 +79,23 @@ void DocumentUndo::add(CmdTransaction* cmd)
     clearRedo();
   }
 
-  m_undoHistory.add(cmd);
+  // The background thread doesn't touch the new state (it's kept),
+  // we only need the lock to modify the list of states.
+  {
+    std::lock_guard<std::mutex> lock(m_compactMutex);
+    m_undoHistory.add(cmd);
+    m_totalSize += cmd->memSize();
+    updateKeptStates();
+  }
   notify_observers(&DocumentUndoObserver::onAddUndoState, this);
+
+  checkMemoryLimit();
 }
 
 bool DocumentUndo::canUndo() const
 {
-  return m_undoHistory.canUndo();
+  return (m_undoHistory.canUndo() &&
+          m_undoHistory.currentState() != m_lastDroppedState);
 }
 
 bool DocumentUndo::canRedo() const
@@ -62,19 +105,65 @@ bool DocumentUndo::canRedo() const
 
 void DocumentUndo::undo()
 {
+  const undo::UndoState* state = m_undoHistory.currentState();
+  waitCompaction(state);
+  if (!state || state == m_lastDroppedState)
+    return;
+
+  const Cmd* cmd = static_cast<const Cmd*>(state->cmd());
+  const size_t oldSize = cmd->memSize();
   m_undoHistory.undo();
+  {
+    std::lock_guard<std::mutex> lock(m_compactMutex);
+    m_totalSize = m_totalSize - oldSize + cmd->memSize();
+    updateKeptStates();
+  }
+  m_compactCond.notify_all();
   notify_observers(&DocumentUndoObserver::onAfterUndo, this);
 }
 
 void DocumentUndo::redo()
 {
+  const undo::UndoState* state = nextRedo();
+  waitCompaction(state);
+  if (!state)
+    return;
+
+  const Cmd* cmd = static_cast<const Cmd*>(state->cmd());
+  const size_t oldSize = cmd->memSize();
   m_undoHistory.redo();
+  {
+    std::lock_guard<std::mutex> lock(m_compactMutex);
+    m_totalSize = m_totalSize - oldSize + cmd->memSize();
+    updateKeptStates();
+  }
+  m_compactCond.notify_all();
   notify_observers(&DocumentUndoObserver::onAfterRedo, this);
 }
 
 void DocumentUndo::clearRedo()
 {
-  m_undoHistory.clearRedo();
+  if (m_undoHistory.canRedo()) {
+    // The background thread could be compacting a redo state
+    pauseCompaction();
+    {
+      std::lock_guard<std::mutex> lock(m_compactMutex);
+      for (const undo::UndoState* state=nextRedo(); state; state=state->next())
+        m_totalSize -= static_cast<const Cmd*>(state->cmd())->memSize();
+
+      m_undoHistory.clearRedo();
+
+      // All states were deleted
+      if (!m_undoHistory.currentState()) {
+        for (int phase=0; phase<kCompactPhases; ++phase) {
+          m_compactCursor[phase] = nullptr;
+          m_compactSkipped[phase] = nullptr;
+        }
+        m_compactDropStopped = false;
+      }
+    }
+    resumeCompaction();
+  }
   notify_observers(&DocumentUndoObserver::onClearRedo, this);
 }
 
@@ -143,7 +232,24 @@ Cmd* DocumentUndo::lastExecutedCmd() const
 
 void DocumentUndo::moveToState(const undo::UndoState* state)
 {
+  // We cannot go back through states with dropped data
+  if (!isReachableState(state))
+    return;
+
+  // Several commands are undone/redone, so the background thread
+  // cannot be working on any of them.
+  pauseCompaction();
   m_undoHistory.moveTo(state);
+  {
+    // Recount the whole history as we don't know which commands
+    // were executed
+    std::lock_guard<std::mutex> lock(m_compactMutex);
+    m_totalSize = 0;
+    for (const undo::UndoState* it=m_undoHistory.firstState();
+         it; it=it->next())
+      m_totalSize += static_cast<const Cmd*>(it->cmd())->memSize();
+  }
+  resumeCompaction();
 }
 
 const undo::UndoState* DocumentUndo::nextUndo() const
@@ -160,4 +266,214 @@ const undo::UndoState* DocumentUndo::nextRedo() const
     return m_undoHistory.firstState();
 }
 
+void DocumentUndo::setMemoryLimit(size_t limit, bool canDropStates)
+{
+  std::lock_guard<std::mutex> lock(m_compactMutex);
+  m_compactLimit = (limit > 0 ? limit: std::numeric_limits<size_t>::max());
+  m_compactCanDrop = canDropStates;
+}
+
+void DocumentUndo::finishCompaction()
+{
+  checkMemoryLimit();
+
+  std::unique_lock<std::mutex> lock(m_compactMutex);
+  int phase;
+  while (m_compactThread &&
+         (m_compactingState ||
+          (!m_compactPaused &&
+           m_totalSize > m_compactLimit &&
+           nextStateToCompact(phase))))
+    m_compactCond.wait(lock);
+}
+
+void DocumentUndo::checkMemoryLimit()
+{
+  if (App::instance()) {
+    // Only old states of a linear history can be dropped (from the
+    // oldest one, so we cannot go back to them anymore).
+    Preferences& pref = App::instance()->preferences();
+    setMemoryLimit(size_t(pref.undo.sizeLimit()) * 1024 * 1024,
+                   !pref.undo.allowNonlinearHistory());
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_compactMutex);
+    if (m_totalSize <= m_compactLimit)
+      return;
+
+    if (!m_compactThread)
+      m_compactThread.reset(
+        new base::thread(base::Bind<void>(&DocumentUndo::compactStates, this)));
+  }
+  m_compactCond.notify_all();
+}
+
+// Executed in a background thread
+void DocumentUndo::compactStates()
+{
+  std::unique_lock<std::mutex> lock(m_compactMutex);
+  while (!m_compactExit) {
+    int phase = kCompress;
+    const undo::UndoState* state = nullptr;
+    if (!m_compactPaused && m_totalSize > m_compactLimit)
+      state = nextStateToCompact(phase);
+
+    // Nothing else to do until the history changes
+    if (!state) {
+      m_compactCond.wait(lock);
+      continue;
+    }
+
+    m_compactingState = state;
+    m_compactCursor[phase] = state;
+    lock.unlock();
+
+    Cmd* cmd = static_cast<Cmd*>(state->cmd());
+    const size_t oldSize = cmd->memSize();
+    bool dropped = false;
+    switch (phase) {
+      case kCompress:
+        cmd->compressUndoData();
+        break;
+      case kSpill:
+        cmd->spillUndoData(&m_spillFile);
+        break;
+      case kDrop:
+        dropped = cmd->dropUndoData();
+        break;
+    }
+    const size_t newSize = cmd->memSize();
+
+    lock.lock();
+    m_totalSize = m_totalSize - oldSize + newSize;
+    if (phase == kDrop) {
+      if (dropped)
+        m_lastDroppedState = state;
+      else {
+        // This command cannot drop its data, so it must be undoable
+        // and we cannot drop the next states (dropped states must be
+        // contiguous from the oldest one).
+        m_compactCursor[kDrop] = state->prev();
+        m_compactDropStopped = true;
+      }
+    }
+    m_compactingState = nullptr;
+    m_compactCond.notify_all();
+  }
+}
+
+// Returns the next state to be compacted (and its phase) continuing
+// from the states processed in previous calls. Old states are
+// processed from the oldest one, and the kept states are skipped
+// (except in the drop phase, which must stop before them).
+const undo::UndoState* DocumentUndo::nextStateToCompact(int& phase)
+{
+  for (int p=kCompress; p<kCompactPhases; ++p) {
+    if (p == kDrop && (!m_compactCanDrop || m_compactDropStopped))
+      break;
+
+    const undo::UndoState* state =
+      (m_compactCursor[p] ? m_compactCursor[p]->next():
+                            m_undoHistory.firstState());
+
+    for (; state && isKeptState(state); state=state->next()) {
+      if (p == kDrop) {
+        state = nullptr;
+        break;
+      }
+      if (!m_compactSkipped[p])
+        m_compactSkipped[p] = state;
+    }
+
+    if (state) {
+      phase = p;
+      return state;
+    }
+  }
+  return nullptr;
+}
+
+bool DocumentUndo::isKeptState(const undo::UndoState* state) const
+{
+  return (std::find(m_keptStates.begin(), m_keptStates.end(), state)
+          != m_keptStates.end());
+}
+
+// Must be called with m_compactMutex locked each time the current
+// state or the list of states changes.
+void DocumentUndo::updateKeptStates()
+{
+  const undo::UndoState* current = m_undoHistory.currentState();
+  const undo::UndoState* state;
+  int i;
+
+  m_keptStates.clear();
+  if (current) {
+    for (state=current, i=0; state && i<kKeepStates; state=state->prev(), ++i)
+      m_keptStates.push_back(state);
+    for (state=current->next(), i=1; state && i<kKeepStates; state=state->next(), ++i)
+      m_keptStates.push_back(state);
+  }
+  else {
+    for (state=m_undoHistory.firstState(), i=1; state && i<kKeepStates; state=state->next(), ++i)
+      m_keptStates.push_back(state);
+  }
+
+  // Skipped states can be compacted now (if they aren't kept anymore)
+  for (int phase=0; phase<kCompactPhases; ++phase) {
+    if (m_compactSkipped[phase]) {
+      m_compactCursor[phase] = m_compactSkipped[phase]->prev();
+      m_compactSkipped[phase] = nullptr;
+    }
+  }
+}
+
+// Waits until the background thread finishes its work with the given
+// state (which could have been picked before it was kept).
+void DocumentUndo::waitCompaction(const undo::UndoState* state)
+{
+  if (!state)
+    return;
+
+  std::unique_lock<std::mutex> lock(m_compactMutex);
+  while (m_compactingState == state)
+    m_compactCond.wait(lock);
+}
+
+// Stops the background thread between states so we can modify any
+// state of the history.
+void DocumentUndo::pauseCompaction()
+{
+  std::unique_lock<std::mutex> lock(m_compactMutex);
+  m_compactPaused = true;
+  while (m_compactingState)
+    m_compactCond.wait(lock);
+}
+
+void DocumentUndo::resumeCompaction()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_compactMutex);
+    m_compactPaused = false;
+    updateKeptStates();
+  }
+  m_compactCond.notify_all();
+}
+
+bool DocumentUndo::isReachableState(const undo::UndoState* state) const
+{
+  const undo::UndoState* dropped = m_lastDroppedState;
+  if (!dropped)
+    return true;
+
+  // Only the last dropped state and the next ones can be reached
+  // (the dropped state itself cannot be undone).
+  for (; dropped; dropped = dropped->next()) {
+    if (dropped == state)
+      return true;
+  }
+  return false;
+}
+
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -8,13 +8,22 @@
 #define APP_DOCUMENT_UNDO_H_INCLUDED
 #pragma once
 
+#include "app/undo_buffer.h"
 #include "base/disable_copying.h"
 #include "base/unique_ptr.h"
 #include "doc/sprite_position.h"
 #include "obs/observable.h"
 #include "undo/undo_history.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <vector>
+
+namespace base {
+  class thread;
+}
 
 namespace doc {
   class Context;
@@ -30,6 +39,7 @@ namespace app {
   class DocumentUndo : public obs::observable<DocumentUndoObserver> {
   public:
     DocumentUndo();
+    ~DocumentUndo();
 
     void setContext(doc::Context* ctx);
 
@@ -61,10 +71,40 @@ namespace app {
 
     void moveToState(const undo::UndoState* state);
 
+    // Maximum memory used by the history (0 means no limit), and if
+    // old states can be dropped to stay under the limit. By default
+    // they are taken from the "undo" preferences each time a state
+    // is added.
+    void setMemoryLimit(size_t limit, bool canDropStates);
+
+    // Waits until the background thread cannot reduce the memory
+    // used by the history anymore.
+    void finishCompaction();
+
   private:
     const undo::UndoState* nextUndo() const;
     const undo::UndoState* nextRedo() const;
 
+    // Functions to keep the memory used by the history under the
+    // "undo.size_limit" option. Old states are compressed, moved to
+    // the spill file, or dropped (in that order) in a background
+    // thread.
+    void checkMemoryLimit();
+    void compactStates();
+    const undo::UndoState* nextStateToCompact(int& phase);
+    bool isKeptState(const undo::UndoState* state) const;
+    void updateKeptStates();
+    void waitCompaction(const undo::UndoState* state);
+    void pauseCompaction();
+    void resumeCompaction();
+    bool isReachableState(const undo::UndoState* state) const;
+
+    enum { kCompress, kSpill, kDrop, kCompactPhases };
+
+    // Declared before m_undoHistory because the spill file must be
+    // alive while the commands are in the history.
+    UndoSpillFile m_spillFile;
+
     undo::UndoHistory m_undoHistory;
     doc::Context* m_ctx;
 
@@ -79,6 +119,40 @@ namespace app {
     // way. E.g. If the save process fails.
     bool m_savedStateIsLost;
 
+    // Thread that reduces the memory used by the history (one state at
+    // a time) while m_totalSize is greater than m_compactLimit. It's
+    // created the first time the limit is exceeded and lives until the
+    // document is destroyed. All the following fields are protected by
+    // m_compactMutex.
+    base::UniquePtr<base::thread> m_compactThread;
+    std::mutex m_compactMutex;
+    std::condition_variable m_compactCond;
+    bool m_compactExit;
+    bool m_compactPaused;
+    bool m_compactCanDrop;
+    bool m_compactDropStopped;  // A state couldn't drop its data
+    size_t m_compactLimit;
+
+    // Sum of memSize() of all commands in the history
+    size_t m_totalSize;
+
+    // States near the current one, they are never compacted (they
+    // are the next ones to be undone/redone).
+    std::vector<const undo::UndoState*> m_keptStates;
+
+    // For each phase, the last processed state (nullptr to start from
+    // the first one), and the first kept state that was skipped (so
+    // we can go back to it when it's not kept anymore).
+    const undo::UndoState* m_compactCursor[kCompactPhases];
+    const undo::UndoState* m_compactSkipped[kCompactPhases];
+
+    // State being compacted by the background thread right now
+    const undo::UndoState* m_compactingState;
+
+    // Newest state with dropped data. It cannot be undone, so we
+    // cannot go back to previous states.
+    std::atomic<const undo::UndoState*> m_lastDroppedState;
+
     DISABLE_COPYING(DocumentUndo);
   };
 
@@ -0,0 +1,114 @@
+// Aseprite
+// Copyright (C) 2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#include "tests/test.h"
+
+#include "app/cmd_transaction.h"
+#include "app/document_undo.h"
+
+#include <atomic>
+#include <vector>
+
+using namespace app;
+
+// Transaction that uses "size" bytes. Only droppable transactions
+// implement onDropUndoData() (like CopyRegion), the others cannot
+// reduce their memory (like most commands).
+class TestTransaction : public CmdTransaction {
+public:
+  TestTransaction(size_t size, bool droppable)
+    : CmdTransaction("Test", false, nullptr)
+    , m_size(size)
+    , m_droppable(droppable)
+    , m_undone(false) {
+  }
+
+  bool undone() const { return m_undone; }
+
+protected:
+  void onExecute() override { }
+  void onUndo() override { m_undone = true; }
+  void onRedo() override { m_undone = false; }
+  size_t onMemSize() const override { return m_size; }
+  bool onDropUndoData() override {
+    if (!m_droppable || m_size == 0)
+      return false;
+    m_size = 0;
+    return true;
+  }
+
+private:
+  std::atomic<size_t> m_size;
+  bool m_droppable;
+  bool m_undone;
+};
+
+static TestTransaction* add_transaction(DocumentUndo& undo, bool droppable)
+{
+  TestTransaction* cmd = new TestTransaction(1024*1024, droppable);
+  cmd->execute(nullptr);
+  undo.add(cmd);
+  return cmd;
+}
+
+TEST(DocumentUndo, CommandsWithoutDropHooksStayUndoable)
+{
+  DocumentUndo undo;
+  undo.setMemoryLimit(1024, true);
+
+  std::vector<TestTransaction*> cmds;
+  for (int i=0; i<10; ++i)
+    cmds.push_back(add_transaction(undo, false));
+  undo.finishCompaction();
+
+  for (int i=9; i>=0; --i) {
+    ASSERT_TRUE(undo.canUndo()) << "State " << i;
+    undo.undo();
+    EXPECT_TRUE(cmds[i]->undone());
+  }
+  EXPECT_FALSE(undo.canUndo());
+}
+
+TEST(DocumentUndo, DropStopsAtCommandsWithoutDropHooks)
+{
+  DocumentUndo undo;
+  undo.setMemoryLimit(1024, true);
+
+  // The 4th state cannot drop its data, so only the first 3 states
+  // can be dropped.
+  std::vector<TestTransaction*> cmds;
+  for (int i=0; i<8; ++i)
+    cmds.push_back(add_transaction(undo, i != 3));
+  undo.finishCompaction();
+
+  for (int i=0; i<3; ++i)
+    EXPECT_EQ(size_t(0), cmds[i]->memSize()) << "State " << i;
+  for (int i=3; i<8; ++i)
+    EXPECT_EQ(size_t(1024*1024), cmds[i]->memSize()) << "State " << i;
+
+  for (int i=7; i>=3; --i) {
+    ASSERT_TRUE(undo.canUndo()) << "State " << i;
+    undo.undo();
+    EXPECT_TRUE(cmds[i]->undone());
+  }
+  EXPECT_FALSE(undo.canUndo());
+}
+
+TEST(DocumentUndo, NoDropInNonlinearHistory)
+{
+  DocumentUndo undo;
+  undo.setMemoryLimit(1024, false);
+
+  std::vector<TestTransaction*> cmds;
+  for (int i=0; i<5; ++i)
+    cmds.push_back(add_transaction(undo, true));
+  undo.finishCompaction();
+
+  for (int i=4; i>=0; --i) {
+    ASSERT_TRUE(undo.canUndo()) << "State " << i;
+    undo.undo();
+  }
+}
@@ -975,7 +975,7 @@ public:
   typename ImageTraits::pixel_t read_pixel(FILE* f);
   void write_pixel(FILE* f, typename ImageTraits::pixel_t c);
   void read_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
-  void write_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
+  void write_scanline(typename ImageTraits::const_address_t address, int w, uint8_t* buffer);
 };
 
 template<>
@@ -1005,7 +1005,7 @@ public:
       *(address++) = rgba(r, g, b, a);
     }
   }
-  void write_scanline(RgbTraits::address_t address, int w, uint8_t* buffer)
+  void write_scanline(RgbTraits::const_address_t address, int w, uint8_t* buffer)
   {
     for (int x=0; x<w; ++x) {
       *(buffer++) = rgba_getr(*address);
@@ -1038,7 +1038,7 @@ public:
       *(address++) = graya(k, a);
     }
   }
-  void write_scanline(GrayscaleTraits::address_t address, int w, uint8_t* buffer)
+  void write_scanline(GrayscaleTraits::const_address_t address, int w, uint8_t* buffer)
   {
     for (int x=0; x<w; ++x) {
       *(buffer++) = graya_getv(*address);
@@ -1061,7 +1061,7 @@ public:
   {
     memcpy(address, buffer, w);
   }
-  void write_scanline(IndexedTraits::address_t address, int w, uint8_t* buffer)
+  void write_scanline(IndexedTraits::const_address_t address, int w, uint8_t* buffer)
   {
     memcpy(buffer, address, w);
   }
@@ -1193,8 +1193,8 @@ static void write_compressed_image(FILE* f, const Image* image)
   std::vector<uint8_t> compressed(4096);
 
   for (y=0; y<image->height(); y++) {
-    typename ImageTraits::address_t address =
-      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
+    typename ImageTraits::const_address_t address =
+      (typename ImageTraits::const_address_t)image->getPixelConstAddress(0, y);
 
     pixel_io.write_scanline(address, image->width(), &scanline[0]);
 
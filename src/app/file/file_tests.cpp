@@ -13,6 +13,7 @@
 #include "app/file/file_formats_manager.h"
 #include "base/unique_ptr.h"
 #include "doc/doc.h"
+#include "render/render.h"
 
 #include <cstdio>
 #include <cstdlib>
@@ -77,3 +78,131 @@ TEST(File, SeveralSizes)
     }
   }
 }
+
+TEST(File, GifFrames)
+{
+  const int w = 32, h = 24;
+  const int nframes = 5;
+  const doc::color_t colors[] = {
+    doc::rgba(255, 0, 0, 255),
+    doc::rgba(0, 255, 0, 255),
+    doc::rgba(0, 0, 255, 255),
+    doc::rgba(255, 255, 0, 255)
+  };
+  app::Context ctx;
+  std::vector<doc::ImageRef> expected;
+
+  {
+    base::UniquePtr<doc::Document> doc(ctx.documents().add(w, h, doc::ColorMode::RGB));
+    doc->setFilename("test.gif");
+
+    doc::Sprite* sprite = doc->sprite();
+    doc::LayerImage* layer = static_cast<doc::LayerImage*>(sprite->root()->firstLayer());
+    ASSERT_TRUE(layer != nullptr);
+    for (frame_t frame=1; frame<nframes; ++frame)
+      sprite->addFrame(frame);
+
+    // Each frame moves a rectangle over a transparent background
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      doc::ImageRef image(doc::Image::create(doc::IMAGE_RGB, w, h));
+      doc::clear_image(image.get(), 0);
+      doc::fill_rect(image.get(), 2+3*frame, 1+2*frame, 12+3*frame, 9+2*frame,
+                     colors[frame % 4]);
+      doc::fill_rect(image.get(), 0, h-2, w-1, h-1, colors[(frame+1) % 4]);
+
+      if (frame == 0)
+        doc::copy_image(layer->cel(frame)->image(), image.get());
+      else
+        layer->addCel(new doc::Cel(frame, image));
+
+      expected.push_back(image);
+    }
+
+    save_document(&ctx, doc.get());
+    doc->close();
+  }
+
+  {
+    base::UniquePtr<app::Document> doc(load_document(&ctx, "test.gif"));
+    doc::Sprite* sprite = doc->sprite();
+    ASSERT_EQ(w, sprite->width());
+    ASSERT_EQ(h, sprite->height());
+    ASSERT_EQ(nframes, sprite->totalFrames());
+
+    doc::ImageRef image(doc::Image::create(doc::IMAGE_RGB, w, h));
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      render::Render render;
+      render.setBgType(render::BgType::NONE);
+      doc::clear_image(image.get(), 0);
+      render.renderSprite(image.get(), sprite, frame);
+
+      for (int y=0; y<h; ++y)
+        for (int x=0; x<w; ++x)
+          ASSERT_EQ(get_pixel_fast<RgbTraits>(expected[frame].get(), x, y),
+                    get_pixel_fast<RgbTraits>(image.get(), x, y));
+    }
+
+    doc->close();
+  }
+}
+
+TEST(File, GifManyColors)
+{
+  // Each frame uses 200 different colors, so the whole animation
+  // needs more than 256 colors and must be loaded as RGB.
+  const int w = 20, h = 10;
+  const int nframes = 3;
+  app::Context ctx;
+  std::vector<doc::ImageRef> expected;
+
+  {
+    base::UniquePtr<doc::Document> doc(ctx.documents().add(w, h, doc::ColorMode::RGB));
+    doc->setFilename("test.gif");
+
+    doc::Sprite* sprite = doc->sprite();
+    doc::LayerImage* layer = static_cast<doc::LayerImage*>(sprite->root()->firstLayer());
+    ASSERT_TRUE(layer != nullptr);
+    for (frame_t frame=1; frame<nframes; ++frame)
+      sprite->addFrame(frame);
+
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      doc::ImageRef image(doc::Image::create(doc::IMAGE_RGB, w, h));
+      for (int y=0; y<h; ++y)
+        for (int x=0; x<w; ++x)
+          put_pixel_fast<RgbTraits>(image.get(), x, y,
+                                    doc::rgba(10*x+frame, 20*y+frame, 80*frame, 255));
+
+      if (frame == 0)
+        doc::copy_image(layer->cel(frame)->image(), image.get());
+      else
+        layer->addCel(new doc::Cel(frame, image));
+
+      expected.push_back(image);
+    }
+
+    save_document(&ctx, doc.get());
+    doc->close();
+  }
+
+  {
+    base::UniquePtr<app::Document> doc(load_document(&ctx, "test.gif"));
+    doc::Sprite* sprite = doc->sprite();
+    ASSERT_EQ(doc::IMAGE_RGB, sprite->pixelFormat());
+    ASSERT_EQ(nframes, sprite->totalFrames());
+
+    doc::ImageRef image(doc::Image::create(doc::IMAGE_RGB, w, h));
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      render::Render render;
+      render.setBgType(render::BgType::NONE);
+      doc::clear_image(image.get(), 0);
+      render.renderSprite(image.get(), sprite, frame);
+
+      for (int y=0; y<h; ++y)
+        for (int x=0; x<w; ++x)
+          ASSERT_EQ(get_pixel_fast<RgbTraits>(expected[frame].get(), x, y),
+                    get_pixel_fast<RgbTraits>(image.get(), x, y));
+    }
+
+    doc->close();
+  }
+}
@@ -116,8 +116,10 @@ bool FliFormat::onLoad(FileOp* fop)
     // First frame, or the frame changes
     if (!prevCel ||
         (count_diff_between_images(prevCel->image(), bmp.get()))) {
-      // Add the new frame
-      ImageRef image(Image::createCopy(bmp.get()));
+      // Add the new frame. We need a deep copy because the decoder
+      // writes the next frames directly in the "bmp" buffer (a
+      // shared copy would share its pixels with "bmp").
+      ImageRef image(crop_image(bmp.get(), 0, 0, w, h, bmp->maskColor()));
       Cel* cel = new Cel(frame_out, image);
       layer->addCel(cel);
 
@@ -22,6 +22,8 @@
 #include "base/fs.h"
 #include "base/unique_ptr.h"
 #include "doc/doc.h"
+#include "doc/thread_pool.h"
+#include "render/error_diffusion.h"
 #include "render/quantization.h"
 #include "render/render.h"
 #include "ui/alert.h"
@@ -31,6 +33,12 @@
 
 #include <gif_lib.h>
 
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 #ifdef _WIN32
   #include <io.h>
   #define posix_lseek  _lseek
@@ -164,13 +172,20 @@ static inline doc::color_t colormap2rgba(ColorMapObject* colormap, int i) {
 
 // Decodes a GIF file trying to keep the image in Indexed format. If
 // it's not possible to handle it as Indexed (e.g. it contains more
-// than 256 colors), the file will be automatically converted to RGB.
+// than 256 colors), the file will be loaded as RGB.
+//
+// GIF files are made to be composed over RGB output. Each frame is
+// composed over the previous frame, and combinations of local
+// colormaps can output any number of colors, not just 256. So the
+// decoding is done in two steps:
 //
-// This is a complex process because GIF files are made to be composed
-// over RGB output. Each frame is composed over the previous frame,
-// and combinations of local colormaps can output any number of
-// colors, not just 256. So previous RGB colors must be kept and
-// merged with new colormaps.
+// 1. All frames are read from the file (decompressing their pixels)
+//    to know the colors that are used in the whole animation, so we
+//    can choose the final pixel format and palette of the sprite
+//    before creating any cel.
+// 2. Frames are composed directly (in place) over the same canvas
+//    with the final pixel format, and a copy of it is used as the cel
+//    image of each frame.
 class GifDecoder {
 public:
   GifDecoder(FileOp* fop, GifFileType* gifFile, int fd, int filesize)
@@ -180,24 +195,24 @@ public:
     , m_filesize(filesize)
     , m_sprite(nullptr)
     , m_spriteBounds(0, 0, m_gifFile->SWidth, m_gifFile->SHeight)
-    , m_frameNum(0)
+    , m_layer(nullptr)
     , m_opaque(false)
     , m_disposalMethod(DisposalMethod::NONE)
     , m_bgIndex(m_gifFile->SBackGroundColor >= 0 ? m_gifFile->SBackGroundColor: 0)
     , m_localTransparentIndex(-1)
     , m_frameDelay(1)
-    , m_remap(256)
     , m_hasLocalColormaps(false)
-    , m_firstLocalColormap(nullptr) {
+    , m_usesBgIndex(false)
+    , m_pixelFormat(IMAGE_INDEXED)
+    , m_transparentIndex(0)
+    , m_extraBgIndex(-1) {
     TRACE("GIF: background index=%d\n", (int)m_gifFile->SBackGroundColor);
     TRACE("GIF: global colormap=%d, ncolors=%d\n",
           (m_gifFile->SColorMap ? 1: 0),
           (m_gifFile->SColorMap ? m_gifFile->SColorMap->ColorCount: 0));
-  }
 
-  ~GifDecoder() {
-    if (m_firstLocalColormap)
-      GifFreeMapObject(m_firstLocalColormap);
+    if (m_gifFile->SColorMap)
+      m_colormaps.push_back(readColormap(m_gifFile->SColorMap));
   }
 
   Sprite* releaseSprite() {
@@ -212,7 +227,7 @@ public:
       readRecord(recType);
 
       // Just one frame?
-      if (m_fop->isOneFrame() && m_frameNum > 0)
+      if (m_fop->isOneFrame() && !m_frames.empty())
         break;
 
       if (m_fop->isStop())
@@ -220,49 +235,55 @@ public:
 
       if (m_filesize > 0) {
         int pos = posix_lseek(m_fd, 0, SEEK_CUR);
-        m_fop->setProgress(double(pos) / double(m_filesize));
+        m_fop->setProgress(0.5 * double(pos) / double(m_filesize));
       }
     }
 
-    if (m_sprite) {
-      // Add entries to include the transparent color
-      if (m_bgIndex >= m_sprite->palette(0)->size())
-        m_sprite->palette(0)->resize(m_bgIndex+1);
-
-      switch (m_sprite->pixelFormat()) {
-
-        case IMAGE_INDEXED: {
-          // Use the original global color map
-          ColorMapObject* global = m_gifFile->SColorMap;
-          if (!global)
-            global = m_firstLocalColormap;
-          if (global &&
-              global->ColorCount >= m_sprite->palette(0)->size() &&
-              !m_hasLocalColormaps) {
-            remapToGlobalColormap(global);
-          }
-          break;
-        }
+    if (m_frames.empty())
+      return false;
 
-        case IMAGE_RGB:
-          // Avoid huge color palettes
-          if (m_sprite->palette(0)->size() > 256) {
-            reduceToAnOptimizedPalette();
-          }
-          break;
-      }
+    choosePixelFormat();
+    createSprite();
+
+    for (frame_t frame=0; frame<frame_t(m_frames.size()); ++frame) {
+      composeFrame(frame);
+
+      // Release the frame pixels as soon as possible
+      std::vector<uint8_t>().swap(m_frames[frame].pixels);
 
-      if (m_layer && m_opaque)
-        m_layer->configureAsBackground();
+      if (m_fop->isStop()) {
+        m_sprite->setTotalFrames(frame+1);
+        break;
+      }
 
-      return true;
+      m_fop->setProgress(0.5 + 0.5 * double(frame+1) / double(m_frames.size()));
     }
-    else
-      return false;
+
+    if (m_opaque)
+      m_layer->configureAsBackground();
+
+    return true;
   }
 
 private:
 
+  // Colors of a GIF colormap.
+  typedef std::vector<color_t> Colormap;
+
+  // Value used in tables to skip transparent pixels (it cannot be an
+  // index or an opaque RGB color).
+  static const color_t kSkipPixel = 0x00ffffff;
+
+  // A frame read from the file.
+  struct Frame {
+    gfx::Rect bounds;
+    int colormap;                 // Index in m_colormaps
+    int transparentIndex;
+    DisposalMethod disposalMethod;
+    int delay;
+    std::vector<uint8_t> pixels;  // Indexes (bounds.w * bounds.h)
+  };
+
   GifRecordType readRecordType() {
     GifRecordType type;
     if (DGifGetRecordType(m_gifFile, &type) == GIF_ERROR)
@@ -288,6 +309,8 @@ private:
     if (DGifGetImageDesc(m_gifFile) == GIF_ERROR)
       throw Exception("Invalid GIF image descriptor.\n");
 
+    const int frameNum = int(m_frames.size());
+
     // These are the bounds of the image to read.
     gfx::Rect frameBounds(
       m_gifFile->Image.Left,
@@ -296,94 +319,46 @@ private:
       m_gifFile->Image.Height);
 
     if (!m_spriteBounds.contains(frameBounds))
-      throw Exception("Image %d is out of sprite bounds.\n", (int)m_frameNum);
-
-    // Create sprite if this is the first frame
-    if (!m_sprite)
-      createSprite();
-
-    // Add a frame if it's necessary
-    if (m_sprite->lastFrame() < m_frameNum)
-      m_sprite->addFrame(m_frameNum);
+      throw Exception("Image %d is out of sprite bounds.\n", frameNum);
 
-    // Create a temporary image loading the frame pixels from the GIF file
-    UniquePtr<Image> frameImage(
-      readFrameIndexedImage(frameBounds));
+    TRACE("GIF: Frame[%d] transparent index = %d\n", frameNum, m_localTransparentIndex);
 
-    TRACE("GIF: Frame[%d] transparent index = %d\n", (int)m_frameNum, m_localTransparentIndex);
-
-    if (m_frameNum == 0) {
-      if (m_localTransparentIndex >= 0)
-        m_opaque = false;
-      else
-        m_opaque = true;
-    }
+    if (frameNum == 0)
+      m_opaque = (m_localTransparentIndex < 0);
 
-    // Merge this frame colors with the current palette
-    updatePalette(frameImage);
-
-    // Convert the sprite to RGB if we have more than 256 colors
-    if ((m_sprite->pixelFormat() == IMAGE_INDEXED) &&
-        (m_sprite->palette(m_frameNum)->size() > 256)) {
-      TRACE("GIF: Converting to RGB because we have %d colors\n",
-            m_sprite->palette(m_frameNum)->size());
-
-      convertIndexedSpriteToRgb();
-    }
-
-    // Composite frame with previous frame
-    if (m_sprite->pixelFormat() == IMAGE_INDEXED) {
-      compositeIndexedImageToIndexed(frameBounds, frameImage);
-    }
-    else {
-      compositeIndexedImageToRgb(frameBounds, frameImage);
-    }
-
-    // Create cel
-    createCel();
-
-    // Dispose/clear frame content
-    process_disposal_method(m_previousImage.get(),
-                            m_currentImage.get(),
-                            m_disposalMethod,
-                            frameBounds,
-                            m_bgIndex);
-
-    // Copy the current image into previous image
-    copy_image(m_previousImage.get(), m_currentImage.get());
-
-    // Set frame delay (1/100th seconds to milliseconds)
-    if (m_frameDelay >= 0)
-      m_sprite->setFrameDuration(m_frameNum, m_frameDelay*10);
+    m_frames.push_back(Frame());
+    Frame& frame = m_frames.back();
+    frame.bounds = frameBounds;
+    frame.colormap = getFrameColormap();
+    frame.transparentIndex = m_localTransparentIndex;
+    frame.disposalMethod = m_disposalMethod;
+    frame.delay = m_frameDelay;
+    readFramePixels(frame);
+    scanFrameColors(frame);
 
     // Reset extension variables
     m_disposalMethod = DisposalMethod::NONE;
     m_localTransparentIndex = -1;
     m_frameDelay = 1;
-
-    // Next frame
-    ++m_frameNum;
   }
 
-  Image* readFrameIndexedImage(const gfx::Rect& frameBounds) {
-    UniquePtr<Image> frameImage(
-      Image::create(IMAGE_INDEXED, frameBounds.w, frameBounds.h));
-
-    IndexedTraits::address_t addr;
+  void readFramePixels(Frame& frame) {
+    const gfx::Rect& frameBounds = frame.bounds;
+    frame.pixels.resize(frameBounds.w * frameBounds.h);
+    if (frame.pixels.empty())
+      return;
 
     if (m_gifFile->Image.Interlace) {
       // Need to perform 4 passes on the image
       for (int i=0; i<4; ++i)
         for (int y = interlaced_offset[i]; y < frameBounds.h; y += interlaced_jumps[i]) {
-          addr = frameImage->getPixelAddress(0, y);
-          if (DGifGetLine(m_gifFile, addr, frameBounds.w) == GIF_ERROR)
+          if (DGifGetLine(m_gifFile, &frame.pixels[y*frameBounds.w], frameBounds.w) == GIF_ERROR)
             throw Exception("Invalid interlaced image data.");
         }
     }
     else {
       for (int y = 0; y < frameBounds.h; ++y) {
-        addr = frameImage->getPixelAddress(0, y);
-        if (DGifGetLine(m_gifFile, addr, frameBounds.w) == GIF_ERROR)
+        if (DGifGetLine(m_gifFile, &frame.pixels[y*frameBounds.w], frameBounds.w) == GIF_ERROR)
           throw Exception("Invalid image data (%d).\n"
 #if GIFLIB_MAJOR >= 5
                           , m_gifFile->Error
@@ -393,246 +368,236 @@ private:
                           );
       }
     }
+  }
 
-    return frameImage.release();
+  static Colormap readColormap(ColorMapObject* colormap) {
+    Colormap colors(colormap->ColorCount);
+    for (int i=0; i<colormap->ColorCount; ++i)
+      colors[i] = colormap2rgba(colormap, i);
+    return colors;
   }
 
-  ColorMapObject* getFrameColormap() {
-    ColorMapObject* global = m_gifFile->SColorMap;
+  // Returns the index in m_colormaps of the colormap used by the
+  // current image. If the first colormap (the global one, or the
+  // first local colormap if the file doesn't have a global one) is
+  // the only one used in the file, m_hasLocalColormaps is false.
+  int getFrameColormap() {
     ColorMapObject* colormap = m_gifFile->Image.ColorMap;
 
     if (!colormap) {
       // Doesn't have local map, use the global one
-      colormap = global;
+      if (!m_gifFile->SColorMap)
+        throw Exception("There is no color map.");
+      return 0;
     }
-    else if (!m_hasLocalColormaps) {
-      if (!global) {
-        if (!m_firstLocalColormap)
-          m_firstLocalColormap = GifMakeMapObject(colormap->ColorCount,
-                                                  colormap->Colors);
-        global = m_firstLocalColormap;
-      }
 
-      if (global->ColorCount != colormap->ColorCount)
-        m_hasLocalColormaps = true;
-      else {
-        for (int i=0; i<colormap->ColorCount; ++i) {
-          if (global->Colors[i].Red   != colormap->Colors[i].Red ||
-              global->Colors[i].Green != colormap->Colors[i].Green ||
-              global->Colors[i].Blue  != colormap->Colors[i].Blue) {
-            m_hasLocalColormaps = true;
-            break;
-          }
-        }
-      }
+    Colormap colors = readColormap(colormap);
+    if (!m_colormaps.empty() &&
+        m_colormaps[0] == colors) {
+      return 0;
     }
 
-    if (!colormap)
-      throw Exception("There is no color map.");
+    if (!m_colormaps.empty())
+      m_hasLocalColormaps = true;
 
-    return colormap;
+    m_colormaps.push_back(std::move(colors));
+    return int(m_colormaps.size()-1);
   }
 
-  // Adds colors used in the GIF frame so we can draw it over
-  // m_currentImage. If the frame contains a local colormap, we try to
-  // find them in the current sprite palette (using
-  // Palette::findExactMatch()) so we don't add duplicated entries.
-  // To do so we use a Remap (m_remap variable) which matches the
-  // original GIF frame colors with the current sprite colors.
-  void updatePalette(const Image* frameImage) {
-    ColorMapObject* colormap = getFrameColormap();
-    int ncolors = colormap->ColorCount;
-    bool isLocalColormap = (m_gifFile->Image.ColorMap ? true: false);
-
-    TRACE("GIF: Local colormap=%d, ncolors=%d\n", isLocalColormap, ncolors);
-
-    // We'll calculate the list of used colormap indexes in this
-    // frameImage.
-    PalettePicks usedEntries(ncolors);
-    if (isLocalColormap) {
-      // With this we avoid discarding the transparent index when a
-      // frame indicates that it uses a specific index as transparent
-      // but the image is completely opaque anyway.
-      if (m_localTransparentIndex >= 0 &&
-          m_localTransparentIndex < ncolors) {
-        usedEntries[m_localTransparentIndex] = true;
-      }
+  // Adds the colors used by the frame to the list of used colors in
+  // the whole animation (only needed when there are local colormaps,
+  // in other case the first colormap will be the palette).
+  void scanFrameColors(const Frame& frame) {
+    const Colormap& colormap = m_colormaps[frame.colormap];
+    const int ncolors = int(colormap.size());
+    bool used[256] = { false };
+
+    for (uint8_t i : frame.pixels)
+      used[i] = true;
+    if (frame.transparentIndex >= 0 &&
+        frame.transparentIndex < 256)
+      used[frame.transparentIndex] = false;
+
+    // Check if we need an extra color equal to the bg color because
+    // the bg index is used as an opaque color in a transparent sprite.
+    if (m_bgIndex < 256 && used[m_bgIndex])
+      m_usesBgIndex = true;
 
-      for (const auto& i : LockImageBits<IndexedTraits>(frameImage)) {
-        if (i >= 0 && i < ncolors)
-          usedEntries[i] = true;
-      }
-    }
-    // Mark all entries as used if the colormap is global.
-    else {
-      usedEntries.all();
+    for (int i=0; i<ncolors; ++i) {
+      if (used[i] &&
+          m_usedColorsSet.insert(colormap[i]).second)
+        m_usedColors.push_back(colormap[i]);
     }
+  }
 
-    // Number of colors (indexes) used in the frame image.
-    int usedNColors = usedEntries.picks();
-
-    // Check if we need an extra color equal to the bg color in a
-    // transparent frameImage.
-    bool needsExtraBgColor = false;
-    if (m_sprite->pixelFormat() == IMAGE_INDEXED &&
-        !m_opaque && m_bgIndex != m_localTransparentIndex) {
-      for (const auto& i : LockImageBits<IndexedTraits>(frameImage)) {
-        if (i == m_bgIndex &&
-            i != m_localTransparentIndex) {
-          needsExtraBgColor = true;
-          break;
-        }
+  // Chooses the pixel format and palette of the sprite from the
+  // colors used in all frames.
+  void choosePixelFormat() {
+    const Colormap& first = m_colormaps[0];
+    m_colorsMap.clear();
+
+    if (!m_hasLocalColormaps) {
+      // Use the original colormap as the palette (so the indexes of
+      // the GIF file are kept).
+      m_palette = first;
+      if (m_bgIndex >= int(m_palette.size()))
+        m_palette.resize(m_bgIndex+1, rgba(0, 0, 0, 255));
+      if (!m_opaque && m_usesBgIndex) {
+        m_extraBgIndex = int(m_palette.size());
+        m_palette.push_back(m_palette[m_bgIndex]);
       }
+      m_transparentIndex = m_bgIndex;
     }
-
-    UniquePtr<Palette> palette;
-    if (m_frameNum == 0)
-      palette.reset(new Palette(m_frameNum, usedNColors + (needsExtraBgColor ? 1: 0)));
     else {
-      palette.reset(new Palette(*m_sprite->palette(m_frameNum-1)));
-      palette->setFrame(m_frameNum);
-    }
-    resetRemap(MAX(ncolors, palette->size()));
-
-    // Number of colors in the colormap that are part of the current
-    // sprite palette.
-    int found = 0;
-    if (m_frameNum > 0) {
-      for (int i=0; i<ncolors; ++i) {
-        if (!usedEntries[i])
+      // The first entry is used for the transparent color (or the
+      // background color in opaque sprites), then the used colors.
+      m_palette.clear();
+      m_palette.push_back(bgColor());
+      if (m_opaque)
+        m_colorsMap[m_palette[0]] = 0;
+
+      for (color_t color : m_usedColors) {
+        if (m_colorsMap.find(color) != m_colorsMap.end())
           continue;
-
-        int j = palette->findExactMatch(
-          colormap->Colors[i].Red,
-          colormap->Colors[i].Green,
-          colormap->Colors[i].Blue, 255,
-          (m_opaque ? -1: m_bgIndex));
-        if (j >= 0) {
-          m_remap.map(i, j);
-          ++found;
-        }
+        m_colorsMap[color] = int(m_palette.size());
+        m_palette.push_back(color);
       }
+      m_transparentIndex = 0;
     }
 
-    // All needed colors in the colormap are present in the current
-    // palette.
-    if (found == usedNColors)
-      return;
+    if (m_palette.size() <= 256) {
+      m_pixelFormat = IMAGE_INDEXED;
+    }
+    else {
+      TRACE("GIF: Using RGB format because we have %d colors\n",
+            int(m_palette.size()));
 
-    // In other case, we need to add the missing colors...
+      m_pixelFormat = IMAGE_RGB;
 
-    // First index that acts like a base for new colors in palette.
-    int base = (m_frameNum == 0 ? 0: palette->size());
+      // Avoid huge color palettes
+      render::PaletteOptimizer optimizer;
+      for (color_t color : m_usedColorsSet)
+        optimizer.feedWithRgbaColor(color);
 
-    // Number of colors in the image that aren't in the palette.
-    int missing = (usedNColors - found);
+      Palette palette(0, 256);
+      optimizer.calculate(&palette, m_bgIndex, nullptr);
 
-    TRACE("GIF: Bg index=%d,\n"
-          "  Local transparent index=%d,\n"
-          "  Need extra index to show bg color=%d,\n  "
-          "  Found colors in palette=%d,\n"
-          "  Used colors in local pixels=%d,\n"
-          "  Base for new colors in palette=%d,\n"
-          "  Colors in the image missing in the palette=%d,\n"
-          "  New palette size=%d\n",
-          m_bgIndex, m_localTransparentIndex, needsExtraBgColor,
-          found, usedNColors, base, missing,
-          base + missing + (needsExtraBgColor ? 1: 0));
+      m_palette.resize(palette.size());
+      for (int i=0; i<palette.size(); ++i)
+        m_palette[i] = palette.getEntry(i);
+      m_transparentIndex = m_bgIndex;
+    }
+  }
 
-    Palette oldPalette(*palette);
-    palette->resize(base + missing + (needsExtraBgColor ? 1: 0));
-    resetRemap(MAX(ncolors, palette->size()));
+  // Color used to clear the canvas in opaque sprites.
+  color_t bgColor() const {
+    if (m_bgIndex < int(m_colormaps[0].size()))
+      return m_colormaps[0][m_bgIndex];
+    else
+      return rgba(0, 0, 0, 255);
+  }
 
-    for (int i=0; i<ncolors; ++i) {
-      if (!usedEntries[i])
-        continue;
+  void createSprite() {
+    const int w = m_spriteBounds.w;
+    const int h = m_spriteBounds.h;
+
+    Palette palette(0, int(m_palette.size()));
+    for (int i=0; i<palette.size(); ++i)
+      palette.setEntry(i, m_palette[i]);
+
+    m_sprite.reset(new Sprite(m_pixelFormat, w, h, palette.size()));
+    m_sprite->setTransparentColor(m_transparentIndex);
+    m_sprite->setPalette(&palette, false);
+    m_sprite->setTotalFrames(frame_t(m_frames.size()));
+
+    m_canvas.reset(Image::create(m_pixelFormat, w, h));
+    if (m_pixelFormat == IMAGE_INDEXED) {
+      m_canvasBg = m_transparentIndex;
+      m_canvas->setMaskColor(m_transparentIndex);
+    }
+    else {
+      m_canvasBg = (m_opaque ? bgColor(): rgba(0, 0, 0, 0));
+    }
+    clear_image(m_canvas.get(), m_canvasBg);
 
-      int j = -1;
+    m_layer = new LayerImage(m_sprite.get());
+    m_sprite->root()->addLayer(m_layer);
+  }
 
-      if (m_frameNum > 0) {
-        j = oldPalette.findExactMatch(
-          colormap->Colors[i].Red,
-          colormap->Colors[i].Green,
-          colormap->Colors[i].Blue, 255,
-          (m_opaque ? -1: m_bgIndex));
+  // Composes the given frame over the canvas, creates its cel, and
+  // then disposes the frame from the canvas.
+  void composeFrame(frame_t frameNum) {
+    const Frame& frame = m_frames[frameNum];
+    const gfx::Rect& bounds = frame.bounds;
+    const Colormap& colormap = m_colormaps[frame.colormap];
+
+    // Save the area that the frame will modify to restore it later
+    ImageRef saved;
+    if (frame.disposalMethod == DisposalMethod::RESTORE_PREVIOUS)
+      saved.reset(crop_image(m_canvas.get(), bounds, m_canvasBg));
+
+    // Table to convert the frame indexes to the canvas pixels
+    color_t table[256];
+    for (int i=0; i<256; ++i) {
+      if (i == frame.transparentIndex ||
+          i >= int(colormap.size())) {
+        table[i] = kSkipPixel;
       }
-
-      if (j < 0) {
-        j = base++;
-        palette->setEntry(j, colormap2rgba(colormap, i));
+      else if (m_pixelFormat == IMAGE_RGB) {
+        table[i] = colormap[i];
+      }
+      else if (!m_hasLocalColormaps) {
+        table[i] = (i == m_bgIndex && m_extraBgIndex >= 0 ? m_extraBgIndex: i);
+      }
+      else {
+        auto it = m_colorsMap.find(colormap[i]);
+        table[i] = (it != m_colorsMap.end() ? color_t(it->second): kSkipPixel);
       }
-      m_remap.map(i, j);
     }
 
-    if (needsExtraBgColor) {
-      int i = m_bgIndex;
-      int j = base++;
-      palette->setEntry(j, colormap2rgba(colormap, i));
-      m_remap.map(i, j);
-    }
+    if (m_pixelFormat == IMAGE_INDEXED)
+      composePixels<IndexedTraits>(frame, table);
+    else
+      composePixels<RgbTraits>(frame, table);
 
-    ASSERT(base == palette->size());
-    m_sprite->setPalette(palette, false);
-  }
+    // Create cel
+    ImageRef celImage(Image::createCopy(m_canvas.get()));
+    m_layer->addCel(new Cel(frameNum, celImage));
 
-  void compositeIndexedImageToIndexed(const gfx::Rect& frameBounds,
-                                      const Image* frameImage) {
-    // Compose the frame image with the previous frame
-    for (int y=0; y<frameBounds.h; ++y) {
-      for (int x=0; x<frameBounds.w; ++x) {
-        color_t i = get_pixel_fast<IndexedTraits>(frameImage, x, y);
-        if (i == m_localTransparentIndex)
-          continue;
+    // Set frame delay (1/100th seconds to milliseconds)
+    if (frame.delay >= 0)
+      m_sprite->setFrameDuration(frameNum, frame.delay*10);
 
-        i = m_remap[i];
-        put_pixel_fast<IndexedTraits>(m_currentImage.get(),
-                                      frameBounds.x + x,
-                                      frameBounds.y + y, i);
-      }
+    // Dispose/clear frame content
+    switch (frame.disposalMethod) {
+      case DisposalMethod::RESTORE_BGCOLOR:
+        fill_rect(m_canvas.get(), bounds, m_canvasBg);
+        break;
+      case DisposalMethod::RESTORE_PREVIOUS:
+        copy_image(m_canvas.get(), saved.get(), bounds.x, bounds.y);
+        break;
+      default:
+        break;
     }
   }
 
-  void compositeIndexedImageToRgb(const gfx::Rect& frameBounds,
-                                  const Image* frameImage) {
-    ColorMapObject* colormap = getFrameColormap();
-
-    // Compose the frame image with the previous frame
-    for (int y=0; y<frameBounds.h; ++y) {
-      for (int x=0; x<frameBounds.w; ++x) {
-        color_t i = get_pixel_fast<IndexedTraits>(frameImage, x, y);
-        if (i == m_localTransparentIndex)
-          continue;
+  template<typename ImageTraits>
+  void composePixels(const Frame& frame, const color_t* table) {
+    const gfx::Rect& bounds = frame.bounds;
+    const uint8_t* src = (frame.pixels.empty() ? nullptr: &frame.pixels[0]);
 
-        i = rgba(
-          colormap->Colors[i].Red,
-          colormap->Colors[i].Green,
-          colormap->Colors[i].Blue, 255);
+    for (int y=0; y<bounds.h; ++y) {
+      auto dst = (typename ImageTraits::address_t)
+        m_canvas->getPixelAddress(bounds.x, bounds.y+y);
 
-        put_pixel_fast<RgbTraits>(m_currentImage.get(),
-                                  frameBounds.x + x,
-                                  frameBounds.y + y, i);
+      for (int x=0; x<bounds.w; ++x, ++src, ++dst) {
+        const color_t c = table[*src];
+        if (c != kSkipPixel)
+          *dst = (typename ImageTraits::pixel_t)c;
       }
     }
   }
 
-  void createCel() {
-    Cel* cel = new Cel(m_frameNum, ImageRef(0));
-    try {
-      ImageRef celImage(Image::createCopy(m_currentImage.get()));
-      try {
-        cel->data()->setImage(celImage);
-      }
-      catch (...) {
-        throw;
-      }
-      m_layer->addCel(cel);
-    }
-    catch (...) {
-      delete cel;
-      throw;
-    }
-  }
-
   void readExtensionRecord() {
     int extCode;
     GifByteType* extension;
@@ -656,107 +621,6 @@ private:
     }
   }
 
-  void createSprite() {
-    ColorMapObject* colormap = nullptr;
-    if (m_gifFile->SColorMap) {
-      colormap = m_gifFile->SColorMap;
-    }
-    else if (m_gifFile->Image.ColorMap) {
-      colormap = m_gifFile->Image.ColorMap;
-    }
-    int ncolors = (colormap ? colormap->ColorCount: 1);
-    int w = m_spriteBounds.w;
-    int h = m_spriteBounds.h;
-
-    m_sprite.reset(new Sprite(IMAGE_INDEXED, w, h, ncolors));
-    m_sprite->setTransparentColor(m_bgIndex);
-
-    m_currentImage.reset(Image::create(IMAGE_INDEXED, w, h));
-    m_previousImage.reset(Image::create(IMAGE_INDEXED, w, h));
-    m_currentImage->setMaskColor(m_bgIndex);
-    m_previousImage->setMaskColor(m_bgIndex);
-    clear_image(m_currentImage.get(), m_bgIndex);
-    clear_image(m_previousImage.get(), m_bgIndex);
-
-    m_layer = new LayerImage(m_sprite.get());
-    m_sprite->root()->addLayer(m_layer);
-  }
-
-  void resetRemap(int ncolors) {
-    m_remap = Remap(ncolors);
-    for (int i=0; i<ncolors; ++i)
-      m_remap.map(i, i);
-  }
-
-  // Converts the whole sprite read so far because it contains more
-  // than 256 colors at the same time.
-  void convertIndexedSpriteToRgb() {
-    for (Cel* cel : m_sprite->uniqueCels()) {
-      Image* oldImage = cel->image();
-      ImageRef newImage(
-        render::convert_pixel_format
-        (oldImage, NULL, IMAGE_RGB, DitheringMethod::NONE,
-         nullptr,
-         m_sprite->palette(cel->frame()),
-         m_opaque,
-         m_bgIndex));
-
-      m_sprite->replaceImage(oldImage->id(), newImage);
-    }
-
-    m_currentImage.reset(
-      render::convert_pixel_format
-      (m_currentImage.get(), NULL, IMAGE_RGB, DitheringMethod::NONE,
-       nullptr,
-       m_sprite->palette(m_frameNum),
-       m_opaque,
-       m_bgIndex));
-
-    m_previousImage.reset(
-      render::convert_pixel_format
-      (m_previousImage.get(), NULL, IMAGE_RGB, DitheringMethod::NONE,
-       nullptr,
-       m_sprite->palette(MAX(0, m_frameNum-1)),
-       m_opaque,
-       m_bgIndex));
-
-    m_sprite->setPixelFormat(IMAGE_RGB);
-  }
-
-  void remapToGlobalColormap(ColorMapObject* colormap) {
-    Palette* oldPalette = m_sprite->palette(0);
-    Palette newPalette(0, colormap->ColorCount);
-
-    for (int i=0; i<colormap->ColorCount; ++i) {
-      newPalette.setEntry(i, colormap2rgba(colormap, i));;
-    }
-
-    Remap remap = create_remap_to_change_palette(
-      oldPalette, &newPalette, m_bgIndex,
-      m_opaque); // We cannot remap the transparent color if the
-                 // sprite isn't opaque, because we
-                 // cannot write the header again
-
-    for (Cel* cel : m_sprite->uniqueCels())
-      doc::remap_image(cel->image(), remap);
-
-    m_sprite->setPalette(&newPalette, false);
-  }
-
-  void reduceToAnOptimizedPalette() {
-    render::PaletteOptimizer optimizer;
-    const Palette* palette = m_sprite->palette(0);
-
-    // Feed the palette optimizer with pixels inside frameBounds
-    for (int i=0; i<palette->size(); ++i) {
-      optimizer.feedWithRgbaColor(palette->getEntry(i));
-    }
-
-    Palette newPalette(0, 256);
-    optimizer.calculate(&newPalette, m_bgIndex, nullptr);
-    m_sprite->setPalette(&newPalette, false);
-  }
-
   FileOp* m_fop;
   GifFileType* m_gifFile;
   int m_fd;
@@ -764,21 +628,33 @@ private:
   UniquePtr<Sprite> m_sprite;
   gfx::Rect m_spriteBounds;
   LayerImage* m_layer;
-  int m_frameNum;
   bool m_opaque;
+
+  // Values of the last graphics extension record (for the next image)
   DisposalMethod m_disposalMethod;
   int m_bgIndex;
   int m_localTransparentIndex;
   int m_frameDelay;
-  ImageRef m_currentImage;
-  ImageRef m_previousImage;
-  Remap m_remap;
-  bool m_hasLocalColormaps;     // Indicates that this fila contains local colormaps
-
-  // This is a copy of the first local color map. It's used to see if
-  // all local colormaps are the same, so we can use it as a global
-  // colormap.
-  ColorMapObject* m_firstLocalColormap;
+
+  // Frames and colormaps read from the file (m_colormaps[0] is the
+  // global colormap or the first local one)
+  std::vector<Frame> m_frames;
+  std::vector<Colormap> m_colormaps;
+  bool m_hasLocalColormaps;     // Indicates that this file contains different local colormaps
+  bool m_usesBgIndex;           // The bg index is used as an opaque color in some frame
+  std::vector<color_t> m_usedColors; // Used colors in order of appearance
+  std::unordered_set<color_t> m_usedColorsSet;
+
+  // Final format/palette of the sprite
+  PixelFormat m_pixelFormat;
+  std::vector<color_t> m_palette;
+  std::unordered_map<color_t, int> m_colorsMap; // Color -> palette index (with local colormaps)
+  int m_transparentIndex;
+  int m_extraBgIndex;
+
+  // Image where frames are composed
+  ImageRef m_canvas;
+  color_t m_canvasBg;
 };
 
 bool GifFormat::onLoad(FileOp* fop)
@@ -811,12 +687,75 @@ bool GifFormat::onLoad(FileOp* fop)
     return false;
 }
 
+// Returns true if the GIF colormaps must be created quantizing the
+// rendered frames (so they can be dithered). The sprite palette can
+// be used directly only for indexed sprites with one palette where
+// all layers are opaque and use the normal blend mode.
+static bool needs_quantized_colormaps(const Sprite* sprite)
+{
+  if (sprite->pixelFormat() != IMAGE_INDEXED ||
+      sprite->getPalettes().size() != 1)
+    return true;
+
+  // If some layer has opacity < 255 or a different blend mode, we
+  // need to create color palettes.
+  for (const Layer* layer : sprite->allVisibleLayers()) {
+    if (layer->isVisible() && layer->isImage()) {
+      const LayerImage* imageLayer = static_cast<const LayerImage*>(layer);
+      if (imageLayer->opacity() < 255 ||
+          imageLayer->blendMode() != BlendMode::NORMAL)
+        return true;
+    }
+  }
+  return false;
+}
+
+// Names of the dithering methods in the GIF options (the same ones
+// used by the "dithering" param of ChangePixelFormat).
+static std::string dithering_to_string(DitheringMethod dithering)
+{
+  switch (dithering) {
+    case DitheringMethod::FLOYD_STEINBERG: return "floyd-steinberg";
+    case DitheringMethod::ATKINSON: return "atkinson";
+    case DitheringMethod::SIERRA: return "sierra";
+    default: return "none";
+  }
+}
+
+static DitheringMethod dithering_from_string(const std::string& dithering)
+{
+  if (dithering == "floyd-steinberg")
+    return DitheringMethod::FLOYD_STEINBERG;
+  else if (dithering == "atkinson")
+    return DitheringMethod::ATKINSON;
+  else if (dithering == "sierra")
+    return DitheringMethod::SIERRA;
+  else
+    return DitheringMethod::NONE;
+}
+
 #ifdef ENABLE_SAVE
 
 class GifEncoder {
 public:
   typedef int gifframe_t;
 
+  // Data of one frame through the encoding steps.
+  struct FrameData {
+    gifframe_t gifFrame;
+    frame_t frame;
+    gfx::Rect bounds;
+    DisposalMethod disposal;
+    ImageRef rgbImage;          // Pixels of the rendered frame inside "bounds"
+    ImageRef indexedImage;      // Final indexes to write in the GIF file
+    std::shared_ptr<ColorMapObject> colormap; // Local colormap (or nullptr to use the global one)
+    int localTransparent;
+
+    FrameData() : gifFrame(0), frame(0),
+                  disposal(DisposalMethod::NONE),
+                  localTransparent(-1) { }
+  };
+
   GifEncoder(FileOp* fop, GifFileType* gifFile)
     : m_fop(fop)
     , m_gifFile(gifFile)
@@ -836,32 +775,13 @@ public:
       m_bitsPerPixel = 8;
     }
 
-    if (m_sprite->pixelFormat() == IMAGE_INDEXED &&
-        m_sprite->getPalettes().size() == 1) {
-      // If some layer has opacity < 255 or a different blend mode, we
-      // need to create color palettes.
-      for (const Layer* layer : m_sprite->allVisibleLayers()) {
-        if (layer->isVisible() && layer->isImage()) {
-          const LayerImage* imageLayer = static_cast<const LayerImage*>(layer);
-          if (imageLayer->opacity() < 255 ||
-              imageLayer->blendMode() != BlendMode::NORMAL) {
-            m_quantizeColormaps = true;
-            break;
-          }
-        }
-      }
-
-      if (!m_quantizeColormaps) {
-        m_globalColormap = createColorMap(m_sprite->palette(0));
-        m_bgIndex = m_sprite->transparentColor();
-      }
-      else
-        m_bgIndex = 0;
+    m_quantizeColormaps = needs_quantized_colormaps(m_sprite);
+    if (!m_quantizeColormaps) {
+      m_globalColormap = createColorMap(m_sprite->palette(0));
+      m_bgIndex = m_sprite->transparentColor();
     }
-    else {
+    else
       m_bgIndex = 0;
-      m_quantizeColormaps = true;
-    }
 
     m_transparentIndex = (m_hasBackground ? -1: m_bgIndex);
 
@@ -873,11 +793,14 @@ public:
     const base::SharedPtr<GifOptions> gifOptions = fop->formatOptions();
     m_interlaced = gifOptions->interlaced();
     m_loop = (gifOptions->loop() ? 0: -1);
+    m_dithering = gifOptions->dithering();
 
-    for (int i=0; i<3; ++i)
-      m_images[i].reset(Image::create(IMAGE_RGB,
-                                      m_spriteBounds.w,
-                                      m_spriteBounds.h));
+    // The sprite RgbMap cannot be used from worker threads (it's
+    // regenerated on demand), so we use our own copy.
+    if (!m_quantizeColormaps) {
+      m_globalRgbMap.reset(new RgbMap);
+      m_globalRgbMap->regenerate(m_sprite->palette(0), m_transparentIndex);
+    }
   }
 
   ~GifEncoder() {
@@ -890,53 +813,97 @@ public:
     if (m_loop >= 0)
       writeLoopExtension();
 
-    // Previous and next images are used to decide the best disposal
-    // method (e.g. if it's more convenient to restore the background
-    // color or to restore the previous frame to reach the next one).
-    m_previousImage = m_images[0].get();
-    m_currentImage = m_images[1].get();
-    m_nextImage = m_images[2].get();
-
-    auto frame_beg = m_fop->roi().selectedFrames().begin();
-    auto frame_end = m_fop->roi().selectedFrames().end();
-    auto frame_it = frame_beg;
-
     // In this code "gifFrame" will be the GIF frame, and "frame" will
     // be the doc::Sprite frame.
-    gifframe_t nframes = totalFrames();
-    for (gifframe_t gifFrame=0; gifFrame<nframes; ++gifFrame) {
-      ASSERT(frame_it != frame_end);
-      frame_t frame = *frame_it;
-      ++frame_it;
-
-      if (gifFrame == 0)
-        renderFrame(frame, m_nextImage);
-      else
-        std::swap(m_previousImage, m_currentImage);
-
-      // Render next frame
-      std::swap(m_currentImage, m_nextImage);
-      if (gifFrame+1 < nframes)
-        renderFrame(*frame_it, m_nextImage);
-
-      gfx::Rect frameBounds;
-      DisposalMethod disposal;
-      calculateBestDisposalMethod(gifFrame, frameBounds, disposal);
-
-      // TODO We could join both frames in a longer one (with more duration)
-      if (frameBounds.isEmpty())
-        frameBounds = gfx::Rect(0, 0, 1, 1);
-
-      writeImage(gifFrame, frame, frameBounds, disposal);
-
-      // Dispose/clear frame content
-      process_disposal_method(m_previousImage,
-                              m_currentImage,
-                              disposal,
-                              frameBounds,
-                              m_clearColor);
-
-      m_fop->setProgress(double(gifFrame+1) / double(nframes));
+    const gifframe_t nframes = totalFrames();
+    std::vector<frame_t> frames;
+    frames.reserve(nframes);
+    for (frame_t frame : m_fop->roi().selectedFrames())
+      frames.push_back(frame);
+    ASSERT(int(frames.size()) == nframes);
+
+    // Frames are encoded in batches. The frames of each batch are
+    // rendered, quantized and mapped to indexes in parallel. The
+    // bounds/disposal method of each frame depends on the previous
+    // frame, and the LZW compression must write frames in order, so
+    // these two steps are serial (and fast compared with the others).
+    const int batchSize = std::max(2, 2*doc::ThreadPool::instance()->concurrency());
+
+    // Rendered frames, only the ones of the current batch (and the
+    // first one of the next batch) are alive at the same time.
+    std::vector<ImageRef> rendered(nframes);
+    gifframe_t renderedEnd = 0;
+
+    // Previous frame (after its disposal method) used to decide the
+    // best disposal method (e.g. if it's more convenient to restore
+    // the background color or to restore the previous frame to reach
+    // the next one).
+    ImageRef previous;
+
+    for (gifframe_t batchBegin=0; batchBegin<nframes; batchBegin+=batchSize) {
+      const gifframe_t batchEnd = std::min(batchBegin+batchSize, nframes);
+
+      // Render frames (the next frame of the last one in the batch is
+      // needed to calculate its bounds)
+      const gifframe_t renderEnd = std::min(batchEnd+1, nframes);
+      for (gifframe_t i=renderedEnd; i<renderEnd; ++i)
+        rendered[i] = acquireImage();
+
+      doc::parallel_for(
+        renderedEnd, renderEnd, 1,
+        [this, &frames, &rendered](int from, int to) {
+          for (int i=from; i<to; ++i)
+            renderFrame(frames[i], rendered[i].get());
+        });
+      renderedEnd = renderEnd;
+
+      // Calculate bounds and disposal method of each frame
+      std::vector<FrameData> batch(batchEnd-batchBegin);
+      for (gifframe_t gifFrame=batchBegin; gifFrame<batchEnd; ++gifFrame) {
+        FrameData& data = batch[gifFrame-batchBegin];
+        data.gifFrame = gifFrame;
+        data.frame = frames[gifFrame];
+
+        m_previousImage = previous.get();
+        m_currentImage = rendered[gifFrame].get();
+        m_nextImage = (gifFrame+1 < nframes ? rendered[gifFrame+1].get(): nullptr);
+
+        calculateBestDisposalMethod(gifFrame, data.bounds, data.disposal);
+
+        // TODO We could join both frames in a longer one (with more duration)
+        if (data.bounds.isEmpty())
+          data.bounds = gfx::Rect(0, 0, 1, 1);
+
+        // Keep the pixels to encode before the disposal method
+        // modifies the current image.
+        data.rgbImage.reset(crop_image(m_currentImage, data.bounds, 0));
+
+        // Dispose/clear frame content
+        process_disposal_method(m_previousImage,
+                                m_currentImage,
+                                data.disposal,
+                                data.bounds,
+                                m_clearColor);
+
+        if (previous)
+          releaseImage(previous);
+        previous = rendered[gifFrame];
+        rendered[gifFrame].reset();
+      }
+      m_previousImage = m_currentImage = m_nextImage = nullptr;
+
+      // Quantize colors and map pixels to indexes
+      doc::parallel_for(
+        0, int(batch.size()), 1,
+        [this, &batch](int from, int to) {
+          for (int i=from; i<to; ++i)
+            prepareFrame(batch[i]);
+        });
+
+      for (const FrameData& data : batch) {
+        writeFrame(data);
+        m_fop->setProgress(double(data.gifFrame+1) / double(nframes));
+      }
     }
     return true;
   }
@@ -1050,7 +1017,8 @@ private:
       // Special case were it's better to restore the previous frame
       // when we dispose the current one than clearing with the bg
       // color.
-      if (m_hasBackground && !prev.isEmpty()) {
+      if (m_hasBackground && !prev.isEmpty() &&
+          gifFrame+1 < totalFrames()) {
         gfx::Rect prevNext = calculateFrameBounds(m_previousImage, m_nextImage);
         if (!prevNext.isEmpty() &&
             frameBounds.contains(prevNext) &&
@@ -1066,35 +1034,35 @@ private:
     }
   }
 
-  void writeImage(gifframe_t gifFrame, frame_t frame, const gfx::Rect& frameBounds, DisposalMethod disposal) {
+  // Converts the RGB pixels of the frame to the indexes that will be
+  // written in the GIF file (creating a local colormap if needed).
+  // Called from worker threads, so it cannot modify the encoder.
+  void prepareFrame(FrameData& data) const {
+    const gfx::Rect& frameBounds = data.bounds;
+    const Image* rgbImage = data.rgbImage.get();
     UniquePtr<Palette> framePaletteRef;
     UniquePtr<RgbMap> rgbmapRef;
-    Palette* framePalette = m_sprite->palette(frame);
-    RgbMap* rgbmap = m_sprite->rgbMap(frame);
+    const Palette* framePalette = m_sprite->palette(data.frame);
+    const RgbMap* rgbmap = m_globalRgbMap.get();
 
     // Create optimized palette for RGB/Grayscale images
     if (m_quantizeColormaps) {
-      framePaletteRef.reset(createOptimizedPalette(frameBounds));
+      framePaletteRef.reset(createOptimizedPalette(rgbImage));
       framePalette = framePaletteRef.get();
 
       rgbmapRef.reset(new RgbMap);
+      rgbmapRef->regenerate(framePalette, m_transparentIndex);
       rgbmap = rgbmapRef.get();
-      rgbmap->regenerate(framePalette, m_transparentIndex);
     }
 
     // We will store the frameBounds pixels in frameImage, with the
     // indexes that must be stored in the GIF file for this specific
     // frame.
-    if (!m_frameImageBuf)
-      m_frameImageBuf.reset(new ImageBuffer);
-
     ImageRef frameImage(Image::create(IMAGE_INDEXED,
                                       frameBounds.w,
-                                      frameBounds.h,
-                                      m_frameImageBuf));
+                                      frameBounds.h));
 
-    // Convert the frameBounds area of m_currentImage (RGB) to frameImage (Indexed)
-    // bool needsTransparent = false;
+    // Convert the RGB pixels to frameImage (Indexed)
     PalettePicks usedColors(framePalette->size());
 
     // If the sprite needs a transparent color we mark it as used so
@@ -1108,8 +1076,27 @@ private:
       usedColors[i] = true;
     }
 
-    {
-      LockImageBits<RgbTraits> bits(m_currentImage, frameBounds);
+    if (m_quantizeColormaps &&
+        render::ErrorDiffusionDither::isSupported(m_dithering)) {
+      render::ErrorDiffusionDither dither(
+        m_dithering, m_transparentIndex,
+        128,                    // Same alpha threshold as below
+        true);                  // GIF colors are opaque
+      dither.ditherRgbImageToIndexed(rgbImage, frameImage.get(),
+                                     rgbmap, framePalette);
+
+      for (int y=0; y<frameBounds.h; ++y) {
+        auto addr = (IndexedTraits::const_address_t)frameImage->getPixelConstAddress(0, y);
+        for (int x=0; x<frameBounds.w; ++x, ++addr) {
+          int i = *addr;
+          if (i >= usedColors.size())
+            usedColors.resize(i+1);
+          usedColors[i] = true;
+        }
+      }
+    }
+    else {
+      LockImageBits<RgbTraits> bits(rgbImage);
       auto it = bits.begin();
       for (int y=0; y<frameBounds.h; ++y) {
         for (int x=0; x<frameBounds.w; ++x, ++it) {
@@ -1160,8 +1147,7 @@ private:
       remap.map(i, i);
 
     int localTransparent = m_transparentIndex;
-    ColorMapObject* colormap = m_globalColormap;
-    if (!colormap) {
+    if (!m_globalColormap) {
       Palette reducedPalette(0, usedNColors);
 
       for (int i=0, j=0; i<framePalette->size(); ++i) {
@@ -1172,7 +1158,7 @@ private:
         }
       }
 
-      colormap = createColorMap(&reducedPalette);
+      data.colormap.reset(createColorMap(&reducedPalette), GifFreeMapObject);
       if (localTransparent >= 0)
         localTransparent = remap[localTransparent];
     }
@@ -1180,20 +1166,35 @@ private:
     if (localTransparent >= 0 && m_transparentIndex != localTransparent)
       remap.map(m_transparentIndex, localTransparent);
 
+    // Remap the pixels to the final colormap indexes
+    for (int y=0; y<frameBounds.h; ++y) {
+      auto addr = (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
+      for (int x=0; x<frameBounds.w; ++x, ++addr)
+        *addr = remap[*addr];
+    }
+
+    data.indexedImage = frameImage;
+    data.localTransparent = localTransparent;
+    data.rgbImage.reset();
+  }
+
+  // Writes the frame prepared with prepareFrame() in the GIF file.
+  void writeFrame(const FrameData& data) {
+    const gfx::Rect& frameBounds = data.bounds;
+    const Image* frameImage = data.indexedImage.get();
+
     // Write extension record.
-    writeExtension(gifFrame, frame, localTransparent, disposal);
+    writeExtension(data.gifFrame, data.frame, data.localTransparent, data.disposal);
 
     // Write the image record.
     if (EGifPutImageDesc(m_gifFile,
                          frameBounds.x, frameBounds.y,
                          frameBounds.w, frameBounds.h,
                          m_interlaced ? 1: 0,
-                         (colormap != m_globalColormap ? colormap: nullptr)) == GIF_ERROR) {
-      throw Exception("Error writing GIF frame %d.\n", gifFrame);
+                         data.colormap.get()) == GIF_ERROR) {
+      throw Exception("Error writing GIF frame %d.\n", data.gifFrame);
     }
 
-    std::vector<uint8_t> scanline(frameBounds.w);
-
     // Write the image data (pixels).
     if (m_interlaced) {
       // Need to perform 4 passes on the images.
@@ -1202,11 +1203,8 @@ private:
           IndexedTraits::address_t addr =
             (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
 
-          for (int i=0; i<frameBounds.w; ++i, ++addr)
-            scanline[i] = remap[*addr];
-
-          if (EGifPutLine(m_gifFile, &scanline[0], frameBounds.w) == GIF_ERROR)
-            throw Exception("Error writing GIF image scanlines for frame %d.\n", gifFrame);
+          if (EGifPutLine(m_gifFile, addr, frameBounds.w) == GIF_ERROR)
+            throw Exception("Error writing GIF image scanlines for frame %d.\n", data.gifFrame);
         }
     }
     else {
@@ -1215,23 +1213,17 @@ private:
         IndexedTraits::address_t addr =
           (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
 
-        for (int i=0; i<frameBounds.w; ++i, ++addr)
-          scanline[i] = remap[*addr];
-
-        if (EGifPutLine(m_gifFile, &scanline[0], frameBounds.w) == GIF_ERROR)
-          throw Exception("Error writing GIF image scanlines for frame %d.\n", gifFrame);
+        if (EGifPutLine(m_gifFile, addr, frameBounds.w) == GIF_ERROR)
+          throw Exception("Error writing GIF image scanlines for frame %d.\n", data.gifFrame);
       }
     }
-
-    if (colormap && colormap != m_globalColormap)
-      GifFreeMapObject(colormap);
   }
 
-  Palette* createOptimizedPalette(const gfx::Rect& frameBounds) {
+  Palette* createOptimizedPalette(const Image* image) const {
     render::PaletteOptimizer optimizer;
 
-    // Feed the palette optimizer with pixels inside frameBounds
-    for (const auto& color : LockImageBits<RgbTraits>(m_currentImage, frameBounds)) {
+    // Feed the palette optimizer with pixels of the frame
+    for (const auto& color : LockImageBits<RgbTraits>(image)) {
       if (rgba_geta(color) >= 128)
         optimizer.feedWithRgbaColor(
           rgba(rgba_getr(color),
@@ -1244,13 +1236,32 @@ private:
     return palette;
   }
 
-  void renderFrame(frame_t frame, Image* dst) {
+  void renderFrame(frame_t frame, Image* dst) const {
     render::Render render;
     render.setBgType(render::BgType::NONE);
     clear_image(dst, m_clearColor);
     render.renderSprite(dst, m_sprite, frame);
   }
 
+  ImageRef acquireImage() {
+    ImageRef image;
+    if (!m_freeImages.empty()) {
+      image = m_freeImages.back();
+      m_freeImages.pop_back();
+    }
+    else {
+      image.reset(Image::create(IMAGE_RGB,
+                                m_spriteBounds.w,
+                                m_spriteBounds.h));
+    }
+    return image;
+  }
+
+  void releaseImage(ImageRef& image) {
+    m_freeImages.push_back(image);
+    image.reset();
+  }
+
 private:
 
   static ColorMapObject* createColorMap(const Palette* palette) {
@@ -1285,8 +1296,9 @@ private:
   bool m_quantizeColormaps;
   bool m_interlaced;
   int m_loop;
-  ImageBufferPtr m_frameImageBuf;
-  ImageRef m_images[3];
+  DitheringMethod m_dithering;
+  UniquePtr<RgbMap> m_globalRgbMap;
+  std::vector<ImageRef> m_freeImages;
   Image* m_previousImage;
   Image* m_currentImage;
   Image* m_nextImage;
@@ -1330,21 +1342,36 @@ base::SharedPtr<FormatOptions> GifFormat::onGetFormatOptions(FileOp* fop)
     // Configuration parameters
     gif_options->setInterlaced(get_config_bool("GIF", "Interlaced", gif_options->interlaced()));
     gif_options->setLoop(get_config_bool("GIF", "Loop", gif_options->loop()));
+    gif_options->setDithering(
+      dithering_from_string(
+        get_config_string("GIF", "Dithering",
+                          dithering_to_string(gif_options->dithering()).c_str())));
 
     // Load the window to ask to the user the GIF options he wants.
 
     app::gen::GifOptions win;
     win.interlaced()->setSelected(gif_options->interlaced());
     win.loop()->setSelected(gif_options->loop());
+    win.dithering()->setSelectedItemIndex(
+      win.dithering()->findItemIndexByValue(
+        dithering_to_string(gif_options->dithering())));
+
+    // Dithering is only used when the frames are quantized
+    win.ditheringContainer()->setVisible(
+      needs_quantized_colormaps(fop->document()->sprite()));
 
     win.openWindowInForeground();
 
     if (win.closer() == win.ok()) {
       gif_options->setInterlaced(win.interlaced()->isSelected());
       gif_options->setLoop(win.loop()->isSelected());
+      gif_options->setDithering(
+        dithering_from_string(win.dithering()->getValue()));
 
       set_config_bool("GIF", "Interlaced", gif_options->interlaced());
       set_config_bool("GIF", "Loop", gif_options->loop());
+      set_config_string("GIF", "Dithering",
+                        dithering_to_string(gif_options->dithering()).c_str());
     }
     else {
       gif_options.reset(NULL);
@@ -18,20 +18,26 @@ namespace app {
   public:
     GifOptions(
       bool interlaced = false,
-      bool loop = true)
+      bool loop = true,
+      doc::DitheringMethod dithering = doc::DitheringMethod::NONE)
       : m_interlaced(interlaced)
-      , m_loop(loop) {
+      , m_loop(loop)
+      , m_dithering(dithering) {
     }
 
     bool interlaced() const { return m_interlaced; }
     bool loop() const { return m_loop; }
+    // Dithering used to reduce RGB frames to 256 colors
+    doc::DitheringMethod dithering() const { return m_dithering; }
 
     void setInterlaced(bool interlaced) { m_interlaced = interlaced; }
     void setLoop(bool loop) { m_loop = loop; }
+    void setDithering(doc::DitheringMethod dithering) { m_dithering = dithering; }
 
   private:
     bool m_interlaced;
     bool m_loop;
+    doc::DitheringMethod m_dithering;
   };
 
 } // namespace app
@@ -299,11 +299,11 @@ bool JpegFormat::onSave(FileOp* fop)
   while (cinfo.next_scanline < cinfo.image_height) {
     // RGB
     if (image->pixelFormat() == IMAGE_RGB) {
-      uint32_t* src_address;
+      const uint32_t* src_address;
       uint8_t* dst_address;
       int x, y;
       for (y=0; y<(int)buffer_height; y++) {
-        src_address = (uint32_t*)image->getPixelAddress(0, cinfo.next_scanline+y);
+        src_address = (const uint32_t*)image->getPixelConstAddress(0, cinfo.next_scanline+y);
         dst_address = ((uint8_t**)buffer)[y];
 
         for (x=0; x<image->width(); ++x) {
@@ -316,11 +316,11 @@ bool JpegFormat::onSave(FileOp* fop)
     }
     // Grayscale.
     else {
-      uint16_t* src_address;
+      const uint16_t* src_address;
       uint8_t* dst_address;
       int x, y;
       for (y=0; y<(int)buffer_height; y++) {
-        src_address = (uint16_t*)image->getPixelAddress(0, cinfo.next_scanline+y);
+        src_address = (const uint16_t*)image->getPixelConstAddress(0, cinfo.next_scanline+y);
         dst_address = ((uint8_t**)buffer)[y];
         for (x=0; x<image->width(); ++x)
           *(dst_address++) = graya_getv(*(src_address++));
@@ -478,7 +478,7 @@ bool PngFormat::onSave(FileOp* fop)
     for (y = 0; y < height; y++) {
       /* RGB_ALPHA */
       if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_RGB_ALPHA) {
-        uint32_t* src_address = (uint32_t*)image->getPixelAddress(0, y);
+        const uint32_t* src_address = (const uint32_t*)image->getPixelConstAddress(0, y);
         uint8_t* dst_address = row_pointer;
         unsigned int x, c;
 
@@ -492,7 +492,7 @@ bool PngFormat::onSave(FileOp* fop)
       }
       /* RGB */
       else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_RGB) {
-        uint32_t* src_address = (uint32_t*)image->getPixelAddress(0, y);
+        const uint32_t* src_address = (const uint32_t*)image->getPixelConstAddress(0, y);
         uint8_t* dst_address = row_pointer;
         unsigned int x, c;
 
@@ -505,7 +505,7 @@ bool PngFormat::onSave(FileOp* fop)
       }
       /* GRAY_ALPHA */
       else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_GRAY_ALPHA) {
-        uint16_t* src_address = (uint16_t*)image->getPixelAddress(0, y);
+        const uint16_t* src_address = (const uint16_t*)image->getPixelConstAddress(0, y);
         uint8_t* dst_address = row_pointer;
         unsigned int x, c;
 
@@ -517,7 +517,7 @@ bool PngFormat::onSave(FileOp* fop)
       }
       /* GRAY */
       else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_GRAY) {
-        uint16_t* src_address = (uint16_t*)image->getPixelAddress(0, y);
+        const uint16_t* src_address = (const uint16_t*)image->getPixelConstAddress(0, y);
         uint8_t* dst_address = row_pointer;
         unsigned int x, c;
 
@@ -528,7 +528,7 @@ bool PngFormat::onSave(FileOp* fop)
       }
       /* PALETTE */
       else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE) {
-        uint8_t* src_address = (uint8_t*)image->getPixelAddress(0, y);
+        const uint8_t* src_address = image->getPixelConstAddress(0, y);
         uint8_t* dst_address = row_pointer;
         unsigned int x;
 
@@ -294,7 +294,7 @@ bool WebPFormat::onSave(FileOp* fop)
 
   ScopedWebPPicture scopedPic(pic); // Calls WebPPictureFree automatically
 
-  if (!WebPPictureImportRGBA(&pic, (uint8_t*)image->getPixelAddress(0, 0), image->width() * sizeof(uint32_t))) {
+  if (!WebPPictureImportRGBA(&pic, image->getPixelConstAddress(0, 0), image->width() * sizeof(uint32_t))) {
     fop->setError("Error converting RGBA data into a WebP picture\n");
     return false;
   }
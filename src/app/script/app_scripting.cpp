@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -18,6 +18,7 @@
 #include "app/script/selection_class.h"
 #include "app/script/sprite_class.h"
 #include "app/script/sprite_wrap.h"
+#include "script/profiler.h"
 
 namespace app {
 
@@ -32,8 +33,9 @@ const script::ConstantEntry ColorMode_constants[] = {
 
 }
 
-AppScripting::AppScripting(script::EngineDelegate* delegate)
-  : script::Engine(delegate)
+AppScripting::AppScripting(script::EngineDelegate* delegate,
+                           script::Profiler* profiler)
+  : script::Engine(delegate, profiler)
 {
   auto& ctx = context();
   register_app_object(ctx);
@@ -73,6 +75,9 @@ void AppScripting::onAfterEval(bool err)
 {
   // Commit all transactions
   if (!err) {
+    script::ProfilerScope scope(profiler(),
+                                script::Profiler::Category::Section,
+                                "commit");
     for (auto& it : m_sprites)
       it.second->commit();
   }
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -30,7 +30,8 @@ namespace app {
     typedef std::map<doc::ObjectId, SpriteWrap*> Sprites;
 
   public:
-    AppScripting(script::EngineDelegate* delegate);
+    AppScripting(script::EngineDelegate* delegate,
+                 script::Profiler* profiler = nullptr);
 
     SpriteWrap* wrapSprite(app::Document* doc);
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2015-2016  David Capello
+// Copyright (C) 2015-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -11,12 +11,91 @@
 #include "app/script/image_class.h"
 
 #include "app/script/image_wrap.h"
+#include "app/script/sprite_wrap.h"
+#include "base/base.h"
 #include "doc/image.h"
+#include "doc/image_impl.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "doc/primitives_fast.h"
+#include "doc/sprite.h"
+#include "render/render.h"
+#include "script/engine.h"
+
+#include <algorithm>
+#include <cstring>
 
 namespace app {
 
 namespace {
 
+// Returns the rectangle specified in the "i" to "i+3" arguments
+// (x, y, width, height) clipped to the image bounds, or the whole
+// image if the arguments are undefined.
+gfx::Rect get_rect_args(script::Context& ctx, script::index_t i,
+                        const doc::Image* image)
+{
+  gfx::Rect rc = image->bounds();
+  if (!ctx.isUndefined(i)) {
+    rc.x = ctx.requireInt(i);
+    rc.y = ctx.requireInt(i+1);
+    rc.w = ctx.requireInt(i+2);
+    rc.h = ctx.requireInt(i+3);
+    rc &= image->bounds();
+  }
+  return rc;
+}
+
+script::ArrayType array_type_for_image(const doc::Image* image)
+{
+  switch (image->pixelFormat()) {
+    case doc::IMAGE_RGB: return script::ArrayType::Uint32;
+    case doc::IMAGE_GRAYSCALE: return script::ArrayType::Uint16;
+    default: return script::ArrayType::Uint8;
+  }
+}
+
+// Copies the pixels of the "rc" area to/from a buffer of pixels
+// (one element for each pixel, row by row, "bufRowSize" bytes per
+// row). The buffer of a script array doesn't need to be aligned to
+// the pixel size, so rows are copied with memcpy().
+template<typename ImageTraits>
+void copy_pixels_to_buffer(const doc::Image* image, const gfx::Rect& rc,
+                           uint8_t* buf, std::size_t bufRowSize)
+{
+  const std::size_t rowSize = rc.w * sizeof(typename ImageTraits::pixel_t);
+  for (int y=rc.y; y<rc.y2(); ++y, buf+=bufRowSize)
+    std::memcpy(buf,
+                doc::get_pixel_const_address_fast<ImageTraits>(image, rc.x, y),
+                rowSize);
+}
+
+template<typename ImageTraits>
+void copy_pixels_from_buffer(doc::Image* image, const gfx::Rect& rc,
+                             const uint8_t* buf, std::size_t bufRowSize)
+{
+  const std::size_t rowSize = rc.w * sizeof(typename ImageTraits::pixel_t);
+  for (int y=rc.y; y<rc.y2(); ++y, buf+=bufRowSize)
+    std::memcpy(doc::get_pixel_address_fast<ImageTraits>(image, rc.x, y),
+                buf, rowSize);
+}
+
+void copy_bitmap_to_buffer(const doc::Image* image, const gfx::Rect& rc,
+                           uint8_t* buf, std::size_t bufRowSize)
+{
+  for (int y=rc.y; y<rc.y2(); ++y, buf+=bufRowSize)
+    for (int x=rc.x; x<rc.x2(); ++x)
+      buf[x-rc.x] = uint8_t(doc::get_pixel_fast<doc::BitmapTraits>(image, x, y));
+}
+
+void copy_bitmap_from_buffer(doc::Image* image, const gfx::Rect& rc,
+                             const uint8_t* buf, std::size_t bufRowSize)
+{
+  for (int y=rc.y; y<rc.y2(); ++y, buf+=bufRowSize)
+    for (int x=rc.x; x<rc.x2(); ++x)
+      doc::put_pixel_fast<doc::BitmapTraits>(image, x, y, buf[x-rc.x] ? 1: 0);
+}
+
 script::result_t Image_ctor(script::ContextHandle handle)
 {
   return 0;
@@ -30,8 +109,8 @@ script::result_t Image_putPixel(script::ContextHandle handle)
   doc::color_t color = ctx.requireUInt(2);
 
   auto wrap = (ImageWrap*)ctx.getThis();
-  if (wrap) {
-    wrap->modifyRegion(gfx::Region(gfx::Rect(x, y, 1, 1)));
+  if (wrap && wrap->image()->bounds().contains(gfx::Point(x, y))) {
+    wrap->modifyRect(gfx::Rect(x, y, 1, 1));
     wrap->image()->putPixel(x, y, color);
   }
 
@@ -46,7 +125,9 @@ script::result_t Image_getPixel(script::ContextHandle handle)
 
   auto wrap = (ImageWrap*)ctx.getThis();
   if (wrap) {
-    doc::color_t color = wrap->image()->getPixel(x, y);
+    doc::color_t color = 0;
+    if (wrap->image()->bounds().contains(gfx::Point(x, y)))
+      color = wrap->image()->getPixel(x, y);
     ctx.pushUInt(color);
     return 1;
   }
@@ -54,6 +135,202 @@ script::result_t Image_getPixel(script::ContextHandle handle)
     return 0;
 }
 
+// image.getPixels([x, y, width, height]) returns a typed array with
+// the pixels of the given area (Uint32Array for RGB images,
+// Uint16Array for grayscale, and Uint8Array for indexed images).
+script::result_t Image_getPixels(script::ContextHandle handle)
+{
+  script::Context ctx(handle);
+  auto wrap = (ImageWrap*)ctx.getThis();
+  if (!wrap)
+    return 0;
+
+  const doc::Image* image = wrap->image();
+  const gfx::Rect rc = get_rect_args(ctx, 0, image);
+  const std::size_t n = (rc.isEmpty() ? 0: std::size_t(rc.w) * rc.h);
+  auto buf = (uint8_t*)ctx.pushTypedArray(array_type_for_image(image), n);
+  if (n == 0)
+    return 1;
+
+  const std::size_t bufRowSize = std::size_t(rc.w) * image->getRowStrideSize(1);
+  switch (image->pixelFormat()) {
+    case doc::IMAGE_RGB:
+      copy_pixels_to_buffer<doc::RgbTraits>(image, rc, buf, bufRowSize);
+      break;
+    case doc::IMAGE_GRAYSCALE:
+      copy_pixels_to_buffer<doc::GrayscaleTraits>(image, rc, buf, bufRowSize);
+      break;
+    case doc::IMAGE_INDEXED:
+      copy_pixels_to_buffer<doc::IndexedTraits>(image, rc, buf, bufRowSize);
+      break;
+    case doc::IMAGE_BITMAP:
+      copy_bitmap_to_buffer(image, rc, buf, bufRowSize);
+      break;
+  }
+  return 1;
+}
+
+// image.putPixels(array, [x, y, width, height]) replaces the pixels
+// of the given area with the pixels of the array (in the same format
+// returned by getPixels()). The array can be smaller than the area,
+// in that case only its first rows are copied. Pixels of the area
+// outside the image are skipped.
+script::result_t Image_putPixels(script::ContextHandle handle)
+{
+  script::Context ctx(handle);
+  std::size_t size = 0;
+  auto buf = (const uint8_t*)ctx.requireBuffer(0, &size);
+
+  auto wrap = (ImageWrap*)ctx.getThis();
+  if (!wrap)
+    return 0;
+
+  doc::Image* image = wrap->image();
+  gfx::Rect area = image->bounds();
+  if (!ctx.isUndefined(1)) {
+    area = gfx::Rect(ctx.requireInt(1), ctx.requireInt(2),
+                     ctx.requireInt(3), ctx.requireInt(4));
+  }
+  if (area.isEmpty())
+    return 0;
+
+  // Only whole rows of the given area are copied
+  const int bpp = image->getRowStrideSize(1);
+  const std::size_t bufRowSize = std::size_t(area.w) * bpp;
+  area.h = int(std::min<std::size_t>(area.h, size / bufRowSize));
+
+  const gfx::Rect rc = area.createIntersection(image->bounds());
+  if (rc.isEmpty())
+    return 0;
+
+  // Skip the rows/columns of the buffer outside the image
+  buf += (rc.y-area.y) * bufRowSize + (rc.x-area.x) * bpp;
+
+  wrap->modifyRect(rc);
+
+  switch (image->pixelFormat()) {
+    case doc::IMAGE_RGB:
+      copy_pixels_from_buffer<doc::RgbTraits>(image, rc, buf, bufRowSize);
+      break;
+    case doc::IMAGE_GRAYSCALE:
+      copy_pixels_from_buffer<doc::GrayscaleTraits>(image, rc, buf, bufRowSize);
+      break;
+    case doc::IMAGE_INDEXED:
+      copy_pixels_from_buffer<doc::IndexedTraits>(image, rc, buf, bufRowSize);
+      break;
+    case doc::IMAGE_BITMAP:
+      copy_bitmap_from_buffer(image, rc, buf, bufRowSize);
+      break;
+  }
+  return 0;
+}
+
+// image.fill(color, [x, y, width, height])
+script::result_t Image_fill(script::ContextHandle handle)
+{
+  script::Context ctx(handle);
+  doc::color_t color = ctx.requireUInt(0);
+
+  auto wrap = (ImageWrap*)ctx.getThis();
+  if (wrap) {
+    const gfx::Rect rc = get_rect_args(ctx, 1, wrap->image());
+    if (!rc.isEmpty()) {
+      wrap->modifyRect(rc);
+      doc::fill_rect(wrap->image(), rc, color);
+    }
+  }
+  return 0;
+}
+
+// image.clear([color]) fills the whole image with the given color
+// (or the transparent color).
+script::result_t Image_clear(script::ContextHandle handle)
+{
+  script::Context ctx(handle);
+
+  auto wrap = (ImageWrap*)ctx.getThis();
+  if (wrap) {
+    doc::Image* image = wrap->image();
+    doc::color_t color = (ctx.isUndefined(0) ? image->maskColor():
+                                               ctx.requireUInt(0));
+    wrap->modifyRect(image->bounds());
+    doc::clear_image(image, color);
+  }
+  return 0;
+}
+
+// Returns the area of "dst" that is modified when "src" is drawn in
+// the "x", "y" position.
+gfx::Rect get_draw_bounds(const doc::Image* dst, const doc::Image* src,
+                          int x, int y)
+{
+  return dst->bounds().createIntersection(
+    gfx::Rect(x, y, src->width(), src->height()));
+}
+
+// image.blit(srcImage, x, y) copies the pixels of srcImage (with the
+// same color mode) in the given position (transparent pixels are
+// copied too).
+script::result_t Image_blit(script::ContextHandle handle)
+{
+  script::Context ctx(handle);
+  auto srcWrap = (ImageWrap*)ctx.requireObject(0, "Image");
+  int x = ctx.requireInt(1);
+  int y = ctx.requireInt(2);
+
+  auto wrap = (ImageWrap*)ctx.getThis();
+  if (wrap && srcWrap &&
+      wrap->image()->pixelFormat() == srcWrap->image()->pixelFormat()) {
+    doc::Image* dst = wrap->image();
+    const gfx::Rect rc = get_draw_bounds(dst, srcWrap->image(), x, y);
+    if (!rc.isEmpty()) {
+      // Copy the source image if we are blitting an image in itself
+      doc::ImageRef tmp;
+      const doc::Image* src = srcWrap->image();
+      if (src == dst) {
+        tmp.reset(doc::Image::createCopy(src));
+        src = tmp.get();
+      }
+
+      wrap->modifyRect(rc);
+      doc::copy_image(dst, src, x, y);
+    }
+  }
+  return 0;
+}
+
+// image.drawImage(srcImage, x, y, [opacity]) composites srcImage in
+// the given position (transparent pixels are skipped).
+script::result_t Image_drawImage(script::ContextHandle handle)
+{
+  script::Context ctx(handle);
+  auto srcWrap = (ImageWrap*)ctx.requireObject(0, "Image");
+  int x = ctx.requireInt(1);
+  int y = ctx.requireInt(2);
+  int opacity = (ctx.isUndefined(3) ? 255: ctx.requireInt(3));
+
+  auto wrap = (ImageWrap*)ctx.getThis();
+  if (wrap && srcWrap) {
+    doc::Image* dst = wrap->image();
+    const gfx::Rect rc = get_draw_bounds(dst, srcWrap->image(), x, y);
+    if (!rc.isEmpty()) {
+      doc::ImageRef tmp;
+      const doc::Image* src = srcWrap->image();
+      if (src == dst) {
+        tmp.reset(doc::Image::createCopy(src));
+        src = tmp.get();
+      }
+
+      wrap->modifyRect(rc);
+      render::composite_image(
+        dst, src,
+        wrap->sprite()->sprite()->palette(wrap->frame()),
+        x, y, MID(0, opacity, 255), doc::BlendMode::NORMAL);
+    }
+  }
+  return 0;
+}
+
 script::result_t Image_get_width(script::ContextHandle handle)
 {
   script::Context ctx(handle);
@@ -81,6 +358,12 @@ script::result_t Image_get_height(script::ContextHandle handle)
 const script::FunctionEntry Image_methods[] = {
   { "getPixel", Image_getPixel, 2 },
   { "putPixel", Image_putPixel, 3 },
+  { "getPixels", Image_getPixels, 4 },
+  { "putPixels", Image_putPixels, 5 },
+  { "fill", Image_fill, 5 },
+  { "clear", Image_clear, 1 },
+  { "blit", Image_blit, 3 },
+  { "drawImage", Image_drawImage, 4 },
   { nullptr, nullptr, 0 }
 };
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2016  David Capello
+// Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -17,9 +17,10 @@
 
 namespace app {
 
-ImageWrap::ImageWrap(SpriteWrap* sprite, doc::Image* img)
+ImageWrap::ImageWrap(SpriteWrap* sprite, doc::Image* img, doc::frame_t frame)
   : m_sprite(sprite)
   , m_image(img)
+  , m_frame(frame)
   , m_backup(nullptr)
 {
 }
@@ -30,6 +31,7 @@ ImageWrap::~ImageWrap()
 
 void ImageWrap::commit()
 {
+  flushModifiedRect();
   if (m_modifiedRegion.isEmpty())
     return;
 
@@ -52,4 +54,36 @@ void ImageWrap::modifyRegion(const gfx::Region& rgn)
   m_modifiedRegion |= rgn;
 }
 
+void ImageWrap::modifyRect(const gfx::Rect& rc)
+{
+  if (rc.isEmpty())
+    return;
+
+  if (!m_backup)
+    m_backup.reset(doc::Image::createCopy(m_image));
+
+  // Extend the current rectangle if the new one is just at its right
+  if (!m_modifiedRect.isEmpty() &&
+      m_modifiedRect.x2() == rc.x &&
+      m_modifiedRect.y == rc.y &&
+      m_modifiedRect.h == rc.h) {
+    m_modifiedRect.w += rc.w;
+    return;
+  }
+
+  if (m_modifiedRect.contains(rc))
+    return;
+
+  flushModifiedRect();
+  m_modifiedRect = rc;
+}
+
+void ImageWrap::flushModifiedRect()
+{
+  if (!m_modifiedRect.isEmpty()) {
+    m_modifiedRegion |= gfx::Region(m_modifiedRect);
+    m_modifiedRect = gfx::Rect();
+  }
+}
+
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2016  David Capello
+// Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -8,6 +8,7 @@
 #define APP_SCRIPT_IMAGE_WRAP_H_INCLUDED
 #pragma once
 
+#include "doc/frame.h"
 #include "doc/image.h"
 #include "doc/image_ref.h"
 #include "gfx/region.h"
@@ -17,7 +18,7 @@ namespace app {
 
   class ImageWrap {
   public:
-    ImageWrap(SpriteWrap* sprite, doc::Image* img);
+    ImageWrap(SpriteWrap* sprite, doc::Image* img, doc::frame_t frame);
     ~ImageWrap();
 
     void commit();
@@ -25,12 +26,27 @@ namespace app {
     SpriteWrap* sprite() const { return m_sprite; }
     doc::Image* image() const { return m_image; }
 
+    // Frame where the image was found (its palette is used to draw
+    // other images in this one).
+    doc::frame_t frame() const { return m_frame; }
+
     void modifyRegion(const gfx::Region& rgn);
+
+    // Same as modifyRegion() for one rectangle, but consecutive
+    // rectangles in the same row (e.g. when a script calls putPixel()
+    // for each pixel) are joined before they are added to the
+    // modified region.
+    void modifyRect(const gfx::Rect& rc);
+
   private:
+    void flushModifiedRect();
+
     SpriteWrap* m_sprite;
     doc::Image* m_image;
+    doc::frame_t m_frame;
     doc::ImageRef m_backup;
     gfx::Region m_modifiedRegion;
+    gfx::Rect m_modifiedRect;
   };
 
 } // namespace app
@@ -21,12 +21,18 @@
 #include "app/transaction.h"
 #include "app/ui/document_view.h"
 #include "app/ui_context.h"
+#include "doc/cel.h"
+#include "doc/layer.h"
 #include "doc/mask.h"
 #include "doc/palette.h"
+#include "doc/primitives_fast.h"
 #include "doc/site.h"
 #include "doc/sprite.h"
 #include "script/engine.h"
 
+#include <memory>
+#include <vector>
+
 namespace app {
 
 namespace {
@@ -169,6 +175,72 @@ script::result_t Sprite_loadPalette(script::ContextHandle handle)
   return 0;
 }
 
+// Selects the pixels of the given color in each frame of the active
+// layer. Returns an array with one element for each frame, null if
+// nothing is selected in that frame, or an object with the bounds
+// of the selection (x, y, width, height) and its "pixels" (a
+// Uint8Array with 1 for each selected pixel, row by row).
+script::result_t Sprite_selectionsByColor(script::ContextHandle handle)
+{
+  script::Context ctx(handle);
+  doc::color_t color = ctx.requireUInt(0);
+  int tolerance = (ctx.isUndefined(1) ? 0: ctx.requireInt(1));
+
+  auto wrap = (SpriteWrap*)ctx.getThis();
+  if (!wrap)
+    return 0;
+
+  doc::Layer* layer = wrap->activeLayer();
+  if (!layer || !layer->isImage())
+    return 0;
+
+  // Generate the masks of all frames at the same time
+  const doc::frame_t nframes = wrap->sprite()->totalFrames();
+  std::vector<std::unique_ptr<doc::Mask>> masks(nframes);
+  std::vector<const doc::Image*> images;
+  std::vector<doc::Mask*> maskPtrs;
+  for (doc::frame_t frame=0; frame<nframes; ++frame) {
+    const doc::Cel* cel = layer->cel(frame);
+    if (cel) {
+      masks[frame].reset(new doc::Mask);
+      images.push_back(cel->image());
+      maskPtrs.push_back(masks[frame].get());
+    }
+  }
+  doc::masks_by_color(images, maskPtrs, color, tolerance);
+
+  script::index_t array = ctx.pushArray();
+  for (doc::frame_t frame=0; frame<nframes; ++frame) {
+    doc::Mask* mask = masks[frame].get();
+    if (!mask || mask->isEmpty()) {
+      ctx.pushNull();
+      ctx.setPropIndex(array, frame);
+      continue;
+    }
+
+    const doc::Cel* cel = layer->cel(frame);
+    mask->offsetOrigin(cel->x(), cel->y());
+
+    const gfx::Rect bounds = mask->bounds();
+    const doc::Image* bitmap = mask->bitmap();
+    script::index_t obj = ctx.pushObject();
+    ctx.pushNumber(bounds.x); ctx.setProp(obj, "x");
+    ctx.pushNumber(bounds.y); ctx.setProp(obj, "y");
+    ctx.pushNumber(bounds.w); ctx.setProp(obj, "width");
+    ctx.pushNumber(bounds.h); ctx.setProp(obj, "height");
+
+    auto buf = (uint8_t*)ctx.pushTypedArray(script::ArrayType::Uint8,
+                                            bounds.w*bounds.h);
+    for (int y=0; y<bounds.h; ++y)
+      for (int x=0; x<bounds.w; ++x)
+        *(buf++) = uint8_t(doc::get_pixel_fast<doc::BitmapTraits>(bitmap, x, y));
+    ctx.setProp(obj, "pixels");
+
+    ctx.setPropIndex(array, frame);
+  }
+  return 1;
+}
+
 script::result_t Sprite_get_filename(script::ContextHandle handle)
 {
   script::Context ctx(handle);
@@ -243,6 +315,7 @@ const script::FunctionEntry Sprite_methods[] = {
   { "save", Sprite_save, 2 },
   { "saveAs", Sprite_saveAs, 2 },
   { "loadPalette", Sprite_loadPalette, 1 },
+  { "selectionsByColor", Sprite_selectionsByColor, 2 },
   { nullptr, nullptr, 0 }
 };
 
@@ -85,16 +85,29 @@ ImageWrap* SpriteWrap::activeImage()
 
   doc::Site site;
   m_view->getSite(&site);
-  return wrapImage(site.image());
+  return wrapImage(site.image(), site.frame());
 }
 
-ImageWrap* SpriteWrap::wrapImage(doc::Image* img)
+doc::Layer* SpriteWrap::activeLayer()
+{
+  if (!m_view) {
+    m_view = UIContext::instance()->getFirstDocumentView(m_doc);
+    if (!m_view)
+      return nullptr;
+  }
+
+  doc::Site site;
+  m_view->getSite(&site);
+  return site.layer();
+}
+
+ImageWrap* SpriteWrap::wrapImage(doc::Image* img, doc::frame_t frame)
 {
   auto it = m_images.find(img->id());
   if (it != m_images.end())
     return it->second;
   else {
-    auto wrap = new ImageWrap(this, img);
+    auto wrap = new ImageWrap(this, img, frame);
     m_images[img->id()] = wrap;
     return wrap;
   }
@@ -8,12 +8,14 @@
 #define APP_SCRIPT_SPRITE_WRAP_H_INCLUDED
 #pragma once
 
+#include "doc/frame.h"
 #include "doc/object_id.h"
 
 #include <map>
 
 namespace doc {
   class Image;
+  class Layer;
   class Sprite;
 }
 
@@ -37,8 +39,9 @@ namespace app {
     app::Document* document();
     doc::Sprite* sprite();
     ImageWrap* activeImage();
+    doc::Layer* activeLayer();
 
-    ImageWrap* wrapImage(doc::Image* img);
+    ImageWrap* wrapImage(doc::Image* img, doc::frame_t frame);
 
   private:
     app::Document* m_doc;
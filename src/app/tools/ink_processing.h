@@ -8,6 +8,7 @@
 #include "doc/blend_funcs.h"
 #include "doc/image_impl.h"
 #include "doc/layer.h"
+#include "doc/mask_runs.h"
 #include "doc/palette.h"
 #include "doc/remap.h"
 #include "doc/rgbmap.h"
@@ -16,6 +17,8 @@
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
 
+#include <algorithm>
+
 namespace app {
 namespace tools {
 
@@ -32,7 +35,7 @@ template<typename Derived>
 class InkProcessing {
 public:
   void operator()(int x1, int y, int x2, ToolLoop* loop) {
-    int x;
+    Derived* ink = static_cast<Derived*>(this);
 
     // Use mask
     if (loop->useMask()) {
@@ -48,23 +51,38 @@ public:
       if (x2 > maskOrigin.x+maskBounds.w-1)
         x2 = maskOrigin.x+maskBounds.w-1;
 
-      if (Image* bitmap = loop->getMask()->bitmap()) {
-        static_cast<Derived*>(this)->initIterators(loop, x1, y);
+      if (MaskRuns* maskRuns = loop->getMaskRuns()) {
+        // Process only the selected spans of the [x1, x2] segment
+        const MaskRuns::Runs& runs = maskRuns->row(y-maskOrigin.y);
+        const int u1 = x1-maskOrigin.x;
+        const int u2 = x2-maskOrigin.x+1;
 
-        for (x=x1; x<=x2; ++x) {
-          if (bitmap->getPixel(x-maskOrigin.x, y-maskOrigin.y))
-            static_cast<Derived*>(this)->processPixel(x, y);
+        auto it = std::upper_bound(
+          runs.begin(), runs.end(), u1,
+          [](int u, const MaskRuns::Run& run) { return u < run.x2; });
 
-          static_cast<Derived*>(this)->moveIterators();
+        for (; it != runs.end() && it->x1 < u2; ++it) {
+          int a = std::max(it->x1, u1);
+          int b = std::min(it->x2, u2);
+          ink->processSpan(loop, a+maskOrigin.x, y, b-a);
         }
         return;
       }
     }
 
-    static_cast<Derived*>(this)->initIterators(loop, x1, y);
-    for (x=x1; x<=x2; ++x) {
-      static_cast<Derived*>(this)->processPixel(x, y);
-      static_cast<Derived*>(this)->moveIterators();
+    if (x1 <= x2)
+      ink->processSpan(loop, x1, y, x2-x1+1);
+  }
+
+  // Processes the [x, x+w) span of the "y" row. By default it calls
+  // processPixel() for each pixel, inks can hide this member function
+  // with a specific loop for the whole span.
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    Derived* ink = static_cast<Derived*>(this);
+    ink->initIterators(loop, x, y);
+    for (const int x2=x+w; x<x2; ++x) {
+      ink->processPixel(x, y);
+      ink->moveIterators();
     }
   }
 };
@@ -98,6 +116,51 @@ public:
   }
 
 protected:
+  // Span loops for inks where the result of each pixel depends only
+  // on its source pixel value, given by Derived::processColor().
+
+  // Reuses the last result for consecutive equal pixels.
+  void processSpanReusingLastColor(ToolLoop* loop, int x, int y, int w) {
+    Derived* ink = static_cast<Derived*>(this);
+    ink->initIterators(loop, x, y);
+
+    typename ImageTraits::pixel_t prevSrc = 0, prevResult = 0;
+    for (int i=0; i<w; ++i) {
+      const typename ImageTraits::pixel_t c = m_srcAddress[i];
+      if (i == 0 || c != prevSrc) {
+        prevSrc = c;
+        prevResult = ink->processColor(c);
+      }
+      m_dstAddress[i] = prevResult;
+    }
+  }
+
+  // Calls processColor() once for each different index of the span.
+  void processSpanWithColorTable(ToolLoop* loop, int x, int y, int w) {
+    Derived* ink = static_cast<Derived*>(this);
+    ink->initIterators(loop, x, y);
+
+    // It's not worth to initialize the table for a few pixels
+    if (w < 16) {
+      for (int i=0; i<w; ++i)
+        m_dstAddress[i] = ink->processColor(m_srcAddress[i]);
+      return;
+    }
+
+    static_assert(ImageTraits::max_value <= 255, "Invalid traits to use a color table");
+    color_t table[256];
+    bool valid[256];
+    std::fill(valid, valid+256, false);
+    for (int i=0; i<w; ++i) {
+      const typename ImageTraits::pixel_t c = m_srcAddress[i];
+      if (!valid[c]) {
+        table[c] = ink->processColor(c);
+        valid[c] = true;
+      }
+      m_dstAddress[i] = table[c];
+    }
+  }
+
   typename ImageTraits::address_t m_srcAddress;
   typename ImageTraits::address_t m_dstAddress;
 };
@@ -120,8 +183,10 @@ public:
     }
   }
 
-  void processPixel(int x, int y) {
-    *SimpleInkProcessing<CopyInkProcessing<ImageTraits>, ImageTraits>::m_dstAddress = m_color;
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    this->initIterators(loop, x, y);
+    std::fill(this->m_dstAddress, this->m_dstAddress+w,
+              typename ImageTraits::pixel_t(m_color));
   }
 
 private:
@@ -140,8 +205,13 @@ public:
     , m_opacity(loop->getOpacity()) {
   }
 
-  void processPixel(int x, int y) {
-    // Do nothing
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    // Do nothing (it's specialized for each case)
+  }
+
+  color_t processColor(color_t c) {
+    // Do nothing (it's specialized for each case)
+    return c;
   }
 
 private:
@@ -150,21 +220,46 @@ private:
 };
 
 template<>
-void LockAlphaInkProcessing<RgbTraits>::processPixel(int x, int y) {
-  color_t result = rgba_blender_normal(*m_srcAddress, m_color, m_opacity);
-  *m_dstAddress = rgba(
+void LockAlphaInkProcessing<RgbTraits>::processSpan(ToolLoop* loop, int x, int y, int w) {
+  // An opaque color replaces the RGB components of each pixel
+  if (m_opacity == 255 && rgba_geta(m_color) == 255) {
+    initIterators(loop, x, y);
+    const color_t rgb = (m_color & rgba_rgb_mask);
+    for (int i=0; i<w; ++i)
+      m_dstAddress[i] = rgb | (m_srcAddress[i] & rgba_a_mask);
+  }
+  else
+    processSpanReusingLastColor(loop, x, y, w);
+}
+
+template<>
+color_t LockAlphaInkProcessing<RgbTraits>::processColor(color_t c) {
+  color_t result = rgba_blender_normal(c, m_color, m_opacity);
+  return rgba(
     rgba_getr(result),
     rgba_getg(result),
     rgba_getb(result),
-    rgba_geta(*m_srcAddress));
+    rgba_geta(c));
 }
 
 template<>
-void LockAlphaInkProcessing<GrayscaleTraits>::processPixel(int x, int y) {
-  color_t result = graya_blender_normal(*m_srcAddress, m_color, m_opacity);
-  *m_dstAddress = graya(
+void LockAlphaInkProcessing<GrayscaleTraits>::processSpan(ToolLoop* loop, int x, int y, int w) {
+  if (m_opacity == 255 && graya_geta(m_color) == 255) {
+    initIterators(loop, x, y);
+    const color_t v = graya_getv(m_color);
+    for (int i=0; i<w; ++i)
+      m_dstAddress[i] = v | (m_srcAddress[i] & graya_a_mask);
+  }
+  else
+    processSpanReusingLastColor(loop, x, y, w);
+}
+
+template<>
+color_t LockAlphaInkProcessing<GrayscaleTraits>::processColor(color_t c) {
+  color_t result = graya_blender_normal(c, m_color, m_opacity);
+  return graya(
     graya_getv(result),
-    graya_geta(*m_srcAddress));
+    graya_geta(c));
 }
 
 template<>
@@ -178,15 +273,18 @@ public:
     , m_maskIndex(loop->getLayer()->isBackground() ? -1: loop->sprite()->transparentColor()) {
   }
 
-  void processPixel(int x, int y) {
-    color_t c = *m_srcAddress;
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    processSpanWithColorTable(loop, x, y, w);
+  }
+
+  color_t processColor(color_t c) {
     if (c == m_maskIndex)
       c = m_palette->getEntry(c) & rgba_rgb_mask;  // Alpha = 0
     else
       c = m_palette->getEntry(c);
 
     color_t result = rgba_blender_normal(c, m_color, m_opacity);
-    *m_dstAddress = m_palette->findBestfit(
+    return m_palette->findBestfit(
       rgba_getr(result),
       rgba_getg(result),
       rgba_getb(result),
@@ -213,8 +311,13 @@ public:
     m_opacity = loop->getOpacity();
   }
 
-  void processPixel(int x, int y) {
-    // Do nothing
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    // Do nothing (it's specialized for each case)
+  }
+
+  color_t processColor(color_t c) {
+    // Do nothing (it's specialized for each case)
+    return c;
   }
 
 private:
@@ -223,13 +326,34 @@ private:
 };
 
 template<>
-void TransparentInkProcessing<RgbTraits>::processPixel(int x, int y) {
-  *m_dstAddress = rgba_blender_normal(*m_srcAddress, m_color, m_opacity);
+void TransparentInkProcessing<RgbTraits>::processSpan(ToolLoop* loop, int x, int y, int w) {
+  // An opaque color covers everything
+  if (m_opacity == 255 && rgba_geta(m_color) == 255) {
+    initIterators(loop, x, y);
+    std::fill(m_dstAddress, m_dstAddress+w, m_color);
+  }
+  else
+    processSpanReusingLastColor(loop, x, y, w);
 }
 
 template<>
-void TransparentInkProcessing<GrayscaleTraits>::processPixel(int x, int y) {
-  *m_dstAddress = graya_blender_normal(*m_srcAddress, m_color, m_opacity);
+color_t TransparentInkProcessing<RgbTraits>::processColor(color_t c) {
+  return rgba_blender_normal(c, m_color, m_opacity);
+}
+
+template<>
+void TransparentInkProcessing<GrayscaleTraits>::processSpan(ToolLoop* loop, int x, int y, int w) {
+  if (m_opacity == 255 && graya_geta(m_color) == 255) {
+    initIterators(loop, x, y);
+    std::fill(m_dstAddress, m_dstAddress+w, GrayscaleTraits::pixel_t(m_color));
+  }
+  else
+    processSpanReusingLastColor(loop, x, y, w);
+}
+
+template<>
+color_t TransparentInkProcessing<GrayscaleTraits>::processColor(color_t c) {
+  return graya_blender_normal(c, m_color, m_opacity);
 }
 
 template<>
@@ -243,18 +367,21 @@ public:
     m_maskIndex(loop->getLayer()->isBackground() ? -1: loop->sprite()->transparentColor()) {
   }
 
-  void processPixel(int x, int y) {
-    color_t c = *m_srcAddress;
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    processSpanWithColorTable(loop, x, y, w);
+  }
+
+  color_t processColor(color_t c) {
     if (c == m_maskIndex)
       c = m_palette->getEntry(c) & rgba_rgb_mask;  // Alpha = 0
     else
       c = m_palette->getEntry(c);
 
     c = rgba_blender_normal(c, m_color, m_opacity);
-    *m_dstAddress = m_rgbmap->mapColor(rgba_getr(c),
-                                       rgba_getg(c),
-                                       rgba_getb(c),
-                                       rgba_geta(c));
+    return m_rgbmap->mapColor(rgba_getr(c),
+                              rgba_getg(c),
+                              rgba_getb(c),
+                              rgba_geta(c));
   }
 
 private:
@@ -277,8 +404,13 @@ public:
     m_opacity = loop->getOpacity();
   }
 
-  void processPixel(int x, int y) {
-    // Do nothing
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    this->processSpanReusingLastColor(loop, x, y, w);
+  }
+
+  color_t processColor(color_t c) {
+    // Do nothing (it's specialized for each case)
+    return c;
   }
 
 private:
@@ -287,13 +419,13 @@ private:
 };
 
 template<>
-void MergeInkProcessing<RgbTraits>::processPixel(int x, int y) {
-  *m_dstAddress = rgba_blender_merge(*m_srcAddress, m_color, m_opacity);
+color_t MergeInkProcessing<RgbTraits>::processColor(color_t c) {
+  return rgba_blender_merge(c, m_color, m_opacity);
 }
 
 template<>
-void MergeInkProcessing<GrayscaleTraits>::processPixel(int x, int y) {
-  *m_dstAddress = graya_blender_merge(*m_srcAddress, m_color, m_opacity);
+color_t MergeInkProcessing<GrayscaleTraits>::processColor(color_t c) {
+  return graya_blender_merge(c, m_color, m_opacity);
 }
 
 template<>
@@ -309,18 +441,21 @@ public:
             (m_palette->getEntry(loop->getPrimaryColor()))) {
   }
 
-  void processPixel(int x, int y) {
-    color_t c = *m_srcAddress;
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    processSpanWithColorTable(loop, x, y, w);
+  }
+
+  color_t processColor(color_t c) {
     if (c == m_maskIndex)
       c = m_palette->getEntry(c) & rgba_rgb_mask;  // Alpha = 0
     else
       c = m_palette->getEntry(c);
 
     c = rgba_blender_merge(c, m_color, m_opacity);
-    *m_dstAddress = m_rgbmap->mapColor(rgba_getr(c),
-                                       rgba_getg(c),
-                                       rgba_getb(c),
-                                       rgba_geta(c));
+    return m_rgbmap->mapColor(rgba_getr(c),
+                              rgba_getg(c),
+                              rgba_getb(c),
+                              rgba_geta(c));
   }
 
 private:
@@ -719,9 +854,11 @@ public:
     m_left(loop->getMouseButton() == ToolLoop::Left) {
   }
 
-  void processPixel(int x, int y) {
-    color_t src = *m_srcAddress;
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    processSpanReusingLastColor(loop, x, y, w);
+  }
 
+  color_t processColor(color_t src) {
     // We cannot use the m_rgbmap->mapColor() function because RgbMaps
     // are created with findBestfit(), and findBestfit() limits the
     // returned indexes to [0,255] range (it's mainly used for RGBA ->
@@ -733,10 +870,8 @@ public:
                                       -1);
 
     // If we didn't find the exact match.
-    if (i < 0) {
-      *m_dstAddress = src;
-      return;
-    }
+    if (i < 0)
+      return src;
 
     if (m_remap) {
       i = (*m_remap)[i];
@@ -754,7 +889,7 @@ public:
       }
     }
 
-    *m_dstAddress = m_palette->getEntry(i);
+    return m_palette->getEntry(i);
   }
 
 private:
@@ -774,20 +909,20 @@ public:
     m_left(loop->getMouseButton() == ToolLoop::Left) {
   }
 
-  // Works as the RGBA version
-  void processPixel(int x, int y) {
-    color_t src = *m_srcAddress;
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    processSpanReusingLastColor(loop, x, y, w);
+  }
 
+  // Works as the RGBA version
+  color_t processColor(color_t src) {
     int i = m_palette->findExactMatch(graya_getv(src),
                                       graya_getv(src),
                                       graya_getv(src),
                                       graya_geta(src),
                                       -1);
 
-    if (i < 0) {
-      *m_dstAddress = src;
-      return;
-    }
+    if (i < 0)
+      return src;
 
     if (m_remap) {
       i = (*m_remap)[i];
@@ -806,7 +941,7 @@ public:
     }
 
     color_t rgba = m_palette->getEntry(i);
-    *m_dstAddress = graya(
+    return graya(
       int(255.0 * Hsv(Rgb(rgba_getr(rgba),
                           rgba_getg(rgba),
                           rgba_getb(rgba))).value()),
@@ -829,8 +964,11 @@ public:
     m_left(loop->getMouseButton() == ToolLoop::Left) {
   }
 
-  void processPixel(int x, int y) {
-    color_t src = *m_srcAddress;
+  void processSpan(ToolLoop* loop, int x, int y, int w) {
+    processSpanWithColorTable(loop, x, y, w);
+  }
+
+  color_t processColor(color_t src) {
     int i = src;
 
     if (m_remap) {
@@ -849,7 +987,7 @@ public:
       }
     }
 
-    *m_dstAddress = i;
+    return i;
   }
 
 private:
@@ -0,0 +1,73 @@
+// Aseprite
+// Copyright (C) 2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/tools/latency_histogram.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace app {
+namespace tools {
+
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+void LatencyHistogram::reset()
+{
+  std::fill(m_buckets, m_buckets+kBuckets, 0);
+  m_count = 0;
+  m_max = 0.0;
+}
+
+void LatencyHistogram::addSample(double msecs)
+{
+  int bucket = 0;
+  while (bucket < kBuckets-1 && msecs >= bucketLimit(bucket))
+    ++bucket;
+
+  ++m_buckets[bucket];
+  ++m_count;
+  m_max = std::max(m_max, msecs);
+}
+
+double LatencyHistogram::percentile(double p) const
+{
+  if (m_count == 0)
+    return 0.0;
+
+  const int n = std::max(1, int(p * m_count + 0.5));
+  int acc = 0;
+  for (int bucket=0; bucket<kBuckets-1; ++bucket) {
+    acc += m_buckets[bucket];
+    if (acc >= n)
+      return bucketLimit(bucket);
+  }
+  return m_max;
+}
+
+std::string LatencyHistogram::summary() const
+{
+  char buf[256];
+  std::sprintf(buf, "p50=%g p90=%g p99=%g max=%.1f (n=%d)",
+               percentile(0.5), percentile(0.9), percentile(0.99),
+               m_max, m_count);
+  return buf;
+}
+
+// static
+double LatencyHistogram::bucketLimit(int bucket)
+{
+  return double(1 << bucket);
+}
+
+} // namespace tools
+} // namespace app
@@ -0,0 +1,53 @@
+// Aseprite
+// Copyright (C) 2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_TOOLS_LATENCY_HISTOGRAM_H_INCLUDED
+#define APP_TOOLS_LATENCY_HISTOGRAM_H_INCLUDED
+#pragma once
+
+#include <string>
+
+namespace app {
+  namespace tools {
+
+    // Histogram of latencies (in milliseconds) with power of two
+    // buckets: [0,1), [1,2), [2,4), [4,8), ..., [512,inf).
+    //
+    // It's used to measure the time from the moment a mouse/pen
+    // sample is received to the moment its pixels are shown on the
+    // screen (see ToolLoopManager).
+    class LatencyHistogram {
+    public:
+      enum { kBuckets = 11 };
+
+      LatencyHistogram();
+
+      void reset();
+      void addSample(double msecs);
+
+      int count() const { return m_count; }
+      int bucketCount(int bucket) const { return m_buckets[bucket]; }
+      double maxLatency() const { return m_max; }
+
+      // Returns the upper limit of the bucket that contains the
+      // given percentile (0.0 to 1.0) of the samples.
+      double percentile(double p) const;
+
+      // Returns a text like "p50=4 p90=8 p99=16 max=12.5 (n=100)".
+      std::string summary() const;
+
+      static double bucketLimit(int bucket);
+
+    private:
+      int m_buckets[kBuckets];
+      int m_count;
+      double m_max;
+    };
+
+  } // namespace tools
+} // namespace app
+
+#endif
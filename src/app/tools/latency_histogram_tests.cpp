@@ -0,0 +1,48 @@
+// Aseprite
+// Copyright (C) 2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#include "tests/test.h"
+
+#include "app/tools/latency_histogram.h"
+
+using namespace app::tools;
+
+TEST(LatencyHistogram, Buckets)
+{
+  LatencyHistogram h;
+  h.addSample(0.5);
+  h.addSample(1.0);
+  h.addSample(3.9);
+  h.addSample(4.0);
+  h.addSample(10000.0);
+
+  EXPECT_EQ(5, h.count());
+  EXPECT_EQ(1, h.bucketCount(0));
+  EXPECT_EQ(1, h.bucketCount(1));
+  EXPECT_EQ(1, h.bucketCount(2));
+  EXPECT_EQ(1, h.bucketCount(3));
+  EXPECT_EQ(1, h.bucketCount(LatencyHistogram::kBuckets-1));
+  EXPECT_EQ(10000.0, h.maxLatency());
+}
+
+TEST(LatencyHistogram, Percentile)
+{
+  LatencyHistogram h;
+  EXPECT_EQ(0.0, h.percentile(0.5));
+
+  for (int i=0; i<90; ++i)
+    h.addSample(1.5);
+  for (int i=0; i<10; ++i)
+    h.addSample(20.0);
+
+  EXPECT_EQ(2.0, h.percentile(0.5));
+  EXPECT_EQ(2.0, h.percentile(0.9));
+  EXPECT_EQ(32.0, h.percentile(0.99));
+
+  h.reset();
+  EXPECT_EQ(0, h.count());
+  EXPECT_EQ(0.0, h.maxLatency());
+}
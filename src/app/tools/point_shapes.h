@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -33,16 +33,16 @@ public:
 
 class BrushPointShape : public PointShape {
   Brush* m_brush;
-  base::SharedPtr<CompressedImage> m_compressedImage;
+  const CompressedImage* m_stamp;
   bool m_firstPoint;
 
 public:
 
   void preparePointShape(ToolLoop* loop) override {
     m_brush = loop->getBrush();
-    m_compressedImage.reset(new CompressedImage(m_brush->image(),
-                                                m_brush->maskBitmap(),
-                                                false));
+    // The stamp is cached in the brush, so it's created only one
+    // time for all the strokes with the same brush.
+    m_stamp = m_brush->stamp();
     m_firstPoint = true;
   }
 
@@ -66,7 +66,7 @@ public:
       }
     }
 
-    for (auto scanline : *m_compressedImage) {
+    for (const auto& scanline : *m_stamp) {
       int u = x+scanline.x;
       doInkHline(u, y+scanline.y, u+scanline.w-1, loop);
     }
@@ -24,6 +24,7 @@ namespace doc {
   class Image;
   class Layer;
   class Mask;
+  class MaskRuns;
   class Remap;
   class RgbMap;
   class Slice;
@@ -118,6 +119,12 @@ namespace app {
       virtual Mask* getMask() = 0;
       virtual void setMask(Mask* newMask) = 0;
 
+      // Selected pixels of the current mask as horizontal runs, used
+      // by inks to paint whole spans instead of checking the mask
+      // pixel by pixel. It's nullptr if useMask() is false or the
+      // mask is empty.
+      virtual MaskRuns* getMaskRuns() = 0;
+
       // Adds a new slice (only for slice ink)
       virtual void addSlice(doc::Slice* newSlice) = 0;
 
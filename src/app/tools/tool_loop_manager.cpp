@@ -11,6 +11,7 @@
 #include "app/tools/tool_loop_manager.h"
 
 #include "app/context.h"
+#include "app/document.h"
 #include "app/snap_to_grid.h"
 #include "app/tools/controller.h"
 #include "app/tools/ink.h"
@@ -35,11 +36,18 @@ using namespace filters;
 ToolLoopManager::ToolLoopManager(ToolLoop* toolLoop)
   : m_toolLoop(toolLoop)
   , m_dirtyArea(toolLoop->getDirtyArea())
+  , m_working(false)
+  , m_stop(false)
 {
+  // Paint inks only modify the destination image (they don't need
+  // the UI), so they can be rasterized in a background thread.
+  if (m_toolLoop->getInk()->isPaint())
+    m_worker = std::thread([this]{ workerLoop(); });
 }
 
 ToolLoopManager::~ToolLoopManager()
 {
+  stopWorker();
 }
 
 bool ToolLoopManager::isCanceled() const
@@ -74,6 +82,9 @@ void ToolLoopManager::pressButton(const Pointer& pointer)
   if (isCanceled())
     return;
 
+  // Finish the pending movements before the new button is processed
+  waitWorker();
+
   // If the user pressed the other mouse button...
   if ((m_toolLoop->getMouseButton() == ToolLoop::Left && pointer.button() == Pointer::Right) ||
       (m_toolLoop->getMouseButton() == ToolLoop::Right && pointer.button() == Pointer::Left)) {
@@ -104,6 +115,8 @@ bool ToolLoopManager::releaseButton(const Pointer& pointer)
   if (isCanceled())
     return false;
 
+  waitWorker();
+
   Point spritePoint = pointer.point();
   snapToGrid(spritePoint);
 
@@ -127,6 +140,63 @@ void ToolLoopManager::movement(const Pointer& pointer)
   if (isCanceled())
     return;
 
+  // Queue the movement for the background thread
+  if (isAsync()) {
+    Sample sample;
+    sample.pointer = pointer;
+    sample.time = Clock::now();
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_samples.push_back(sample);
+    }
+    m_cv.notify_all();
+    return;
+  }
+
+  moveTo(pointer);
+  m_toolLoop->updateStatusBar(m_statusText.c_str());
+
+  doLoopStep(false);
+}
+
+bool ToolLoopManager::present()
+{
+  gfx::Region area;
+  std::vector<Clock::time_point> samples;
+  std::string statusText;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_drawnSamples.empty())
+      return (!m_working && m_samples.empty());
+
+    // The worker doesn't start a new step until m_drawnSamples is
+    // cleared, so the destination image can be read safely.
+    area = m_drawnArea;
+    samples = m_drawnSamples;
+    statusText = m_drawnStatusText;
+  }
+
+  presentDirtyArea(area);
+  m_toolLoop->updateStatusBar(statusText.c_str());
+
+  const Clock::time_point now = Clock::now();
+  for (const auto& time : samples)
+    m_latency.addSample(
+      std::chrono::duration<double, std::milli>(now - time).count());
+
+  bool done;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_drawnArea.clear();
+    m_drawnSamples.clear();
+    done = (!m_working && m_samples.empty());
+  }
+  m_cv.notify_all();
+  return done;
+}
+
+void ToolLoopManager::moveTo(const Pointer& pointer)
+{
   // Convert the screen point to a sprite point
   Point spritePoint = pointer.point();
   // Calculate the speed (new sprite point - old sprite point)
@@ -136,11 +206,8 @@ void ToolLoopManager::movement(const Pointer& pointer)
 
   m_toolLoop->getController()->movement(m_toolLoop, m_stroke, spritePoint);
 
-  std::string statusText;
-  m_toolLoop->getController()->getStatusBarText(m_stroke, statusText);
-  m_toolLoop->updateStatusBar(statusText.c_str());
-
-  doLoopStep(false);
+  m_statusText.clear();
+  m_toolLoop->getController()->getStatusBarText(m_stroke, m_statusText);
 }
 
 void ToolLoopManager::doLoopStep(bool last_step)
@@ -201,8 +268,127 @@ void ToolLoopManager::doLoopStep(bool last_step)
     m_toolLoop->copyValidDstToSrcImage(m_dirtyArea);
   }
 
-  if (!m_dirtyArea.isEmpty())
-    m_toolLoop->updateDirtyArea();
+  if (!m_dirtyArea.isEmpty()) {
+    // The background thread accumulates the modified area, it will
+    // be shown by the UI thread in present().
+    if (std::this_thread::get_id() == m_worker.get_id()) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_drawnArea.createUnion(m_drawnArea, m_dirtyArea);
+    }
+    else
+      m_toolLoop->updateDirtyArea();
+  }
+}
+
+void ToolLoopManager::stopWorker()
+{
+  if (!isAsync())
+    return;
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_samples.clear();
+  }
+  m_cv.notify_all();
+  m_worker.join();
+}
+
+// Waits until all the queued movements are drawn and presented.
+void ToolLoopManager::waitWorker()
+{
+  if (!isAsync())
+    return;
+
+  while (!present()) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]{
+        return (!m_drawnSamples.empty() ||
+                (!m_working && m_samples.empty()));
+      });
+  }
+}
+
+// Executed in the background thread.
+void ToolLoopManager::workerLoop()
+{
+  app::Document* document = m_toolLoop->getDocument();
+  std::vector<Sample> samples;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this]{
+          return (m_stop ||
+                  (!m_samples.empty() && m_drawnSamples.empty()));
+        });
+      if (m_stop)
+        break;
+
+      // Coalesce all the samples received until now
+      samples.swap(m_samples);
+      m_working = true;
+    }
+
+    // Lock the document to write, so editors (which lock it to read)
+    // don't render the destination image while we are modifying it.
+    bool locked;
+    while (!(locked = document->lock(RWLock::WriteLock, 0))) {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_stop)
+          break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (locked) {
+      try {
+        if (!isCanceled()) {
+          // Tools like line or rectangle redraw the whole trace on
+          // each step, so we can draw only the last position.
+          if (m_toolLoop->getTracePolicy() == TracePolicy::Last) {
+            for (const auto& sample : samples)
+              moveTo(sample.pointer);
+            doLoopStep(false);
+          }
+          else {
+            for (const auto& sample : samples) {
+              moveTo(sample.pointer);
+              doLoopStep(false);
+            }
+          }
+        }
+      }
+      catch (...) {
+        m_toolLoop->cancel();
+      }
+      document->unlock();
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      for (const auto& sample : samples)
+        m_drawnSamples.push_back(sample.time);
+      m_drawnStatusText = m_statusText;
+      m_working = false;
+    }
+    m_cv.notify_all();
+    samples.clear();
+  }
+}
+
+void ToolLoopManager::presentDirtyArea(const gfx::Region& area)
+{
+  if (area.isEmpty())
+    return;
+
+  // The dirty area of the last step is needed by tools like line or
+  // rectangle (see calculateDirtyArea()).
+  gfx::Region lastDirtyArea(m_dirtyArea);
+  m_dirtyArea = area;
+  m_toolLoop->updateDirtyArea();
+  m_dirtyArea = lastDirtyArea;
 }
 
 // Applies the grid settings to the specified sprite point.
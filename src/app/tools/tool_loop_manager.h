@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -8,11 +8,17 @@
 #define APP_TOOLS_TOOL_LOOP_MANAGER_H_INCLUDED
 #pragma once
 
+#include "app/tools/latency_histogram.h"
 #include "app/tools/pointer.h"
 #include "app/tools/stroke.h"
 #include "gfx/point.h"
 #include "gfx/region.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 namespace gfx { class Region; }
@@ -38,6 +44,12 @@ class ToolLoop;
 // 5. When the user release the mouse:
 //    - ToolLoopManager::releaseButton
 //
+// For paint inks, the mouse movements are rasterized in a background
+// thread (the document is locked to write while a step is drawn), so
+// the UI thread can continue processing (and coalescing) new mouse
+// events. In this case the UI thread must call
+// ToolLoopManager::present periodically to show the modified pixels.
+//
 class ToolLoopManager {
 public:
   // Contructs a manager for the ToolLoop delegate.
@@ -66,17 +78,58 @@ public:
   // Should be called each time the user moves the mouse inside the editor.
   void movement(const Pointer& pointer);
 
+  // Returns true if the mouse movements are rasterized in a
+  // background thread.
+  bool isAsync() const { return m_worker.joinable(); }
+
+  // Updates the screen with the pixels that were modified by the
+  // background thread since the last call. Returns false if there
+  // are samples that weren't presented yet (the function should be
+  // called again later).
+  bool present();
+
+  // Time from each mouse movement to the moment it's presented.
+  const LatencyHistogram& latency() const { return m_latency; }
+
 private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Sample {
+    Pointer pointer;
+    Clock::time_point time;
+  };
+
+  void moveTo(const Pointer& pointer);
   void doLoopStep(bool last_step);
   void snapToGrid(gfx::Point& point);
 
   void calculateDirtyArea(const Strokes& strokes);
 
+  void stopWorker();
+  void waitWorker();
+  void workerLoop();
+  void presentDirtyArea(const gfx::Region& area);
+
   ToolLoop* m_toolLoop;
   Stroke m_stroke;
   Pointer m_lastPointer;
   gfx::Point m_oldPoint;
   gfx::Region& m_dirtyArea;
+  std::string m_statusText;
+
+  // Background thread to rasterize mouse movements. All the
+  // following fields are protected by m_mutex.
+  std::thread m_worker;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::vector<Sample> m_samples;    // Samples to rasterize
+  std::vector<Clock::time_point> m_drawnSamples;
+  gfx::Region m_drawnArea;          // Area modified by the worker
+  std::string m_drawnStatusText;
+  bool m_working;
+  bool m_stop;
+
+  LatencyHistogram m_latency;
 };
 
 } // namespace tools
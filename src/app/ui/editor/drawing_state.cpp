@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -13,6 +13,7 @@
 #include "app/commands/command.h"
 #include "app/commands/commands.h"
 #include "app/commands/params.h"
+#include "app/pref/preferences.h"
 #include "app/tools/controller.h"
 #include "app/tools/ink.h"
 #include "app/tools/tool.h"
@@ -23,6 +24,7 @@
 #include "app/ui/editor/glue.h"
 #include "app/ui/keyboard_shortcuts.h"
 #include "app/ui_context.h"
+#include "base/log.h"
 #include "doc/layer.h"
 #include "ui/message.h"
 #include "ui/system.h"
@@ -38,6 +40,10 @@ namespace app {
 
 using namespace ui;
 
+// Milliseconds between each check of new pixels drawn in the
+// background thread of the ToolLoopManager.
+static const int kPresentInterval = 4;
+
 DrawingState::DrawingState(tools::ToolLoop* toolLoop)
   : m_toolLoop(toolLoop)
   , m_toolLoopManager(new tools::ToolLoopManager(toolLoop))
@@ -93,6 +99,12 @@ void DrawingState::initToolLoop(Editor* editor, MouseMessage* msg)
 
   editor->setLastDrawingPosition(pointer.point());
   editor->captureMouse();
+
+  if (m_toolLoopManager->isAsync()) {
+    m_presentTimer.reset(new ui::Timer(kPresentInterval, editor));
+    m_presentTimer->Tick.connect(&DrawingState::onPresentTick, this);
+    m_presentTimer->start();
+  }
 }
 
 void DrawingState::notifyToolLoopModifiersChange(Editor* editor)
@@ -163,6 +175,7 @@ bool DrawingState::onMouseMove(Editor* editor, MouseMessage* msg)
   // Notify mouse movement to the tool
   ASSERT(m_toolLoopManager != NULL);
   m_toolLoopManager->movement(pointer);
+  m_toolLoopManager->present();
 
   // Save the last point.
   editor->setLastDrawingPosition(pointer.point());
@@ -219,6 +232,12 @@ void DrawingState::onExposeSpritePixels(const gfx::Region& rgn)
     m_toolLoop->validateDstImage(rgn);
 }
 
+void DrawingState::onPresentTick()
+{
+  if (m_toolLoopManager)
+    m_toolLoopManager->present();
+}
+
 void DrawingState::destroyLoopIfCanceled(Editor* editor)
 {
   // Cancel drawing loop
@@ -242,12 +261,24 @@ void DrawingState::destroyLoop(Editor* editor)
     editor->renderEngine().removePreviewImage();
   }
 
+  m_presentTimer.reset();
+
+  if (m_toolLoopManager) {
+    if (m_toolLoopManager->latency().count() > 0 &&
+        Preferences::instance().perf.showRenderTime()) {
+      LOG("TOOL: Stroke latency %s\n",
+          m_toolLoopManager->latency().summary().c_str());
+    }
+
+    // Stop the background thread before the tool-loop is disposed
+    delete m_toolLoopManager;
+    m_toolLoopManager = nullptr;
+  }
+
   if (m_toolLoop)
     m_toolLoop->dispose();
 
-  delete m_toolLoopManager;
   delete m_toolLoop;
-  m_toolLoopManager = nullptr;
   m_toolLoop = nullptr;
 
   app_rebuild_documents_tabs();
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -9,6 +9,8 @@
 #pragma once
 
 #include "app/ui/editor/standby_state.h"
+#include "base/unique_ptr.h"
+#include "ui/timer.h"
 
 namespace app {
   namespace tools {
@@ -39,6 +41,7 @@ namespace app {
   private:
     void destroyLoopIfCanceled(Editor* editor);
     void destroyLoop(Editor* editor);
+    void onPresentTick();
 
     // The tool-loop.
     tools::ToolLoop* m_toolLoop;
@@ -46,6 +49,10 @@ namespace app {
     // Tool-loop manager
     tools::ToolLoopManager* m_toolLoopManager;
 
+    // Timer to show the pixels drawn by the tool-loop manager in its
+    // background thread.
+    base::UniquePtr<ui::Timer> m_presentTimer;
+
     // True if at least we've received a onMouseMove(). It's used to
     // cancel selection tool (deselect) when the user click (press and
     // release the mouse button in the same location).
@@ -168,6 +168,8 @@ Editor::Editor(Document* document, EditorFlags flags)
   , m_padding(0, 0)
   , m_antsTimer(100, this)
   , m_antsOffset(0)
+  , m_maskTilesScaleX(0.0)
+  , m_maskTilesScaleY(0.0)
   , m_customizationDelegate(NULL)
   , m_docView(NULL)
   , m_flags(flags)
@@ -853,30 +855,73 @@ void Editor::drawMask(Graphics* g)
       !m_docPref.show.selectionEdges())
     return;
 
-  ASSERT(m_document->getMaskBoundaries());
+  const doc::MaskBoundaries* boundaries = m_document->getMaskBoundaries();
+  ASSERT(boundaries);
+  updateMaskTilesCache(*boundaries);
 
   int x = m_padding.x;
   int y = m_padding.y;
+  gfx::Rect clip = g->getClipBounds().offset(-x, -y);
 
-  for (const auto& seg : *m_document->getMaskBoundaries()) {
-    CheckedDrawMode checked(g, m_antsOffset);
-    gfx::Rect bounds = m_proj.apply(seg.bounds());
+  CheckedDrawMode checked(g, m_antsOffset);
 
-    if (m_proj.scaleX() >= 1.0) {
-      if (!seg.open() && seg.vertical())
-        --bounds.x;
-    }
+  for (const MaskTile& tile : m_maskTiles) {
+    if (!tile.bounds.intersects(clip))
+      continue;
 
-    if (m_proj.scaleY() >= 1.0) {
-      if (!seg.open() && !seg.vertical())
-        --bounds.y;
+    for (const MaskSegment& seg : tile.segs) {
+      // The color doesn't matter, we are using CheckedDrawMode
+      if (seg.vertical)
+        g->drawVLine(gfx::rgba(0, 0, 0), x+seg.bounds.x, y+seg.bounds.y, seg.bounds.h);
+      else
+        g->drawHLine(gfx::rgba(0, 0, 0), x+seg.bounds.x, y+seg.bounds.y, seg.bounds.w);
     }
+  }
+}
 
-    // The color doesn't matter, we are using CheckedDrawMode
-    if (seg.vertical())
-      g->drawVLine(gfx::rgba(0, 0, 0), x+bounds.x, y+bounds.y, bounds.h);
-    else
-      g->drawHLine(gfx::rgba(0, 0, 0), x+bounds.x, y+bounds.y, bounds.w);
+void Editor::updateMaskTilesCache(const doc::MaskBoundaries& boundaries)
+{
+  // Convert all the tiles again if the zoom has changed
+  if (m_maskTilesScaleX != m_proj.scaleX() ||
+      m_maskTilesScaleY != m_proj.scaleY()) {
+    m_maskTiles.clear();
+    m_maskTilesScaleX = m_proj.scaleX();
+    m_maskTilesScaleY = m_proj.scaleY();
+  }
+
+  const doc::MaskBoundaries::tiles_type& tiles = boundaries.tiles();
+  m_maskTiles.resize(tiles.size());
+
+  for (std::size_t i=0; i<tiles.size(); ++i) {
+    const doc::MaskBoundaries::Tile& tile = tiles[i];
+    MaskTile& cached = m_maskTiles[i];
+    if (cached.version == tile.version())
+      continue;
+
+    cached.version = tile.version();
+    // One extra pixel for closed segments (they are moved one pixel
+    // to the left/top)
+    cached.bounds = m_proj.apply(tile.bounds()).enlarge(1);
+    cached.segs.clear();
+    cached.segs.reserve(tile.segments().size());
+
+    for (const auto& seg : tile.segments()) {
+      MaskSegment cachedSeg;
+      cachedSeg.bounds = m_proj.apply(seg.bounds());
+      cachedSeg.vertical = seg.vertical();
+
+      if (m_proj.scaleX() >= 1.0) {
+        if (!seg.open() && seg.vertical())
+          --cachedSeg.bounds.x;
+      }
+
+      if (m_proj.scaleY() >= 1.0) {
+        if (!seg.open() && !seg.vertical())
+          --cachedSeg.bounds.y;
+      }
+
+      cached.segs.push_back(cachedSeg);
+    }
   }
 }
 
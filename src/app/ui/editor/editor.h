@@ -25,6 +25,7 @@
 #include "doc/image_buffer.h"
 #include "filters/tiled_mode.h"
 #include "gfx/fwd.h"
+#include "gfx/rect.h"
 #include "obs/connection.h"
 #include "render/zoom.h"
 #include "ui/base.h"
@@ -33,8 +34,11 @@
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <vector>
+
 namespace doc {
   class Layer;
+  class MaskBoundaries;
   class Site;
   class Sprite;
 }
@@ -277,6 +281,7 @@ namespace app {
 
     void drawMaskSafe();
     void drawMask(ui::Graphics* g);
+    void updateMaskTilesCache(const doc::MaskBoundaries& boundaries);
     void drawGrid(ui::Graphics* g, const gfx::Rect& spriteBounds, const gfx::Rect& gridBounds,
                   const app::Color& color, int alpha);
     void drawSlices(ui::Graphics* g);
@@ -326,6 +331,23 @@ namespace app {
     ui::Timer m_antsTimer;
     int m_antsOffset;
 
+    // Segments of each tile of the mask boundaries in editor
+    // coordinates. A tile is converted again only when it's
+    // regenerated or the zoom changes, so drawing the marching ants
+    // only iterates the segments of the visible tiles.
+    struct MaskSegment {
+      gfx::Rect bounds;
+      bool vertical;
+    };
+    struct MaskTile {
+      int version;
+      gfx::Rect bounds;
+      std::vector<MaskSegment> segs;
+      MaskTile() : version(0) { }
+    };
+    std::vector<MaskTile> m_maskTiles;
+    double m_maskTilesScaleX, m_maskTilesScaleY;
+
     obs::scoped_connection m_fgColorChangeConn;
     obs::scoped_connection m_contextBarBrushChangeConn;
     obs::scoped_connection m_showExtrasConn;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -702,9 +702,12 @@ void PixelsMovement::drawMask(doc::Mask* mask, bool shrink)
   mask->replace(bounds);
   if (shrink)
     mask->freeze();
+  // Read the initial mask through a const pointer so its runs are
+  // not converted to a bitmap.
+  const Mask* initialMask = m_initialMask;
   clear_image(mask->bitmap(), 0);
   drawParallelogram(mask->bitmap(),
-                    m_initialMask->bitmap(),
+                    initialMask->bitmap(),
                     nullptr,
                     corners, bounds.origin());
   if (shrink)
@@ -755,7 +758,8 @@ retry:;      // In case that we don't have enough memory for RotSprite
           int(corners.rightBottom().x-leftTop.x),
           int(corners.rightBottom().y-leftTop.y),
           int(corners.leftBottom().x-leftTop.x),
-          int(corners.leftBottom().y-leftTop.y));
+          int(corners.leftBottom().y-leftTop.y),
+          &m_rotSpriteBuffers);
       }
       catch (const std::bad_alloc&) {
         StatusBar::instance()->showTip(1000,
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -14,6 +14,7 @@
 #include "app/ui/editor/handle_type.h"
 #include "base/shared_ptr.h"
 #include "doc/algorithm/flip_type.h"
+#include "doc/algorithm/rotsprite.h"
 #include "doc/site.h"
 #include "gfx/size.h"
 #include "obs/connection.h"
@@ -141,6 +142,8 @@ namespace app {
     obs::scoped_connection m_pivotPosConn;
     obs::scoped_connection m_rotAlgoConn;
     ExtraCelRef m_extraCel;
+    // Scratch images reused by RotSprite on each preview update.
+    doc::algorithm::RotSpriteBuffers m_rotSpriteBuffers;
   };
 
   inline PixelsMovement::MoveModifier& operator|=(PixelsMovement::MoveModifier& a,
@@ -42,6 +42,7 @@
 #include "doc/image.h"
 #include "doc/layer.h"
 #include "doc/mask.h"
+#include "doc/mask_runs.h"
 #include "doc/palette.h"
 #include "doc/palette_picks.h"
 #include "doc/remap.h"
@@ -270,6 +271,7 @@ class ToolLoopImpl : public ToolLoopBase {
   int m_spraySpeed;
   bool m_useMask;
   Mask* m_mask;
+  base::UniquePtr<MaskRuns> m_maskRuns;
   gfx::Point m_maskOrigin;
   bool m_canceled;
   Transaction m_transaction;
@@ -383,6 +385,8 @@ public:
     m_maskOrigin = (!m_mask->isEmpty() ? gfx::Point(m_mask->bounds().x-m_celOrigin.x,
                                                     m_mask->bounds().y-m_celOrigin.y):
                                          gfx::Point(0, 0));
+    if (m_useMask && !m_mask->isEmpty())
+      m_maskRuns.reset(new MaskRuns(m_mask));
   }
 
   ~ToolLoopImpl() {
@@ -466,6 +470,7 @@ public:
   void setMask(Mask* newMask) override {
     m_transaction.execute(new cmd::SetMask(m_document, newMask));
   }
+  MaskRuns* getMaskRuns() override { return m_maskRuns.get(); }
   void addSlice(Slice* newSlice) override {
     m_transaction.execute(new cmd::AddSlice(m_sprite, newSlice));
   }
@@ -611,6 +616,7 @@ public:
   bool useMask() override { return false; }
   Mask* getMask() override { return nullptr; }
   void setMask(Mask* newMask) override { }
+  MaskRuns* getMaskRuns() override { return nullptr; }
   void addSlice(Slice* newSlice) override { }
   gfx::Point getMaskOrigin() override { return gfx::Point(0, 0); }
   bool getFilled() override { return false; }
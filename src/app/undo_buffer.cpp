@@ -0,0 +1,199 @@
+// Aseprite
+// Copyright (C) 2001-2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/undo_buffer.h"
+
+#include "base/debug.h"
+
+#include "zlib.h"
+
+#include <climits>
+
+namespace app {
+
+//////////////////////////////////////////////////////////////////////
+// UndoSpillFile
+
+UndoSpillFile::UndoSpillFile()
+  : m_file(nullptr)
+  , m_failed(false)
+{
+}
+
+UndoSpillFile::~UndoSpillFile()
+{
+  if (m_file)
+    fclose(m_file);
+}
+
+bool UndoSpillFile::write(const uint8_t* data, size_t size, long& pos)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (!m_file) {
+    // Don't try to create the file again if it failed the first time
+    if (m_failed)
+      return false;
+
+    m_file = std::tmpfile();
+    if (!m_file) {
+      m_failed = true;
+      return false;
+    }
+  }
+
+  if (fseek(m_file, 0, SEEK_END) != 0)
+    return false;
+
+  pos = ftell(m_file);
+  if (pos < 0 || size > size_t(LONG_MAX - pos))
+    return false;
+
+  return (fwrite(data, 1, size, m_file) == size);
+}
+
+bool UndoSpillFile::read(long pos, uint8_t* data, size_t size)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (!m_file ||
+      fseek(m_file, pos, SEEK_SET) != 0)
+    return false;
+
+  return (fread(data, 1, size, m_file) == size);
+}
+
+//////////////////////////////////////////////////////////////////////
+// UndoBuffer
+
+UndoBuffer::UndoBuffer()
+  : m_rawSize(0)
+  , m_storedSize(0)
+  , m_compressed(false)
+  , m_incompressible(false)
+  , m_location(Location::Memory)
+  , m_file(nullptr)
+  , m_filePos(0)
+  , m_memSize(0)
+{
+}
+
+void UndoBuffer::resize(size_t size)
+{
+  ASSERT(isLoaded());
+
+  m_data.resize(size);
+  m_rawSize = size;
+  m_memSize = m_data.capacity();
+}
+
+bool UndoBuffer::load()
+{
+  if (m_location == Location::Dropped)
+    return false;
+
+  if (m_location == Location::File) {
+    std::vector<uint8_t> data(m_storedSize);
+    if (m_storedSize > 0 &&
+        !m_file->read(m_filePos, &data[0], m_storedSize))
+      return false;
+
+    setData(data);
+    m_location = Location::Memory;
+  }
+
+  if (m_compressed) {
+    std::vector<uint8_t> raw(m_rawSize);
+    uLongf rawSize = uLongf(m_rawSize);
+    if (uncompress(&raw[0], &rawSize,
+                   &m_data[0], uLong(m_data.size())) != Z_OK ||
+        rawSize != uLongf(m_rawSize))
+      return false;
+
+    setData(raw);
+    m_compressed = false;
+  }
+
+  // The loaded data will be modified (e.g. swapped with the image
+  // pixels), so it can be compressed again.
+  m_incompressible = false;
+  return true;
+}
+
+bool UndoBuffer::compress()
+{
+  if (m_location != Location::Memory ||
+      m_compressed ||
+      m_incompressible ||
+      m_rawSize == 0)
+    return false;
+
+  // Favor speed, the data is compressed in a background thread each
+  // time the history goes over the memory limit.
+  std::vector<uint8_t> compressed(compressBound(uLong(m_rawSize)));
+  uLongf compressedSize = uLongf(compressed.size());
+  if (compress2(&compressed[0], &compressedSize,
+                &m_data[0], uLong(m_rawSize),
+                Z_BEST_SPEED) != Z_OK ||
+      compressedSize >= m_rawSize) {
+    m_incompressible = true;
+    return false;
+  }
+
+  // Copy to a vector with the exact capacity
+  std::vector<uint8_t> data(compressed.begin(),
+                            compressed.begin()+compressedSize);
+  setData(data);
+  m_compressed = true;
+  return true;
+}
+
+bool UndoBuffer::spill(UndoSpillFile* file)
+{
+  if (m_location != Location::Memory ||
+      m_data.empty())
+    return false;
+
+  compress();
+
+  long pos;
+  if (!file->write(&m_data[0], m_data.size(), pos))
+    return false;
+
+  m_storedSize = m_data.size();
+  m_file = file;
+  m_filePos = pos;
+  m_location = Location::File;
+
+  std::vector<uint8_t> empty;
+  setData(empty);
+  return true;
+}
+
+bool UndoBuffer::drop()
+{
+  if (m_location == Location::Dropped)
+    return false;
+
+  m_location = Location::Dropped;
+
+  std::vector<uint8_t> empty;
+  setData(empty);
+  return true;
+}
+
+void UndoBuffer::setData(std::vector<uint8_t>& data)
+{
+  // swap() releases the old capacity (unlike clear()/assign())
+  m_data.swap(data);
+  m_memSize = m_data.capacity();
+}
+
+} // namespace app
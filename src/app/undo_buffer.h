@@ -0,0 +1,95 @@
+// Aseprite
+// Copyright (C) 2001-2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UNDO_BUFFER_H_INCLUDED
+#define APP_UNDO_BUFFER_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace app {
+
+  // Temporary file used to move the data of old undo states from
+  // memory to disk. The file is deleted automatically when it's
+  // closed (or when the program finishes).
+  class UndoSpillFile {
+  public:
+    UndoSpillFile();
+    ~UndoSpillFile();
+
+    // Appends the given data at the end of the file (the file is
+    // created the first time it's needed). Returns false if the data
+    // cannot be written.
+    bool write(const uint8_t* data, size_t size, long& pos);
+    bool read(long pos, uint8_t* data, size_t size);
+
+  private:
+    // The file is written by the background thread of DocumentUndo
+    // and read when a state is undone/redone.
+    std::mutex m_mutex;
+    FILE* m_file;
+    bool m_failed;
+
+    DISABLE_COPYING(UndoSpillFile);
+  };
+
+  // Buffer of bytes used by commands to save the information needed
+  // to undo/redo them (e.g. pixels). Old undo states can compress the
+  // data, move it to an UndoSpillFile, or drop it when the history
+  // uses too much memory (see DocumentUndo).
+  class UndoBuffer {
+  public:
+    UndoBuffer();
+
+    // Returns the uncompressed data. The buffer must be loaded.
+    uint8_t* data() { return m_data.data(); }
+    size_t size() const { return m_rawSize; }
+    void resize(size_t size);
+
+    // Decompresses the data and/or loads it from the spill file.
+    // Returns false if the data was dropped or cannot be read.
+    bool load();
+
+    // Each function returns true if the data was compressed, spilled,
+    // or dropped respectively.
+    bool compress();
+    bool spill(UndoSpillFile* file);
+    bool drop();
+
+    bool isLoaded() const { return (m_location == Location::Memory &&
+                                    !m_compressed); }
+    bool isDropped() const { return m_location == Location::Dropped; }
+
+    // Bytes used in memory (it can be called from any thread).
+    size_t memSize() const { return m_memSize; }
+
+  private:
+    enum class Location { Memory, File, Dropped };
+
+    void setData(std::vector<uint8_t>& data);
+
+    std::vector<uint8_t> m_data;  // Raw or compressed data in memory
+    size_t m_rawSize;
+    size_t m_storedSize;          // Size of the data in the spill file
+    bool m_compressed;
+    bool m_incompressible;        // True if compress() didn't help
+    Location m_location;
+    UndoSpillFile* m_file;
+    long m_filePos;
+    std::atomic<size_t> m_memSize;
+
+    DISABLE_COPYING(UndoBuffer);
+  };
+
+} // namespace app
+
+#endif
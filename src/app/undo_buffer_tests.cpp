@@ -0,0 +1,87 @@
+// Aseprite
+// Copyright (C) 2001-2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#include "tests/test.h"
+
+#include "app/undo_buffer.h"
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace app;
+
+static void fill_buffer(UndoBuffer& buf, size_t size, bool random)
+{
+  buf.resize(size);
+  for (size_t i=0; i<size; ++i)
+    buf.data()[i] = uint8_t(random ? std::rand(): i / 64);
+}
+
+static std::vector<uint8_t> buffer_data(UndoBuffer& buf)
+{
+  EXPECT_TRUE(buf.isLoaded());
+  return std::vector<uint8_t>(buf.data(), buf.data()+buf.size());
+}
+
+TEST(UndoBuffer, Compress)
+{
+  UndoBuffer buf;
+  fill_buffer(buf, 64*1024, false);
+  std::vector<uint8_t> original = buffer_data(buf);
+  size_t memSize = buf.memSize();
+
+  EXPECT_TRUE(buf.compress());
+  EXPECT_FALSE(buf.isLoaded());
+  EXPECT_LT(buf.memSize(), memSize);
+  EXPECT_FALSE(buf.compress());
+
+  EXPECT_TRUE(buf.load());
+  EXPECT_EQ(original, buffer_data(buf));
+}
+
+TEST(UndoBuffer, Incompressible)
+{
+  UndoBuffer buf;
+  fill_buffer(buf, 1024, true);
+  std::vector<uint8_t> original = buffer_data(buf);
+
+  EXPECT_FALSE(buf.compress());
+  EXPECT_TRUE(buf.isLoaded());
+  EXPECT_EQ(original, buffer_data(buf));
+}
+
+TEST(UndoBuffer, Spill)
+{
+  UndoSpillFile file;
+  UndoBuffer a, b;
+  fill_buffer(a, 32*1024, false);
+  fill_buffer(b, 1000, true);
+  std::vector<uint8_t> originalA = buffer_data(a);
+  std::vector<uint8_t> originalB = buffer_data(b);
+
+  EXPECT_TRUE(a.spill(&file));
+  EXPECT_TRUE(b.spill(&file));
+  EXPECT_EQ(0, a.memSize());
+  EXPECT_EQ(0, b.memSize());
+  EXPECT_FALSE(a.spill(&file));
+
+  EXPECT_TRUE(b.load());
+  EXPECT_TRUE(a.load());
+  EXPECT_EQ(originalA, buffer_data(a));
+  EXPECT_EQ(originalB, buffer_data(b));
+}
+
+TEST(UndoBuffer, Drop)
+{
+  UndoBuffer buf;
+  fill_buffer(buf, 1024, false);
+
+  EXPECT_TRUE(buf.drop());
+  EXPECT_TRUE(buf.isDropped());
+  EXPECT_EQ(0, buf.memSize());
+  EXPECT_FALSE(buf.drop());
+  EXPECT_FALSE(buf.load());
+}
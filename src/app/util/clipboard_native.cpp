@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2016  David Capello
+// Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -24,6 +24,7 @@
 #include "she/system.h"
 #include "ui/alert.h"
 
+#include <algorithm>
 #include <sstream>
 #include <vector>
 
@@ -117,8 +118,17 @@ bool set_native_clipboard_bitmap(const doc::Image* image,
 
   switch (image->pixelFormat()) {
     case doc::IMAGE_RGB: {
-      // We use the RGB image data directly
-      clip::image img(image->getPixelAddress(0, 0), spec);
+      // Copy row by row (rows of an image aren't contiguous in
+      // memory when they are shared with other images)
+      clip::image img(spec);
+      char* dst = img.data();
+      for (int y=0; y<image->height(); ++y, dst+=spec.bytes_per_row) {
+        const doc::RgbTraits::const_address_t src =
+          doc::get_pixel_const_address_fast<doc::RgbTraits>(image, 0, y);
+        std::copy((const char*)src,
+                  (const char*)src + spec.bytes_per_row,
+                  dst);
+      }
       l.set_image(img);
       break;
     }
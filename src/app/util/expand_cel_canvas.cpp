@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -28,8 +28,14 @@
 #include "doc/site.h"
 #include "doc/sprite.h"
 
+#include <algorithm>
+
 namespace {
 
+// Size of the tiles used to track the valid areas of the source and
+// destination canvas.
+const int kTileSize = 32;
+
 // We cannot have two ExpandCelCanvas instances at the same time
 // (because we share ImageBuffers between them).
 static app::ExpandCelCanvas* singleton = nullptr;
@@ -53,6 +59,55 @@ static void create_buffers()
   }
 }
 
+// Calls func(tx, ty) for each tile that intersects the given region
+// (in canvas coordinates when the origin is subtracted). A tile can
+// be visited several times.
+template<typename Func>
+static void for_each_tile(const gfx::Region& rgn,
+                          const gfx::Point& origin,
+                          const gfx::Size& tiles,
+                          Func func)
+{
+  const gfx::Rect tilesBounds(0, 0, tiles.w*kTileSize, tiles.h*kTileSize);
+
+  for (const auto& rgnRect : rgn) {
+    gfx::Rect rc(rgnRect);
+    rc.offset(-origin);
+    rc &= tilesBounds;
+    if (rc.isEmpty())
+      continue;
+
+    const int tx1 = rc.x / kTileSize;
+    const int ty1 = rc.y / kTileSize;
+    const int tx2 = (rc.x2()-1) / kTileSize;
+    const int ty2 = (rc.y2()-1) / kTileSize;
+    for (int ty=ty1; ty<=ty2; ++ty)
+      for (int tx=tx1; tx<=tx2; ++tx)
+        func(tx, ty);
+  }
+}
+
+// Copies the "rc" area of "src" (an image located at "srcPos") to
+// "dst". Pixels outside "src" are cleared.
+static void copy_from_source(doc::Image* dst,
+                             const doc::Image* src,
+                             const gfx::Point& srcPos,
+                             const gfx::Rect& rc)
+{
+  gfx::Rect inside;
+  if (src)
+    inside = rc.createIntersection(gfx::Rect(srcPos, src->size()));
+
+  if (inside != rc)
+    doc::fill_rect(dst, rc, dst->maskColor());
+
+  if (!inside.isEmpty())
+    dst->copy(src, gfx::Clip(inside.x, inside.y,
+                             inside.x-srcPos.x,
+                             inside.y-srcPos.y,
+                             inside.w, inside.h));
+}
+
 }
 
 namespace app {
@@ -117,6 +172,12 @@ ExpandCelCanvas::ExpandCelCanvas(
   // draw this cel).
   m_cel->setPosition(m_bounds.x, m_bounds.y);
 
+  // Nothing is valid at the beginning
+  m_tiles.w = (m_bounds.w + kTileSize - 1) / kTileSize;
+  m_tiles.h = (m_bounds.h + kTileSize - 1) / kTileSize;
+  m_validSrcTiles.resize(m_tiles.w*m_tiles.h, false);
+  m_validDstTiles.resize(m_tiles.w*m_tiles.h, false);
+
   if (m_celCreated) {
     getDestCanvas();
     m_cel->data()->setImage(m_dstImage);
@@ -189,20 +250,27 @@ void ExpandCelCanvas::commit()
 
     ASSERT(m_cel->image() == m_celImage.get());
 
-    gfx::Region* regionToPatch = &m_validDstRegion;
-    gfx::Region reduced;
-
-    if (m_canCompareSrcVsDst) {
-      ASSERT(gfx::Region().createSubtraction(m_validDstRegion, m_validSrcRegion).isEmpty());
-
-      for (gfx::Rect rc : m_validDstRegion) {
-        if (algorithm::shrink_bounds2(getSourceCanvas(),
-                                      getDestCanvas(), rc, rc)) {
-          reduced |= gfx::Region(rc);
+    // Patch only the modified area of each valid tile
+    gfx::Region regionToPatch;
+    for (int ty=0; ty<m_tiles.h; ++ty) {
+      for (int tx=0; tx<m_tiles.w; ++tx) {
+        if (!m_validDstTiles[ty*m_tiles.w+tx])
+          continue;
+
+        gfx::Rect rc = getTileBounds(tx, ty);
+        if (m_canCompareSrcVsDst) {
+          ASSERT(m_validSrcTiles[ty*m_tiles.w+tx]);
+          if (!algorithm::shrink_bounds2(getSourceCanvas(),
+                                         getDestCanvas(), rc, rc))
+            continue;
+        }
+        else {
+          // Join consecutive valid tiles of this row
+          while (tx+1 < m_tiles.w && m_validDstTiles[ty*m_tiles.w+tx+1])
+            rc |= getTileBounds(++tx, ty);
         }
+        regionToPatch |= gfx::Region(rc);
       }
-
-      regionToPatch = &reduced;
     }
 
     if (m_layer->isBackground()) {
@@ -210,7 +278,7 @@ void ExpandCelCanvas::commit()
         new cmd::CopyRegion(
           m_cel->image(),
           m_dstImage.get(),
-          *regionToPatch,
+          regionToPatch,
           m_bounds.origin()));
     }
     else {
@@ -218,7 +286,7 @@ void ExpandCelCanvas::commit()
         new cmd::PatchCel(
           m_cel,
           m_dstImage.get(),
-          *regionToPatch,
+          regionToPatch,
           m_bounds.origin()));
     }
   }
@@ -276,101 +344,79 @@ void ExpandCelCanvas::validateSourceCanvas(const gfx::Region& rgn)
 {
   getSourceCanvas();
 
-  gfx::Region rgnToValidate(rgn);
-  rgnToValidate.offset(-m_bounds.origin());
-  rgnToValidate.createSubtraction(rgnToValidate, m_validSrcRegion);
-  rgnToValidate.createIntersection(rgnToValidate, gfx::Region(m_srcImage->bounds()));
-
-  if (m_celImage) {
-    gfx::Region rgnToClear;
-    rgnToClear.createSubtraction(rgnToValidate,
-      gfx::Region(m_celImage->bounds()
-        .offset(m_origCelPos)
-        .offset(-m_bounds.origin())));
-    for (const auto& rc : rgnToClear)
-      fill_rect(m_srcImage.get(), rc, m_srcImage->maskColor());
-
-    for (const auto& rc : rgnToValidate)
-      m_srcImage->copy(m_celImage.get(),
-        gfx::Clip(rc.x, rc.y,
-          rc.x+m_bounds.x-m_origCelPos.x,
-          rc.y+m_bounds.y-m_origCelPos.y, rc.w, rc.h));
-  }
-  else {
-    for (const auto& rc : rgnToValidate)
-      fill_rect(m_srcImage.get(), rc, m_srcImage->maskColor());
-  }
-
-  m_validSrcRegion.createUnion(m_validSrcRegion, rgnToValidate);
+  for_each_tile(
+    rgn, m_bounds.origin(), m_tiles,
+    [this](int tx, int ty) {
+      if (!m_validSrcTiles[ty*m_tiles.w+tx])
+        validateSourceTile(tx, ty);
+    });
 }
 
 void ExpandCelCanvas::validateDestCanvas(const gfx::Region& rgn)
 {
-  Image* src;
-  int src_x, src_y;
-  if ((m_flags & NeedsSource) == NeedsSource) {
+  if ((m_flags & NeedsSource) == NeedsSource)
     validateSourceCanvas(rgn);
-    src = m_srcImage.get();
-    src_x = m_bounds.x;
-    src_y = m_bounds.y;
-  }
-  else {
-    src = m_celImage.get();
-    src_x = m_origCelPos.x;
-    src_y = m_origCelPos.y;
-  }
 
   getDestCanvas();
 
-  gfx::Region rgnToValidate(rgn);
-  rgnToValidate.offset(-m_bounds.origin());
-  rgnToValidate.createSubtraction(rgnToValidate, m_validDstRegion);
-  rgnToValidate.createIntersection(rgnToValidate, gfx::Region(m_dstImage->bounds()));
-
-  if (src) {
-    gfx::Region rgnToClear;
-    rgnToClear.createSubtraction(rgnToValidate,
-      gfx::Region(src->bounds()
-        .offset(src_x, src_y)
-        .offset(-m_bounds.origin())));
-    for (const auto& rc : rgnToClear)
-      fill_rect(m_dstImage.get(), rc, m_dstImage->maskColor());
-
-    for (const auto& rc : rgnToValidate)
-      m_dstImage->copy(src,
-        gfx::Clip(rc.x, rc.y,
-          rc.x+m_bounds.x-src_x,
-          rc.y+m_bounds.y-src_y, rc.w, rc.h));
-  }
-  else {
-    for (const auto& rc : rgnToValidate)
-      fill_rect(m_dstImage.get(), rc, m_dstImage->maskColor());
-  }
-
-  m_validDstRegion.createUnion(m_validDstRegion, rgnToValidate);
+  for_each_tile(
+    rgn, m_bounds.origin(), m_tiles,
+    [this](int tx, int ty) {
+      if (!m_validDstTiles[ty*m_tiles.w+tx])
+        validateDestTile(tx, ty);
+    });
 }
 
 void ExpandCelCanvas::invalidateDestCanvas()
 {
-  m_validDstRegion.clear();
+  std::fill(m_validDstTiles.begin(), m_validDstTiles.end(), false);
 }
 
 void ExpandCelCanvas::invalidateDestCanvas(const gfx::Region& rgn)
 {
-  gfx::Region rgnToInvalidate(rgn);
-  rgnToInvalidate.offset(-m_bounds.origin());
-  m_validDstRegion.createSubtraction(m_validDstRegion, rgnToInvalidate);
+  // Tiles are kept valid, and only the given region is restored from
+  // the source (other pixels of the same tiles can be modified).
+  if ((m_flags & NeedsSource) == NeedsSource)
+    validateSourceCanvas(rgn);
+
+  const gfx::Rect canvasBounds(0, 0, m_bounds.w, m_bounds.h);
+  for (const auto& rgnRect : rgn) {
+    gfx::Rect rc(rgnRect);
+    rc.offset(-m_bounds.origin());
+    rc &= canvasBounds;
+    if (rc.isEmpty())
+      continue;
+
+    for (int ty=rc.y/kTileSize; ty<=(rc.y2()-1)/kTileSize; ++ty) {
+      for (int tx=rc.x/kTileSize; tx<=(rc.x2()-1)/kTileSize; ++tx) {
+        if (m_validDstTiles[ty*m_tiles.w+tx])
+          restoreDestRect(rc.createIntersection(getTileBounds(tx, ty)));
+      }
+    }
+  }
 }
 
 void ExpandCelCanvas::copyValidDestToSourceCanvas(const gfx::Region& rgn)
 {
-  gfx::Region rgn2(rgn);
-  rgn2.offset(-m_bounds.origin());
-  rgn2.createIntersection(rgn2, m_validSrcRegion);
-  rgn2.createIntersection(rgn2, m_validDstRegion);
-  for (const auto& rc : rgn2)
-    m_srcImage->copy(m_dstImage.get(),
-      gfx::Clip(rc.x, rc.y, rc.x, rc.y, rc.w, rc.h));
+  const gfx::Rect canvasBounds(0, 0, m_bounds.w, m_bounds.h);
+  for (const auto& rgnRect : rgn) {
+    gfx::Rect rc(rgnRect);
+    rc.offset(-m_bounds.origin());
+    rc &= canvasBounds;
+    if (rc.isEmpty())
+      continue;
+
+    for (int ty=rc.y/kTileSize; ty<=(rc.y2()-1)/kTileSize; ++ty) {
+      for (int tx=rc.x/kTileSize; tx<=(rc.x2()-1)/kTileSize; ++tx) {
+        const int i = ty*m_tiles.w+tx;
+        if (m_validSrcTiles[i] && m_validDstTiles[i]) {
+          const gfx::Rect tileRc = rc.createIntersection(getTileBounds(tx, ty));
+          m_srcImage->copy(m_dstImage.get(),
+            gfx::Clip(tileRc.x, tileRc.y, tileRc.x, tileRc.y, tileRc.w, tileRc.h));
+        }
+      }
+    }
+  }
 
   // We cannot compare src vs dst in this case (e.g. on tools like
   // spray and jumble that updated the source image form the modified
@@ -378,6 +424,45 @@ void ExpandCelCanvas::copyValidDestToSourceCanvas(const gfx::Region& rgn)
   m_canCompareSrcVsDst = false;
 }
 
+gfx::Rect ExpandCelCanvas::getTileBounds(int tx, int ty) const
+{
+  return gfx::Rect(tx*kTileSize, ty*kTileSize, kTileSize, kTileSize)
+    .createIntersection(gfx::Rect(0, 0, m_bounds.w, m_bounds.h));
+}
+
+void ExpandCelCanvas::validateSourceTile(int tx, int ty)
+{
+  copy_from_source(m_srcImage.get(),
+                   m_celImage.get(),
+                   m_origCelPos - m_bounds.origin(),
+                   getTileBounds(tx, ty));
+
+  m_validSrcTiles[ty*m_tiles.w+tx] = true;
+}
+
+void ExpandCelCanvas::validateDestTile(int tx, int ty)
+{
+  restoreDestRect(getTileBounds(tx, ty));
+
+  m_validDstTiles[ty*m_tiles.w+tx] = true;
+}
+
+// Copies the given area (in canvas coordinates) from the source
+// canvas (or the cel image if we don't need the source canvas) to
+// the destination canvas.
+void ExpandCelCanvas::restoreDestRect(const gfx::Rect& rc)
+{
+  if ((m_flags & NeedsSource) == NeedsSource) {
+    ASSERT(m_validSrcTiles[(rc.y/kTileSize)*m_tiles.w + rc.x/kTileSize]);
+    copy_from_source(m_dstImage.get(), m_srcImage.get(),
+                     gfx::Point(0, 0), rc);
+  }
+  else {
+    copy_from_source(m_dstImage.get(), m_celImage.get(),
+                     m_origCelPos - m_bounds.origin(), rc);
+  }
+}
+
 gfx::Rect ExpandCelCanvas::getTrimDstImageBounds() const
 {
   if (m_layer->isBackground())
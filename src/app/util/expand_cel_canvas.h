@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -16,6 +16,8 @@
 #include "gfx/region.h"
 #include "gfx/size.h"
 
+#include <vector>
+
 namespace doc {
   class Cel;
   class Image;
@@ -73,6 +75,11 @@ namespace app {
     gfx::Rect getTrimDstImageBounds() const;
     ImageRef trimDstImage(const gfx::Rect& bounds) const;
 
+    gfx::Rect getTileBounds(int tx, int ty) const;
+    void validateSourceTile(int tx, int ty);
+    void validateDestTile(int tx, int ty);
+    void restoreDestRect(const gfx::Rect& rc);
+
     Document* m_document;
     Sprite* m_sprite;
     Layer* m_layer;
@@ -88,8 +95,12 @@ namespace app {
     bool m_closed;
     bool m_committed;
     Transaction& m_transaction;
-    gfx::Region m_validSrcRegion;
-    gfx::Region m_validDstRegion;
+
+    // Valid areas of m_srcImage and m_dstImage as tiles of the
+    // canvas (m_tiles is the number of columns and rows of tiles).
+    gfx::Size m_tiles;
+    std::vector<bool> m_validSrcTiles;
+    std::vector<bool> m_validDstTiles;
 
     // True if we can compare src image with dst image to patch the
     // cel. This is false when dst is copied to the src, so we cannot
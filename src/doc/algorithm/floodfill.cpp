@@ -1,344 +1,443 @@
-// The floodfill routine.
-// By Shawn Hargreaves.
-//
-// Changes by David Capello:
-// - Adapted to Aseprite
-// - Added non-contiguous mode
-// - Added mask parameter
+// Aseprite Document Library
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
-//
-// TODO rewrite this algorithm from scratch
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#include "doc/algorithm/floodfill.h"
+
 #include "base/base.h"
-#include "doc/algo.h"
+#include "base/unique_ptr.h"
 #include "doc/image.h"
+#include "doc/image_impl.h"
 #include "doc/mask.h"
+#include "doc/mask_runs.h"
 #include "doc/primitives.h"
-#include "doc/primitives_fast.h"
+#include "gfx/rect.h"
 
-#include <climits>
-#include <cmath>
+#include <algorithm>
 #include <vector>
 
 namespace doc {
 namespace algorithm {
 
-struct FLOODED_LINE {   // store segments which have been flooded
-  short flags;          // status of the segment
-  short lpos, rpos;     // left and right ends of segment
-  short y;              // y coordinate of the segment
-  int next;             // linked list if several per line
-};
+namespace {
 
-/* Note: a 'short' is not sufficient for 'next' above in some corner cases. */
+// Number of pixels compared together to skip a long sequence of
+// pixels. The comparisons of a block are done without branches, so the
+// compiler can vectorize them.
+const int kBlockSize = 16;
 
+// Functors to know if a pixel is equal (ExactMatch) or similar
+// (ToleranceMatch) to the source color of the fill. Two transparent
+// pixels are always equal (no matter their RGB values). They don't use
+// branches, so loops that check several pixels can be vectorized.
 
-static std::vector<FLOODED_LINE> flood_buf;
-static int flood_count;          /* number of flooded segments */
+template<typename ImageTraits>
+class ExactMatch {
+public:
+  ExactMatch(color_t src)
+    : m_src(src) {
+  }
 
-#define FLOOD_IN_USE             1
-#define FLOOD_TODO_ABOVE         2
-#define FLOOD_TODO_BELOW         4
+  bool operator()(typename ImageTraits::pixel_t c) const {
+    return (c == m_src);
+  }
 
-#define FLOOD_LINE(c)            (&flood_buf[c])
+private:
+  typename ImageTraits::pixel_t m_src;
+};
 
-static inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
-{
-  if (tolerance == 0)
-    return (c1 == c2) || (rgba_geta(c1) == 0 && rgba_geta(c2) == 0);
-  else {
-    int r1 = rgba_getr(c1);
-    int g1 = rgba_getg(c1);
-    int b1 = rgba_getb(c1);
-    int a1 = rgba_geta(c1);
-    int r2 = rgba_getr(c2);
-    int g2 = rgba_getg(c2);
-    int b2 = rgba_getb(c2);
-    int a2 = rgba_geta(c2);
-
-    if (a1 == 0 && a2 == 0)
-      return true;
-
-    return ((ABS(r1-r2) <= tolerance) &&
-            (ABS(g1-g2) <= tolerance) &&
-            (ABS(b1-b2) <= tolerance) &&
-            (ABS(a1-a2) <= tolerance));
+template<>
+class ExactMatch<RgbTraits> {
+public:
+  ExactMatch(color_t src)
+    : m_src(src)
+    , m_transparent(rgba_geta(src) == 0) {
   }
-}
 
-static inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
-{
-  if (tolerance == 0)
-    return (c1 == c2) || (graya_geta(c1) == 0 && graya_geta(c2) == 0);
-  else {
-    int k1 = graya_getv(c1);
-    int a1 = graya_geta(c1);
-    int k2 = graya_getv(c2);
-    int a2 = graya_geta(c2);
-
-    if (a1 == 0 && a2 == 0)
-      return true;
-
-    return ((ABS(k1-k2) <= tolerance) &&
-            (ABS(a1-a2) <= tolerance));
+  bool operator()(RgbTraits::pixel_t c) const {
+    return (c == m_src) | (m_transparent & ((c & rgba_a_mask) == 0));
   }
-}
 
-static inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
-{
-  if (tolerance == 0)
-    return (c1 == c2);
-  else
-    return ABS((int)c1 - (int)c2) <= tolerance;
-}
+private:
+  RgbTraits::pixel_t m_src;
+  bool m_transparent;
+};
+
+template<>
+class ExactMatch<GrayscaleTraits> {
+public:
+  ExactMatch(color_t src)
+    : m_src(src)
+    , m_transparent(graya_geta(src) == 0) {
+  }
+
+  bool operator()(GrayscaleTraits::pixel_t c) const {
+    return (c == m_src) | (m_transparent & ((c & graya_a_mask) == 0));
+  }
+
+private:
+  GrayscaleTraits::pixel_t m_src;
+  bool m_transparent;
+};
 
 template<typename ImageTraits>
-static inline bool color_equal(color_t c1, color_t c2, int tolerance)
-{
+class ToleranceMatch {
   static_assert(false && sizeof(ImageTraits), "Invalid color comparison");
-  return false;
-}
-
-template<>
-inline bool color_equal<RgbTraits>(color_t c1, color_t c2, int tolerance)
-{
-  return color_equal_32(c1, c2, tolerance);
-}
+};
 
 template<>
-inline bool color_equal<GrayscaleTraits>(color_t c1, color_t c2, int tolerance)
-{
-  return color_equal_16(c1, c2, tolerance);
-}
+class ToleranceMatch<RgbTraits> {
+public:
+  ToleranceMatch(color_t src, int tolerance)
+    : m_r(rgba_getr(src))
+    , m_g(rgba_getg(src))
+    , m_b(rgba_getb(src))
+    , m_a(rgba_geta(src))
+    , m_tolerance(tolerance)
+    , m_range(2*tolerance) {
+  }
 
-template<>
-inline bool color_equal<IndexedTraits>(color_t c1, color_t c2, int tolerance)
-{
-  return color_equal_8(c1, c2, tolerance);
-}
+  bool operator()(RgbTraits::pixel_t c) const {
+    const int a = rgba_geta(c);
+    return
+      ((m_a == 0) & (a == 0)) |
+      ((unsigned(int(rgba_getr(c)) - m_r + m_tolerance) <= m_range) &
+       (unsigned(int(rgba_getg(c)) - m_g + m_tolerance) <= m_range) &
+       (unsigned(int(rgba_getb(c)) - m_b + m_tolerance) <= m_range) &
+       (unsigned(a - m_a + m_tolerance) <= m_range));
+  }
 
+private:
+  int m_r, m_g, m_b, m_a;
+  int m_tolerance;
+  unsigned m_range;
+};
 
+template<>
+class ToleranceMatch<GrayscaleTraits> {
+public:
+  ToleranceMatch(color_t src, int tolerance)
+    : m_v(graya_getv(src))
+    , m_a(graya_geta(src))
+    , m_tolerance(tolerance)
+    , m_range(2*tolerance) {
+  }
 
-/* flooder:
- *  Fills a horizontal line around the specified position, and adds it
- *  to the list of drawn segments. Returns the first x coordinate after
- *  the part of the line which it has dealt with.
- */
-static int flooder(const Image* image,
-                   const Mask* mask,
-                   int x, int y,
-                   const gfx::Rect& bounds,
-                   color_t src_color, int tolerance, void *data, AlgoHLine proc)
-{
-#define MASKED(u, v)                                                    \
-        (mask &&                                                        \
-         (!mask->bounds().contains(u, v) ||                             \
-          (mask->bitmap() &&                                            \
-           !get_pixel_fast<BitmapTraits>(mask->bitmap(),                \
-                                         (u)-mask->bounds().x,          \
-                                         (v)-mask->bounds().y))))
-
-  FLOODED_LINE *p;
-  int left = 0, right = 0;
-  int c;
+  bool operator()(GrayscaleTraits::pixel_t c) const {
+    const int a = graya_geta(c);
+    return
+      ((m_a == 0) & (a == 0)) |
+      ((unsigned(int(graya_getv(c)) - m_v + m_tolerance) <= m_range) &
+       (unsigned(a - m_a + m_tolerance) <= m_range));
+  }
 
-  switch (image->pixelFormat()) {
+private:
+  int m_v, m_a;
+  int m_tolerance;
+  unsigned m_range;
+};
 
-    case IMAGE_RGB:
-      {
-        uint32_t* address = reinterpret_cast<uint32_t*>(image->getPixelAddress(0, y));
+template<>
+class ToleranceMatch<IndexedTraits> {
+public:
+  ToleranceMatch(color_t src, int tolerance)
+    : m_index(src)
+    , m_tolerance(tolerance)
+    , m_range(2*tolerance) {
+  }
 
-        // Check start pixel
-        if (!color_equal_32((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
+  bool operator()(IndexedTraits::pixel_t c) const {
+    return (unsigned(int(c) - m_index + m_tolerance) <= m_range);
+  }
 
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_32((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
+private:
+  int m_index;
+  int m_tolerance;
+  unsigned m_range;
+};
 
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_32((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
+// Returns the first pixel in [x, x2) where match(pixel) != Value, or
+// x2 if all pixels are equal to Value.
+template<bool Value, typename Pixel, typename Match>
+int skip_right(const Pixel* row, int x, int x2, const Match& match)
+{
+  while (x2-x >= kBlockSize) {
+    int n = 0;
+    for (int i=0; i<kBlockSize; ++i)
+      n += (match(row[x+i]) == Value);
+    if (n < kBlockSize)
       break;
+    x += kBlockSize;
+  }
+  while (x < x2 && match(row[x]) == Value)
+    ++x;
+  return x;
+}
 
-    case IMAGE_GRAYSCALE:
-      {
-        uint16_t* address = reinterpret_cast<uint16_t*>(image->getPixelAddress(0, y));
-
-        // Check start pixel
-        if (!color_equal_16((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
+// Returns the leftmost pixel in [x1, x] so all pixels in [result, x)
+// have match(pixel) == Value.
+template<bool Value, typename Pixel, typename Match>
+int skip_left(const Pixel* row, int x, int x1, const Match& match)
+{
+  while (x-x1 >= kBlockSize) {
+    int n = 0;
+    for (int i=1; i<=kBlockSize; ++i)
+      n += (match(row[x-i]) == Value);
+    if (n < kBlockSize)
+      break;
+    x -= kBlockSize;
+  }
+  while (x > x1 && match(row[x-1]) == Value)
+    --x;
+  return x;
+}
 
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_16((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
+// Contiguous fill using a stack of filled spans. Each time a span is
+// filled, the rows above and below it are scanned to find new spans.
+// Pixels that were already filled are marked in a bit table (so we
+// don't depend on the result of "proc" to know what was filled).
+template<typename ImageTraits, typename Match>
+class ScanlineFill {
+  typedef typename ImageTraits::pixel_t pixel_t;
+
+  // Filled [x1, x2) segment of the y row
+  struct Span {
+    int x1, x2, y;
+    Span(int x1, int x2, int y) : x1(x1), x2(x2), y(y) { }
+  };
+
+public:
+  ScanlineFill(const Image* image,
+               const Mask* mask,
+               const gfx::Rect& bounds,
+               const Match& match,
+               void* data,
+               AlgoHLine proc)
+    : m_image(image)
+    , m_bounds(bounds)
+    , m_match(match)
+    , m_data(data)
+    , m_proc(proc)
+    , m_filled(bounds.h) {
+    if (mask) {
+      m_maskRuns.reset(new MaskRuns(mask));
+      m_maskBounds = m_maskRuns->bounds();
+    }
+  }
 
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_16((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
+  void fill(int x, int y) {
+    scanRow(y, x, x+1);
 
-    case IMAGE_INDEXED:
-      {
-        uint8_t* address = image->getPixelAddress(0, y);
+    while (!m_stack.empty()) {
+      Span span = m_stack.back();
+      m_stack.pop_back();
 
-        // Check start pixel
-        if (!color_equal_8((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
+      if (span.y > m_bounds.y)
+        scanRow(span.y-1, span.x1, span.x2);
+      if (span.y+1 < m_bounds.y2())
+        scanRow(span.y+1, span.x1, span.x2);
+    }
+  }
 
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_8((int)*(address+left), src_color, tolerance) || MASKED(left, y))
+private:
+  // Fills all non-filled spans of the "y" row that touch the [x1, x2)
+  // segment.
+  void scanRow(int y, int x1, int x2) {
+    const pixel_t* row = (const pixel_t*)m_image->getPixelConstAddress(0, y);
+
+    forEachPaintableSegment(
+      y, x1, x2,
+      [this, row, y, x1, x2](int a, int b) {
+        int x = std::max(a, x1);
+        const int end = std::min(b, x2);
+
+        while (x < end) {
+          x = skipFilled(x, end, y);
+          if (x == end)
             break;
-        }
 
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_8((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
+          if (!m_match(row[x])) {
+            x = skip_right<false>(row, x+1, end, m_match);
+            continue;
+          }
+
+          // Extend the span to the left/right limits of the paintable
+          // segment (not only the [x1, x2) range)
+          int s1 = skip_left<true>(row, x, a, m_match);
+          int s2 = skip_right<true>(row, x+1, b, m_match);
+          addSpan(s1, s2, y);
+          x = s2+1;
         }
-      }
-      break;
-
-    default:
-      // Check start pixel
-      if (get_pixel(image, x, y) != src_color || MASKED(x, y))
-        return x+1;
-
-      // Work left from starting point
-      for (left=x-1; left>=bounds.x; left--) {
-        if (get_pixel(image, left, y) != src_color || MASKED(left, y))
-          break;
-      }
-
-      // Work right from starting point
-      for (right=x+1; right<bounds.x2(); right++) {
-        if (get_pixel(image, right, y) != src_color || MASKED(right, y))
-          break;
-      }
-      break;
+      });
   }
 
-  left++;
-  right--;
+  // Calls func(a, b) for each [a, b) segment of the "y" row inside the
+  // fill bounds and the mask that touches the [x1, x2) range.
+  template<typename Func>
+  void forEachPaintableSegment(int y, int x1, int x2, Func func) {
+    if (!m_maskRuns) {
+      func(m_bounds.x, m_bounds.x2());
+      return;
+    }
 
-  /* draw the line */
-  (*proc)(left, y, right, data);
+    if (y < m_maskBounds.y || y >= m_maskBounds.y2())
+      return;
 
-  /* store it in the list of flooded segments */
-  c = y;
-  p = FLOOD_LINE(c);
+    const MaskRuns::Runs& runs = m_maskRuns->row(y-m_maskBounds.y);
+    const int u1 = x1-m_maskBounds.x;
+    const int u2 = x2-m_maskBounds.x;
 
-  if (p->flags) {
-    while (p->next) {
-      c = p->next;
-      p = FLOOD_LINE(c);
-    }
+    auto it = std::upper_bound(
+      runs.begin(), runs.end(), u1,
+      [](int u, const MaskRuns::Run& run) { return u < run.x2; });
 
-    p->next = c = flood_count++;
-    flood_buf.resize(flood_count);
-    p = FLOOD_LINE(c);
+    for (; it != runs.end() && it->x1 < u2; ++it) {
+      int a = std::max(it->x1+m_maskBounds.x, m_bounds.x);
+      int b = std::min(it->x2+m_maskBounds.x, m_bounds.x2());
+      if (a < b)
+        func(a, b);
+    }
   }
 
-  p->flags = FLOOD_IN_USE;
-  p->lpos = left;
-  p->rpos = right;
-  p->y = y;
-  p->next = 0;
+  void addSpan(int x1, int x2, int y) {
+    ASSERT(x1 < x2);
+    (*m_proc)(x1, y, x2-1, m_data);
+
+    // Rows of the table are allocated only when they are used
+    std::vector<uint32_t>& filled = m_filled[y-m_bounds.y];
+    if (filled.empty())
+      filled.resize((m_bounds.w+31) / 32, 0);
+
+    int u = x1-m_bounds.x;
+    const int u2 = x2-m_bounds.x;
+    for (; u<u2 && (u & 31); ++u)
+      filled[u >> 5] |= (1u << (u & 31));
+    for (; u+32<=u2; u+=32)
+      filled[u >> 5] = 0xffffffff;
+    for (; u<u2; ++u)
+      filled[u >> 5] |= (1u << (u & 31));
+
+    m_stack.push_back(Span(x1, x2, y));
+  }
 
-  if (y > bounds.y)
-    p->flags |= FLOOD_TODO_ABOVE;
+  // Returns the first non-filled pixel in [x, x2).
+  int skipFilled(int x, int x2, int y) const {
+    const std::vector<uint32_t>& filled = m_filled[y-m_bounds.y];
+    if (filled.empty())
+      return x;
+
+    int u = x-m_bounds.x;
+    const int u2 = x2-m_bounds.x;
+    while (u < u2) {
+      uint32_t bits = filled[u >> 5];
+      if (bits == 0xffffffff)
+        u = (u | 31)+1;
+      else if (bits & (1u << (u & 31)))
+        ++u;
+      else
+        break;
+    }
+    return std::min(u, u2)+m_bounds.x;
+  }
 
-  if (y+1 < bounds.y2())
-    p->flags |= FLOOD_TODO_BELOW;
+  const Image* m_image;
+  gfx::Rect m_bounds;
+  Match m_match;
+  void* m_data;
+  AlgoHLine m_proc;
+  base::UniquePtr<MaskRuns> m_maskRuns;
+  gfx::Rect m_maskBounds;
+  std::vector<std::vector<uint32_t> > m_filled;
+  std::vector<Span> m_stack;
+};
 
-  return right+2;
+template<typename ImageTraits, typename Match>
+void contiguous_fill(const Image* image,
+                     const Mask* mask,
+                     int x, int y,
+                     const gfx::Rect& bounds,
+                     const Match& match,
+                     void* data,
+                     AlgoHLine proc)
+{
+  ScanlineFill<ImageTraits, Match> fill(image, mask, bounds, match, data, proc);
+  fill.fill(x, y);
 }
 
-
-
-/* check_flood_line:
- *  Checks a line segment, using the scratch buffer is to store a list of
- *  segments which have already been drawn in order to minimise the required
- *  number of tests.
- */
-static int check_flood_line(const Image* image,
-                            const Mask* mask,
-                            int y, int left, int right,
-                            const gfx::Rect& bounds,
-                            int src_color, int tolerance, void *data, AlgoHLine proc)
+// Non-contiguous case, all pixels of the given color in the bounds
+// are filled (the mask is not used).
+template<typename ImageTraits, typename Match>
+void replace_color(const Image* image,
+                   const gfx::Rect& bounds,
+                   const Match& match,
+                   void* data,
+                   AlgoHLine proc)
 {
-  int c;
-  FLOODED_LINE *p;
-  int ret = false;
-
-  while (left <= right) {
-    c = y;
+  typedef typename ImageTraits::pixel_t pixel_t;
 
-    for (;;) {
-      p = FLOOD_LINE(c);
+  for (int y=bounds.y; y<bounds.y2(); ++y) {
+    const pixel_t* row = (const pixel_t*)image->getPixelConstAddress(0, y);
 
-      if ((left >= p->lpos) && (left <= p->rpos)) {
-        left = p->rpos+2;
+    for (int x=bounds.x; x<bounds.x2(); ) {
+      x = skip_right<false>(row, x, bounds.x2(), match);
+      if (x == bounds.x2())
         break;
-      }
-
-      c = p->next;
 
-      if (!c) {
-        left = flooder(image, mask, left, y, bounds, src_color, tolerance, data, proc);
-        ret = true;
-        break;
-      }
+      int right = skip_right<true>(row, x+1, bounds.x2(), match);
+      (*proc)(x, y, right-1, data);
+      x = right;
     }
   }
+}
 
-  return ret;
+template<typename ImageTraits, typename Match>
+void floodfill_with_match(const Image* image,
+                          const Mask* mask,
+                          int x, int y,
+                          const gfx::Rect& bounds,
+                          const Match& match,
+                          bool contiguous,
+                          void* data,
+                          AlgoHLine proc)
+{
+  if (contiguous)
+    contiguous_fill<ImageTraits>(image, mask, x, y, bounds, match, data, proc);
+  else
+    replace_color<ImageTraits>(image, bounds, match, data, proc);
 }
 
 template<typename ImageTraits>
-static void replace_color(const Image* image, const gfx::Rect& bounds, int src_color, int tolerance, void* data, AlgoHLine proc)
+void floodfill_templ(const Image* image,
+                     const Mask* mask,
+                     int x, int y,
+                     const gfx::Rect& bounds,
+                     color_t src_color, int tolerance,
+                     bool contiguous,
+                     void* data,
+                     AlgoHLine proc)
 {
-  typename ImageTraits::address_t address;
-
-  for (int y=bounds.y; y<bounds.y2(); ++y) {
-    address = reinterpret_cast<typename ImageTraits::address_t>(image->getPixelAddress(bounds.x, y));
-
-    for (int x=bounds.x; x<bounds.x2(); ++x, ++address) {
-      int right = -1;
-
-      if (color_equal<ImageTraits>((int)(*address), src_color, tolerance)) {
-        ++address;
-        for (right=x+1; right<bounds.x2(); ++right, ++address) {
-          if (!color_equal<ImageTraits>((int)(*address), src_color, tolerance))
-            break;
-        }
-        (*proc)(x, y, right-1, data);
-        x = right;
-      }
-    }
-  }
+  if (tolerance == 0)
+    floodfill_with_match<ImageTraits>(
+      image, mask, x, y, bounds,
+      ExactMatch<ImageTraits>(src_color),
+      contiguous, data, proc);
+  else
+    floodfill_with_match<ImageTraits>(
+      image, mask, x, y, bounds,
+      ToleranceMatch<ImageTraits>(src_color, tolerance),
+      contiguous, data, proc);
 }
 
-/* floodfill:
- *  Fills an enclosed area (starting at point x, y) with the specified color.
- */
+} // anonymous namespace
+
+// Fills the area connected to the pixel (x, y) (4-connected
+// neighbors) of a similar color (using the given tolerance).
 void floodfill(const Image* image,
                const Mask* mask,
                int x, int y,
@@ -352,73 +451,24 @@ void floodfill(const Image* image,
       (y < 0) || (y >= image->height()))
     return;
 
+  const gfx::Rect rc = bounds.createIntersection(image->bounds());
+  if (!rc.contains(gfx::Point(x, y)))
+    return;
+
   // What color to replace?
   color_t src_color = get_pixel(image, x, y);
 
-  // Non-contiguous case, we replace colors in the whole image.
-  if (!contiguous) {
-    switch (image->pixelFormat()) {
-      case IMAGE_RGB:
-        replace_color<RgbTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-      case IMAGE_GRAYSCALE:
-        replace_color<GrayscaleTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-      case IMAGE_INDEXED:
-        replace_color<IndexedTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-    }
-    return;
-  }
-
-  /* set up the list of flooded segments */
-  flood_buf.resize(image->height());
-  flood_count = image->height();
-  FLOODED_LINE* p = (FLOODED_LINE*)&flood_buf[0];
-  for (int c=0; c<flood_count; c++) {
-    p[c].flags = 0;
-    p[c].lpos = SHRT_MAX;
-    p[c].rpos = SHRT_MIN;
-    p[c].y = y;
-    p[c].next = 0;
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      floodfill_templ<RgbTraits>(image, mask, x, y, rc, src_color, tolerance, contiguous, data, proc);
+      break;
+    case IMAGE_GRAYSCALE:
+      floodfill_templ<GrayscaleTraits>(image, mask, x, y, rc, src_color, tolerance, contiguous, data, proc);
+      break;
+    case IMAGE_INDEXED:
+      floodfill_templ<IndexedTraits>(image, mask, x, y, rc, src_color, tolerance, contiguous, data, proc);
+      break;
   }
-
-  // Start up the flood algorithm
-  flooder(image, mask, x, y, bounds, src_color, tolerance, data, proc);
-
-  // Continue as long as there are some segments still to test
-  bool done;
-  do {
-    done = true;
-
-    // For each line on the screen
-    for (int c=0; c<flood_count; c++) {
-
-      p = FLOOD_LINE(c);
-
-      // Check below the segment?
-      if (p->flags & FLOOD_TODO_BELOW) {
-        p->flags &= ~FLOOD_TODO_BELOW;
-        if (check_flood_line(image, mask, p->y+1, p->lpos, p->rpos, bounds,
-            src_color, tolerance, data, proc)) {
-          done = false;
-          p = FLOOD_LINE(c);
-        }
-      }
-
-      // Check above the segment?
-      if (p->flags & FLOOD_TODO_ABOVE) {
-        p->flags &= ~FLOOD_TODO_ABOVE;
-        if (check_flood_line(image, mask, p->y-1, p->lpos, p->rpos, bounds,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-          // Special case shortcut for going backwards
-          if ((c > bounds.y) && (c < bounds.y2()))
-            c -= 2;
-        }
-      }
-    }
-  } while (!done);
 }
 
 } // namespace algorithm
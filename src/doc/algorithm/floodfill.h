@@ -18,6 +18,10 @@ namespace doc {
 
   namespace algorithm {
 
+    // Calls "proc" for each horizontal segment of pixels similar to
+    // the (x, y) pixel (using the given tolerance) inside the bounds.
+    // If "contiguous" is true, only the area connected to (x, y)
+    // (4-connected and inside the mask) is filled.
     void floodfill(const Image* image,
                    const Mask* mask,
                    int x, int y,
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -10,14 +10,18 @@
 
 #include "doc/algorithm/resize_image.h"
 
+#include "base/pi.h"
 #include "doc/algorithm/rotsprite.h"
 #include "doc/image_impl.h"
 #include "doc/palette.h"
 #include "doc/primitives_fast.h"
 #include "doc/rgbmap.h"
+#include "doc/thread_pool.h"
 #include "gfx/point.h"
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 namespace doc {
 namespace algorithm {
@@ -41,8 +45,320 @@ void resize_image_nearest(const Image* src, Image* dst)
   }
 }
 
+namespace {
+
+// Minimum number of rows processed by each thread
+const int kRowsPerTask = 16;
+
+// Precision of the weights used to interpolate pixels
+const int kWeightBits = 14;
+
+// Each class converts pixels of some image format to channels that
+// can be interpolated (indexed images are interpolated in RGBA and
+// then mapped back to the palette).
+class RgbPixels {
+public:
+  typedef RgbTraits Traits;
+  enum { Channels = 4 };
+
+  void split(RgbTraits::pixel_t c, int* v) const {
+    v[0] = rgba_getr(c);
+    v[1] = rgba_getg(c);
+    v[2] = rgba_getb(c);
+    v[3] = rgba_geta(c);
+  }
+
+  RgbTraits::pixel_t join(const int* v) const {
+    return rgba(v[0], v[1], v[2], v[3]);
+  }
+};
+
+class GrayscalePixels {
+public:
+  typedef GrayscaleTraits Traits;
+  enum { Channels = 2 };
+
+  void split(GrayscaleTraits::pixel_t c, int* v) const {
+    v[0] = graya_getv(c);
+    v[1] = graya_geta(c);
+  }
+
+  GrayscaleTraits::pixel_t join(const int* v) const {
+    return graya(v[0], v[1]);
+  }
+};
+
+class IndexedPixels {
+public:
+  typedef IndexedTraits Traits;
+  enum { Channels = 4 };
+
+  IndexedPixels(const Palette* pal, const RgbMap* rgbmap, color_t maskColor)
+    : m_pal(pal), m_rgbmap(rgbmap), m_maskColor(maskColor) {
+  }
+
+  void split(IndexedTraits::pixel_t c, int* v) const {
+    color_t rgba = m_pal->getEntry(c);
+    if (c == m_maskColor)
+      rgba &= rgba_rgb_mask; // Set alpha = 0
+    m_rgb.split(rgba, v);
+  }
+
+  IndexedTraits::pixel_t join(const int* v) const {
+    return m_rgbmap->mapColor(v[0], v[1], v[2], v[3]);
+  }
+
+private:
+  const Palette* m_pal;
+  const RgbMap* m_rgbmap;
+  color_t m_maskColor;
+  RgbPixels m_rgb;
+};
+
+// Source pixels (and the weight of the second one, from 0 to 256)
+// for a pixel of the destination image in one axis.
+struct BilinearTap {
+  int i1, i2, weight;
+};
+
+std::vector<BilinearTap> calc_bilinear_taps(int srcSize, int dstSize)
+{
+  std::vector<BilinearTap> taps(dstSize);
+  for (int i=0; i<dstSize; ++i) {
+    // First and last pixels of both images are aligned
+    const int pos = (dstSize > 1 ? int(int64_t(i) * (srcSize-1) * 256 / (dstSize-1)): 0);
+    BilinearTap& tap = taps[i];
+    tap.i1 = std::min(pos >> 8, srcSize-1);
+    tap.i2 = std::min(tap.i1+1, srcSize-1);
+    tap.weight = (pos & 255);
+  }
+  return taps;
+}
+
+template<typename Pixels>
+void resize_image_bilinear(const Image* src, Image* dst, const Pixels& pixels)
+{
+  typedef typename Pixels::Traits Traits;
+  const int N = Pixels::Channels;
+
+  const std::vector<BilinearTap> xTaps = calc_bilinear_taps(src->width(), dst->width());
+  const std::vector<BilinearTap> yTaps = calc_bilinear_taps(src->height(), dst->height());
+
+  parallel_for(
+    0, dst->height(), kRowsPerTask,
+    [&](int begin, int end) {
+      int c[4][N], v[N];
+
+      for (int y=begin; y<end; ++y) {
+        const BilinearTap& ty = yTaps[y];
+        const int wy2 = ty.weight;
+        const int wy1 = 256 - wy2;
+        const int width = dst->width();
+        auto row1 = get_pixel_const_address_fast<Traits>(src, 0, ty.i1);
+        auto row2 = get_pixel_const_address_fast<Traits>(src, 0, ty.i2);
+        auto dstPtr = get_pixel_address_fast<Traits>(dst, 0, y);
+
+        for (int x=0; x<width; ++x, ++dstPtr) {
+          const BilinearTap& tx = xTaps[x];
+          const int w1 = (256 - tx.weight) * wy1;
+          const int w2 = tx.weight * wy1;
+          const int w3 = (256 - tx.weight) * wy2;
+          const int w4 = tx.weight * wy2;
+
+          pixels.split(row1[tx.i1], c[0]);
+          pixels.split(row1[tx.i2], c[1]);
+          pixels.split(row2[tx.i1], c[2]);
+          pixels.split(row2[tx.i2], c[3]);
+
+          for (int i=0; i<N; ++i)
+            v[i] = (c[0][i]*w1 + c[1][i]*w2 + c[2][i]*w3 + c[3][i]*w4) >> 16;
+
+          *dstPtr = pixels.join(v);
+        }
+      }
+    });
+}
+
+// Filters for the separable resampling methods
+double box_filter(double x)
+{
+  return (x >= -0.5 && x < 0.5 ? 1.0: 0.0);
+}
+
+double bicubic_filter(double x)
+{
+  const double a = -0.5;
+  x = std::fabs(x);
+  if (x < 1.0)
+    return ((a+2.0)*x - (a+3.0))*x*x + 1.0;
+  else if (x < 2.0)
+    return (((x-5.0)*x + 8.0)*x - 4.0)*a;
+  else
+    return 0.0;
+}
+
+double sinc(double x)
+{
+  if (x == 0.0)
+    return 1.0;
+  x *= PI;
+  return std::sin(x) / x;
+}
+
+double lanczos3_filter(double x)
+{
+  if (x > -3.0 && x < 3.0)
+    return sinc(x) * sinc(x/3.0);
+  else
+    return 0.0;
+}
+
+// Weights of the source pixels to calculate each destination pixel
+// in one axis. As the weights are precalculated, each axis is
+// resized with a simple loop of integer multiplications.
+struct ResampleWeights {
+  int taps;                     // Number of source pixels for each destination pixel
+  std::vector<int> first;       // First source pixel of each destination pixel
+  std::vector<int> weights;     // "taps" weights for each destination pixel
+};
+
+void calc_resample_weights(int srcSize, int dstSize,
+                           double (*filter)(double), double support,
+                           ResampleWeights& w)
+{
+  const double scale = double(srcSize) / double(dstSize);
+
+  // When the image is reduced, the filter is stretched so all source
+  // pixels are used (e.g. the box filter averages the whole area).
+  const double filterScale = std::max(1.0, scale);
+  const double radius = support * filterScale;
+
+  w.taps = std::min(int(std::ceil(radius))*2 + 1, srcSize);
+  w.first.resize(dstSize);
+  w.weights.assign(dstSize * w.taps, 0);
+
+  std::vector<double> k(w.taps);
+  for (int i=0; i<dstSize; ++i) {
+    const double center = (i + 0.5) * scale;
+    const int x1 = std::max(0, int(center - radius + 0.5));
+    const int x2 = std::min(srcSize, int(center + radius + 0.5));
+    const int first = std::min(x1, srcSize - w.taps);
+    double sum = 0.0;
+
+    std::fill(k.begin(), k.end(), 0.0);
+    for (int x=x1; x<x2; ++x) {
+      double value = filter((x + 0.5 - center) / filterScale);
+      k[x - first] = value;
+      sum += value;
+    }
+
+    int* weights = &w.weights[i * w.taps];
+    if (sum == 0.0) {
+      weights[std::min(int(center), srcSize-1) - first] = (1 << kWeightBits);
+    }
+    else {
+      // The biggest weight is adjusted so all weights sum exactly 1.0
+      int total = 0, biggest = 0;
+      for (int j=0; j<w.taps; ++j) {
+        weights[j] = int(std::floor(k[j] / sum * (1 << kWeightBits) + 0.5));
+        total += weights[j];
+        if (weights[j] > weights[biggest])
+          biggest = j;
+      }
+      weights[biggest] += (1 << kWeightBits) - total;
+    }
+    w.first[i] = first;
+  }
+}
+
+inline int weighted_channel(int value)
+{
+  return std::max(0, std::min(255, (value + (1 << (kWeightBits-1))) >> kWeightBits));
+}
+
+// Resizes the image with two passes (first horizontal then vertical)
+// using the given filter to calculate the weights of each pixel.
+template<typename Pixels>
+void resize_image_separable(const Image* src, Image* dst, const Pixels& pixels,
+                            double (*filter)(double), double support)
+{
+  typedef typename Pixels::Traits Traits;
+  const int N = Pixels::Channels;
+  const int dstWidth = dst->width();
+
+  ResampleWeights xw, yw;
+  calc_resample_weights(src->width(), dstWidth, filter, support, xw);
+  calc_resample_weights(src->height(), dst->height(), filter, support, yw);
+
+  // Horizontal pass: each source row is resized to the new width
+  std::vector<uint8_t> tmp(dstWidth * src->height() * N);
+  parallel_for(
+    0, src->height(), kRowsPerTask,
+    [&](int begin, int end) {
+      std::vector<int> row(src->width() * N);
+
+      for (int y=begin; y<end; ++y) {
+        auto srcPtr = get_pixel_const_address_fast<Traits>(src, 0, y);
+        for (int x=0; x<src->width(); ++x, ++srcPtr)
+          pixels.split(*srcPtr, &row[x*N]);
+
+        uint8_t* out = &tmp[y * dstWidth * N];
+        for (int x=0; x<dstWidth; ++x) {
+          const int* weights = &xw.weights[x * xw.taps];
+          const int* in = &row[xw.first[x] * N];
+
+          for (int i=0; i<N; ++i, ++out) {
+            int value = 0;
+            for (int j=0; j<xw.taps; ++j)
+              value += weights[j] * in[j*N + i];
+            *out = weighted_channel(value);
+          }
+        }
+      }
+    });
+
+  // Vertical pass: each destination row is a weighted sum of rows
+  // from the horizontal pass
+  parallel_for(
+    0, dst->height(), kRowsPerTask,
+    [&](int begin, int end) {
+      std::vector<int> values(dstWidth * N);
+
+      for (int y=begin; y<end; ++y) {
+        const int* weights = &yw.weights[y * yw.taps];
+        std::fill(values.begin(), values.end(), 0);
+
+        for (int j=0; j<yw.taps; ++j) {
+          const uint8_t* in = &tmp[(yw.first[y] + j) * dstWidth * N];
+          const int weight = weights[j];
+          if (weight) {
+            for (int i=0; i<dstWidth*N; ++i)
+              values[i] += weight * in[i];
+          }
+        }
+
+        auto dstPtr = get_pixel_address_fast<Traits>(dst, 0, y);
+        int* v = &values[0];
+        for (int x=0; x<dstWidth; ++x, ++dstPtr, v+=N) {
+          for (int i=0; i<N; ++i)
+            v[i] = weighted_channel(v[i]);
+          *dstPtr = pixels.join(v);
+        }
+      }
+    });
+}
+
+} // anonymous namespace
+
 void resize_image(const Image* src, Image* dst, ResizeMethod method, const Palette* pal, const RgbMap* rgbmap, color_t maskColor)
 {
+  ASSERT(src->pixelFormat() == dst->pixelFormat());
+
+  // Bitmaps cannot be interpolated
+  if (src->pixelFormat() == IMAGE_BITMAP &&
+      method != RESIZE_METHOD_ROTSPRITE)
+    method = RESIZE_METHOD_NEAREST_NEIGHBOR;
+
   switch (method) {
 
     // TODO optimize this
@@ -58,100 +374,35 @@ void resize_image(const Image* src, Image* dst, ResizeMethod method, const Palet
       break;
     }
 
-    // TODO optimize this
-    case RESIZE_METHOD_BILINEAR: {
-      uint32_t color[4], dst_color = 0;
-      double u, v, du, dv;
-      int u_floor, u_floor2;
-      int v_floor, v_floor2;
-      int x, y;
-
-      u = v = 0.0;
-      du = (src->width()-1) * 1.0 / (dst->width()-1);
-      dv = (src->height()-1) * 1.0 / (dst->height()-1);
-      for (y=0; y<dst->height(); ++y) {
-        for (x=0; x<dst->width(); ++x) {
-          u_floor = (int)std::floor(u);
-          v_floor = (int)std::floor(v);
-
-          if (u_floor > src->width()-1) {
-            u_floor = src->width()-1;
-            u_floor2 = src->width()-1;
-          }
-          else if (u_floor == src->width()-1)
-            u_floor2 = u_floor;
-          else
-            u_floor2 = u_floor+1;
-
-          if (v_floor > src->height()-1) {
-            v_floor = src->height()-1;
-            v_floor2 = src->height()-1;
-          }
-          else if (v_floor == src->height()-1)
-            v_floor2 = v_floor;
-          else
-            v_floor2 = v_floor+1;
-
-          // get the four colors
-          color[0] = src->getPixel(u_floor,  v_floor);
-          color[1] = src->getPixel(u_floor2, v_floor);
-          color[2] = src->getPixel(u_floor,  v_floor2);
-          color[3] = src->getPixel(u_floor2, v_floor2);
-
-          // calculate the interpolated color
-          double u1 = u - u_floor;
-          double v1 = v - v_floor;
-          double u2 = 1 - u1;
-          double v2 = 1 - v1;
-
-          switch (dst->pixelFormat()) {
-            case IMAGE_RGB: {
-              int r = int((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
-                          (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
-              int g = int((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
-                          (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
-              int b = int((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
-                          (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
-              int a = int((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
-                          (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
-              dst_color = rgba(r, g, b, a);
-              break;
-            }
-            case IMAGE_GRAYSCALE: {
-              int v = int((graya_getv(color[0])*u2 + graya_getv(color[1])*u1)*v2 +
-                          (graya_getv(color[2])*u2 + graya_getv(color[3])*u1)*v1);
-              int a = int((graya_geta(color[0])*u2 + graya_geta(color[1])*u1)*v2 +
-                          (graya_geta(color[2])*u2 + graya_geta(color[3])*u1)*v1);
-              dst_color = graya(v, a);
-              break;
-            }
-            case IMAGE_INDEXED: {
-              // Convert index to RGBA values
-              for (int i=0; i<4; ++i) {
-                if (color[i] == maskColor)
-                  color[i] = pal->getEntry(color[i]) & rgba_rgb_mask; // Set alpha = 0
-                else
-                  color[i] = pal->getEntry(color[i]);
-              }
-
-              int r = int((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
-                          (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
-              int g = int((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
-                          (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
-              int b = int((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
-                          (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
-              int a = int((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
-                          (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
-              dst_color = rgbmap->mapColor(r, g, b, a);
-              break;
-            }
-          }
+    case RESIZE_METHOD_BILINEAR:
+      switch (src->pixelFormat()) {
+        case IMAGE_RGB: resize_image_bilinear(src, dst, RgbPixels()); break;
+        case IMAGE_GRAYSCALE: resize_image_bilinear(src, dst, GrayscalePixels()); break;
+        case IMAGE_INDEXED: resize_image_bilinear(src, dst, IndexedPixels(pal, rgbmap, maskColor)); break;
+      }
+      break;
 
-          dst->putPixel(x, y, dst_color);
-          u += du;
-        }
-        u = 0.0;
-        v += dv;
+    case RESIZE_METHOD_BOX:
+    case RESIZE_METHOD_BICUBIC:
+    case RESIZE_METHOD_LANCZOS: {
+      double (*filter)(double) = nullptr;
+      double support = 0.0;
+      switch (method) {
+        case RESIZE_METHOD_BOX: filter = box_filter; support = 0.5; break;
+        case RESIZE_METHOD_BICUBIC: filter = bicubic_filter; support = 2.0; break;
+        case RESIZE_METHOD_LANCZOS: filter = lanczos3_filter; support = 3.0; break;
+        default: break;
+      }
+      switch (src->pixelFormat()) {
+        case IMAGE_RGB:
+          resize_image_separable(src, dst, RgbPixels(), filter, support);
+          break;
+        case IMAGE_GRAYSCALE:
+          resize_image_separable(src, dst, GrayscalePixels(), filter, support);
+          break;
+        case IMAGE_INDEXED:
+          resize_image_separable(src, dst, IndexedPixels(pal, rgbmap, maskColor), filter, support);
+          break;
       }
       break;
     }
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -22,13 +22,19 @@ namespace doc {
       RESIZE_METHOD_NEAREST_NEIGHBOR,
       RESIZE_METHOD_BILINEAR,
       RESIZE_METHOD_ROTSPRITE,
+      RESIZE_METHOD_BOX,        // Average of the covered area
+      RESIZE_METHOD_BICUBIC,
+      RESIZE_METHOD_LANCZOS,    // Lanczos with 3 lobes
     };
 
     // Resizes the source image 'src' to the destination image 'dst'.
+    // Bitmaps are always resized with RESIZE_METHOD_NEAREST_NEIGHBOR
+    // (except with RotSprite).
     //
-    // Warning: If you are using the RESIZE_METHOD_BILINEAR, it is
-    // recommended to use 'fixup_image_transparent_colors' function
-    // over the source image 'src' BEFORE using this routine.
+    // Warning: If you are using an interpolation method (bilinear,
+    // box, bicubic, or Lanczos), it is recommended to use
+    // 'fixup_image_transparent_colors' function over the source
+    // image 'src' BEFORE using this routine.
     void resize_image(const Image* src, Image* dst, ResizeMethod method, const Palette* palette, const RgbMap* rgbmap,
                       color_t maskColor);
 
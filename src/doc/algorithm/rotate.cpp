@@ -17,9 +17,11 @@
 #include "doc/mask.h"
 #include "doc/primitives.h"
 #include "doc/primitives_fast.h"
+#include "doc/thread_pool.h"
 #include "fixmath/fixmath.h"
 
 #include <cmath>
+#include <vector>
 
 namespace doc {
 namespace algorithm {
@@ -190,6 +192,18 @@ void parallelogram(Image* bmp, const Image* sprite, const Image* mask,
 
 // Scanline drawers.
 
+// Minimum number of scanlines drawn by each thread
+static const int kScanlinesPerTask = 16;
+
+// A scanline of the destination bitmap calculated by
+// ase_parallelogram_map(). All the scanlines are calculated first,
+// and then they are drawn in parallel.
+struct ParallelogramScanline {
+  fixed l_bmp_x, r_bmp_x;
+  int bmp_y;
+  fixed l_spr_x, l_spr_y;
+};
+
 template<class Traits, class Delegate>
 static void draw_scanline(
   Image* bmp,
@@ -206,35 +220,59 @@ static void draw_scanline(
 
   delegate.lockBits(bmp, gfx::Rect(l_bmp_x, bmp_y_i, r_bmp_x - l_bmp_x + 1, 1));
 
-  gfx::Rect maskBounds = (mask ? mask->bounds(): spr->bounds());
+  if (mask) {
+    gfx::Rect maskBounds = mask->bounds();
+
+    for (int x=(int)l_bmp_x; x<=(int)r_bmp_x; ++x) {
+      int u = l_spr_x>>16;
+      int v = l_spr_y>>16;
+
+      if (maskBounds.contains(u, v) && get_pixel_fast<BitmapTraits>(mask, u, v))
+        delegate.putPixel(spr, u, v);
+      delegate.nextPixel();
 
-  for (int x=(int)l_bmp_x; x<=(int)r_bmp_x; ++x) {
-    int u = l_spr_x>>16;
-    int v = l_spr_y>>16;
+      l_spr_x += spr_dx;
+      l_spr_y += spr_dy;
+    }
+  }
+  // Without rotation all the pixels come from the same sprite row
+  else if (spr_dy == 0) {
+    const int v = l_spr_y>>16;
 
-    if (!mask ||
-        (maskBounds.contains(u, v) && get_pixel_fast<BitmapTraits>(mask, u, v)))
-      delegate.putPixel(spr, u, v);
-    delegate.nextPixel();
+    for (int x=(int)l_bmp_x; x<=(int)r_bmp_x; ++x) {
+      delegate.putPixel(spr, l_spr_x>>16, v);
+      delegate.nextPixel();
 
-    l_spr_x += spr_dx;
-    l_spr_y += spr_dy;
+      l_spr_x += spr_dx;
+    }
+  }
+  else {
+    for (int x=(int)l_bmp_x; x<=(int)r_bmp_x; ++x) {
+      delegate.putPixel(spr, l_spr_x>>16, l_spr_y>>16);
+      delegate.nextPixel();
+
+      l_spr_x += spr_dx;
+      l_spr_y += spr_dy;
+    }
   }
 
   delegate.unlockBits();
 }
 
+// Delegate that modifies the pixels of the scanline using their
+// addresses directly (all the pixels of a row are contiguous in
+// memory).
 template<class Traits>
 class GenericDelegate {
 public:
   void lockBits(Image* bmp, const gfx::Rect& bounds) {
-    m_bits = bmp->lockBits<Traits>(Image::ReadWriteLock, bounds);
-    m_it = m_bits.begin();
-    m_end = m_bits.end();
+    m_it = get_pixel_address_fast<Traits>(bmp, bounds.x, bounds.y);
+#ifdef _DEBUG
+    m_end = m_it + bounds.w;
+#endif
   }
 
   void unlockBits() {
-    m_bits.unlock();
   }
 
   void nextPixel() {
@@ -242,11 +280,11 @@ public:
     ++m_it;
   }
 
-private:
-  ImageBits<Traits> m_bits;
-
 protected:
-  typename LockImageBits<Traits>::iterator m_it, m_end;
+  typename Traits::address_t m_it;
+#ifdef _DEBUG
+  typename Traits::address_t m_end;
+#endif
 };
 
 class RgbDelegate : public GenericDelegate<RgbTraits> {
@@ -303,8 +341,24 @@ private:
   color_t m_mask_color;
 };
 
-class BitmapDelegate : public GenericDelegate<BitmapTraits> {
+// Bitmap pixels aren't addressable one by one, so we use an iterator.
+class BitmapDelegate {
 public:
+  void lockBits(Image* bmp, const gfx::Rect& bounds) {
+    m_bits = bmp->lockBits<BitmapTraits>(Image::ReadWriteLock, bounds);
+    m_it = m_bits.begin();
+    m_end = m_bits.end();
+  }
+
+  void unlockBits() {
+    m_bits.unlock();
+  }
+
+  void nextPixel() {
+    ASSERT(m_it != m_end);
+    ++m_it;
+  }
+
   void putPixel(const Image* spr, int spr_x, int spr_y) {
     ASSERT(m_it != m_end);
 
@@ -312,6 +366,10 @@ public:
     if (c != 0)                 // TODO
       *m_it = c;
   }
+
+private:
+  ImageBits<BitmapTraits> m_bits;
+  LockImageBits<BitmapTraits>::iterator m_it, m_end;
 };
 
 /* _parallelogram_map:
@@ -385,6 +443,8 @@ static void ase_parallelogram_map(
   int bmp_y_i;
   /* Right edge of scanline. */
   int right_edge_test;
+  /* Scanlines to be drawn. */
+  std::vector<ParallelogramScanline> scanlines;
 
   /* Get index of topmost point. */
   top_index = 0;
@@ -481,6 +541,8 @@ static void ase_parallelogram_map(
   if (bmp_y_i >= clip_bottom_i)
     return;
 
+  scanlines.reserve(clip_bottom_i - bmp_y_i);
+
   /* Vertical gap between top corner and centre of topmost scanline. */
   extra_scanline_fraction = (bmp_y_i << 16) + 0x8000 - top_bmp_y;
   /* Calculate x coordinate of beginning of scanline in bmp. */
@@ -713,10 +775,13 @@ static void ase_parallelogram_map(
           }
         }
       }
-      draw_scanline<Traits, Delegate>(bmp, spr, mask,
-        l_bmp_x_rounded, bmp_y_i, r_bmp_x_rounded,
-        l_spr_x_rounded, l_spr_y_rounded,
-        spr_dx, spr_dy, delegate);
+      ParallelogramScanline scanline;
+      scanline.l_bmp_x = l_bmp_x_rounded;
+      scanline.r_bmp_x = r_bmp_x_rounded;
+      scanline.bmp_y = bmp_y_i;
+      scanline.l_spr_x = l_spr_x_rounded;
+      scanline.l_spr_y = l_spr_y_rounded;
+      scanlines.push_back(scanline);
 
     }
     /* I'm not going to apoligize for this label and its gotos: to get
@@ -736,6 +801,22 @@ static void ase_parallelogram_map(
     r_spr_y += r_spr_dy;
 #endif
   }
+
+  /* Draw the scanlines: each one modifies a different row of bmp, so
+     they can be drawn in parallel. Each task uses its own copy of the
+     delegate. */
+  parallel_for(
+    0, int(scanlines.size()), kScanlinesPerTask,
+    [&](int i1, int i2) {
+      Delegate taskDelegate(delegate);
+      for (int i=i1; i<i2; ++i) {
+        const ParallelogramScanline& scanline = scanlines[i];
+        draw_scanline<Traits, Delegate>(bmp, spr, mask,
+          scanline.l_bmp_x, scanline.bmp_y, scanline.r_bmp_x,
+          scanline.l_spr_x, scanline.l_spr_y,
+          spr_dx, spr_dy, taskDelegate);
+      }
+    });
 }
 
 /* _parallelogram_map_standard:
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,223 +8,314 @@
 #include "config.h"
 #endif
 
-#include "base/base.h"
+#include "doc/algorithm/rotsprite.h"
+
 #include "base/unique_ptr.h"
-#include "doc/algorithm/rotate.h"
+#include "doc/blend_funcs.h"
 #include "doc/image_impl.h"
-#include "doc/primitives.h"
+#include "doc/primitives_fast.h"
+#include "doc/thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
 
 namespace doc {
 namespace algorithm {
 
+namespace {
+
+// Minimum number of rows processed by each thread
+const int kRowsPerTask = 16;
+
+// The source image is scaled up to 8x: two scale2x passes are done
+// in scratch images, and the last one is calculated for each sampled
+// pixel only.
+const int kScale = 8;
+
+// Pixels around the needed source region that are scaled too, so
+// the scale2x results inside the region are the same as if the whole
+// image were scaled.
+const int kRegionBorder = 2;
+
+// Maps the center of each destination pixel to the source image
+// scaled up to 8x.
+struct InverseMap {
+  double u0, v0;                // Source point of pixel (0, 0)
+  double du_dx, dv_dx;          // Increment for each column
+  double du_dy, dv_dy;          // Increment for each row
+
+  double u(double x, double y) const { return u0 + x*du_dx + y*du_dy; }
+  double v(double x, double y) const { return v0 + x*dv_dx + y*dv_dy; }
+};
+
+} // anonymous namespace
+
 // More information about EPX/Scale2x:
 // http://en.wikipedia.org/wiki/Pixel_art_scaling_algorithms#EPX.2FScale2.C3.97.2FAdvMAME2.C3.97
 // http://scale2x.sourceforge.net/algorithm.html
 // http://scale2x.sourceforge.net/scale2xandepx.html
-template<typename ImageTraits>
-static void image_scale2x_tpl(Image* dst, const Image* src, int src_w, int src_h)
+//
+//   A
+// C P B
+//   D
+//
+// Returns the pixel of the given quadrant (0=top-left, 1=top-right,
+// 2=bottom-left, 3=bottom-right) that replaces P.
+static inline color_t scale2x_pixel(color_t P, color_t A, color_t B,
+                                    color_t C, color_t D, int quadrant)
 {
-#if 0      // TODO complete this implementation that should be faster
-           // than using a lot of get/put_pixel_fast calls.
-  int dst_w = src_w*2;
-  int dst_h = src_h*2;
-
-  LockImageBits<ImageTraits> dstBits(dst, Image::WriteLock, gfx::Rect(0, 0, dst_w, dst_h));
-  const LockImageBits<ImageTraits> srcBits(src);
-
-  LockImageBits<ImageTraits>::iterator dstRow0_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow1_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow0_end = dstBits.end();
-  LockImageBits<ImageTraits>::iterator dstRow1_end = dstBits.end();
-
-  // Iterators:
-  //   A
-  // C P B
-  //   D
-  //
-  // These iterators are displaced through src image and are modified in this way:
-  //
-  // P: is the simplest one, we just start from (0, 0) to srcEnd.
-  // A: starts from row 0 (so A = P in the first row), then we start
-  //    again from the row 0.
-  // B: It starts from (1, row) and in the last pixel we don't moved it.
-  // C: It starts from (0, 0) and then it is moved with a delay.
-  // D: It starts from row 1 and continues until we reach the last
-  //    row, in that case we start D iterator again.
-  //
-  LockImageBits<ImageTraits>::const_iterator itP, itA, itB, itC, itD, savedD;
-  LockImageBits<ImageTraits>::const_iterator srcEnd = srcBits.end();
-  color_t P, A, B, C, D;
-
-  // Adjust iterators
-  itP = itA = itB = itC = itD = savedD = srcBits.begin();
-  dstRow1_it += dst_w;
-  itD += src->width();
-
-  for (int y=0; y<src_h; ++y) {
-    if (y == 1) itA = srcBits.begin();
-    if (y == src_h-2) savedD = itD;
-    if (y == src_h-1) itD = savedD;
-    ++itB;
-
-    for (int x=0; x<src_w; ++x) {
-      ASSERT(itP != srcEnd);
-      ASSERT(itA != srcEnd);
-      ASSERT(itB != srcEnd);
-      ASSERT(itC != srcEnd);
-      ASSERT(itD != srcEnd);
-      ASSERT(dstRow0_it != dstRow0_end);
-      ASSERT(dstRow1_it != dstRow1_end);
-
-      P = *itP;
-      A = *itA;                 // y-1
-      B = *itB;                 // x+1
-      C = *itC;                 // x-1
-      D = *itD;                 // y+1
-
-      *dstRow0_it = (C == A && C != D && A != B ? A: P);
-      ++dstRow0_it;
-      *dstRow0_it = (A == B && A != C && B != D ? B: P);
-      ++dstRow0_it;
-
-      *dstRow1_it = (D == C && D != B && C != A ? C: P);
-      ++dstRow1_it;
-      *dstRow1_it = (B == D && B != A && D != C ? D: P);
-      ++dstRow1_it;
-
-      ++itP;
-      ++itA;
-      if (x < src_w-2) ++itB;
-      if (x > 0) ++itC;
-      ++itD;
-    }
-
-    // Adjust iterators for the next two rows.
-    ++itB;
-    ++itC;
-    dstRow0_it += dst_w;
-    if (y < src_h-1)
-      dstRow1_it += dst_w;
-  }
-
-  // ASSERT(itP == srcEnd);
-  // ASSERT(itA == srcEnd);
-  // ASSERT(itB == srcEnd);
-  // ASSERT(itC == srcEnd);
-  // ASSERT(itD == srcEnd);
-  ASSERT(dstRow0_it == dstRow0_end);
-  ASSERT(dstRow1_it == dstRow1_end);
-#else
-
-#define A c[0]
-#define B c[1]
-#define C c[2]
-#define D c[3]
-#define P c[4]
-
-  LockImageBits<ImageTraits> dstBits(dst, gfx::Rect(0, 0, src_w*2, src_h*2));
-  auto dstIt = dstBits.begin();
-  auto dstIt2 = dstIt;
-
-  color_t c[5];
-  for (int y=0; y<src_h; ++y) {
-    dstIt2 += src_w*2;
-    for (int x=0; x<src_w; ++x) {
-      P = get_pixel_fast<ImageTraits>(src, x, y);
-      A = (y > 0 ? get_pixel_fast<ImageTraits>(src, x, y-1): P);
-      B = (x < src_w-1 ? get_pixel_fast<ImageTraits>(src, x+1, y): P);
-      C = (x > 0 ? get_pixel_fast<ImageTraits>(src, x-1, y): P);
-      D = (y < src_h-1 ? get_pixel_fast<ImageTraits>(src, x, y+1): P);
-
-      *dstIt = (C == A && C != D && A != B ? A: P);
-      ++dstIt;
-      *dstIt = (A == B && A != C && B != D ? B: P);
-      ++dstIt;
-
-      *dstIt2 = (D == C && D != B && C != A ? C: P);
-      ++dstIt2;
-      *dstIt2 = (B == D && B != A && D != C ? D: P);
-      ++dstIt2;
-    }
-    dstIt += src_w*2;
+  switch (quadrant) {
+    case 0: return (C == A && C != D && A != B ? A: P);
+    case 1: return (A == B && A != C && B != D ? B: P);
+    case 2: return (D == C && D != B && C != A ? C: P);
+    default: return (B == D && B != A && D != C ? D: P);
   }
+}
 
-#endif
+// Scales the "bounds" region of "src" to the whole "dst" image
+// (which must be twice the size of "bounds"). Pixels outside
+// "bounds" are treated as the nearest pixel of the region.
+template<typename ImageTraits>
+static void image_scale2x_tpl(Image* dst, const Image* src, const gfx::Rect& bounds)
+{
+  parallel_for(
+    0, bounds.h, kRowsPerTask,
+    [dst, src, bounds](int v1, int v2) {
+      color_t P, A, B, C, D;
+
+      for (int v=v1; v<v2; ++v) {
+        const int y = bounds.y+v;
+
+        for (int u=0; u<bounds.w; ++u) {
+          const int x = bounds.x+u;
+
+          P = get_pixel_fast<ImageTraits>(src, x, y);
+          A = (v > 0 ? get_pixel_fast<ImageTraits>(src, x, y-1): P);
+          B = (u < bounds.w-1 ? get_pixel_fast<ImageTraits>(src, x+1, y): P);
+          C = (u > 0 ? get_pixel_fast<ImageTraits>(src, x-1, y): P);
+          D = (v < bounds.h-1 ? get_pixel_fast<ImageTraits>(src, x, y+1): P);
+
+          put_pixel_fast<ImageTraits>(dst, 2*u,   2*v,   scale2x_pixel(P, A, B, C, D, 0));
+          put_pixel_fast<ImageTraits>(dst, 2*u+1, 2*v,   scale2x_pixel(P, A, B, C, D, 1));
+          put_pixel_fast<ImageTraits>(dst, 2*u,   2*v+1, scale2x_pixel(P, A, B, C, D, 2));
+          put_pixel_fast<ImageTraits>(dst, 2*u+1, 2*v+1, scale2x_pixel(P, A, B, C, D, 3));
+        }
+      }
+    });
 }
 
-static void image_scale2x(Image* dst, const Image* src, int src_w, int src_h)
+static void image_scale2x(Image* dst, const Image* src, const gfx::Rect& bounds)
 {
   switch (src->pixelFormat()) {
-    case IMAGE_RGB:       image_scale2x_tpl<RgbTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_GRAYSCALE: image_scale2x_tpl<GrayscaleTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_INDEXED:   image_scale2x_tpl<IndexedTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_BITMAP:    image_scale2x_tpl<BitmapTraits>(dst, src, src_w, src_h); break;
+    case IMAGE_RGB:       image_scale2x_tpl<RgbTraits>(dst, src, bounds); break;
+    case IMAGE_GRAYSCALE: image_scale2x_tpl<GrayscaleTraits>(dst, src, bounds); break;
+    case IMAGE_INDEXED:   image_scale2x_tpl<IndexedTraits>(dst, src, bounds); break;
+    case IMAGE_BITMAP:    image_scale2x_tpl<BitmapTraits>(dst, src, bounds); break;
   }
 }
 
-void rotsprite_image(Image* bmp, const Image* spr, const Image* mask,
-  int x1, int y1, int x2, int y2,
-  int x3, int y3, int x4, int y4)
+// Returns the pixel (x, y) of "src" scaled 2x without creating the
+// scaled image.
+template<typename ImageTraits>
+static inline color_t scale2x_sample(const Image* src, int x, int y)
 {
-  static ImageBufferPtr buf[3]; // TODO non-thread safe
+  const int u = (x >> 1);
+  const int v = (y >> 1);
+  const color_t P = get_pixel_fast<ImageTraits>(src, u, v);
+  const color_t A = (v > 0 ? get_pixel_fast<ImageTraits>(src, u, v-1): P);
+  const color_t B = (u < src->width()-1 ? get_pixel_fast<ImageTraits>(src, u+1, v): P);
+  const color_t C = (u > 0 ? get_pixel_fast<ImageTraits>(src, u-1, v): P);
+  const color_t D = (v < src->height()-1 ? get_pixel_fast<ImageTraits>(src, u, v+1): P);
+  return scale2x_pixel(P, A, B, C, D, (x & 1) | ((y & 1) << 1));
+}
 
-  for (int i=0; i<3; ++i)
-    if (!buf[i])
-      buf[i].reset(new ImageBuffer(1));
+// Blends a pixel of the rotated sprite in "back". Returns false if
+// the pixel is transparent (same rules as the parallelogram() drawers).
+template<typename ImageTraits>
+static inline bool blend_rotsprite_pixel(color_t& back, color_t front, color_t maskColor);
 
-  int xmin = MIN(x1, MIN(x2, MIN(x3, x4)));
-  int xmax = MAX(x1, MAX(x2, MAX(x3, x4)));
-  int ymin = MIN(y1, MIN(y2, MIN(y3, y4)));
-  int ymax = MAX(y1, MAX(y2, MAX(y3, y4)));
-  int rot_width = xmax - xmin;
-  int rot_height = ymax - ymin;
+template<>
+inline bool blend_rotsprite_pixel<RgbTraits>(color_t& back, color_t front, color_t maskColor)
+{
+  if ((rgba_geta(maskColor) != 0) &&
+      ((front & rgba_rgb_mask) == (maskColor & rgba_rgb_mask)))
+    return false;
+  back = rgba_blender_normal(back, front);
+  return true;
+}
 
-  if (rot_width == 0 || rot_height == 0)
-    return;
+template<>
+inline bool blend_rotsprite_pixel<GrayscaleTraits>(color_t& back, color_t front, color_t maskColor)
+{
+  if ((graya_geta(maskColor) != 0) &&
+      ((front & graya_v_mask) == (maskColor & graya_v_mask)))
+    return false;
+  back = graya_blender_normal(back, front);
+  return true;
+}
 
-  int scale = 8;
-  base::UniquePtr<Image> bmp_copy(Image::create(bmp->pixelFormat(), rot_width*scale, rot_height*scale, buf[0]));
-  base::UniquePtr<Image> tmp_copy(Image::create(spr->pixelFormat(), spr->width()*scale, spr->height()*scale, buf[1]));
-  base::UniquePtr<Image> spr_copy(Image::create(spr->pixelFormat(), spr->width()*scale, spr->height()*scale, buf[2]));
-  base::UniquePtr<Image> msk_copy;
+template<>
+inline bool blend_rotsprite_pixel<IndexedTraits>(color_t& back, color_t front, color_t maskColor)
+{
+  if (front == maskColor)
+    return false;
+  back = front;
+  return true;
+}
 
-  color_t maskColor = spr->maskColor();
+template<>
+inline bool blend_rotsprite_pixel<BitmapTraits>(color_t& back, color_t front, color_t maskColor)
+{
+  if (front == 0)
+    return false;
+  back = front;
+  return true;
+}
 
-  bmp_copy->setMaskColor(maskColor);
-  tmp_copy->setMaskColor(maskColor);
-  spr_copy->setMaskColor(maskColor);
+// Draws each pixel in "bounds" of "bmp" whose center is covered by
+// the sprite. "spr4x" is the "region" of the sprite scaled 4x.
+template<typename ImageTraits>
+static void rotsprite_image_tpl(Image* bmp, const Image* spr, const Image* mask,
+                                const Image* spr4x, const gfx::Rect& region,
+                                const gfx::Rect& bounds, const InverseMap& map)
+{
+  const int64_t spr_w = int64_t(spr->width())*kScale;
+  const int64_t spr_h = int64_t(spr->height())*kScale;
+  const int region_x = region.x*kScale;
+  const int region_y = region.y*kScale;
+  const int region_w = region.w*kScale;
+  const int region_h = region.h*kScale;
+  const gfx::Rect maskBounds = (mask ? mask->bounds(): gfx::Rect());
+  const color_t maskColor = spr->maskColor();
+
+  // 16.16 fixed point increments
+  const int64_t du = int64_t(std::floor(map.du_dx * 65536.0 + 0.5));
+  const int64_t dv = int64_t(std::floor(map.dv_dx * 65536.0 + 0.5));
+
+  parallel_for(
+    bounds.y, bounds.y2(), kRowsPerTask,
+    [&](int y1, int y2) {
+      for (int y=y1; y<y2; ++y) {
+        int64_t u = int64_t(std::floor(map.u(bounds.x, y) * 65536.0 + 0.5));
+        int64_t v = int64_t(std::floor(map.v(bounds.x, y) * 65536.0 + 0.5));
+
+        for (int x=bounds.x; x<bounds.x2(); ++x, u+=du, v+=dv) {
+          const int64_t su = (u >> 16);
+          const int64_t sv = (v >> 16);
+          if (su < 0 || sv < 0 || su >= spr_w || sv >= spr_h)
+            continue;
+
+          if (mask) {
+            const int mx = int(su / kScale);
+            const int my = int(sv / kScale);
+            if (!maskBounds.contains(mx, my) ||
+                !get_pixel_fast<BitmapTraits>(mask, mx, my))
+              continue;
+          }
+
+          const int rx = int(su) - region_x;
+          const int ry = int(sv) - region_y;
+          if (rx < 0 || ry < 0 || rx >= region_w || ry >= region_h)
+            continue;
+
+          color_t c = get_pixel_fast<ImageTraits>(bmp, x, y);
+          if (blend_rotsprite_pixel<ImageTraits>(
+                c, scale2x_sample<ImageTraits>(spr4x, rx, ry), maskColor))
+            put_pixel_fast<ImageTraits>(bmp, x, y, c);
+        }
+      }
+    });
+}
 
-  spr_copy->clear(maskColor);
-  spr_copy->copy(spr, gfx::Clip(spr->bounds()));
+void rotsprite_image(Image* bmp, const Image* spr, const Image* mask,
+  int x1, int y1, int x2, int y2,
+  int x3, int y3, int x4, int y4,
+  RotSpriteBuffers* buffers)
+{
+  const int xmin = std::min(x1, std::min(x2, std::min(x3, x4)));
+  const int xmax = std::max(x1, std::max(x2, std::max(x3, x4)));
+  const int ymin = std::min(y1, std::min(y2, std::min(y3, y4)));
+  const int ymax = std::max(y1, std::max(y2, std::max(y3, y4)));
+
+  // Destination pixels that can be modified
+  gfx::Rect bounds(xmin, ymin, xmax - xmin, ymax - ymin);
+  bounds &= bmp->bounds();
+  if (bounds.isEmpty() || spr->width() < 1 || spr->height() < 1)
+    return;
 
-  for (int i=0; i<3; ++i) {
-    // clear_image(tmp_copy, maskColor);
-    image_scale2x(tmp_copy, spr_copy, spr->width()*(1<<i), spr->height()*(1<<i));
-    spr_copy->copy(tmp_copy, gfx::Clip(tmp_copy->bounds()));
-  }
+  // Affine transformation from the source image to the destination
+  // parallelogram (the (x3, y3) corner is implicit).
+  const double ax = double(x2 - x1) / spr->width();
+  const double ay = double(y2 - y1) / spr->width();
+  const double bx = double(x4 - x1) / spr->height();
+  const double by = double(y4 - y1) / spr->height();
+  const double det = ax*by - ay*bx;
+  if (det == 0.0)
+    return;
 
-  if (mask) {
-    // Same ImageBuffer than tmp_copy
-    msk_copy.reset(Image::create(IMAGE_BITMAP, mask->width()*scale, mask->height()*scale, buf[1]));
-    clear_image(msk_copy, 0);
-    scale_image(msk_copy, mask,
-                0, 0, msk_copy->width(), msk_copy->height(),
-                0, 0, mask->width(), mask->height());
+  InverseMap map;
+  map.du_dx =  kScale * by / det;
+  map.dv_dx = -kScale * ay / det;
+  map.du_dy = -kScale * bx / det;
+  map.dv_dy =  kScale * ax / det;
+  map.u0 = (0.5 - x1)*map.du_dx + (0.5 - y1)*map.du_dy;
+  map.v0 = (0.5 - x1)*map.dv_dx + (0.5 - y1)*map.dv_dy;
+
+  // Region of the source image that is mapped to "bounds" (from the
+  // first corner to the other three ones)
+  double umin = map.u(bounds.x - 0.5, bounds.y - 0.5) / kScale;
+  double vmin = map.v(bounds.x - 0.5, bounds.y - 0.5) / kScale;
+  double umax = umin;
+  double vmax = vmin;
+  for (int i=1; i<4; ++i) {
+    const double x = ((i & 1) ? bounds.x2(): bounds.x) - 0.5;
+    const double y = ((i & 2) ? bounds.y2(): bounds.y) - 0.5;
+    const double u = map.u(x, y) / kScale;
+    const double v = map.v(x, y) / kScale;
+    umin = std::min(umin, u);
+    umax = std::max(umax, u);
+    vmin = std::min(vmin, v);
+    vmax = std::max(vmax, v);
   }
 
-  clear_image(bmp_copy, maskColor);
-  scale_image(bmp_copy, bmp,
-              0, 0, bmp_copy->width(), bmp_copy->height(),
-              xmin, ymin, rot_width, rot_height);
-
-  parallelogram(
-    bmp_copy, spr_copy, msk_copy.get(),
-    (x1-xmin)*scale, (y1-ymin)*scale, (x2-xmin)*scale, (y2-ymin)*scale,
-    (x3-xmin)*scale, (y3-ymin)*scale, (x4-xmin)*scale, (y4-ymin)*scale);
+  const int u1 = int(std::floor(std::max<double>(umin, 0.0)));
+  const int v1 = int(std::floor(std::max<double>(vmin, 0.0)));
+  const int u2 = int(std::ceil(std::min<double>(umax, spr->width())));
+  const int v2 = int(std::ceil(std::min<double>(vmax, spr->height())));
+  gfx::Rect region(u1 - kRegionBorder, v1 - kRegionBorder,
+                   u2 - u1 + 2*kRegionBorder, v2 - v1 + 2*kRegionBorder);
+  region &= spr->bounds();
+  if (region.isEmpty())
+    return;
 
-  scale_image(bmp, bmp_copy,
-              xmin, ymin, rot_width, rot_height,
-              0, 0, bmp_copy->width(), bmp_copy->height());
+  RotSpriteBuffers tmpBuffers;
+  if (!buffers)
+    buffers = &tmpBuffers;
+  if (!buffers->scale2x) buffers->scale2x.reset(new ImageBuffer(1));
+  if (!buffers->scale4x) buffers->scale4x.reset(new ImageBuffer(1));
+
+  base::UniquePtr<Image> spr2x(
+    Image::create(spr->pixelFormat(), region.w*2, region.h*2, buffers->scale2x));
+  base::UniquePtr<Image> spr4x(
+    Image::create(spr->pixelFormat(), region.w*4, region.h*4, buffers->scale4x));
+
+  image_scale2x(spr2x, spr, region);
+  image_scale2x(spr4x, spr2x, spr2x->bounds());
+
+  switch (bmp->pixelFormat()) {
+    case IMAGE_RGB:
+      rotsprite_image_tpl<RgbTraits>(bmp, spr, mask, spr4x, region, bounds, map);
+      break;
+    case IMAGE_GRAYSCALE:
+      rotsprite_image_tpl<GrayscaleTraits>(bmp, spr, mask, spr4x, region, bounds, map);
+      break;
+    case IMAGE_INDEXED:
+      rotsprite_image_tpl<IndexedTraits>(bmp, spr, mask, spr4x, region, bounds, map);
+      break;
+    case IMAGE_BITMAP:
+      rotsprite_image_tpl<BitmapTraits>(bmp, spr, mask, spr4x, region, bounds, map);
+      break;
+  }
 }
 
 } // namespace algorithm
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2015 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,14 +8,31 @@
 #define DOC_ALGORITHM_ROTSPRITE_H_INCLUDED
 #pragma once
 
+#include "doc/image_buffer.h"
+
 namespace doc {
   class Image;
 
   namespace algorithm {
 
+    // Scratch memory used by rotsprite_image() to scale up the
+    // source image. It can be kept between calls (e.g. while the
+    // user is transforming the selection) so the intermediate images
+    // are not allocated each time. The same instance cannot be used
+    // by two rotsprite_image() calls at the same time.
+    class RotSpriteBuffers {
+    public:
+      ImageBufferPtr scale2x;   // Source region scaled 2x
+      ImageBufferPtr scale4x;   // Source region scaled 4x
+    };
+
+    // Draws "src" in the "dst" parallelogram (x1,y1)-(x2,y2)-(x3,y3)-(x4,y4)
+    // using the RotSprite algorithm. If "buffers" is nullptr, the
+    // scratch images are allocated for this call only.
     void rotsprite_image(Image* dst, const Image* src, const Image* mask,
       int x1, int y1, int x2, int y2,
-      int x3, int y3, int x4, int y4);
+      int x3, int y3, int x4, int y4,
+      RotSpriteBuffers* buffers = nullptr);
 
   } // namespace algorithm
 } // namespace doc
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -18,11 +18,58 @@
 #include "doc/primitives.h"
 
 #include <cmath>
+#include <mutex>
+#include <vector>
 
 namespace doc {
 
 static int generation = 0;
 
+namespace {
+
+// Generated brush images (and their stamps) are cached, so brushes
+// with the same type/size/angle (e.g. when the user changes the
+// brush size back and forth, or a new brush is created from the
+// preferences) don't need to be rasterized again.
+struct CachedBrush {
+  BrushType type;
+  int size;
+  int angle;
+  ImageRef image;
+  base::SharedPtr<CompressedImage> stamp;
+};
+
+const std::size_t kBrushCacheSize = 32;
+std::mutex brush_cache_mutex;
+std::vector<CachedBrush> brush_cache; // The most recently used is the last one
+
+bool find_cached_brush(BrushType type, int size, int angle,
+                       CachedBrush& result)
+{
+  std::unique_lock<std::mutex> lock(brush_cache_mutex);
+  for (auto it=brush_cache.begin(); it!=brush_cache.end(); ++it) {
+    if (it->type == type &&
+        it->size == size &&
+        it->angle == angle) {
+      result = *it;
+      brush_cache.erase(it);
+      brush_cache.push_back(result);
+      return true;
+    }
+  }
+  return false;
+}
+
+void add_cached_brush(const CachedBrush& brush)
+{
+  std::unique_lock<std::mutex> lock(brush_cache_mutex);
+  if (brush_cache.size() >= kBrushCacheSize)
+    brush_cache.erase(brush_cache.begin());
+  brush_cache.push_back(brush);
+}
+
+} // anonymous namespace
+
 Brush::Brush()
 {
   m_type = kCircleBrushType;
@@ -85,10 +132,20 @@ void Brush::setAngle(int angle)
   regenerate();
 }
 
+const CompressedImage* Brush::stamp() const
+{
+  if (!m_stamp && m_image)
+    m_stamp.reset(new CompressedImage(m_image.get(),
+                                      m_maskBitmap.get(),
+                                      false));
+  return m_stamp.get();
+}
+
 void Brush::setImage(const Image* image,
                      const Image* maskBitmap)
 {
   m_type = kImageBrushType;
+  m_stamp.reset();
   m_image.reset(Image::createCopy(image));
   if (maskBitmap)
     m_maskBitmap.reset(Image::createCopy(maskBitmap));
@@ -227,6 +284,9 @@ void Brush::setImageColor(ImageColor imageColor, color_t color)
   if (!m_image)
     return;
 
+  // The stamp points to the old image
+  m_stamp.reset();
+
   if (!m_backupImage)
     m_backupImage.reset(Image::createCopy(m_image.get()));
   else
@@ -272,6 +332,7 @@ void Brush::setImageColor(ImageColor imageColor, color_t color)
 void Brush::clean()
 {
   m_gen = ++generation;
+  m_stamp.reset();
   m_image.reset();
   m_maskBitmap.reset();
   m_backupImage.reset();
@@ -289,6 +350,20 @@ void Brush::regenerate()
 
   ASSERT(m_size > 0);
 
+  // Image brushes cannot be generated from type/size/angle
+  const bool cacheable = (m_type != kImageBrushType);
+  CachedBrush cached;
+  if (cacheable &&
+      find_cached_brush(m_type, m_size, m_angle, cached)) {
+    m_image = cached.image;
+    m_stamp = cached.stamp;
+    m_maskBitmap.reset();
+    m_bounds = gfx::Rect(
+      -m_image->width()/2, -m_image->height()/2,
+      m_image->width(), m_image->height());
+    return;
+  }
+
   int size = m_size;
   if (m_type == kSquareBrushType && m_angle != 0 && m_size > 2)
     size = (int)std::sqrt((double)2*m_size*m_size)+2;
@@ -349,6 +424,16 @@ void Brush::regenerate()
   m_bounds = gfx::Rect(
     -m_image->width()/2, -m_image->height()/2,
     m_image->width(), m_image->height());
+
+  if (cacheable) {
+    cached.type = m_type;
+    cached.size = m_size;
+    cached.angle = m_angle;
+    cached.image = m_image;
+    cached.stamp.reset(new CompressedImage(m_image.get(), nullptr, false));
+    m_stamp = cached.stamp;
+    add_cached_brush(cached);
+  }
 }
 
 } // namespace doc
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,10 +8,12 @@
 #define DOC_BRUSH_H_INCLUDED
 #pragma once
 
+#include "base/shared_ptr.h"
 #include "base/unique_ptr.h"
 #include "doc/brush_pattern.h"
 #include "doc/brush_type.h"
 #include "doc/color.h"
+#include "doc/compressed_image.h"
 #include "doc/image_ref.h"
 #include "gfx/point.h"
 #include "gfx/rect.h"
@@ -44,6 +46,12 @@ namespace doc {
 
     const gfx::Rect& bounds() const { return m_bounds; }
 
+    // Returns the pixels of the brush as horizontal spans (relative
+    // to the brush image), so it can be stamped with one ink hline
+    // for each span. It's created on demand, and shared between
+    // brushes with the same type, size, and angle.
+    const CompressedImage* stamp() const;
+
     void setType(BrushType type);
     void setSize(int size);
     void setAngle(int angle);
@@ -66,6 +74,7 @@ namespace doc {
     int m_angle;                          // Angle in degrees 0-360
     ImageRef m_image;                     // Image of the brush
     ImageRef m_maskBitmap;
+    mutable base::SharedPtr<CompressedImage> m_stamp; // Spans of m_image
     gfx::Rect m_bounds;
     BrushPattern m_pattern;               // How the image should be replicated
     gfx::Point m_patternOrigin;           // From what position the brush was taken
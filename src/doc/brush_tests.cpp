@@ -0,0 +1,95 @@
+// Aseprite Document Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/brush.h"
+#include "doc/image.h"
+#include "doc/primitives.h"
+
+using namespace doc;
+
+// Returns the number of pixels painted by the brush stamp, checking
+// that each span covers only pixels of the brush mask.
+static int count_stamp_pixels(const Brush& brush)
+{
+  const Image* mask = (brush.maskBitmap() ? brush.maskBitmap(): brush.image());
+  int n = 0;
+  for (const auto& scanline : *brush.stamp()) {
+    for (int x=scanline.x; x<scanline.x+scanline.w; ++x)
+      EXPECT_NE(0, get_pixel(mask, x, scanline.y));
+    n += scanline.w;
+  }
+  return n;
+}
+
+static int count_mask_pixels(const Image* mask)
+{
+  int n = 0;
+  for (int y=0; y<mask->height(); ++y)
+    for (int x=0; x<mask->width(); ++x)
+      if (get_pixel(mask, x, y))
+        ++n;
+  return n;
+}
+
+TEST(Brush, StampMatchesImage)
+{
+  for (BrushType type : { kCircleBrushType, kSquareBrushType, kLineBrushType }) {
+    for (int size : { 1, 2, 7, 16, 33 }) {
+      for (int angle : { 0, 30, 45 }) {
+        Brush brush(type, size, angle);
+        ASSERT_TRUE(brush.stamp() != nullptr);
+        EXPECT_EQ(count_mask_pixels(brush.image()),
+                  count_stamp_pixels(brush));
+      }
+    }
+  }
+}
+
+TEST(Brush, SharedStamps)
+{
+  Brush a(kCircleBrushType, 12, 0);
+  Brush b(kCircleBrushType, 12, 0);
+  Brush c(kCircleBrushType, 13, 0);
+
+  EXPECT_EQ(a.image(), b.image());
+  EXPECT_EQ(a.stamp(), b.stamp());
+  EXPECT_NE(a.stamp(), c.stamp());
+
+  // Each brush has a new generation anyway
+  EXPECT_NE(a.gen(), b.gen());
+
+  b.setSize(13);
+  EXPECT_EQ(c.stamp(), b.stamp());
+  EXPECT_EQ(count_mask_pixels(c.image()), count_stamp_pixels(b));
+}
+
+TEST(Brush, ImageBrushStamp)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 4, 3));
+  clear_image(image.get(), image->maskColor());
+  put_pixel(image.get(), 1, 0, rgba(255, 0, 0, 255));
+  put_pixel(image.get(), 2, 0, rgba(0, 255, 0, 255));
+  put_pixel(image.get(), 3, 2, rgba(0, 0, 255, 255));
+
+  Brush brush;
+  brush.setImage(image.get(), nullptr);
+  EXPECT_EQ(3, count_stamp_pixels(brush));
+
+  brush.setImageColor(Brush::ImageColor::MainColor, rgba(0, 0, 0, 255));
+  EXPECT_EQ(3, count_stamp_pixels(brush));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
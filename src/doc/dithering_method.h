@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -14,6 +14,9 @@ namespace doc {
   enum class DitheringMethod {
     NONE,
     ORDERED,
+    FLOYD_STEINBERG,
+    ATKINSON,
+    SIERRA,
   };
 
 } // namespace doc
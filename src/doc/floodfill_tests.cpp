@@ -0,0 +1,228 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/floodfill.h"
+#include "doc/image_impl.h"
+#include "doc/image_ref.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+#include "doc/test_image.h"
+
+#include <cstdlib>
+#include <string>
+
+using namespace doc;
+
+// Paints each hline in a bitmap, and checks that no pixel is painted
+// twice.
+static void paint_hline(int x1, int y, int x2, void* data)
+{
+  Image* dst = reinterpret_cast<Image*>(data);
+  for (int x=x1; x<=x2; ++x) {
+    EXPECT_EQ(0, get_pixel(dst, x, y)) << "x=" << x << " y=" << y;
+    put_pixel(dst, x, y, 1);
+  }
+}
+
+static void count_hline(int x1, int y, int x2, void* data)
+{
+  *reinterpret_cast<int*>(data) += x2-x1+1;
+}
+
+static ImageRef fill(const Image* image, const Mask* mask,
+                     int x, int y, int tolerance, bool contiguous)
+{
+  ImageRef dst(Image::create(IMAGE_BITMAP, image->width(), image->height()));
+  dst->clear(0);
+  algorithm::floodfill(image, mask, x, y, image->bounds(),
+                       tolerance, contiguous, dst.get(), paint_hline);
+  return dst;
+}
+
+static void expect_bitmap(const char* expected, const Image* bitmap)
+{
+  for (int y=0; y<bitmap->height(); ++y)
+    for (int x=0; x<bitmap->width(); ++x, ++expected)
+      EXPECT_EQ(*expected == '#' ? 1: 0, int(get_pixel(bitmap, x, y)))
+        << "x=" << x << " y=" << y;
+}
+
+static ImageRef create_indexed(int w, int h, const char* pixels)
+{
+  ImageRef image(Image::create(IMAGE_INDEXED, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x, ++pixels)
+      put_pixel(image.get(), x, y, *pixels-'0');
+  return image;
+}
+
+TEST(FloodFill, Contiguous)
+{
+  ImageRef image = create_indexed(
+    8, 5,
+    "00100000"
+    "00101110"
+    "11101010"
+    "00001110"
+    "00100000");
+
+  expect_bitmap(
+    "##......"
+    "##......"
+    "........"
+    "........"
+    "........",
+    fill(image.get(), nullptr, 0, 0, 0, true).get());
+
+  // Diagonal pixels are not connected
+  expect_bitmap(
+    "...#####"
+    "...#...#"
+    "...#...#"
+    "####...#"
+    "##.#####",
+    fill(image.get(), nullptr, 7, 0, 0, true).get());
+
+  expect_bitmap(
+    "........"
+    "........"
+    ".....#.."
+    "........"
+    "........",
+    fill(image.get(), nullptr, 5, 2, 0, true).get());
+}
+
+TEST(FloodFill, NonContiguousAndTolerance)
+{
+  ImageRef image = create_indexed(
+    6, 3,
+    "012345"
+    "543210"
+    "000000");
+
+  expect_bitmap(
+    ".#...."
+    "....#."
+    "......",
+    fill(image.get(), nullptr, 1, 0, 0, false).get());
+
+  expect_bitmap(
+    "###..."
+    "...###"
+    "######",
+    fill(image.get(), nullptr, 0, 0, 2, false).get());
+
+  // Diagonal pixels are not connected
+  expect_bitmap(
+    "......"
+    "...###"
+    "######",
+    fill(image.get(), nullptr, 0, 2, 2, true).get());
+}
+
+TEST(FloodFill, TransparentRgbPixels)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 4, 1));
+  put_pixel(image.get(), 0, 0, rgba(255, 0, 0, 0));
+  put_pixel(image.get(), 1, 0, rgba(0, 255, 0, 0));
+  put_pixel(image.get(), 2, 0, rgba(255, 0, 0, 1));
+  put_pixel(image.get(), 3, 0, rgba(0, 0, 0, 0));
+
+  expect_bitmap("##..", fill(image.get(), nullptr, 0, 0, 0, true).get());
+  expect_bitmap("##.#", fill(image.get(), nullptr, 0, 0, 0, false).get());
+  expect_bitmap("####", fill(image.get(), nullptr, 0, 0, 1, true).get());
+}
+
+TEST(FloodFill, Mask)
+{
+  ImageRef image(Image::create(IMAGE_INDEXED, 8, 4));
+  image->clear(0);
+
+  Mask mask;
+  mask.replace(gfx::Rect(1, 0, 6, 4));
+  mask.subtract(gfx::Rect(3, 0, 1, 3));
+
+  expect_bitmap(
+    ".##.###."
+    ".##.###."
+    ".##.###."
+    ".######.",
+    fill(image.get(), &mask, 2, 1, 0, true).get());
+
+  // Start point outside the mask
+  expect_bitmap(
+    "........"
+    "........"
+    "........"
+    "........",
+    fill(image.get(), &mask, 3, 0, 0, true).get());
+}
+
+TEST(FloodFill, Bounds)
+{
+  ImageRef image(Image::create(IMAGE_GRAYSCALE, 6, 6));
+  image->clear(graya(0, 255));
+
+  ImageRef dst(Image::create(IMAGE_BITMAP, 6, 6));
+  dst->clear(0);
+  algorithm::floodfill(image.get(), nullptr, 2, 2, gfx::Rect(1, 1, 3, 2),
+                       0, true, dst.get(), paint_hline);
+  expect_bitmap(
+    "......"
+    ".###.."
+    ".###.."
+    "......"
+    "......"
+    "......",
+    dst.get());
+}
+
+// Run with --gtest_also_run_disabled_tests to measure the time to
+// fill big canvases.
+TEST(FloodFill, DISABLED_Benchmark8K)
+{
+  const int w = 8192, h = 8192;
+  const PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED };
+  std::srand(1);
+
+  for (PixelFormat format : formats) {
+    ImageRef image(Image::create(format, w, h));
+    image->clear(0);
+
+    // Random walls so there are a lot of short segments
+    const color_t wall = (format == IMAGE_RGB ? rgba(255, 255, 255, 255):
+                          format == IMAGE_GRAYSCALE ? graya(255, 255): 1);
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        if ((std::rand() % 40) == 0)
+          put_pixel(image.get(), x, y, wall);
+
+    for (int contiguous=1; contiguous>=0; --contiguous) {
+      int pixels = 0;
+      print_benchmark(
+        std::string(format == IMAGE_RGB ? "RGB":
+                    format == IMAGE_GRAYSCALE ? "Grayscale": "Indexed") +
+        (contiguous ? " contiguous": " non-contiguous"),
+        [&]{
+          algorithm::floodfill(image.get(), nullptr, 1, 1, image->bounds(),
+                               0, (contiguous ? true: false), &pixels, count_hline);
+        });
+      EXPECT_GT(pixels, w*h/2);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
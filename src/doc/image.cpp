@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -57,10 +57,35 @@ Image* Image::create(PixelFormat format, int width, int height,
   return NULL;
 }
 
+template<class Traits>
+static Image* create_shared_copy(const Image* image)
+{
+  const ImageImpl<Traits>* src = static_cast<const ImageImpl<Traits>*>(image);
+  if (src->isShareable())
+    return new ImageImpl<Traits>(*src);
+  else
+    return nullptr;
+}
+
 // static
 Image* Image::createCopy(const Image* image, const ImageBufferPtr& buffer)
 {
   ASSERT(image);
+
+  // Share the pixels with the original image (copy-on-write) when
+  // the copy doesn't need to use a specific buffer.
+  if (!buffer) {
+    Image* copy = nullptr;
+    switch (image->pixelFormat()) {
+      case IMAGE_RGB:       copy = create_shared_copy<RgbTraits>(image); break;
+      case IMAGE_GRAYSCALE: copy = create_shared_copy<GrayscaleTraits>(image); break;
+      case IMAGE_INDEXED:   copy = create_shared_copy<IndexedTraits>(image); break;
+      case IMAGE_BITMAP:    copy = create_shared_copy<BitmapTraits>(image); break;
+    }
+    if (copy)
+      return copy;
+  }
+
   return crop_image(image, 0, 0, image->width(), image->height(),
     image->maskColor(), buffer);
 }
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -37,6 +37,8 @@ namespace doc {
                          const ImageBufferPtr& buffer = ImageBufferPtr());
     static Image* create(const ImageSpec& spec,
                          const ImageBufferPtr& buffer = ImageBufferPtr());
+    // If no buffer is specified, the copy shares the pixels with the
+    // original image until one of them is modified (copy-on-write).
     static Image* createCopy(const Image* image,
                              const ImageBufferPtr& buffer = ImageBufferPtr());
 
@@ -75,6 +77,9 @@ namespace doc {
     // bounds checks. Use the primitives defined in doc/primitives.h
     // in case that you need bounds check.
     virtual uint8_t* getPixelAddress(int x, int y) const = 0;
+    // Like getPixelAddress() but only to read pixels (it doesn't
+    // duplicate pixels shared with other images).
+    virtual const uint8_t* getPixelConstAddress(int x, int y) const = 0;
     virtual color_t getPixel(int x, int y) const = 0;
     virtual void putPixel(int x, int y, color_t color) = 0;
     virtual void clear(color_t color) = 0;
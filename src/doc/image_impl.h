@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -9,8 +9,12 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "doc/blend_funcs.h"
 #include "doc/image.h"
@@ -22,63 +26,161 @@ namespace doc {
 
   template<typename ImageTraits> class LockImageBits;
 
+  // Rows of an image are grouped in strips of 1<<kImageStripShift
+  // rows. Each strip is shared between an image and its copies (see
+  // Image::createCopy()) until one of them modifies it
+  // (copy-on-write).
+  const int kImageStripShift = 6;
+  const int kImageStripRows = (1 << kImageStripShift);
+
   template<class Traits>
   class ImageImpl : public Image {
   private:
     typedef typename Traits::address_t address_t;
     typedef typename Traits::const_address_t const_address_t;
 
-    ImageBufferPtr m_buffer;
-    address_t m_bits;
-    address_t* m_rows;
+    enum StripState {
+      kStripShared,             // Can be used by other images
+      kStripUnsharing,          // A thread is duplicating the strip
+      kStripWritable            // Only this image uses the strip
+    };
+
+    struct Strip {
+      // Buffer that contains the rows of the strip (the same buffer
+      // can be used by several strips and images).
+      std::shared_ptr<ImageBufferPtr> buffer;
+
+      // Address of the first row of the strip (rows of a strip are
+      // always contiguous). It's atomic because a thread can be
+      // reading rows of the strip while other thread duplicates it.
+      std::atomic<uint8_t*> bits;
+
+      std::atomic<int> state;
+    };
+
+    mutable std::vector<Strip> m_strips;
+    std::size_t m_rowStrideBytes;
 
-    inline address_t getBitsAddress() {
-      return m_bits;
+    // False if the image uses an external buffer (its pixels cannot
+    // be shared because the buffer can be reused by its owner).
+    bool m_shareable;
+
+    inline uint8_t* rowAddress(int y) const {
+      const Strip& strip = m_strips[y >> kImageStripShift];
+      return strip.bits.load(std::memory_order_acquire)
+        + (y & (kImageStripRows-1)) * m_rowStrideBytes;
     }
 
-    inline const_address_t getBitsAddress() const {
-      return m_bits;
+    inline void makeRowWritable(int y) const {
+      Strip& strip = m_strips[y >> kImageStripShift];
+      if (strip.state.load(std::memory_order_acquire) != kStripWritable)
+        unshareStrip(strip, y & ~(kImageStripRows-1), true);
     }
 
-    inline address_t getLineAddress(int y) {
-      ASSERT(y >= 0 && y < height());
-      return m_rows[y];
+    void makeAllRowsWritable(bool keepPixels) const {
+      for (int i=0; i<int(m_strips.size()); ++i) {
+        Strip& strip = m_strips[i];
+        if (strip.state.load(std::memory_order_acquire) != kStripWritable)
+          unshareStrip(strip, (i << kImageStripShift), keepPixels);
+      }
     }
 
-    inline const_address_t getLineAddress(int y) const {
-      ASSERT(y >= 0 && y < height());
-      return m_rows[y];
+    // Gives to this image its own copy of the given strip. If
+    // keepPixels is false, the strip will be completely overwritten,
+    // so there is no need to copy the old pixels. Only one thread
+    // duplicates the strip, other threads wait until it's done.
+    void unshareStrip(Strip& strip, int y1, bool keepPixels) const {
+      int state = kStripShared;
+      if (!strip.state.compare_exchange_strong(state, kStripUnsharing,
+                                               std::memory_order_acquire)) {
+        while (strip.state.load(std::memory_order_acquire) != kStripWritable)
+          std::this_thread::yield();
+        return;
+      }
+
+      // Check if other images are still using this strip
+      if (strip.buffer.use_count() > 1) {
+        const int y2 = std::min(y1 + kImageStripRows, height());
+        const std::size_t size = m_rowStrideBytes * (y2-y1);
+
+        ImageBufferPtr buffer(new ImageBuffer(size));
+        uint8_t* bits = buffer->buffer();
+        if (keepPixels) {
+          const uint8_t* src = strip.bits.load(std::memory_order_relaxed);
+          std::copy(src, src+size, bits);
+        }
+        strip.bits.store(bits, std::memory_order_release);
+        strip.buffer.reset(new ImageBufferPtr(buffer));
+      }
+
+      strip.state.store(kStripWritable, std::memory_order_release);
     }
 
   public:
+    // Returns the address of a pixel to modify it.
     inline address_t address(int x, int y) const {
-      return (address_t)(m_rows[y] + x / (Traits::pixels_per_byte == 0 ? 1 : Traits::pixels_per_byte));
+      makeRowWritable(y);
+      return (address_t)(rowAddress(y)) + x / (Traits::pixels_per_byte == 0 ? 1 : Traits::pixels_per_byte);
+    }
+
+    // Returns the address of a pixel to read it (it doesn't duplicate
+    // shared strips).
+    inline const_address_t constAddress(int x, int y) const {
+      return (const_address_t)(rowAddress(y)) + x / (Traits::pixels_per_byte == 0 ? 1 : Traits::pixels_per_byte);
     }
 
     ImageImpl(int width, int height,
               const ImageBufferPtr& buffer)
       : Image(static_cast<PixelFormat>(Traits::pixel_format), width, height)
-      , m_buffer(buffer)
+      , m_strips((height + kImageStripRows - 1) >> kImageStripShift)
+      , m_rowStrideBytes(Traits::getRowStrideBytes(width))
+      , m_shareable(!buffer)
     {
-      std::size_t for_rows = sizeof(address_t) * height;
-      std::size_t rowstride_bytes = Traits::getRowStrideBytes(width);
-      std::size_t required_size = for_rows + rowstride_bytes*height;
+      std::size_t required_size = std::max<std::size_t>(1, m_rowStrideBytes*height);
 
-      if (!m_buffer)
-        m_buffer.reset(new ImageBuffer(required_size));
+      // All rows are contiguous in memory when the image is created
+      ImageBufferPtr allRows = buffer;
+      if (!allRows)
+        allRows.reset(new ImageBuffer(required_size));
       else
-        m_buffer->resizeIfNecessary(required_size);
-
-      m_rows = (address_t*)m_buffer->buffer();
-      m_bits = (address_t)(m_buffer->buffer() + for_rows);
+        allRows->resizeIfNecessary(required_size);
+
+      for (std::size_t i=0; i<m_strips.size(); ++i) {
+        Strip& strip = m_strips[i];
+        strip.buffer.reset(new ImageBufferPtr(allRows));
+        strip.bits.store(allRows->buffer() + ((i << kImageStripShift) * m_rowStrideBytes),
+                         std::memory_order_relaxed);
+        strip.state.store(kStripWritable, std::memory_order_relaxed);
+      }
+    }
 
-      address_t addr = m_bits;
-      for (int y=0; y<height; ++y) {
-        m_rows[y] = addr;
-        addr = (address_t)(((uint8_t*)addr) + rowstride_bytes);
+    // Creates a copy of the given image sharing all its strips.
+    ImageImpl(const ImageImpl<Traits>& src)
+      : Image(static_cast<PixelFormat>(Traits::pixel_format), src.width(), src.height())
+      , m_strips(src.m_strips.size())
+      , m_rowStrideBytes(src.m_rowStrideBytes)
+      , m_shareable(true)
+    {
+      ASSERT(src.isShareable());
+      setMaskColor(src.maskColor());
+
+      for (std::size_t i=0; i<m_strips.size(); ++i) {
+        Strip& srcStrip = src.m_strips[i];
+        m_strips[i].buffer = srcStrip.buffer;
+        m_strips[i].bits.store(srcStrip.bits.load(std::memory_order_acquire),
+                               std::memory_order_relaxed);
+        m_strips[i].state.store(kStripShared, std::memory_order_relaxed);
+
+        // Now the strip is shared, so "src" cannot modify it
+        // directly either.
+        srcStrip.state.store(kStripShared, std::memory_order_release);
       }
     }
 
+    bool isShareable() const {
+      return m_shareable;
+    }
+
     uint8_t* getPixelAddress(int x, int y) const override {
       ASSERT(x >= 0 && x < width());
       ASSERT(y >= 0 && y < height());
@@ -86,11 +188,18 @@ namespace doc {
       return (uint8_t*)address(x, y);
     }
 
+    const uint8_t* getPixelConstAddress(int x, int y) const override {
+      ASSERT(x >= 0 && x < width());
+      ASSERT(y >= 0 && y < height());
+
+      return (const uint8_t*)constAddress(x, y);
+    }
+
     color_t getPixel(int x, int y) const override {
       ASSERT(x >= 0 && x < width());
       ASSERT(y >= 0 && y < height());
 
-      return *address(x, y);
+      return *constAddress(x, y);
     }
 
     void putPixel(int x, int y, color_t color) override {
@@ -104,6 +213,10 @@ namespace doc {
       int w = width();
       int h = height();
 
+      // All pixels are replaced, shared strips don't need a copy of
+      // their old pixels.
+      makeAllRowsWritable(false);
+
       // Fill the first line
       address_t first = address(0, 0);
       std::fill(first, first+w, color);
@@ -115,7 +228,7 @@ namespace doc {
 
     void copy(const Image* _src, gfx::Clip area) override {
       const ImageImpl<Traits>* src = (const ImageImpl<Traits>*)_src;
-      address_t src_address;
+      const_address_t src_address;
       address_t dst_address;
 
       if (!area.clip(width(), height(), src->width(), src->height()))
@@ -124,8 +237,8 @@ namespace doc {
       for (int end_y=area.dst.y+area.size.h;
            area.dst.y<end_y;
            ++area.dst.y, ++area.src.y) {
-        src_address = src->address(area.src.x, area.src.y);
         dst_address = address(area.dst.x, area.dst.y);
+        src_address = src->constAddress(area.src.x, area.src.y);
 
         std::copy(src_address,
                   src_address + area.size.w,
@@ -219,16 +332,23 @@ namespace doc {
 
   template<>
   inline void ImageImpl<IndexedTraits>::clear(color_t color) {
-    std::fill(m_bits,
-              m_bits + width()*height(),
-              color);
+    makeAllRowsWritable(false);
+
+    const int w = width();
+    for (int y=0; y<height(); ++y) {
+      uint8_t* row = rowAddress(y);
+      std::fill(row, row + w, color);
+    }
   }
 
   template<>
   inline void ImageImpl<BitmapTraits>::clear(color_t color) {
-    std::fill(m_bits,
-              m_bits + BitmapTraits::getRowStrideBytes(width()) * height(),
-              (color ? 0xff: 0x00));
+    makeAllRowsWritable(false);
+
+    for (int y=0; y<height(); ++y) {
+      uint8_t* row = rowAddress(y);
+      std::fill(row, row + m_rowStrideBytes, (color ? 0xff: 0x00));
+    }
   }
 
   template<>
@@ -237,7 +357,7 @@ namespace doc {
     ASSERT(y >= 0 && y < height());
 
     std::div_t d = std::div(x, 8);
-    return ((*(m_rows[y] + d.quot)) & (1<<d.rem)) ? 1: 0;
+    return ((*(rowAddress(y) + d.quot)) & (1<<d.rem)) ? 1: 0;
   }
 
   template<>
@@ -245,11 +365,13 @@ namespace doc {
     ASSERT(x >= 0 && x < width());
     ASSERT(y >= 0 && y < height());
 
+    makeRowWritable(y);
+
     std::div_t d = std::div(x, 8);
     if (color)
-      (*(m_rows[y] + d.quot)) |= (1 << d.rem);
+      (*(rowAddress(y) + d.quot)) |= (1 << d.rem);
     else
-      (*(m_rows[y] + d.quot)) &= ~(1 << d.rem);
+      (*(rowAddress(y) + d.quot)) &= ~(1 << d.rem);
   }
 
   template<>
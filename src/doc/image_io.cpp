@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -39,7 +39,7 @@ bool write_image(std::ostream& os, const Image* image, CancelIO* cancel)
 #if 0
   {
     for (int c=0; c<image->height(); c++)
-      os.write((char*)image->getPixelAddress(0, c), rowSize);
+      os.write((const char*)image->getPixelConstAddress(0, c), rowSize);
   }
 #else
   {
@@ -63,7 +63,7 @@ bool write_image(std::ostream& os, const Image* image, CancelIO* cancel)
         return false;
       }
 
-      zstream.next_in = (Bytef*)image->getPixelAddress(0, y);
+      zstream.next_in = (Bytef*)image->getPixelConstAddress(0, y);
       zstream.avail_in = rowSize;
       int flush = (y == image->height()-1 ? Z_FINISH: Z_NO_FLUSH);
 
@@ -141,8 +141,9 @@ Image* read_image(std::istream& is, bool setId)
     int remain = avail_bytes;
 
     std::vector<uint8_t> compressed(4096);
+    int y = 0;
     uint8_t* address = image->getPixelAddress(0, 0);
-    uint8_t* address_end = image->getPixelAddress(0, 0) + uncompressed_size;
+    uint8_t* address_end = address + rowSize;
 
     while (remain > 0) {
       int len = MIN(remain, (int)compressed.size());
@@ -163,6 +164,14 @@ Image* read_image(std::istream& is, bool setId)
       zstream.avail_in = (uInt)bytes_read;
 
       do {
+        // Rows aren't contiguous in memory (they can be in different
+        // strips), so we uncompress one row at a time.
+        if (address == address_end && y+1 < image->height()) {
+          ++y;
+          address = image->getPixelAddress(0, y);
+          address_end = address + rowSize;
+        }
+
         zstream.next_out = (Bytef*)address;
         zstream.avail_out = address_end - address;
 
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2015 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -22,6 +22,23 @@ namespace doc {
 
   class Image;
 
+  // Mutable iterators use get_pixel_address_fast() and constant
+  // iterators get_pixel_const_address_fast() (so they don't duplicate
+  // shared pixels).
+  template<typename ImageTraits>
+  inline typename ImageTraits::address_t
+  get_iterator_address(const Image* image, int x, int y,
+                       typename ImageTraits::address_t*) {
+    return get_pixel_address_fast<ImageTraits>(image, x, y);
+  }
+
+  template<typename ImageTraits>
+  inline typename ImageTraits::const_address_t
+  get_iterator_address(const Image* image, int x, int y,
+                       typename ImageTraits::const_address_t*) {
+    return get_pixel_const_address_fast<ImageTraits>(image, x, y);
+  }
+
   template<typename ImageTraits,
            typename PointerType,
            typename ReferenceType>
@@ -51,7 +68,7 @@ namespace doc {
 
     ImageIteratorT(const Image* image, const gfx::Rect& bounds, int x, int y) :
       m_image(const_cast<Image*>(image)),
-      m_ptr(get_pixel_address_fast<ImageTraits>(image, x, y)),
+      m_ptr(get_iterator_address<ImageTraits>(image, x, y, (PointerType*)nullptr)),
       m_x(x),
       m_y(y),
       m_xbegin(bounds.x),
@@ -105,7 +122,7 @@ namespace doc {
         ++m_y;
 
         if (m_y < m_image->height())
-          m_ptr = get_pixel_address_fast<ImageTraits>(m_image, m_x, m_y);
+          m_ptr = get_iterator_address<ImageTraits>(m_image, m_x, m_y, (PointerType*)nullptr);
       }
 
       return *this;
@@ -288,7 +305,8 @@ namespace doc {
 
     ImageIteratorT(const Image* image, const gfx::Rect& bounds, int x, int y) :
       m_image(const_cast<Image*>(image)),
-      m_ptr(get_pixel_address_fast<BitmapTraits>(image, x, y)),
+      m_ptr(const_cast<BitmapTraits::address_t>(
+              get_iterator_address<BitmapTraits>(image, x, y, (PointerType*)nullptr))),
       m_x(x),
       m_y(y),
       m_subPixel(x % 8),
@@ -342,7 +360,8 @@ namespace doc {
         ++m_y;
 
         if (m_y < m_image->height())
-          m_ptr = get_pixel_address_fast<BitmapTraits>(m_image, m_x, m_y);
+          m_ptr = const_cast<BitmapTraits::address_t>(
+            get_iterator_address<BitmapTraits>(m_image, m_x, m_y, (PointerType*)nullptr));
         else
           ++m_ptr;
       }
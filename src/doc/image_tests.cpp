@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2015 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -13,6 +13,7 @@
 #include "base/unique_ptr.h"
 #include "doc/image_impl.h"
 #include "doc/primitives.h"
+#include "doc/thread_pool.h"
 
 using namespace base;
 using namespace doc;
@@ -215,6 +216,122 @@ TYPED_TEST(ImageAllTypes, FillRect)
   }
 }
 
+TYPED_TEST(ImageAllTypes, CopyOnWrite)
+{
+  typedef TypeParam ImageTraits;
+
+  const int w = 37;
+  const int h = 3*kImageStripRows + 5;
+  UniquePtr<Image> a(Image::create(ImageTraits::pixel_format, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel_fast<ImageTraits>(a, x, y, std::rand() % ImageTraits::max_value);
+
+  UniquePtr<Image> b(Image::createCopy(a));
+  ASSERT_EQ(0, count_diff_between_images(a, b));
+
+  // Pixels are shared
+  for (int y=0; y<h; ++y)
+    EXPECT_EQ(get_pixel_const_address_fast<ImageTraits>(a, 0, y),
+              get_pixel_const_address_fast<ImageTraits>(b, 0, y));
+
+  // Modify one strip of the copy
+  const int y = kImageStripRows+1;
+  const color_t c = get_pixel_fast<ImageTraits>(a, 3, y);
+  const color_t d = (c == 0 ? 1: 0);
+  put_pixel_fast<ImageTraits>(b, 3, y, d);
+  EXPECT_EQ(c, get_pixel_fast<ImageTraits>(a, 3, y));
+  EXPECT_EQ(d, get_pixel_fast<ImageTraits>(b, 3, y));
+  EXPECT_EQ(1, count_diff_between_images(a, b));
+
+  // Only the modified strip was duplicated
+  for (int v=0; v<h; ++v) {
+    const bool shared =
+      (get_pixel_const_address_fast<ImageTraits>(a, 0, v) ==
+       get_pixel_const_address_fast<ImageTraits>(b, 0, v));
+    EXPECT_EQ(v < kImageStripRows || v >= 2*kImageStripRows, shared);
+  }
+
+  // A copy of the copy, then modify the first image with iterators
+  UniquePtr<Image> e(Image::createCopy(b));
+  int changed = 0;
+  {
+    LockImageBits<ImageTraits> bits(a.get(), gfx::Rect(0, 0, w, 2));
+    for (auto it=bits.begin(), end=bits.end(); it!=end; ++it) {
+      if (*it != d)
+        ++changed;
+      *it = d;
+    }
+  }
+  EXPECT_EQ(0, count_diff_between_images(b, e));
+  EXPECT_EQ(changed+1, count_diff_between_images(a, b));
+
+  // Clear the last copy
+  e->clear(0);
+  EXPECT_EQ(d, get_pixel_fast<ImageTraits>(b, 3, y));
+  EXPECT_EQ(d, get_pixel_fast<ImageTraits>(a, 0, 0));
+  for (int v=0; v<h; ++v)
+    for (int u=0; u<w; ++u)
+      ASSERT_EQ(0, get_pixel_fast<ImageTraits>(e, u, v));
+}
+
+TYPED_TEST(ImageAllTypes, ReadingDoesntDuplicateStrips)
+{
+  typedef TypeParam ImageTraits;
+
+  const int w = 19;
+  const int h = 2*kImageStripRows + 3;
+  UniquePtr<Image> a(Image::create(ImageTraits::pixel_format, w, h));
+  clear_image(a, 1);
+  UniquePtr<Image> b(Image::createCopy(a));
+
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      EXPECT_EQ(1, get_pixel_fast<ImageTraits>(b, x, y));
+      EXPECT_EQ(1, b->getPixel(x, y));
+      EXPECT_EQ(a->getPixelConstAddress(x, y), b->getPixelConstAddress(x, y));
+    }
+}
+
+TEST(Image, DuplicateStripsFromSeveralThreads)
+{
+  const int w = 50;
+  const int h = 10*kImageStripRows;
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, w, h));
+  clear_image(a, 0);
+  UniquePtr<Image> b(Image::createCopy(a));
+
+  // Each row is modified by a different task, so several threads
+  // duplicate the same strips at the same time.
+  parallel_for(
+    0, h, 1,
+    [&b](int y1, int y2) {
+      for (int y=y1; y<y2; ++y)
+        for (int x=0; x<w; ++x)
+          put_pixel_fast<RgbTraits>(b, x, y, y+1);
+    });
+
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      ASSERT_EQ(0, get_pixel_fast<RgbTraits>(a, x, y));
+      ASSERT_EQ(y+1, get_pixel_fast<RgbTraits>(b, x, y));
+    }
+}
+
+TEST(Image, CopyWithExternalBuffer)
+{
+  ImageBufferPtr buffer(new ImageBuffer);
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, 8, 8, buffer));
+  clear_image(a, rgba(255, 0, 0, 255));
+
+  // Images with an external buffer cannot share their pixels
+  // because the buffer could be reused for other images.
+  UniquePtr<Image> b(Image::createCopy(a));
+  EXPECT_NE(get_pixel_const_address_fast<RgbTraits>(a, 0, 0),
+            get_pixel_const_address_fast<RgbTraits>(b, 0, 0));
+  EXPECT_EQ(0, count_diff_between_images(a, b));
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
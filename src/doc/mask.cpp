@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -13,12 +13,103 @@
 #include "base/base.h"
 #include "base/memory.h"
 #include "doc/image_impl.h"
+#include "doc/primitives_fast.h"
+#include "doc/thread_pool.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
 namespace doc {
 
+typedef MaskRuns::Run Run;
+typedef MaskRuns::Runs Runs;
+
+// Adds the [x1, x2) segment to the runs.
+static void add_run(Runs& runs, int x1, int x2)
+{
+  // First run that touches or is after the segment
+  auto it = std::lower_bound(
+    runs.begin(), runs.end(), x1,
+    [](const Run& run, int x) { return run.x2 < x; });
+
+  // Runs that touch the segment are merged with it
+  auto end = it;
+  while (end != runs.end() && end->x1 <= x2) {
+    x1 = std::min(x1, end->x1);
+    x2 = std::max(x2, end->x2);
+    ++end;
+  }
+
+  it = runs.erase(it, end);
+  runs.insert(it, Run(x1, x2));
+}
+
+// Removes the [x1, x2) segment from the runs.
+static void subtract_run(Runs& runs, int x1, int x2)
+{
+  Runs result;
+  result.reserve(runs.size()+1);
+  for (const Run& run : runs) {
+    if (run.x2 <= x1 || run.x1 >= x2)
+      result.push_back(run);
+    else {
+      if (run.x1 < x1)
+        result.push_back(Run(run.x1, x1));
+      if (run.x2 > x2)
+        result.push_back(Run(x2, run.x2));
+    }
+  }
+  runs.swap(result);
+}
+
+// Keeps the part of the runs inside [x1, x2), and moves them "dx"
+// pixels.
+static void clip_runs(Runs& runs, int x1, int x2, int dx)
+{
+  Runs result;
+  result.reserve(runs.size());
+  for (const Run& run : runs) {
+    const int a = std::max(run.x1, x1);
+    const int b = std::min(run.x2, x2);
+    if (a < b)
+      result.push_back(Run(a+dx, b+dx));
+  }
+  runs.swap(result);
+}
+
+// Replaces the runs with the unselected segments of [0, w).
+static void invert_runs(Runs& runs, int w)
+{
+  Runs result;
+  result.reserve(runs.size()+1);
+  int x = 0;
+  for (const Run& run : runs) {
+    if (x < run.x1)
+      result.push_back(Run(x, run.x1));
+    x = run.x2;
+  }
+  if (x < w)
+    result.push_back(Run(x, w));
+  runs.swap(result);
+}
+
+// Sets the [x1, x2) pixels of a row of an IMAGE_BITMAP image.
+static void fill_bitmap_row(uint8_t* row, int x1, int x2)
+{
+  for (; x1 < x2 && (x1 & 7) != 0; ++x1)
+    row[x1/8] |= (1 << (x1 & 7));
+
+  const int bytes = (x2 - x1) / 8;
+  if (bytes > 0) {
+    std::memset(row + x1/8, 0xff, bytes);
+    x1 += bytes*8;
+  }
+
+  for (; x1 < x2; ++x1)
+    row[x1/8] |= (1 << (x1 & 7));
+}
+
 Mask::Mask()
   : Object(ObjectType::Mask)
 {
@@ -41,11 +132,17 @@ void Mask::initialize()
 {
   m_freeze_count = 0;
   m_bounds = gfx::Rect(0, 0, 0, 0);
+  m_useRuns = false;
+  m_bitmapValid = true;
 }
 
 int Mask::getMemSize() const
 {
-  return sizeof(Mask) + (m_bitmap ? m_bitmap->getMemSize(): 0);
+  int size = sizeof(Mask) + (m_bitmap ? m_bitmap->getMemSize(): 0);
+  size += int(m_runs.capacity() * sizeof(Runs));
+  for (const Runs& runs : m_runs)
+    size += int(runs.capacity() * sizeof(Run));
+  return size;
 }
 
 void Mask::setName(const char *name)
@@ -71,9 +168,19 @@ void Mask::unfreeze()
 
 bool Mask::isRectangular() const
 {
-  if (!m_bitmap)
+  if (isEmpty())
     return false;
 
+  if (m_useRuns) {
+    for (const Runs& runs : m_runs) {
+      if (runs.size() != 1 ||
+          runs[0].x1 != 0 ||
+          runs[0].x2 != m_bounds.w)
+        return false;
+    }
+    return true;
+  }
+
   LockImageBits<BitmapTraits> bits(m_bitmap.get());
   LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
 
@@ -90,11 +197,15 @@ void Mask::copyFrom(const Mask* sourceMask)
   clear();
   setName(sourceMask->name().c_str());
 
-  if (sourceMask->bitmap()) {
-    // Add all the area of "mask"
-    add(sourceMask->bounds());
-
-    // And copy the "mask" bitmap
+  if (sourceMask->m_useRuns) {
+    m_bounds = sourceMask->bounds();
+    m_runs = sourceMask->m_runs;
+    runsModified();
+  }
+  else if (sourceMask->m_bitmap) {
+    // Copy the "mask" bitmap
+    m_bounds = sourceMask->bounds();
+    m_bitmap.reset(Image::create(IMAGE_BITMAP, m_bounds.w, m_bounds.h, m_buffer));
     copy_image(m_bitmap.get(), sourceMask->m_bitmap.get());
   }
 }
@@ -107,185 +218,316 @@ void Mask::offsetOrigin(int dx, int dy)
 void Mask::clear()
 {
   m_bitmap.reset();
+  m_runs.clear();
+  m_useRuns = false;
+  m_bitmapValid = true;
   m_bounds = gfx::Rect(0, 0, 0, 0);
 }
 
 void Mask::invert()
 {
-  if (!m_bitmap)
+  if (isEmpty())
     return;
 
-  LockImageBits<BitmapTraits> bits(m_bitmap.get());
-  LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
-
-  for (; it != end; ++it)
-    *it = (*it ? 0: 1);
+  useRuns();
+  for (Runs& runs : m_runs)
+    invert_runs(runs, m_bounds.w);
+  runsModified();
 
   shrink();
 }
 
 void Mask::replace(const gfx::Rect& bounds)
 {
-  m_bounds = bounds;
+  if (bounds.isEmpty()) {
+    clear();
+    return;
+  }
 
-  m_bitmap.reset(Image::create(IMAGE_BITMAP, bounds.w, bounds.h, m_buffer));
-  clear_image(m_bitmap.get(), 1);
+  m_bounds = bounds;
+  m_runs.assign(bounds.h, Runs(1, Run(0, bounds.w)));
+  runsModified();
 }
 
 void Mask::add(const gfx::Rect& bounds)
 {
+  if (isEmpty()) {
+    if (m_freeze_count == 0)
+      replace(bounds);
+    return;
+  }
+
   if (m_freeze_count == 0)
     reserve(bounds);
 
-  fill_rect(m_bitmap.get(),
-    bounds.x-m_bounds.x,
-    bounds.y-m_bounds.y,
-    bounds.x-m_bounds.x+bounds.w-1,
-    bounds.y-m_bounds.y+bounds.h-1, 1);
+  if (m_useRuns) {
+    const gfx::Rect rc = m_bounds.createIntersection(bounds);
+    for (int y=rc.y; y<rc.y+rc.h; ++y)
+      add_run(m_runs[y-m_bounds.y], rc.x-m_bounds.x, rc.x+rc.w-m_bounds.x);
+    runsModified();
+  }
+  else {
+    fill_rect(m_bitmap.get(),
+      bounds.x-m_bounds.x,
+      bounds.y-m_bounds.y,
+      bounds.x-m_bounds.x+bounds.w-1,
+      bounds.y-m_bounds.y+bounds.h-1, 1);
+  }
 }
 
 void Mask::subtract(const gfx::Rect& bounds)
 {
-  if (!m_bitmap)
+  if (isEmpty())
     return;
 
-  fill_rect(m_bitmap.get(),
-    bounds.x-m_bounds.x,
-    bounds.y-m_bounds.y,
-    bounds.x-m_bounds.x+bounds.w-1,
-    bounds.y-m_bounds.y+bounds.h-1, 0);
+  useRuns();
+
+  const gfx::Rect rc = m_bounds.createIntersection(bounds);
+  for (int y=rc.y; y<rc.y+rc.h; ++y)
+    subtract_run(m_runs[y-m_bounds.y], rc.x-m_bounds.x, rc.x+rc.w-m_bounds.x);
+  runsModified();
 
   shrink();
 }
 
 void Mask::intersect(const gfx::Rect& bounds)
 {
-  if (!m_bitmap)
+  if (isEmpty())
     return;
 
   gfx::Rect newBounds = m_bounds.createIntersection(bounds);
+  if (newBounds.isEmpty()) {
+    clear();
+    return;
+  }
 
-  Image* image = NULL;
+  useRuns();
 
-  if (!newBounds.isEmpty()) {
-    image = crop_image(m_bitmap.get(),
-      newBounds.x-m_bounds.x,
-      newBounds.y-m_bounds.y,
-      newBounds.w,
-      newBounds.h, 0);
-  }
+  // Remove the rows outside the new bounds and clip the others
+  const int dx = m_bounds.x - newBounds.x;
+  m_runs.erase(m_runs.begin() + (newBounds.y+newBounds.h-m_bounds.y), m_runs.end());
+  m_runs.erase(m_runs.begin(), m_runs.begin() + (newBounds.y-m_bounds.y));
+  for (Runs& runs : m_runs)
+    clip_runs(runs, -dx, newBounds.w-dx, dx);
 
-  m_bitmap.reset(image);
   m_bounds = newBounds;
+  runsModified();
 
   shrink();
 }
 
-void Mask::byColor(const Image *src, int color, int fuzziness)
-{
-  replace(src->bounds());
+namespace {
 
-  Image* dst = m_bitmap.get();
+// Number of rows processed by each task in byColor()
+const int kRowsPerTask = 16;
 
-  switch (src->pixelFormat()) {
+// Number of pixels compared at the same time in byColor()
+const int kChunkSize = 256;
 
-    case IMAGE_RGB: {
-      const LockImageBits<RgbTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<RgbTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      int src_r, src_g, src_b, src_a;
-      int dst_r, dst_g, dst_b, dst_a;
-      color_t c;
-
-      dst_r = rgba_getr(color);
-      dst_g = rgba_getg(color);
-      dst_b = rgba_getb(color);
-      dst_a = rgba_geta(color);
-
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        src_r = rgba_getr(c);
-        src_g = rgba_getg(c);
-        src_b = rgba_getb(c);
-        src_a = rgba_geta(c);
-
-        if (!((src_r >= dst_r-fuzziness) && (src_r <= dst_r+fuzziness) &&
-              (src_g >= dst_g-fuzziness) && (src_g <= dst_g+fuzziness) &&
-              (src_b >= dst_b-fuzziness) && (src_b <= dst_b+fuzziness) &&
-              (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
-      break;
-    }
+// Functors to know if a pixel matches the color given to byColor().
+// They don't have branches so the compiler can vectorize the loop
+// that compares a whole row of pixels (see color_runs()).
 
-    case IMAGE_GRAYSCALE: {
-      const LockImageBits<GrayscaleTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<GrayscaleTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      int src_k, src_a;
-      int dst_k, dst_a;
-      color_t c;
+// Returns true if |a-b| <= fuzziness (for fuzziness >= 0)
+inline bool in_range(int a, int b, int fuzziness) {
+  return (uint32_t(a - b + fuzziness) <= uint32_t(2*fuzziness));
+}
+
+class RgbColorMatch {
+public:
+  RgbColorMatch(color_t color, int fuzziness)
+    : m_r(rgba_getr(color)), m_g(rgba_getg(color))
+    , m_b(rgba_getb(color)), m_a(rgba_geta(color))
+    , m_fuzziness(fuzziness) { }
+
+  bool operator()(RgbTraits::pixel_t c) const {
+    return (in_range(rgba_getr(c), m_r, m_fuzziness) &
+            in_range(rgba_getg(c), m_g, m_fuzziness) &
+            in_range(rgba_getb(c), m_b, m_fuzziness) &
+            in_range(rgba_geta(c), m_a, m_fuzziness));
+  }
 
-      dst_k = graya_getv(color);
-      dst_a = graya_geta(color);
+private:
+  int m_r, m_g, m_b, m_a, m_fuzziness;
+};
 
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
+class GrayscaleColorMatch {
+public:
+  GrayscaleColorMatch(color_t color, int fuzziness)
+    : m_k(graya_getv(color)), m_a(graya_geta(color))
+    , m_fuzziness(fuzziness) { }
 
-        src_k = graya_getv(c);
-        src_a = graya_geta(c);
+  bool operator()(GrayscaleTraits::pixel_t c) const {
+    return (in_range(graya_getv(c), m_k, m_fuzziness) &
+            in_range(graya_geta(c), m_a, m_fuzziness));
+  }
 
-        if (!((src_k >= dst_k-fuzziness) && (src_k <= dst_k+fuzziness) &&
-              (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness)))
-          *dst_it = 0;
+private:
+  int m_k, m_a, m_fuzziness;
+};
+
+class IndexedColorMatch {
+public:
+  IndexedColorMatch(int color, int fuzziness)
+    : m_min(color > fuzziness ? color-fuzziness: 0)
+    , m_range(color+fuzziness - m_min) { }
+
+  bool operator()(IndexedTraits::pixel_t c) const {
+    return (uint32_t(int(c) - m_min) <= uint32_t(m_range));
+  }
+
+private:
+  int m_min, m_range;
+};
+
+// Builds the runs of a row from the matches of consecutive chunks of
+// pixels.
+class RunsBuilder {
+public:
+  RunsBuilder(Runs& runs) : m_runs(runs), m_start(-1) { }
+
+  // Adds the runs of "matches" (one 0/1 byte for each of the "n"
+  // pixels starting from the "x" column). First the positions where
+  // the value changes are collected, and then they are converted to
+  // runs.
+  void add(const uint8_t* matches, int x, int n) {
+    const uint64_t kAllMatch = 0x0101010101010101ull;
+    int edges[kChunkSize];
+    int count = 0;
+    uint8_t prev = (m_start >= 0 ? 1: 0);
+
+    for (int i=0; i<n; ) {
+      // Skip 8 pixels at a time when all of them are equal to the
+      // previous one (common case in flat areas)
+      if (i+8 <= n) {
+        uint64_t bytes;
+        std::memcpy(&bytes, matches+i, 8);
+        if (bytes == (prev ? kAllMatch: 0)) {
+          i += 8;
+          continue;
+        }
       }
-      ASSERT(dst_it == dst_end);
-      break;
-    }
 
-    case IMAGE_INDEXED: {
-      const LockImageBits<IndexedTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<IndexedTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      color_t c, min, max;
+      // Without branches for noisy areas
+      const int end = std::min(i+8, n);
+      for (; i<end; ++i) {
+        edges[count] = x+i;
+        count += (matches[i] != prev ? 1: 0);
+        prev = matches[i];
+      }
+    }
 
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
+    for (int i=0; i<count; ++i) {
+      if (m_start < 0)
+        m_start = edges[i];
+      else {
+        m_runs.push_back(Run(m_start, edges[i]));
+        m_start = -1;
+      }
+    }
+  }
 
-        if (color > fuzziness)
-          min = color-fuzziness;
-        else
-          min = 0;
-        max = color + fuzziness;
+  void finish(int w) {
+    if (m_start >= 0)
+      m_runs.push_back(Run(m_start, w));
+  }
 
-        if (!((c >= min) && (c <= max)))
-          *dst_it = 0;
+private:
+  Runs& m_runs;
+  int m_start;
+};
+
+// Generates the runs of pixels of each row of "src" that match the
+// given color. Rows are compared in chunks of kChunkSize pixels by a
+// loop without branches and a fixed number of iterations (so the
+// compiler can vectorize it), and then converted to runs.
+template<typename ImageTraits, typename ColorMatch>
+void color_runs(const Image* src, const ColorMatch& match, std::vector<Runs>& rows)
+{
+  const int w = src->width();
+
+  parallel_for(
+    0, src->height(), kRowsPerTask,
+    [src, w, &match, &rows](int y1, int y2) {
+      uint8_t matches[kChunkSize];
+      Runs buffer;
+
+      for (int y=y1; y<y2; ++y) {
+        typename ImageTraits::const_address_t p =
+          get_pixel_const_address_fast<ImageTraits>(src, 0, y);
+        RunsBuilder builder(buffer);
+        buffer.clear();
+
+        for (int x=0; x<w; x+=kChunkSize, p+=kChunkSize) {
+          const int n = std::min(kChunkSize, w-x);
+          if (n == kChunkSize) {
+            for (int i=0; i<kChunkSize; ++i)
+              matches[i] = match(p[i]);
+          }
+          else {
+            for (int i=0; i<n; ++i)
+              matches[i] = match(p[i]);
+          }
+          builder.add(matches, x, n);
+        }
+        builder.finish(w);
+
+        // Copy the runs from the buffer to allocate the exact memory
+        rows[y].assign(buffer.begin(), buffer.end());
       }
-      ASSERT(dst_it == dst_end);
+    });
+}
+
+} // anonymous namespace
+
+void Mask::byColor(const Image *src, int color, int fuzziness)
+{
+  clear();
+  if (fuzziness < 0)
+    return;
+
+  m_bounds = src->bounds();
+  m_runs.resize(m_bounds.h);
+
+  switch (src->pixelFormat()) {
+    case IMAGE_RGB:
+      color_runs<RgbTraits>(src, RgbColorMatch(color, fuzziness), m_runs);
+      break;
+    case IMAGE_GRAYSCALE:
+      color_runs<GrayscaleTraits>(src, GrayscaleColorMatch(color, fuzziness), m_runs);
+      break;
+    case IMAGE_INDEXED:
+      color_runs<IndexedTraits>(src, IndexedColorMatch(color, fuzziness), m_runs);
       break;
-    }
   }
+  runsModified();
 
   shrink();
 }
 
+void masks_by_color(const std::vector<const Image*>& images,
+                    const std::vector<Mask*>& masks,
+                    int color, int fuzziness)
+{
+  ASSERT(images.size() == masks.size());
+  const int n = int(images.size());
+
+  // With few images each one is processed by several threads (rows
+  // in parallel), in other case each thread processes whole images.
+  if (n < ThreadPool::instance()->concurrency()) {
+    for (int i=0; i<n; ++i)
+      masks[i]->byColor(images[i], color, fuzziness);
+  }
+  else {
+    parallel_for(
+      0, n, 1,
+      [&images, &masks, color, fuzziness](int begin, int end) {
+        for (int i=begin; i<end; ++i)
+          masks[i]->byColor(images[i], color, fuzziness);
+      });
+  }
+}
+
 void Mask::crop(const Image *image)
 {
 #define ADVANCE(beg, end, o_end, cmp, op, getpixel1, getpixel)  \
@@ -313,7 +555,7 @@ void Mask::crop(const Image *image)
   int done;
   color_t old_color;
 
-  if (!m_bitmap)
+  if (isEmpty())
     return;
 
   beg_x1 = m_bounds.x;
@@ -355,11 +597,30 @@ void Mask::reserve(const gfx::Rect& bounds)
 {
   ASSERT(!bounds.isEmpty());
 
-  if (!m_bitmap) {
+  if (isEmpty()) {
     m_bounds = bounds;
     m_bitmap.reset(Image::create(IMAGE_BITMAP, bounds.w, bounds.h, m_buffer));
     clear_image(m_bitmap.get(), 0);
   }
+  else if (m_useRuns) {
+    gfx::Rect newBounds = m_bounds.createUnion(bounds);
+
+    if (m_bounds != newBounds) {
+      // Add empty rows and move the runs to the new origin
+      const int dx = m_bounds.x - newBounds.x;
+      m_runs.insert(m_runs.begin(), m_bounds.y - newBounds.y, Runs());
+      m_runs.resize(newBounds.h);
+      if (dx != 0) {
+        for (Runs& runs : m_runs)
+          for (Run& run : runs) {
+            run.x1 += dx;
+            run.x2 += dx;
+          }
+      }
+      m_bounds = newBounds;
+      runsModified();
+    }
+  }
   else {
     gfx::Rect newBounds = m_bounds.createUnion(bounds);
 
@@ -381,6 +642,11 @@ void Mask::shrink()
   if (m_freeze_count > 0)
     return;
 
+  if (m_useRuns) {
+    shrinkRuns();
+    return;
+  }
+
 #define SHRINK_SIDE(u_begin, u_op, u_final, u_add,                      \
                     v_begin, v_op, v_final, v_add, U, V, var)           \
   {                                                                     \
@@ -435,4 +701,94 @@ void Mask::shrink()
 #undef SHRINK_SIDE
 }
 
+void Mask::shrinkRuns()
+{
+  int x1 = m_bounds.w, x2 = 0;
+  int y1 = -1, y2 = -1;
+
+  for (int y=0; y<m_bounds.h; ++y) {
+    const Runs& runs = m_runs[y];
+    if (!runs.empty()) {
+      if (y1 < 0)
+        y1 = y;
+      y2 = y;
+      x1 = std::min(x1, runs.front().x1);
+      x2 = std::max(x2, runs.back().x2);
+    }
+  }
+
+  if (y1 < 0) {
+    clear();
+  }
+  else if (x1 != 0 || x2 != m_bounds.w ||
+           y1 != 0 || y2 != m_bounds.h-1) {
+    m_runs.erase(m_runs.begin()+y2+1, m_runs.end());
+    m_runs.erase(m_runs.begin(), m_runs.begin()+y1);
+    if (x1 != 0) {
+      for (Runs& runs : m_runs)
+        for (Run& run : runs) {
+          run.x1 -= x1;
+          run.x2 -= x1;
+        }
+    }
+
+    m_bounds = gfx::Rect(m_bounds.x+x1, m_bounds.y+y1, x2-x1, y2-y1+1);
+    runsModified();
+  }
+}
+
+// Converts the bitmap to runs.
+void Mask::useRuns()
+{
+  if (m_useRuns || !m_bitmap)
+    return;
+
+  m_runs.clear();
+  m_runs.resize(m_bounds.h);
+  for (int y=0; y<m_bounds.h; ++y)
+    decode_bitmap_runs(m_bitmap.get(), y, m_runs[y]);
+
+  // The bitmap is still valid until the runs are modified
+  m_useRuns = true;
+}
+
+// Converts the runs to a bitmap.
+void Mask::useBitmap()
+{
+  if (!m_bitmapValid)
+    generateBitmap();
+
+  m_runs.clear();
+  m_useRuns = false;
+}
+
+// Must be called each time the runs are modified, the bitmap will be
+// generated again when it's needed.
+void Mask::runsModified()
+{
+  m_useRuns = true;
+  m_bitmap.reset();
+  m_bitmapValid = false;
+}
+
+void Mask::generateBitmap() const
+{
+  std::lock_guard<std::mutex> lock(m_bitmapMutex);
+  if (m_bitmapValid)
+    return;
+
+  ASSERT(m_useRuns);
+  ImageRef bitmap(Image::create(IMAGE_BITMAP, m_bounds.w, m_bounds.h, m_buffer));
+  clear_image(bitmap.get(), 0);
+
+  for (int y=0; y<m_bounds.h; ++y) {
+    uint8_t* row = get_pixel_address_fast<BitmapTraits>(bitmap.get(), 0, y);
+    for (const Run& run : m_runs[y])
+      fill_bitmap_row(row, run.x1, run.x2);
+  }
+
+  m_bitmap = bitmap;
+  m_bitmapValid = true;
+}
+
 } // namespace doc
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2015 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -11,15 +11,25 @@
 #include "doc/image.h"
 #include "doc/image_buffer.h"
 #include "doc/image_ref.h"
+#include "doc/mask_runs.h"
 #include "doc/object.h"
 #include "doc/primitives.h"
 #include "gfx/rect.h"
 
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace doc {
 
   // Represents the selection (selected pixels, 0/1, 0=non-selected, 1=selected)
+  //
+  // The selection can be stored as a bitmap or as a list of runs for
+  // each row. Rectangular operations (replace/add/subtract/intersect),
+  // invert() and byColor() use the runs, so their cost depends on the
+  // number of runs instead of the number of pixels. In that case the
+  // bitmap is generated the first time it's requested.
   class Mask : public Object {
   public:
     Mask();
@@ -31,21 +41,48 @@ namespace doc {
     void setName(const char *name);
     const std::string& name() const { return m_name; }
 
-    const Image* bitmap() const { return m_bitmap.get(); }
-    Image* bitmap() { return m_bitmap.get(); }
+    // Returns the bitmap of the mask (generated from the runs if
+    // it's needed). The non-const version converts the mask to the
+    // bitmap representation, as the caller can modify the bitmap.
+    const Image* bitmap() const {
+      if (!m_bitmapValid)
+        generateBitmap();
+      return m_bitmap.get();
+    }
+    Image* bitmap() {
+      if (m_useRuns)
+        useBitmap();
+      return m_bitmap.get();
+    }
+
+    // Returns true if the selection is stored as runs, in that case
+    // rowRuns() can be used to get the runs of each row.
+    bool hasRuns() const { return m_useRuns; }
+
+    // Returns the runs of the given row (0 <= y < bounds().h) in
+    // mask bitmap coordinates (see MaskRuns).
+    const MaskRuns::Runs& rowRuns(int y) const {
+      ASSERT(m_useRuns);
+      ASSERT(y >= 0 && y < int(m_runs.size()));
+      return m_runs[y];
+    }
 
     // Returns true if the mask is completely empty (i.e. nothing
     // selected)
     bool isEmpty() const {
-      return (!m_bitmap ? true: false);
+      return (!m_useRuns && !m_bitmap ? true: false);
     }
 
     // Returns true if the point is inside the mask
     bool containsPoint(int u, int v) const {
-      return (m_bitmap.get() &&
-              u >= m_bounds.x && u < m_bounds.x+m_bounds.w &&
-              v >= m_bounds.y && v < m_bounds.y+m_bounds.h &&
-              get_pixel(m_bitmap.get(), u-m_bounds.x, v-m_bounds.y));
+      if (isEmpty() ||
+          u < m_bounds.x || u >= m_bounds.x+m_bounds.w ||
+          v < m_bounds.y || v >= m_bounds.y+m_bounds.h)
+        return false;
+      else if (m_useRuns)
+        return runs_contain(m_runs[v-m_bounds.y], u-m_bounds.x);
+      else
+        return (get_pixel(m_bitmap.get(), u-m_bounds.x, v-m_bounds.y) ? true: false);
     }
 
     const gfx::Rect& bounds() const { return m_bounds; }
@@ -99,16 +136,37 @@ namespace doc {
 
   private:
     void initialize();
+    void shrinkRuns();
+    void useRuns();
+    void useBitmap();
+    void runsModified();
+    void generateBitmap() const;
 
     int m_freeze_count;
     std::string m_name;           // Mask name
     gfx::Rect m_bounds;           // Region bounds
-    ImageRef m_bitmap;            // Bitmapped image mask
+    mutable ImageRef m_bitmap;    // Bitmapped image mask
     ImageBufferPtr m_buffer;      // Buffer used in m_bitmap
 
+    // Runs of each row of the mask (when m_useRuns is true).
+    bool m_useRuns;
+    std::vector<MaskRuns::Runs> m_runs;
+
+    // False if m_bitmap must be generated from m_runs. The bitmap
+    // can be requested from several threads at the same time.
+    mutable std::atomic<bool> m_bitmapValid;
+    mutable std::mutex m_bitmapMutex;
+
     Mask& operator=(const Mask& mask);
   };
 
+  // Calls byColor() for each image in parallel (e.g. to select the
+  // same color in several frames). "masks" must contain one mask for
+  // each image.
+  void masks_by_color(const std::vector<const Image*>& images,
+                      const std::vector<Mask*>& masks,
+                      int color, int fuzziness);
+
 } // namespace doc
 
 #endif
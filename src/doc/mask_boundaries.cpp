@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2015 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -11,327 +11,288 @@
 #include "doc/mask_boundaries.h"
 
 #include "doc/image_impl.h"
+#include "doc/primitives_fast.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 
 namespace doc {
 
-MaskBoundaries::MaskBoundaries(const Image* bitmap)
+static_assert(MaskBoundaries::kTileSize == 64,
+              "Each row of a tile is stored in an uint64_t");
+
+static int next_tile_version()
 {
-  int x, y, w = bitmap->width(), h = bitmap->height();
+  static std::atomic<int> version(0);
+  return ++version;
+}
 
-  const LockImageBits<BitmapTraits> bits(bitmap);
-  auto it = bits.begin();       // Current pixel iterator
-#if _DEBUG
-  auto prevIt = bits.begin();   // Previous row iterator (same X pos)
-#endif
+// Like a/b but rounding to -infinity.
+static int floor_div(int a, int b)
+{
+  return (a >= 0 ? a / b: -((-a + b - 1) / b));
+}
 
-  // Vertical segments being expanded from the previous row.
-  std::vector<int> vertSegs(w+1, -1);
+// Returns the 64 pixels of the given row of the bitmap starting from
+// the "x" column (bit 0 is the "x" pixel). The bitmap is located in
+// the "origin" position, and pixels outside the bitmap are zero.
+static uint64_t get_row_bits(const Image* bitmap, const gfx::Point& origin, int x, int y)
+{
+  const int w = bitmap->width();
+  const int bx = x - origin.x;
+  const int by = y - origin.y;
+  if (by < 0 || by >= bitmap->height() || bx >= w || bx + 64 <= 0)
+    return 0;
 
-  // Horizontal segment being expanded from the previous column.
-  int horzSeg;
+  const uint8_t* row = get_pixel_const_address_fast<BitmapTraits>(bitmap, 0, by);
+  const int rowBytes = (w+7) / 8;
+  const int firstByte = floor_div(bx, 8);
+  const int shift = bx - firstByte*8;
+  uint64_t bits = 0;
 
-#define new_hseg(open) {                                        \
-    m_segs.push_back(Segment(open, gfx::Rect(x, y, 1, 0)));     \
-    horzSeg = int(m_segs.size()-1);                             \
-  }
-#define new_vseg(open) {                                        \
-    m_segs.push_back(Segment(open, gfx::Rect(x, y, 0, 1)));     \
-    vertSegs[x] = int(m_segs.size()-1);                         \
-  }
-#define expand_hseg() { \
-    ASSERT(hseg);       \
-    ++hseg->m_bounds.w; \
+  for (int i=0; i<9; ++i) {
+    const int j = firstByte + i;
+    if (j < 0 || j >= rowBytes)
+      continue;
+
+    const uint64_t byte = row[j];
+    const int pos = 8*i - shift;    // Position of the byte in "bits"
+    if (pos < 0)
+      bits |= (byte >> -pos);
+    else if (pos < 64)
+      bits |= (byte << pos);
   }
-#define expand_vseg() { \
-    ASSERT(vseg);       \
-    ++vseg->m_bounds.h; \
+
+  // Remove the unused bits at the end of the row
+  if (bx + 64 > w)
+    bits &= ((uint64_t(1) << (w - bx)) - 1);
+
+  return bits;
+}
+
+enum {
+  kPixelsChanged = 1,
+  kLastRowChanged = 2,            // Bottom row of pixels of the tile
+  kLastColChanged = 4,            // Right column of pixels of the tile
+};
+
+// Compares the pixels of two tiles ("b" can be nullptr for a tile
+// without pixels). Returns the kPixelsChanged/kLastRowChanged/
+// kLastColChanged flags.
+static int compare_tile_rows(const uint64_t* a, const uint64_t* b)
+{
+  const int n = MaskBoundaries::kTileSize;
+  const uint64_t lastCol = (uint64_t(1) << (n-1));
+  int changes = 0;
+
+  for (int k=0; k<n; ++k) {
+    const uint64_t diff = a[k] ^ (b ? b[k]: 0);
+    if (diff) {
+      changes |= kPixelsChanged;
+      if (diff & lastCol)
+        changes |= kLastColChanged;
+      if (k == n-1)
+        changes |= kLastRowChanged;
+    }
   }
-#define stop_expanding_hseg() {                 \
-    horzSeg = -1;                               \
+  return changes;
+}
+
+MaskBoundaries::MaskBoundaries()
+  : m_gridOrigin(0, 0)
+{
+}
+
+MaskBoundaries::MaskBoundaries(const Image* bitmap)
+  : m_gridOrigin(0, 0)
+{
+  regenerate(bitmap);
+}
+
+void MaskBoundaries::regenerate(const Image* bitmap, const gfx::Point& origin)
+{
+  ASSERT(bitmap->pixelFormat() == IMAGE_BITMAP);
+
+  // New grid of tiles, it includes the right and bottom edges of the
+  // bitmap (the "+1" pixel).
+  gfx::Rect grid;
+  grid.x = floor_div(origin.x - m_gridOrigin.x, kTileSize);
+  grid.y = floor_div(origin.y - m_gridOrigin.y, kTileSize);
+  grid.w = floor_div(origin.x + bitmap->width() - m_gridOrigin.x, kTileSize) - grid.x + 1;
+  grid.h = floor_div(origin.y + bitmap->height() - m_gridOrigin.y, kTileSize) - grid.y + 1;
+
+  tiles_type tiles(grid.w * grid.h);
+  std::vector<int> changes(tiles.size(), 0);
+  std::vector<bool> reused(tiles.size(), false);
+
+  for (int v=0; v<grid.h; ++v) {
+    for (int u=0; u<grid.w; ++u) {
+      const int i = v*grid.w + u;
+      const gfx::Point tilePos(grid.x+u, grid.y+v);
+      Tile& tile = tiles[i];
+      tile.m_bounds = gfx::Rect(m_gridOrigin.x + tilePos.x*kTileSize,
+                                m_gridOrigin.y + tilePos.y*kTileSize,
+                                kTileSize, kTileSize);
+
+      for (int k=0; k<kTileSize; ++k)
+        tile.m_rows[k] = get_row_bits(bitmap, origin,
+                                      tile.m_bounds.x, tile.m_bounds.y+k);
+
+      if (m_grid.contains(tilePos)) {
+        Tile& oldTile = m_tiles[(tilePos.y-m_grid.y)*m_grid.w + (tilePos.x-m_grid.x)];
+        changes[i] = compare_tile_rows(tile.m_rows, oldTile.m_rows);
+
+        // Reuse the segments of the old tile (they will be generated
+        // again if the tile or its neighbors were modified)
+        tile.m_segs.swap(oldTile.m_segs);
+        tile.m_version = oldTile.m_version;
+        reused[i] = true;
+      }
+      else
+        changes[i] = compare_tile_rows(tile.m_rows, nullptr);
+    }
   }
-#define stop_expanding_vseg() {                 \
-    vertSegs[x] = -1;                           \
+
+  // Changes in tiles of the old grid that aren't in the new one
+  // (their pixels are zero now).
+  std::vector<int> oldChanges(m_tiles.size(), 0);
+  for (int v=0; v<m_grid.h; ++v) {
+    for (int u=0; u<m_grid.w; ++u) {
+      if (!grid.contains(gfx::Point(m_grid.x+u, m_grid.y+v))) {
+        const int i = v*m_grid.w + u;
+        oldChanges[i] = compare_tile_rows(m_tiles[i].m_rows, nullptr);
+      }
+    }
   }
 
-  for (y=0; y<=h; ++y) {
-    bool prevColor = false;         // Previous color (X-1) same Y row
-    horzSeg = -1;
+  // Returns the changes in the pixels of the given tile (in tile
+  // coordinates).
+  auto tileChanges =
+    [this, &grid, &changes, &oldChanges](int tx, int ty) -> int {
+      if (grid.contains(gfx::Point(tx, ty)))
+        return changes[(ty-grid.y)*grid.w + (tx-grid.x)];
+      else if (m_grid.contains(gfx::Point(tx, ty)))
+        return oldChanges[(ty-m_grid.y)*m_grid.w + (tx-m_grid.x)];
+      else
+        return 0;
+    };
 
-    for (x=0; x<=w; ++x) {
-      bool color = (x < w && y < h && *it ? true: false);
-#if _DEBUG
-      bool prevRowColor = (x < w && y > 0 && *prevIt ? true: false);
-#endif
-      Segment* hseg = (horzSeg >= 0 ? &m_segs[horzSeg]: nullptr);
-      Segment* vseg = (vertSegs[x] >= 0 ? &m_segs[vertSegs[x]]: nullptr);
-
-      //
-      // -   -
-      //
-      // -   1
-      //
-      if (color) {
-        //
-        // - | -
-        //   o
-        // -   1
-        //
-        if (vseg) {
-          //
-          // 0 | 1
-          //   o
-          // -   1
-          //
-          if (vseg->open()) {
-            ASSERT(prevRowColor);
-
-            //
-            // 0 | 1
-            // --x
-            // 1   1
-            //
-            if (hseg) {
-              ASSERT(hseg->open());
-              ASSERT(prevColor);
-              stop_expanding_hseg();
-              stop_expanding_vseg();
-            }
-            //
-            // 0 | 1
-            //   |
-            // 0 | 1
-            //   o
-            else {
-              ASSERT(!prevColor);
-              expand_vseg();
-            }
-          }
-          //
-          // 1 | 0
-          //   x--o
-          // -   1
-          //
-          else {
-            ASSERT(!prevRowColor);
-
-            //
-            // 1 | 0
-            // --x--o
-            // 0 | 1
-            //   o
-            if (hseg) {
-              ASSERT(!prevColor);
-              ASSERT(!hseg->open());
-              new_hseg(true);
-              new_vseg(true);
-            }
-            //
-            // 1 | 0
-            //   x--o
-            // 1   1
-            //
-            else {
-              ASSERT(prevColor);
-              new_hseg(true);
-			  stop_expanding_vseg();
-            }
-          }
-        }
-        //
-        // -   -  (there is no vertical segment in this row, both colors are equal)
-        //
-        // -   1
-        //
-        else {
-          //
-          // -   -
-          // --o
-          // -   1
-          //
-          if (hseg) {
-            //
-            // 0   0
-            // -----o
-            // 1   1
-            //
-            if (hseg->open()) {
-              ASSERT(prevColor);
-              expand_hseg();
-            }
-            //
-            // 1   1
-            // --x
-            // 0 | 1
-            //   o
-            else {
-              ASSERT(!prevColor);
-              stop_expanding_hseg();
-              new_vseg(true);
-            }
-          }
-          else {
-            //
-            // 1   1
-            //
-            // 1   1
-            //
-            if (prevColor) {
-              // Do nothing, we are inside boundaries
-            }
-            //
-            // 0   0
-            //    --o
-            // 0 | 1
-            //   o
-            else {
-              // First two segments of a corner
-              new_hseg(true);
-              new_vseg(true);
-            }
-          }
+  // Generate the segments of the modified tiles, and of the tiles
+  // whose left column or top row of neighbor pixels was modified.
+  for (int v=0; v<grid.h; ++v) {
+    for (int u=0; u<grid.w; ++u) {
+      const int tx = grid.x+u;
+      const int ty = grid.y+v;
+      Tile& tile = tiles[v*grid.w + u];
+
+      if (!reused[v*grid.w + u] ||
+          (tileChanges(tx, ty) & kPixelsChanged) ||
+          (tileChanges(tx-1, ty) & kLastColChanged) ||
+          (tileChanges(tx, ty-1) & kLastRowChanged)) {
+        const uint64_t rowAbove =
+          (v > 0 ? tiles[(v-1)*grid.w + u].m_rows[kTileSize-1]: 0);
+
+        uint64_t colLeft = 0;
+        if (u > 0) {
+          const Tile& left = tiles[v*grid.w + u-1];
+          for (int k=0; k<kTileSize; ++k)
+            colLeft |= ((left.m_rows[k] >> (kTileSize-1)) << k);
         }
+
+        generateTile(tile, rowAbove, colLeft);
       }
-      //
-      // -   -
-      //
-      // -   0
-      //
-      else {
-        //
-        // - | -
-        //   o
-        // -   0
-        //
-        if (vseg) {
-          //
-          // 0 | 1
-          //   o
-          // -   0
-          //
-          if (vseg->open()) {
-            ASSERT(prevRowColor);
-
-            //
-            // 0 | 1
-            // --x--o
-            // 1 | 0
-            //   o
-            if (hseg) {
-              ASSERT(hseg->open());
-              ASSERT(prevColor);
-              new_hseg(false);
-              new_vseg(false);
-            }
-            //
-            // 0 | 1
-            //   x--o
-            // 0   0
-            //
-            else {
-              ASSERT(!prevColor);
-              new_hseg(false);
-              stop_expanding_vseg();
-            }
-          }
-          //
-          // 1 | 0
-          //   o
-          // -   0
-          //
-          else {
-            ASSERT(!prevRowColor);
-
-            //
-            // 1 | 0
-            // --x
-            // 0   0
-            //
-            if (hseg) {
-              ASSERT(!prevColor);
-              stop_expanding_hseg();
-              stop_expanding_vseg();
-            }
-            //
-            // 1 | 0
-            //   |
-            // 1 | 0
-            //   o
-            else {
-              ASSERT(prevColor);
-              expand_vseg();
-            }
-          }
-        }
-        //
-        // -   -  (there is no vertical segment in this row, both colors are equal)
-        //
-        // -   0
-        //
+    }
+  }
+
+  m_tiles.swap(tiles);
+  m_grid = grid;
+  updateSegmentsList();
+}
+
+// Generates the segments at the left and top edges of each pixel in
+// the tile. "rowAbove" are the pixels of the row above the tile, and
+// "colLeft" the pixels of the column at the left side (bit 0 is the
+// pixel at the top).
+void MaskBoundaries::generateTile(Tile& tile, uint64_t rowAbove, uint64_t colLeft)
+{
+  const int x0 = tile.m_bounds.x;
+  const int y0 = tile.m_bounds.y;
+  list_type& segs = tile.m_segs;
+
+  // Vertical segments being expanded from the previous row (index
+  // in "segs" for each column).
+  int vertSegs[kTileSize];
+  std::fill(vertSegs, vertSegs+kTileSize, -1);
+
+  segs.clear();
+
+  for (int y=0; y<kTileSize; ++y) {
+    const uint64_t row = tile.m_rows[y];
+    const uint64_t above = (y > 0 ? tile.m_rows[y-1]: rowAbove);
+    const uint64_t left = (row << 1) | ((colLeft >> y) & 1);
+
+    // Horizontal segments: the pixel is different from the one above
+    const uint64_t hedges = row ^ above;
+    int horzSeg = -1;
+    for (int x=0; x<kTileSize; ++x) {
+      if ((hedges >> x) & 1) {
+        const bool open = ((row >> x) & 1 ? true: false);
+        if (horzSeg >= 0 && segs[horzSeg].open() == open)
+          ++segs[horzSeg].m_bounds.w;
         else {
-          //
-          // -   -
-          // --o
-          // -   0
-          //
-          if (hseg) {
-            //
-            // 0   0
-            // --x
-            // 1 | 0
-            //   o
-            if (hseg->open()) {
-              ASSERT(prevColor);
-              stop_expanding_hseg();
-              new_vseg(false);
-            }
-            //
-            // 1   1
-            // -----o
-            // 0   0
-            //
-            else {
-              ASSERT(!prevColor);
-              expand_hseg();
-            }
-          }
-          else {
-            //
-            // 1   1
-            //    --o
-            // 1 | 0
-            //   o
-            if (prevColor) {
-              new_hseg(false);
-              new_vseg(false);
-            }
-            //
-            // 0   0
-            //
-            // 0   0
-            //
-            else {
-              // Do nothing, we are inside boundaries
-            }
-          }
+          segs.push_back(Segment(open, gfx::Rect(x0+x, y0+y, 1, 0)));
+          horzSeg = int(segs.size()-1);
         }
       }
+      else
+        horzSeg = -1;
+    }
 
-      prevColor = color;
-      if (x < w) {
-#if _DEBUG
-        if (y > 0) ++prevIt;
-#endif
-        if (y < h) ++it;
+    // Vertical segments: the pixel is different from the left one
+    const uint64_t vedges = row ^ left;
+    for (int x=0; x<kTileSize; ++x) {
+      if ((vedges >> x) & 1) {
+        const bool open = ((row >> x) & 1 ? true: false);
+        if (vertSegs[x] >= 0 && segs[vertSegs[x]].open() == open)
+          ++segs[vertSegs[x]].m_bounds.h;
+        else {
+          segs.push_back(Segment(open, gfx::Rect(x0+x, y0+y, 0, 1)));
+          vertSegs[x] = int(segs.size()-1);
+        }
       }
+      else
+        vertSegs[x] = -1;
     }
   }
 
-  ASSERT(it == bits.end());
-  ASSERT(prevIt == bits.end());
+  tile.m_version = next_tile_version();
+}
+
+void MaskBoundaries::updateSegmentsList()
+{
+  std::size_t n = 0;
+  for (const Tile& tile : m_tiles)
+    n += tile.m_segs.size();
+
+  m_segs.clear();
+  m_segs.reserve(n);
+  for (const Tile& tile : m_tiles)
+    m_segs.insert(m_segs.end(), tile.m_segs.begin(), tile.m_segs.end());
 }
 
 void MaskBoundaries::offset(int x, int y)
 {
+  m_gridOrigin.x += x;
+  m_gridOrigin.y += y;
+
+  for (Tile& tile : m_tiles) {
+    tile.m_bounds.offset(x, y);
+    for (Segment& seg : tile.m_segs)
+      seg.offset(x, y);
+    tile.m_version = next_tile_version();
+  }
+
   for (Segment& seg : m_segs)
     seg.offset(x, y);
 }
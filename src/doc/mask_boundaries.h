@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2015 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,6 +8,8 @@
 #define DOC_MASK_BOUNDARIES_H_INCLUDED
 #pragma once
 
+#include "base/ints.h"
+#include "gfx/point.h"
 #include "gfx/rect.h"
 
 #include <vector>
@@ -41,6 +43,34 @@ namespace doc {
     typedef list_type::iterator iterator;
     typedef list_type::const_iterator const_iterator;
 
+    // The boundaries are divided in tiles of kTileSize x kTileSize
+    // pixels, so they can be updated and drawn by parts. A tile
+    // contains the segments at the left and top edges of its pixels
+    // (segments are split at tile edges).
+    static const int kTileSize = 64;
+
+    class Tile {
+    public:
+      const gfx::Rect& bounds() const { return m_bounds; }
+      const list_type& segments() const { return m_segs; }
+
+      // Unique number that changes each time the segments of the tile
+      // are generated or moved. It can be used to cache information
+      // calculated from the segments.
+      int version() const { return m_version; }
+
+    private:
+      gfx::Rect m_bounds;
+      list_type m_segs;
+      int m_version;
+      uint64_t m_rows[kTileSize]; // Pixels of the tile (1 bit each)
+
+      friend class MaskBoundaries;
+    };
+
+    typedef std::vector<Tile> tiles_type;
+
+    MaskBoundaries();
     MaskBoundaries(const Image* bitmap);
 
     const_iterator begin() const { return m_segs.begin(); }
@@ -48,10 +78,34 @@ namespace doc {
     iterator begin() { return m_segs.begin(); }
     iterator end() { return m_segs.end(); }
 
+    const tiles_type& tiles() const { return m_tiles; }
+
+    // Updates the boundaries for the given bitmap placed in the
+    // "origin" position. Only the tiles where the bitmap was
+    // modified since the last call are generated again.
+    void regenerate(const Image* bitmap,
+                    const gfx::Point& origin = gfx::Point(0, 0));
+
     void offset(int x, int y);
 
   private:
+    void generateTile(Tile& tile, uint64_t rowAbove, uint64_t colLeft);
+    void updateSegmentsList();
+
+    // All the segments of all tiles.
     list_type m_segs;
+
+    // Tiles covering the bitmap from the top-left to the bottom-right
+    // corner (including the segments at the right/bottom edges).
+    tiles_type m_tiles;
+
+    // Tile coordinates of the first tile, and number of tiles in
+    // each axis.
+    gfx::Rect m_grid;
+
+    // Position of the tile (0, 0) of the grid. Tiles are aligned to
+    // this point even when the bitmap origin changes.
+    gfx::Point m_gridOrigin;
   };
 
 } // namespace doc
@@ -0,0 +1,172 @@
+// Aseprite Document Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask_boundaries.h"
+#include "doc/primitives.h"
+#include "doc/test_image.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <tuple>
+#include <vector>
+
+using namespace doc;
+
+// Edge of one pixel: x, y, vertical, open
+typedef std::tuple<int, int, bool, bool> Edge;
+
+static bool get_bit(const Image* bitmap, const gfx::Point& origin, int x, int y)
+{
+  x -= origin.x;
+  y -= origin.y;
+  return (x >= 0 && y >= 0 && x < bitmap->width() && y < bitmap->height() &&
+          get_pixel(bitmap, x, y));
+}
+
+static std::vector<Edge> expected_edges(const Image* bitmap, const gfx::Point& origin)
+{
+  std::vector<Edge> edges;
+  for (int y=origin.y; y<=origin.y+bitmap->height(); ++y)
+    for (int x=origin.x; x<=origin.x+bitmap->width(); ++x) {
+      bool c = get_bit(bitmap, origin, x, y);
+      if (c != get_bit(bitmap, origin, x-1, y))
+        edges.push_back(Edge(x, y, true, c));
+      if (c != get_bit(bitmap, origin, x, y-1))
+        edges.push_back(Edge(x, y, false, c));
+    }
+  std::sort(edges.begin(), edges.end());
+  return edges;
+}
+
+static std::vector<Edge> boundaries_edges(const MaskBoundaries& boundaries)
+{
+  std::vector<Edge> edges;
+  for (const auto& seg : boundaries) {
+    const gfx::Rect& rc = seg.bounds();
+    if (seg.vertical())
+      for (int y=rc.y; y<rc.y2(); ++y)
+        edges.push_back(Edge(rc.x, y, true, seg.open()));
+    else
+      for (int x=rc.x; x<rc.x2(); ++x)
+        edges.push_back(Edge(x, rc.y, false, seg.open()));
+  }
+  std::sort(edges.begin(), edges.end());
+  return edges;
+}
+
+// Mostly empty bitmaps with a few isolated pixels
+static const std::vector<color_t> kSparsePixels = {
+  1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// Adds some random rectangles (long edges) to the given bitmap
+static void fill_random_rects(Image* bitmap)
+{
+  for (int i=0; i<8; ++i) {
+    int x = std::rand() % bitmap->width(), y = std::rand() % bitmap->height();
+    fill_rect(bitmap, x, y,
+              x + std::rand() % 40, y + std::rand() % 40,
+              std::rand() % 4 ? 1: 0);
+  }
+}
+
+TEST(MaskBoundaries, Edges)
+{
+  std::srand(1);
+  for (int i=0; i<50; ++i) {
+    ImageRef bitmap = create_random_image(
+      IMAGE_BITMAP, 1 + std::rand() % 200, 1 + std::rand() % 200, kSparsePixels);
+    fill_random_rects(bitmap.get());
+    MaskBoundaries boundaries(bitmap.get());
+    EXPECT_EQ(expected_edges(bitmap.get(), gfx::Point(0, 0)),
+              boundaries_edges(boundaries));
+  }
+}
+
+TEST(MaskBoundaries, Offset)
+{
+  std::srand(2);
+  ImageRef bitmap = create_random_image(IMAGE_BITMAP, 100, 70, kSparsePixels);
+  fill_random_rects(bitmap.get());
+  MaskBoundaries boundaries(bitmap.get());
+  boundaries.offset(-13, 7);
+  EXPECT_EQ(expected_edges(bitmap.get(), gfx::Point(-13, 7)),
+            boundaries_edges(boundaries));
+
+  // Same pixels in the same position, nothing changes
+  std::vector<int> versions;
+  for (const auto& tile : boundaries.tiles())
+    versions.push_back(tile.version());
+  boundaries.regenerate(bitmap.get(), gfx::Point(-13, 7));
+  ASSERT_EQ(versions.size(), boundaries.tiles().size());
+  for (std::size_t i=0; i<versions.size(); ++i)
+    EXPECT_EQ(versions[i], boundaries.tiles()[i].version());
+}
+
+TEST(MaskBoundaries, Incremental)
+{
+  std::srand(3);
+  for (int i=0; i<50; ++i) {
+    ImageRef bitmap = create_random_image(
+      IMAGE_BITMAP, 1 + std::rand() % 300, 1 + std::rand() % 300, kSparsePixels);
+    fill_random_rects(bitmap.get());
+    gfx::Point origin(std::rand() % 200 - 100, std::rand() % 200 - 100);
+
+    MaskBoundaries boundaries;
+    boundaries.regenerate(bitmap.get(), origin);
+    EXPECT_EQ(expected_edges(bitmap.get(), origin),
+              boundaries_edges(boundaries));
+
+    // Modify a small part of the bitmap
+    const int x = std::rand() % bitmap->width();
+    const int y = std::rand() % bitmap->height();
+    const gfx::Rect changed(origin.x+x, origin.y+y, 5, 5);
+    fill_rect(bitmap.get(), x, y, x+4, y+4, std::rand() & 1);
+
+    std::vector<std::pair<gfx::Rect, int> > oldTiles;
+    for (const auto& tile : boundaries.tiles())
+      oldTiles.push_back(std::make_pair(tile.bounds(), tile.version()));
+
+    boundaries.regenerate(bitmap.get(), origin);
+    EXPECT_EQ(expected_edges(bitmap.get(), origin),
+              boundaries_edges(boundaries));
+
+    // Tiles far from the modified area are the same
+    ASSERT_EQ(oldTiles.size(), boundaries.tiles().size());
+    for (std::size_t j=0; j<oldTiles.size(); ++j) {
+      const auto& tile = boundaries.tiles()[j];
+      EXPECT_EQ(oldTiles[j].first, tile.bounds());
+      if (!gfx::Rect(tile.bounds()).enlarge(1).intersects(changed)) {
+        EXPECT_EQ(oldTiles[j].second, tile.version());
+      }
+    }
+
+    // Change the size and position of the bitmap
+    ImageRef bitmap2 = create_random_image(
+      IMAGE_BITMAP, 1 + std::rand() % 300, 1 + std::rand() % 300, kSparsePixels);
+    fill_random_rects(bitmap2.get());
+    origin.x += std::rand() % 100 - 50;
+    origin.y += std::rand() % 100 - 50;
+    boundaries.regenerate(bitmap2.get(), origin);
+    EXPECT_EQ(expected_edges(bitmap2.get(), origin),
+              boundaries_edges(boundaries));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
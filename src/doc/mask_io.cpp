@@ -42,7 +42,7 @@ void write_mask(std::ostream& os, const Mask* mask)
     int size = BitmapTraits::getRowStrideBytes(bounds.w);
 
     for (int c=0; c<bounds.h; c++)
-      os.write((char*)mask->bitmap()->getPixelAddress(0, c), size);
+      os.write((const char*)mask->bitmap()->getPixelConstAddress(0, c), size);
   }
 }
 
@@ -0,0 +1,106 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/mask_runs.h"
+
+#include "base/debug.h"
+#include "doc/image_impl.h"
+#include "doc/mask.h"
+
+namespace doc {
+
+MaskRuns::MaskRuns(const Mask* mask)
+  : m_mask(mask)
+  , m_bounds(mask->bounds())
+{
+  if (mask->isEmpty())
+    m_bounds = gfx::Rect(0, 0, 0, 0);
+  // The runs of the mask are used directly
+  else if (mask->hasRuns())
+    return;
+
+  m_rows.resize(m_bounds.h);
+  m_decoded.resize(m_bounds.h, false);
+}
+
+const MaskRuns::Runs& MaskRuns::row(int y)
+{
+  ASSERT(y >= 0 && y < m_bounds.h);
+
+  if (m_mask->hasRuns())
+    return m_mask->rowRuns(y);
+
+  if (!m_decoded[y]) {
+    decode_bitmap_runs(m_mask->bitmap(), y, m_rows[y]);
+    m_decoded[y] = true;
+  }
+  return m_rows[y];
+}
+
+const MaskRuns::Runs& get_mask_row_runs(const Mask* mask, int y,
+                                        MaskRuns::Runs& buffer)
+{
+  if (mask->hasRuns())
+    return mask->rowRuns(y);
+
+  buffer.clear();
+  decode_bitmap_runs(mask->bitmap(), y, buffer);
+  return buffer;
+}
+
+void decode_bitmap_runs(const Image* bitmap, int y, MaskRuns::Runs& runs)
+{
+  ASSERT(bitmap->pixelFormat() == IMAGE_BITMAP);
+
+  const int w = bitmap->width();
+  const BitmapTraits::pixel_t* p =
+    (const BitmapTraits::pixel_t*)bitmap->getPixelConstAddress(0, y);
+  int start = -1;
+
+  // Full and empty bytes are the common case, so they are
+  // skipped/accepted 8 pixels at a time.
+  for (int x=0; x<w; x+=8, ++p) {
+    const BitmapTraits::pixel_t byte = *p;
+    if (byte == 0) {
+      if (start >= 0) {
+        runs.push_back(MaskRuns::Run(start, x));
+        start = -1;
+      }
+    }
+    else if (byte == 0xff) {
+      if (start < 0)
+        start = x;
+    }
+    else {
+      for (int bit=0; bit<8; ++bit) {
+        if (byte & (1 << bit)) {
+          if (start < 0)
+            start = x+bit;
+        }
+        else if (start >= 0) {
+          runs.push_back(MaskRuns::Run(start, x+bit));
+          start = -1;
+        }
+      }
+    }
+  }
+
+  if (start >= 0)
+    runs.push_back(MaskRuns::Run(start, w+7));
+
+  // The last byte of the row can contain bits after the width of the
+  // image.
+  while (!runs.empty() && runs.back().x1 >= w)
+    runs.pop_back();
+  if (!runs.empty() && runs.back().x2 > w)
+    runs.back().x2 = w;
+}
+
+} // namespace doc
@@ -0,0 +1,99 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_MASK_RUNS_H_INCLUDED
+#define DOC_MASK_RUNS_H_INCLUDED
+#pragma once
+
+#include "gfx/rect.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace doc {
+
+  class Image;
+  class Mask;
+
+  // Selected pixels of a mask as a list of horizontal runs for each
+  // scanline. If the mask is stored as runs (Mask::hasRuns()) they
+  // are used directly, in other case rows are decoded from the mask
+  // bitmap the first time they are requested, so it's cheap to create
+  // an instance for a big mask when only a few rows are going to be
+  // used.
+  //
+  // The mask must not be modified while this object is alive.
+  class MaskRuns {
+  public:
+    // Selected [x1, x2) segment of a row, in mask bitmap coordinates.
+    struct Run {
+      int x1, x2;
+      Run(int x1, int x2) : x1(x1), x2(x2) { }
+    };
+    typedef std::vector<Run> Runs;
+
+    explicit MaskRuns(const Mask* mask);
+
+    const gfx::Rect& bounds() const { return m_bounds; }
+
+    // Returns the runs of the given row (0 <= y < bounds().h) sorted
+    // from left to right.
+    const Runs& row(int y);
+
+  private:
+    const Mask* m_mask;
+    gfx::Rect m_bounds;
+    std::vector<Runs> m_rows;
+    std::vector<bool> m_decoded;
+  };
+
+  // Walks the pixels of a row from left to right telling which ones
+  // are selected, e.g. to skip unselected pixels in a filter.
+  class MaskRunsCursor {
+  public:
+    MaskRunsCursor() : m_runs(nullptr), m_run(0), m_x(0) { }
+
+    // Starts in the "x" pixel of the given runs.
+    MaskRunsCursor(const MaskRuns::Runs& runs, int x)
+      : m_runs(&runs), m_run(0), m_x(x) { }
+
+    // Returns true if the current pixel is selected and moves to the
+    // next one.
+    bool next() {
+      const int x = m_x++;
+      while (m_run < m_runs->size() && (*m_runs)[m_run].x2 <= x)
+        ++m_run;
+      return (m_run < m_runs->size() && (*m_runs)[m_run].x1 <= x);
+    }
+
+  private:
+    const MaskRuns::Runs* m_runs;
+    std::size_t m_run;
+    int m_x;
+  };
+
+  // Returns true if "x" is inside one of the given runs.
+  inline bool runs_contain(const MaskRuns::Runs& runs, int x) {
+    auto it = std::upper_bound(
+      runs.begin(), runs.end(), x,
+      [](int x, const MaskRuns::Run& run) { return x < run.x1; });
+    return (it != runs.begin() && x < (it-1)->x2);
+  }
+
+  // Returns the runs of the "y" row of the mask (0 <= y <
+  // mask->bounds().h). If the mask isn't stored as runs, the row is
+  // decoded in the given "buffer". It can be called from several
+  // threads for the same mask (each one with its own buffer).
+  const MaskRuns::Runs& get_mask_row_runs(const Mask* mask, int y,
+                                          MaskRuns::Runs& buffer);
+
+  // Appends to "runs" the segments of selected pixels of the "y" row
+  // of the given IMAGE_BITMAP image.
+  void decode_bitmap_runs(const Image* bitmap, int y, MaskRuns::Runs& runs);
+
+} // namespace doc
+
+#endif
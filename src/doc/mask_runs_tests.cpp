@@ -0,0 +1,92 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image_impl.h"
+#include "doc/mask.h"
+#include "doc/mask_runs.h"
+
+#include <cstdlib>
+
+using namespace doc;
+
+TEST(MaskRuns, EmptyMask)
+{
+  Mask mask;
+  MaskRuns runs(&mask);
+  EXPECT_TRUE(runs.bounds().isEmpty());
+}
+
+TEST(MaskRuns, Rectangles)
+{
+  Mask mask;
+  mask.replace(gfx::Rect(3, 5, 20, 4));
+  mask.subtract(gfx::Rect(10, 6, 2, 2));
+
+  MaskRuns runs(&mask);
+  EXPECT_EQ(gfx::Rect(3, 5, 20, 4), runs.bounds());
+
+  ASSERT_EQ(1, int(runs.row(0).size()));
+  EXPECT_EQ(0, runs.row(0)[0].x1);
+  EXPECT_EQ(20, runs.row(0)[0].x2);
+
+  for (int y=1; y<3; ++y) {
+    ASSERT_EQ(2, int(runs.row(y).size()));
+    EXPECT_EQ(0, runs.row(y)[0].x1);
+    EXPECT_EQ(7, runs.row(y)[0].x2);
+    EXPECT_EQ(9, runs.row(y)[1].x1);
+    EXPECT_EQ(20, runs.row(y)[1].x2);
+  }
+}
+
+TEST(MaskRuns, RandomBitmaps)
+{
+  std::srand(1);
+
+  for (int w=1; w<40; ++w) {
+    Image* bitmap = Image::create(IMAGE_BITMAP, w, 8);
+    // Set the padding bits of each row too
+    bitmap->clear(1);
+
+    for (int y=0; y<bitmap->height(); ++y)
+      for (int x=0; x<w; ++x)
+        if (y > 0 && (std::rand() % (y+1)) == 0)
+          put_pixel_fast<BitmapTraits>(bitmap, x, y, 0);
+
+    for (int y=0; y<bitmap->height(); ++y) {
+      MaskRuns::Runs runs;
+      decode_bitmap_runs(bitmap, y, runs);
+
+      std::vector<int> row(w, 0);
+      int lastX2 = -1;
+      for (const auto& run : runs) {
+        EXPECT_LT(lastX2, run.x1);
+        EXPECT_LT(run.x1, run.x2);
+        EXPECT_LE(run.x2, w);
+        for (int x=run.x1; x<run.x2; ++x)
+          row[x] = 1;
+        lastX2 = run.x2;
+      }
+
+      for (int x=0; x<w; ++x)
+        EXPECT_EQ(int(get_pixel_fast<BitmapTraits>(bitmap, x, y)), row[x])
+          << "w=" << w << " x=" << x << " y=" << y;
+    }
+
+    delete bitmap;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
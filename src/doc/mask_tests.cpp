@@ -0,0 +1,263 @@
+// Aseprite Document Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+#include "doc/test_image.h"
+
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+using namespace doc;
+
+// Area where the random operations are done
+static const gfx::Rect kArea(-20, -10, 100, 80);
+
+// Selection made pixel by pixel to check the results of Mask
+class ExpectedMask {
+public:
+  ExpectedMask() : m_pixels(kArea.w*kArea.h, false) { }
+
+  const gfx::Rect& bounds() const { return m_bounds; }
+
+  bool get(int x, int y) const {
+    return (kArea.contains(gfx::Point(x, y)) &&
+            m_pixels[(y-kArea.y)*kArea.w + (x-kArea.x)]);
+  }
+
+  void set(int x, int y, bool value) {
+    if (kArea.contains(gfx::Point(x, y)))
+      m_pixels[(y-kArea.y)*kArea.w + (x-kArea.x)] = value;
+  }
+
+  void replace(const gfx::Rect& rc) {
+    fill(kArea, false);
+    fill(rc, true);
+    m_bounds = rc;
+  }
+
+  void add(const gfx::Rect& rc) {
+    fill(rc, true);
+    m_bounds |= rc;
+  }
+
+  void subtract(const gfx::Rect& rc) {
+    fill(rc, false);
+    shrink();
+  }
+
+  void intersect(const gfx::Rect& rc) {
+    for (int y=kArea.y; y<kArea.y2(); ++y)
+      for (int x=kArea.x; x<kArea.x2(); ++x)
+        if (!rc.contains(gfx::Point(x, y)))
+          set(x, y, false);
+    shrink();
+  }
+
+  void invert() {
+    for (int y=m_bounds.y; y<m_bounds.y2(); ++y)
+      for (int x=m_bounds.x; x<m_bounds.x2(); ++x)
+        set(x, y, !get(x, y));
+    shrink();
+  }
+
+private:
+  void fill(const gfx::Rect& rc, bool value) {
+    for (int y=rc.y; y<rc.y2(); ++y)
+      for (int x=rc.x; x<rc.x2(); ++x)
+        set(x, y, value);
+  }
+
+  void shrink() {
+    gfx::Rect bounds;
+    for (int y=kArea.y; y<kArea.y2(); ++y)
+      for (int x=kArea.x; x<kArea.x2(); ++x)
+        if (get(x, y))
+          bounds |= gfx::Rect(x, y, 1, 1);
+    m_bounds = bounds;
+  }
+
+  std::vector<bool> m_pixels;
+  gfx::Rect m_bounds;
+};
+
+static gfx::Rect random_rect()
+{
+  return gfx::Rect(kArea.x + std::rand() % kArea.w,
+                   kArea.y + std::rand() % kArea.h,
+                   1 + std::rand() % 40,
+                   1 + std::rand() % 40) & kArea;
+}
+
+static void expect_same_mask(const ExpectedMask& expected, const Mask& mask)
+{
+  ASSERT_EQ(expected.bounds(), mask.bounds());
+  ASSERT_EQ(expected.bounds().isEmpty(), mask.isEmpty());
+  if (mask.isEmpty())
+    return;
+
+  const Image* bitmap = mask.bitmap();
+  ASSERT_EQ(mask.bounds().w, bitmap->width());
+  ASSERT_EQ(mask.bounds().h, bitmap->height());
+
+  for (int y=kArea.y; y<kArea.y2(); ++y)
+    for (int x=kArea.x; x<kArea.x2(); ++x) {
+      ASSERT_EQ(expected.get(x, y), mask.containsPoint(x, y))
+        << "Pixel (" << x << ", " << y << ")";
+      if (mask.bounds().contains(gfx::Point(x, y))) {
+        ASSERT_EQ(expected.get(x, y),
+                  get_pixel(bitmap, x-mask.bounds().x, y-mask.bounds().y) != 0)
+          << "Pixel (" << x << ", " << y << ")";
+      }
+    }
+}
+
+TEST(Mask, RandomOperations)
+{
+  std::srand(1);
+
+  for (int i=0; i<20; ++i) {
+    ExpectedMask expected;
+    Mask mask;
+
+    for (int j=0; j<30; ++j) {
+      const gfx::Rect rc = random_rect();
+      switch (std::rand() % 6) {
+        case 0:
+          expected.replace(rc);
+          mask.replace(rc);
+          break;
+        case 1:
+          expected.add(rc);
+          mask.add(rc);
+          break;
+        case 2:
+          expected.subtract(rc);
+          mask.subtract(rc);
+          break;
+        case 3:
+          expected.intersect(rc);
+          mask.intersect(rc);
+          break;
+        case 4:
+          expected.invert();
+          mask.invert();
+          break;
+        case 5:
+          // Convert the mask to a bitmap (next operations must work
+          // with both representations)
+          mask.bitmap();
+          EXPECT_FALSE(mask.hasRuns());
+          break;
+      }
+      expect_same_mask(expected, mask);
+
+      Mask copy(mask);
+      expect_same_mask(expected, copy);
+    }
+  }
+}
+
+TEST(Mask, LazyBitmap)
+{
+  Mask mask;
+  mask.replace(gfx::Rect(5, 6, 30, 20));
+  mask.subtract(gfx::Rect(10, 10, 5, 5));
+  EXPECT_TRUE(mask.hasRuns());
+  EXPECT_FALSE(mask.isRectangular());
+
+  // The bitmap is generated from the runs
+  const Mask& constMask = mask;
+  const Image* bitmap = constMask.bitmap();
+  EXPECT_TRUE(mask.hasRuns());
+  EXPECT_EQ(1, get_pixel(bitmap, 0, 0));
+  EXPECT_EQ(0, get_pixel(bitmap, 5, 4));
+  EXPECT_EQ(1, get_pixel(bitmap, 10, 4));
+
+  // The bitmap can be modified
+  put_pixel(mask.bitmap(), 5, 4, 1);
+  EXPECT_FALSE(mask.hasRuns());
+  EXPECT_TRUE(mask.containsPoint(10, 10));
+}
+
+TEST(Mask, ByColor)
+{
+  std::srand(2);
+
+  // Widths smaller and bigger than the chunks of pixels compared at
+  // the same time by byColor()
+  for (int width : { 50, 300 })
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    const std::vector<color_t> colors = {
+      (format == IMAGE_RGB ? rgba(10, 20, 30, 255):
+       format == IMAGE_GRAYSCALE ? graya(10, 255): 10),
+      (format == IMAGE_RGB ? rgba(12, 18, 30, 255):
+       format == IMAGE_GRAYSCALE ? graya(12, 255): 12),
+      (format == IMAGE_RGB ? rgba(10, 20, 30, 0):
+       format == IMAGE_GRAYSCALE ? graya(10, 0): 200) };
+    ImageRef image = create_random_image(format, width, 40, colors);
+
+    for (int fuzziness : { 0, 2 }) {
+      Mask mask;
+      mask.byColor(image.get(), colors[0], fuzziness);
+      EXPECT_TRUE(mask.hasRuns());
+
+      for (int y=0; y<image->height(); ++y)
+        for (int x=0; x<image->width(); ++x) {
+          const color_t c = get_pixel(image.get(), x, y);
+          ASSERT_EQ(c == colors[0] || (fuzziness > 0 && c == colors[1]),
+                    mask.containsPoint(x, y));
+        }
+    }
+  }
+}
+
+TEST(Mask, MasksByColor)
+{
+  std::srand(3);
+
+  std::vector<ImageRef> images;
+  for (int i=0; i<20; ++i)
+    images.push_back(create_random_image(IMAGE_INDEXED,
+                                         1 + std::rand() % 100,
+                                         1 + std::rand() % 100,
+                                         { 0, 1, 2, 3 }));
+
+  std::vector<const Image*> imagePtrs;
+  std::vector<std::unique_ptr<Mask>> masks;
+  std::vector<Mask*> maskPtrs;
+  for (const ImageRef& image : images) {
+    imagePtrs.push_back(image.get());
+    masks.emplace_back(new Mask);
+    maskPtrs.push_back(masks.back().get());
+  }
+  masks_by_color(imagePtrs, maskPtrs, 2, 0);
+
+  for (std::size_t i=0; i<images.size(); ++i) {
+    Mask expected;
+    expected.byColor(images[i].get(), 2, 0);
+    ASSERT_EQ(expected.bounds(), masks[i]->bounds());
+    for (int y=0; y<images[i]->height(); ++y)
+      for (int x=0; x<images[i]->width(); ++x)
+        ASSERT_EQ(get_pixel(images[i].get(), x, y) == 2,
+                  masks[i]->containsPoint(x, y));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
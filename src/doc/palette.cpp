@@ -200,28 +200,34 @@ int Palette::findExactMatch(int r, int g, int b, int a, int mask_index) const
 //////////////////////////////////////////////////////////////////////
 // Based on Allegro's bestfit_color
 
-static std::vector<uint32_t> col_diff;
-static uint32_t* col_diff_g;
-static uint32_t* col_diff_r;
-static uint32_t* col_diff_b;
-static uint32_t* col_diff_a;
+namespace {
+
+// Table of weighted squared differences between components. It's
+// initialized the first time it's used (in a thread-safe way, as
+// findBestfit() can be called from several threads).
+struct ColDiffTable {
+  uint32_t g[128], r[128], b[128], a[128];
+
+  ColDiffTable() {
+    g[0] = r[0] = b[0] = a[0] = 0;
+    g[64] = r[64] = b[64] = a[64] = 0;
+
+    for (int i=1; i<64; ++i) {
+      int k = i * i;
+      g[i] = g[128-i] = k * 59 * 59;
+      r[i] = r[128-i] = k * 30 * 30;
+      b[i] = b[128-i] = k * 11 * 11;
+      a[i] = a[128-i] = k * 8 * 8;
+    }
+  }
 
-static void initBestfit()
-{
-  col_diff.resize(4*128, 0);
-  col_diff_g = &col_diff[128*0];
-  col_diff_r = &col_diff[128*1];
-  col_diff_b = &col_diff[128*2];
-  col_diff_a = &col_diff[128*3];
-
-  for (int i=1; i<64; ++i) {
-    int k = i * i;
-    col_diff_g[i] = col_diff_g[128-i] = k * 59 * 59;
-    col_diff_r[i] = col_diff_r[128-i] = k * 30 * 30;
-    col_diff_b[i] = col_diff_b[128-i] = k * 11 * 11;
-    col_diff_a[i] = col_diff_a[128-i] = k * 8 * 8;
+  static const ColDiffTable& instance() {
+    static ColDiffTable table;
+    return table;
   }
-}
+};
+
+} // anonymous namespace
 
 int Palette::findBestfit(int r, int g, int b, int a, int mask_index) const
 {
@@ -230,8 +236,7 @@ int Palette::findBestfit(int r, int g, int b, int a, int mask_index) const
   ASSERT(b >= 0 && b <= 255);
   ASSERT(a >= 0 && a <= 255);
 
-  if (col_diff.empty())
-    initBestfit();
+  const ColDiffTable& col_diff = ColDiffTable::instance();
 
   r >>= 3;
   g >>= 3;
@@ -249,13 +254,13 @@ int Palette::findBestfit(int r, int g, int b, int a, int mask_index) const
   for (int i=0; i<size; ++i) {
     color_t rgb = m_colors[i];
 
-    int coldiff = col_diff_g[((rgba_getg(rgb)>>3) - g) & 127];
+    int coldiff = col_diff.g[((rgba_getg(rgb)>>3) - g) & 127];
     if (coldiff < lowest) {
-      coldiff += col_diff_r[(((rgba_getr(rgb)>>3) - r) & 127)];
+      coldiff += col_diff.r[(((rgba_getr(rgb)>>3) - r) & 127)];
       if (coldiff < lowest) {
-        coldiff += col_diff_b[(((rgba_getb(rgb)>>3) - b) & 127)];
+        coldiff += col_diff.b[(((rgba_getb(rgb)>>3) - b) & 127)];
         if (coldiff < lowest) {
-          coldiff += col_diff_a[(((rgba_geta(rgb)>>3) - a) & 127)];
+          coldiff += col_diff.a[(((rgba_geta(rgb)>>3) - a) & 127)];
           if (coldiff < lowest && i != mask_index) {
             if (coldiff == 0)
               return i;
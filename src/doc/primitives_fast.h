@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2015 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -14,6 +14,7 @@ namespace doc {
   class Image;
   template<typename ImageTraits> class ImageImpl;
 
+  // Returns the address of a pixel to modify it.
   template<class Traits>
   inline typename Traits::address_t get_pixel_address_fast(const Image* image, int x, int y) {
     ASSERT(x >= 0 && x < image->width());
@@ -22,12 +23,22 @@ namespace doc {
     return (((ImageImpl<Traits>*)image)->address(x, y));
   }
 
+  // Returns the address of a pixel that will be only read (pixels
+  // shared with other images are not duplicated).
+  template<class Traits>
+  inline typename Traits::const_address_t get_pixel_const_address_fast(const Image* image, int x, int y) {
+    ASSERT(x >= 0 && x < image->width());
+    ASSERT(y >= 0 && y < image->height());
+
+    return (((const ImageImpl<Traits>*)image)->constAddress(x, y));
+  }
+
   template<class Traits>
   inline typename Traits::pixel_t get_pixel_fast(const Image* image, int x, int y) {
     ASSERT(x >= 0 && x < image->width());
     ASSERT(y >= 0 && y < image->height());
 
-    return *(((ImageImpl<Traits>*)image)->address(x, y));
+    return *(((const ImageImpl<Traits>*)image)->constAddress(x, y));
   }
 
   template<class Traits>
@@ -46,7 +57,7 @@ namespace doc {
     ASSERT(x >= 0 && x < image->width());
     ASSERT(y >= 0 && y < image->height());
 
-    return (*image->getPixelAddress(x, y)) & (1 << (x % 8)) ? 1: 0;
+    return (*image->getPixelConstAddress(x, y)) & (1 << (x % 8)) ? 1: 0;
   }
 
   template<>
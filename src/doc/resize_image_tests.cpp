@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2016 David Capello
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -13,7 +13,15 @@
 #include "doc/algorithm/resize_image.h"
 #include "doc/color.h"
 #include "doc/image.h"
+#include "doc/image_ref.h"
 #include "doc/primitives.h"
+#include "doc/test_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
 using namespace std;
 using namespace doc;
@@ -94,6 +102,141 @@ TEST(ResizeImage, BilinearInterpRGBType)
 }
 #endif
 
+TEST(ResizeImage, SameSize)
+{
+  ImageRef src = create_random_image(IMAGE_RGB, 17, 9);
+  for (auto method : { algorithm::RESIZE_METHOD_BILINEAR,
+                       algorithm::RESIZE_METHOD_BOX,
+                       algorithm::RESIZE_METHOD_BICUBIC,
+                       algorithm::RESIZE_METHOD_LANCZOS }) {
+    ImageRef dst(Image::create(IMAGE_RGB, 17, 9));
+    algorithm::resize_image(src.get(), dst.get(), method, NULL, NULL, -1);
+    EXPECT_EQ(0, count_diff_between_images(src.get(), dst.get()));
+  }
+}
+
+TEST(ResizeImage, BoxAverage)
+{
+  color_t data[16] = {
+    0x00000000, 0x80808080, 0x40404040, 0x40404040,
+    0x80808080, 0x00000000, 0x40404040, 0x40404040,
+    0x00000000, 0x00000000, 0xf0f0f0f0, 0xf0f0f0f0,
+    0x00000000, 0x00000000, 0xf0f0f0f0, 0xf0f0f0f0 };
+  color_t expected[4] = {
+    0x40404040, 0x40404040,
+    0x00000000, 0xf0f0f0f0 };
+
+  ImageRef src(create_image_from_data(IMAGE_RGB, data, 4, 4));
+  ImageRef dst_expected(create_image_from_data(IMAGE_RGB, expected, 2, 2));
+  ImageRef dst(Image::create(IMAGE_RGB, 2, 2));
+  algorithm::resize_image(src.get(), dst.get(), algorithm::RESIZE_METHOD_BOX, NULL, NULL, -1);
+  EXPECT_EQ(0, count_diff_between_images(dst.get(), dst_expected.get()));
+}
+
+TEST(ResizeImage, SolidColor)
+{
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE }) {
+    const color_t color = (format == IMAGE_RGB ? rgba(10, 200, 30, 255): graya(100, 255));
+    ImageRef src(Image::create(format, 31, 20));
+    clear_image(src.get(), color);
+
+    for (auto method : { algorithm::RESIZE_METHOD_BILINEAR,
+                         algorithm::RESIZE_METHOD_BOX,
+                         algorithm::RESIZE_METHOD_BICUBIC,
+                         algorithm::RESIZE_METHOD_LANCZOS }) {
+      for (int size : { 1, 7, 64 }) {
+        ImageRef dst(Image::create(format, size, size+3));
+        algorithm::resize_image(src.get(), dst.get(), method, NULL, NULL, -1);
+        for (int y=0; y<dst->height(); ++y)
+          for (int x=0; x<dst->width(); ++x)
+            ASSERT_EQ(color, get_pixel(dst.get(), x, y));
+      }
+    }
+  }
+}
+
+// Bilinear interpolation with doubles (like the original
+// implementation of RESIZE_METHOD_BILINEAR)
+static int bilinear_reference(const Image* src, int x, int y,
+                              int dstWidth, int dstHeight,
+                              int (*channel)(color_t))
+{
+  const double u = x * double(src->width()-1) / (dstWidth-1);
+  const double v = y * double(src->height()-1) / (dstHeight-1);
+  const int u1 = std::min(int(u), src->width()-1);
+  const int v1 = std::min(int(v), src->height()-1);
+  const int u2 = std::min(u1+1, src->width()-1);
+  const int v2 = std::min(v1+1, src->height()-1);
+  const double du = u - u1;
+  const double dv = v - v1;
+  return int((channel(get_pixel(src, u1, v1))*(1-du) + channel(get_pixel(src, u2, v1))*du)*(1-dv) +
+             (channel(get_pixel(src, u1, v2))*(1-du) + channel(get_pixel(src, u2, v2))*du)*dv);
+}
+
+static int rgba_r(color_t c) { return rgba_getr(c); }
+static int rgba_g(color_t c) { return rgba_getg(c); }
+static int rgba_b(color_t c) { return rgba_getb(c); }
+static int rgba_a(color_t c) { return rgba_geta(c); }
+static int graya_v(color_t c) { return graya_getv(c); }
+static int graya_a(color_t c) { return graya_geta(c); }
+
+// The fixed point bilinear interpolation is at most 2 levels away
+// from the floating point one.
+TEST(ResizeImage, BilinearFixedPointPrecision)
+{
+  std::srand(1);
+
+  const gfx::Size sizes[] = {
+    gfx::Size(80, 50), gfx::Size(13, 7), gfx::Size(37, 23), gfx::Size(100, 3) };
+
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE }) {
+    ImageRef src = create_random_image(format, 37, 23);
+    std::vector<int (*)(color_t)> channels;
+    if (format == IMAGE_RGB)
+      channels = { rgba_r, rgba_g, rgba_b, rgba_a };
+    else
+      channels = { graya_v, graya_a };
+
+    for (const gfx::Size& size : sizes) {
+      ImageRef dst(Image::create(format, size.w, size.h));
+      algorithm::resize_image(src.get(), dst.get(),
+                              algorithm::RESIZE_METHOD_BILINEAR, NULL, NULL, -1);
+
+      for (int y=0; y<size.h; ++y)
+        for (int x=0; x<size.w; ++x)
+          for (auto channel : channels) {
+            const int expected = bilinear_reference(src.get(), x, y, size.w, size.h, channel);
+            const int value = channel(get_pixel(dst.get(), x, y));
+            ASSERT_LE(std::abs(value - expected), 2)
+              << "Pixel (" << x << ", " << y << ") resizing to "
+              << size.w << "x" << size.h;
+          }
+    }
+  }
+}
+
+TEST(ResizeImage, DISABLED_Benchmark)
+{
+  const char* names[] = { "Nearest", "Bilinear", "RotSprite", "Box", "Bicubic", "Lanczos" };
+  ImageRef src = create_random_image(IMAGE_RGB, 2048, 2048);
+
+  for (auto method : { algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR,
+                       algorithm::RESIZE_METHOD_BILINEAR,
+                       algorithm::RESIZE_METHOD_BOX,
+                       algorithm::RESIZE_METHOD_BICUBIC,
+                       algorithm::RESIZE_METHOD_LANCZOS }) {
+    for (int size : { 256, 3000 }) {
+      ImageRef dst(Image::create(IMAGE_RGB, size, size));
+      print_benchmark(
+        std::string(names[method]) + " 2048x2048 -> " +
+        std::to_string(size) + "x" + std::to_string(size),
+        [&]{
+          algorithm::resize_image(src.get(), dst.get(), method, NULL, NULL, -1);
+        });
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,111 @@
+// Aseprite Document Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/pi.h"
+#include "doc/algorithm/rotate.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "doc/test_image.h"
+
+#include <cmath>
+#include <string>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+TEST(Parallelogram, Translation)
+{
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_INDEXED }) {
+    ImageRef src = create_random_image(format, 97, 61);
+    ImageRef a(Image::create(format, 200, 100));
+    ImageRef b(Image::create(format, 200, 100));
+    clear_image(a.get(), 0);
+    clear_image(b.get(), 0);
+
+    parallelogram(a.get(), src.get(), nullptr,
+                  50, 20, 147, 20, 147, 81, 50, 81);
+    copy_image(b.get(), src.get(), 50, 20);
+
+    expect_same_pixels(a.get(), b.get());
+  }
+}
+
+TEST(Parallelogram, Rotate90)
+{
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_INDEXED }) {
+    ImageRef src = create_random_image(format, 97, 61);
+    ImageRef a(Image::create(format, 61, 97));
+    ImageRef b(Image::create(format, 61, 97));
+    clear_image(a.get(), 0);
+
+    parallelogram(a.get(), src.get(), nullptr,
+                  61, 0, 61, 97, 0, 97, 0, 0);
+    rotate_image(src.get(), b.get(), 90);
+
+    expect_same_pixels(a.get(), b.get());
+  }
+}
+
+TEST(Parallelogram, Mask)
+{
+  ImageRef src(Image::create(IMAGE_INDEXED, 64, 64));
+  clear_image(src.get(), 1);
+
+  ImageRef mask(Image::create(IMAGE_BITMAP, 64, 64));
+  clear_image(mask.get(), 0);
+  fill_rect(mask.get(), 0, 0, 63, 31, 1);
+
+  // Scale 2x, only the top half of the source is selected
+  ImageRef dst(Image::create(IMAGE_INDEXED, 128, 128));
+  clear_image(dst.get(), 0);
+  parallelogram(dst.get(), src.get(), mask.get(),
+                0, 0, 128, 0, 128, 128, 0, 128);
+
+  for (int y=0; y<128; ++y)
+    for (int x=0; x<128; ++x)
+      ASSERT_EQ(y < 64 ? 1: 0, get_pixel(dst.get(), x, y));
+}
+
+TEST(Parallelogram, DISABLED_Benchmark)
+{
+  const int size = 2048;
+
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_INDEXED }) {
+    ImageRef src = create_random_image(format, size, size);
+    ImageRef dst(Image::create(format, 2*size, 2*size));
+
+    for (int angle : { 0, 30 }) {
+      const double a = angle * PI / 180.0;
+      const double c = std::cos(a), s = std::sin(a);
+      const int x1 = size, y1 = 0;
+      const int x2 = x1 + int(size*c), y2 = y1 + int(size*s);
+      const int x4 = x1 - int(size*s), y4 = y1 + int(size*c);
+
+      clear_image(dst.get(), 0);
+      print_benchmark(
+        std::string(format == IMAGE_RGB ? "RGB": "Indexed") + " " +
+        std::to_string(size) + "x" + std::to_string(size) + " rotated " +
+        std::to_string(angle) + " degrees",
+        [&]{
+          parallelogram(dst.get(), src.get(), nullptr,
+                        x1, y1, x2, y2, x2+x4-x1, y2+y4-y1, x4, y4);
+        });
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
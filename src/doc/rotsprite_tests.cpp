@@ -0,0 +1,129 @@
+// Aseprite Document Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/rotsprite.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "doc/test_image.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+// Indexed image with few colors, so scale2x finds a lot of edges.
+static const std::vector<color_t> kFewColors = { 1, 2, 3 };
+
+TEST(RotSprite, SolidColor)
+{
+  ImageRef src(Image::create(IMAGE_RGB, 16, 16));
+  clear_image(src.get(), rgba(255, 0, 0, 255));
+
+  ImageRef dst(Image::create(IMAGE_RGB, 16, 16));
+  clear_image(dst.get(), 0);
+
+  // Rotate 90 degrees
+  rotsprite_image(dst.get(), src.get(), nullptr,
+                  16, 0, 16, 16, 0, 16, 0, 0);
+
+  for (int y=0; y<16; ++y)
+    for (int x=0; x<16; ++x)
+      ASSERT_EQ(rgba(255, 0, 0, 255), get_pixel(dst.get(), x, y));
+}
+
+TEST(RotSprite, ClippedDestination)
+{
+  std::srand(1);
+
+  // The result in a small destination must be the same as in a big
+  // one (only a region of the source image is scaled up).
+  for (int i=0; i<32; ++i) {
+    ImageRef src = create_random_image(IMAGE_INDEXED, 8 + std::rand() % 24, 8 + std::rand() % 24, kFewColors);
+    const int w = src->width();
+    const int h = src->height();
+    const int dx = std::rand() % (w/2);
+    const int dy = std::rand() % (h/2);
+
+    // Corners of a rotated and scaled parallelogram
+    const int x1 = 2*h + dx, y1 = dy;
+    const int x2 = x1 + 2*w, y2 = y1 + w;
+    const int x4 = x1 - h, y4 = y1 + 2*h;
+    const int x3 = x2 + x4 - x1, y3 = y2 + y4 - y1;
+
+    ImageRef big(Image::create(IMAGE_INDEXED, 4*(w+h), 4*(w+h)));
+    clear_image(big.get(), 0);
+    rotsprite_image(big.get(), src.get(), nullptr,
+                    x1, y1, x2, y2, x3, y3, x4, y4);
+
+    const gfx::Rect clip(w, h, w, h);
+    ImageRef small(Image::create(IMAGE_INDEXED, clip.w, clip.h));
+    clear_image(small.get(), 0);
+    rotsprite_image(small.get(), src.get(), nullptr,
+                    x1-clip.x, y1-clip.y, x2-clip.x, y2-clip.y,
+                    x3-clip.x, y3-clip.y, x4-clip.x, y4-clip.y);
+
+    expect_same_pixels(big.get(), clip.x, clip.y,
+                       small.get(), 0, 0, clip.w, clip.h);
+  }
+}
+
+TEST(RotSprite, ReuseBuffers)
+{
+  std::srand(2);
+
+  RotSpriteBuffers buffers;
+  for (int i=0; i<8; ++i) {
+    ImageRef src = create_random_image(IMAGE_INDEXED, 4 + std::rand() % 32, 4 + std::rand() % 32, kFewColors);
+    const int w = src->width();
+    const int h = src->height();
+
+    ImageRef a(Image::create(IMAGE_INDEXED, w+h, w+h));
+    ImageRef b(Image::create(IMAGE_INDEXED, w+h, w+h));
+    clear_image(a.get(), 0);
+    clear_image(b.get(), 0);
+
+    rotsprite_image(a.get(), src.get(), nullptr,
+                    h, 0, w+h, w, w, w+h, 0, h);
+    rotsprite_image(b.get(), src.get(), nullptr,
+                    h, 0, w+h, w, w, w+h, 0, h, &buffers);
+
+    expect_same_pixels(a.get(), 0, 0, b.get(), 0, 0, w+h, w+h);
+  }
+}
+
+TEST(RotSprite, Mask)
+{
+  ImageRef src(Image::create(IMAGE_INDEXED, 8, 8));
+  clear_image(src.get(), 1);
+
+  // Only the left half of the source image is selected
+  ImageRef mask(Image::create(IMAGE_BITMAP, 8, 8));
+  clear_image(mask.get(), 0);
+  fill_rect(mask.get(), 0, 0, 3, 7, 1);
+
+  ImageRef dst(Image::create(IMAGE_INDEXED, 16, 16));
+  clear_image(dst.get(), 0);
+  rotsprite_image(dst.get(), src.get(), mask.get(),
+                  0, 0, 16, 0, 16, 16, 0, 16);
+
+  for (int y=0; y<16; ++y)
+    for (int x=0; x<16; ++x)
+      ASSERT_EQ(x < 8 ? 1: 0, get_pixel(dst.get(), x, y));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,85 @@
+// Aseprite Document Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_TEST_IMAGE_H_INCLUDED
+#define DOC_TEST_IMAGE_H_INCLUDED
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace doc {
+
+  // Creates an image with random pixels. RGB pixels are opaque and
+  // indexes are never 0 (so they are different from a cleared
+  // destination image).
+  inline ImageRef create_random_image(PixelFormat format, int w, int h) {
+    ImageRef image(Image::create(format, w, h));
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x) {
+        color_t c = std::rand();
+        if (format == IMAGE_RGB)
+          c |= rgba_a_mask;
+        else if (format == IMAGE_INDEXED)
+          c = 1 + (c % 255);
+        else if (format == IMAGE_BITMAP)
+          c &= 1;
+        put_pixel(image.get(), x, y, c);
+      }
+    return image;
+  }
+
+  // Creates an image where each pixel is one of the given colors
+  // (e.g. a few colors to get a lot of edges).
+  inline ImageRef create_random_image(PixelFormat format, int w, int h,
+                                      const std::vector<color_t>& colors) {
+    ImageRef image(Image::create(format, w, h));
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        put_pixel(image.get(), x, y, colors[std::rand() % colors.size()]);
+    return image;
+  }
+
+  // Compares the w*h pixels of "a" starting from (ax, ay) with the
+  // pixels of "b" starting from (bx, by).
+  inline void expect_same_pixels(const Image* a, int ax, int ay,
+                                 const Image* b, int bx, int by,
+                                 int w, int h) {
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        ASSERT_EQ(get_pixel(a, ax+x, ay+y), get_pixel(b, bx+x, by+y))
+          << "Pixel (" << x << ", " << y << ")";
+  }
+
+  inline void expect_same_pixels(const Image* a, const Image* b) {
+    ASSERT_EQ(a->width(), b->width());
+    ASSERT_EQ(a->height(), b->height());
+    expect_same_pixels(a, 0, 0, b, 0, 0, a->width(), a->height());
+  }
+
+  // Prints the time used to run func() (used by DISABLED_Benchmark
+  // tests, which can be executed with --gtest_also_run_disabled_tests).
+  template<typename Func>
+  inline void print_benchmark(const std::string& label, Func func) {
+    typedef std::chrono::high_resolution_clock Clock;
+    Clock::time_point t0 = Clock::now();
+    func();
+    double msecs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    std::cout << label << ": " << msecs << " ms\n";
+  }
+
+} // namespace doc
+
+#endif
@@ -0,0 +1,193 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/thread_pool.h"
+
+#include "base/debug.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace doc {
+
+static thread_local bool g_isWorkerThread = false;
+
+// static
+ThreadPool* ThreadPool::instance()
+{
+  // The pool is never deleted, the worker threads are finished with
+  // the process (joining threads from static destructors can hang
+  // on some platforms).
+  static ThreadPool* pool = nullptr;
+  static std::once_flag flag;
+  std::call_once(flag, []{
+      int n = int(std::thread::hardware_concurrency());
+      pool = new ThreadPool(std::max(0, n-1));
+    });
+  return pool;
+}
+
+// static
+bool ThreadPool::isWorkerThread()
+{
+  return g_isWorkerThread;
+}
+
+ThreadPool::ThreadPool(int workers)
+  : m_stop(false)
+{
+  for (int i=0; i<workers; ++i)
+    m_workers.push_back(std::thread([this]{ workerLoop(); }));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+
+  for (auto& worker : m_workers)
+    worker.join();
+}
+
+void ThreadPool::execute(const Task& task)
+{
+  ASSERT(!m_workers.empty());
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_tasks.push_back(task);
+  }
+  m_cv.notify_one();
+}
+
+void ThreadPool::workerLoop()
+{
+  g_isWorkerThread = true;
+
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this]{ return m_stop || !m_tasks.empty(); });
+      if (m_stop && m_tasks.empty())
+        break;
+
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
+
+namespace {
+
+// Shared state between the thread that calls parallel_for() and the
+// helper tasks that it adds to the pool. Helpers that start after
+// the range was completely processed just do nothing.
+struct ParallelRange {
+  const std::function<void(int, int)>* func;
+  int begin, end, grain, chunks;
+  std::atomic<int> next;
+  std::mutex mutex;
+  std::condition_variable cv;
+  int running;
+  bool closed;
+  std::exception_ptr error;
+
+  ParallelRange(const std::function<void(int, int)>* func,
+                int begin, int end, int grain)
+    : func(func)
+    , begin(begin), end(end), grain(grain)
+    , chunks((end-begin+grain-1) / grain)
+    , next(0)
+    , running(0)
+    , closed(false) {
+  }
+
+  void processChunks() {
+    for (;;) {
+      int i = next++;
+      if (i >= chunks)
+        break;
+
+      int from = begin + i*grain;
+      int to = std::min(from+grain, end);
+      try {
+        (*func)(from, to);
+      }
+      catch (...) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+        next = chunks;            // Stop processing other chunks
+      }
+    }
+  }
+};
+
+} // anonymous namespace
+
+void parallel_for(int begin, int end, int grain,
+                  const std::function<void(int, int)>& func)
+{
+  if (begin >= end)
+    return;
+
+  ThreadPool* pool = ThreadPool::instance();
+  const int n = end - begin;
+  const int threads = pool->concurrency();
+
+  // Some extra chunks for each thread to balance the work
+  grain = std::max(grain, (n + threads*4 - 1) / (threads*4));
+  grain = std::max(grain, 1);
+
+  if (threads == 1 || n <= grain || ThreadPool::isWorkerThread()) {
+    func(begin, end);
+    return;
+  }
+
+  auto range = std::make_shared<ParallelRange>(&func, begin, end, grain);
+  const int helpers = std::min(threads, range->chunks) - 1;
+  for (int i=0; i<helpers; ++i) {
+    pool->execute(
+      [range]{
+        {
+          std::unique_lock<std::mutex> lock(range->mutex);
+          if (range->closed)
+            return;
+          ++range->running;
+        }
+        range->processChunks();
+        {
+          std::unique_lock<std::mutex> lock(range->mutex);
+          --range->running;
+        }
+        range->cv.notify_all();
+      });
+  }
+
+  range->processChunks();
+
+  // Wait the helpers that are still processing chunks
+  {
+    std::unique_lock<std::mutex> lock(range->mutex);
+    range->closed = true;
+    range->cv.wait(lock, [&range]{ return range->running == 0; });
+  }
+
+  if (range->error)
+    std::rethrow_exception(range->error);
+}
+
+} // namespace doc
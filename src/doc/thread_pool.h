@@ -0,0 +1,72 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_THREAD_POOL_H_INCLUDED
+#define DOC_THREAD_POOL_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace doc {
+
+  // A set of worker threads used to run CPU-bound image algorithms
+  // (color conversions, quantization, filters, etc.) in parallel.
+  class ThreadPool {
+  public:
+    typedef std::function<void()> Task;
+
+    // Returns the shared pool (created the first time it's used)
+    // with one worker for each extra hardware thread.
+    static ThreadPool* instance();
+
+    explicit ThreadPool(int workers);
+    ~ThreadPool();
+
+    // Number of threads that can run tasks at the same time
+    // (workers + the thread that is waiting the results).
+    int concurrency() const { return int(m_workers.size())+1; }
+
+    // Adds a new task to be executed in some worker thread.
+    void execute(const Task& task);
+
+    // Returns true if the current thread is one of the workers of
+    // any ThreadPool.
+    static bool isWorkerThread();
+
+  private:
+    void workerLoop();
+
+    std::vector<std::thread> m_workers;
+    std::deque<Task> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+
+    DISABLE_COPYING(ThreadPool);
+  };
+
+  // Calls "func(from, to)" for several sub-ranges [from, to) of the
+  // given [begin, end) range using the shared ThreadPool. Each
+  // sub-range will contain at least "grain" elements (e.g. rows) so
+  // small ranges are processed in the calling thread directly. It
+  // returns when all the sub-ranges were processed (the first
+  // exception thrown by "func" is re-thrown in the calling thread).
+  //
+  // When it's called from a worker thread (nested parallel_for) the
+  // whole range is processed in the calling thread.
+  void parallel_for(int begin, int end, int grain,
+                    const std::function<void(int, int)>& func);
+
+} // namespace doc
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -17,103 +17,242 @@
 #include "filters/neighboring_pixels.h"
 #include "doc/image_impl.h"
 #include "doc/palette.h"
+#include "doc/primitives_fast.h"
 #include "doc/rgbmap.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace filters {
 
 using namespace doc;
 
 namespace {
 
-  struct GetPixelsDelegate {
-    uint32_t color;
-    int div;
-    const int* matrixData;
-
-    void reset(const ConvolutionMatrix* matrix) {
-      div = matrix->getDiv();
-      matrixData = &matrix->value(0, 0);
-    }
-
+  // Source pixels are separated in these planes of integers, so the
+  // convolution of each plane is just a sum of its values multiplied
+  // by the matrix values.
+  enum {
+    kRedPlane,
+    kGreenPlane,
+    kBluePlane,
+    kAlphaPlane,
+    kIndexPlane,
+    kTransparentPlane,    // 1 for transparent pixels, their matrix values
+                          // are subtracted from the divisor
+    kPlanes
   };
 
-  struct GetPixelsDelegateRgba : public GetPixelsDelegate {
-    int r, g, b, a;
+  const int kGrayPlane = kRedPlane;
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = 0;
+  // Color channels of transparent pixels are zero (they are not
+  // included in the convolution).
+  inline void split_pixel(color_t color, int* v) {
+    if (rgba_geta(color) == 0) {
+      v[kRedPlane] = v[kGreenPlane] = v[kBluePlane] = v[kAlphaPlane] = 0;
+      v[kTransparentPlane] = 1;
+    }
+    else {
+      v[kRedPlane] = rgba_getr(color);
+      v[kGreenPlane] = rgba_getg(color);
+      v[kBluePlane] = rgba_getb(color);
+      v[kAlphaPlane] = rgba_geta(color);
+      v[kTransparentPlane] = 0;
     }
+  }
 
-    void operator()(RgbTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        if (rgba_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(color) * (*matrixData);
-          g += rgba_getg(color) * (*matrixData);
-          b += rgba_getb(color) * (*matrixData);
-          a += rgba_geta(color) * (*matrixData);
-        }
-      }
-      matrixData++;
+  inline void split_pixel(RgbTraits::pixel_t color, const Palette* pal, int* v) {
+    split_pixel(color, v);
+    v[kIndexPlane] = 0;
+  }
+
+  inline void split_pixel(GrayscaleTraits::pixel_t color, const Palette* pal, int* v) {
+    if (graya_geta(color) == 0) {
+      v[kGrayPlane] = v[kAlphaPlane] = 0;
+      v[kTransparentPlane] = 1;
     }
+    else {
+      v[kGrayPlane] = graya_getv(color);
+      v[kAlphaPlane] = graya_geta(color);
+      v[kTransparentPlane] = 0;
+    }
+    v[kGreenPlane] = v[kBluePlane] = v[kIndexPlane] = 0;
+  }
 
-  };
+  inline void split_pixel(IndexedTraits::pixel_t color, const Palette* pal, int* v) {
+    split_pixel(pal->getEntry(color), v);
+    v[kIndexPlane] = color;
+  }
 
-  struct GetPixelsDelegateGrayscale : public GetPixelsDelegate {
-    int v, a;
+  // Returns true if the matrix is separable, i.e. each value is equal
+  // to rowFactors[y]*colFactors[x].
+  bool get_separable_factors(const ConvolutionMatrix* matrix,
+                             std::vector<int>& rowFactors,
+                             std::vector<int>& colFactors)
+  {
+    const int w = matrix->getWidth();
+    const int h = matrix->getHeight();
+
+    // Column factors are the values of the first non-empty row
+    // divided by their GCD (so row factors are integers too).
+    int y0 = 0;
+    for (; y0<h; ++y0) {
+      int x = 0;
+      for (; x<w && matrix->value(x, y0) == 0; ++x)
+        ;
+      if (x < w)
+        break;
+    }
+    if (y0 == h)
+      return false;
+
+    int gcd = 0;
+    for (int x=0; x<w; ++x) {
+      int a = ABS(matrix->value(x, y0));
+      while (a) {
+        int b = gcd % a;
+        gcd = a;
+        a = b;
+      }
+    }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      v = a = 0;
+    int x0 = -1;
+    colFactors.resize(w);
+    for (int x=0; x<w; ++x) {
+      colFactors[x] = matrix->value(x, y0) / gcd;
+      if (x0 < 0 && colFactors[x] != 0)
+        x0 = x;
     }
 
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        if (graya_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          v += graya_getv(color) * (*matrixData);
-          a += graya_geta(color) * (*matrixData);
+    rowFactors.resize(h);
+    for (int y=0; y<h; ++y) {
+      rowFactors[y] = matrix->value(x0, y) / colFactors[x0];
+      for (int x=0; x<w; ++x) {
+        if (rowFactors[y]*colFactors[x] != matrix->value(x, y)) {
+          rowFactors.clear();
+          colFactors.clear();
+          return false;
         }
       }
-      matrixData++;
     }
+    return true;
+  }
 
-  };
-
-  struct GetPixelsDelegateIndexed : public GetPixelsDelegate {
-    const Palette* pal;
-    int r, g, b, a, index;
-
-    GetPixelsDelegateIndexed(const Palette* pal) : pal(pal) { }
-
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = index = 0;
+  // Calculates the convolution of the given planes for each pixel of
+  // the current row of the filter manager. The result for the "i"
+  // pixel of the row is in sums[plane][i].
+  template<typename Traits>
+  void convolve_row(FilterManager* filterMgr,
+                    const ConvolutionMatrix* matrix,
+                    const std::vector<int>& rowFactors,
+                    const std::vector<int>& colFactors,
+                    const TiledMode tiledMode,
+                    const int planes,
+                    const Palette* pal,
+                    std::vector<int>* sums)
+  {
+    const Image* src = filterMgr->getSourceImage();
+    const int mw = matrix->getWidth();
+    const int mh = matrix->getHeight();
+    const int x0 = filterMgr->x() - matrix->getCenterX();
+    const int y0 = filterMgr->y() - matrix->getCenterY();
+    const int n = filterMgr->getWidth();
+    const bool tiledX = (int(tiledMode) & int(TiledMode::X_AXIS)) ? true: false;
+    const bool tiledY = (int(tiledMode) & int(TiledMode::Y_AXIS)) ? true: false;
+
+    // Source rows are converted to planes resolving the image edges
+    // (clamped or wrapped in tiled mode) just once, so the "dx"
+    // pixel for the "i" pixel of the row is the "i+dx" element of
+    // these buffers. This is not possible if the matrix is wider than
+    // a non-tiled image (see neighboring_pixel_x()), in that case the
+    // buffers contain the whole source row and each element is
+    // mapped.
+    const bool padded = (tiledX || mw <= src->width());
+    const int len = (padded ? n+mw-1: src->width());
+    std::vector<int> buf(mh*kPlanes*len);
+    int v[kPlanes];
+
+    int nplanes = 0;
+    int usedPlanes[kPlanes];
+    for (int p=0; p<kPlanes; ++p)
+      if (planes & (1 << p))
+        usedPlanes[nplanes++] = p;
+
+    for (int dy=0; dy<mh; ++dy) {
+      typename Traits::const_address_t srcRow =
+        get_pixel_const_address_fast<Traits>(
+          src, 0, neighboring_pixel_y(y0, dy, src->height(), tiledY));
+      int* dst = &buf[dy*kPlanes*len];
+
+      for (int i=0; i<len; ++i) {
+        split_pixel(srcRow[padded ? wrap_or_clamp_coord(x0+i, src->width(), tiledX): i], pal, v);
+        for (int j=0; j<nplanes; ++j)
+          dst[usedPlanes[j]*len+i] = v[usedPlanes[j]];
+      }
     }
 
-    void operator()(IndexedTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        index += color * (*matrixData);
-        color_t rgba = pal->getEntry(color);
-        if (rgba_geta(rgba) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(rgba) * (*matrixData);
-          g += rgba_getg(rgba) * (*matrixData);
-          b += rgba_getb(rgba) * (*matrixData);
-          a += rgba_geta(rgba) * (*matrixData);
+    // Adds the "dx" pixel (from the given row) multiplied by "k" to
+    // each sum. The padded loop is simple enough to be vectorized by
+    // the compiler.
+    auto addColumn = [&](int* out, const int* row, const int k, const int dx) {
+      if (padded) {
+        row += dx;
+        for (int i=0; i<n; ++i)
+          out[i] += k*row[i];
+      }
+      else {
+        for (int i=0; i<n; ++i)
+          out[i] += k*row[neighboring_pixel_x(x0+i, dx, src->width(), tiledX)];
+      }
+    };
+
+    std::vector<int> column;
+    if (!rowFactors.empty())
+      column.resize(len);
+
+    for (int j=0; j<nplanes; ++j) {
+      const int p = usedPlanes[j];
+      int* out = sums[p].data();
+      std::fill(out, out+n, 0);
+
+      // Separable matrix: vertical 1D pass over the whole buffer and
+      // then an horizontal 1D pass.
+      if (!rowFactors.empty()) {
+        std::fill(column.begin(), column.end(), 0);
+        for (int dy=0; dy<mh; ++dy) {
+          const int k = rowFactors[dy];
+          if (k) {
+            const int* row = &buf[(dy*kPlanes+p)*len];
+            for (int i=0; i<len; ++i)
+              column[i] += k*row[i];
+          }
+        }
+        for (int dx=0; dx<mw; ++dx) {
+          if (colFactors[dx])
+            addColumn(out, column.data(), colFactors[dx], dx);
+        }
+      }
+      else {
+        for (int dy=0; dy<mh; ++dy) {
+          const int* row = &buf[(dy*kPlanes+p)*len];
+          for (int dx=0; dx<mw; ++dx) {
+            const int k = matrix->value(dx, dy);
+            if (k)
+              addColumn(out, row, k, dx);
+          }
         }
       }
-      matrixData++;
     }
+  }
 
-  };
+  inline int rgba_planes(Target target) {
+    int planes = (1 << kTransparentPlane);
+    if (target & TARGET_RED_CHANNEL) planes |= (1 << kRedPlane);
+    if (target & TARGET_GREEN_CHANNEL) planes |= (1 << kGreenPlane);
+    if (target & TARGET_BLUE_CHANNEL) planes |= (1 << kBluePlane);
+    if (target & TARGET_ALPHA_CHANNEL) planes |= (1 << kAlphaPlane);
+    return planes;
+  }
 
 }
 
@@ -126,7 +265,15 @@ ConvolutionMatrixFilter::ConvolutionMatrixFilter()
 void ConvolutionMatrixFilter::setMatrix(const base::SharedPtr<ConvolutionMatrix>& matrix)
 {
   m_matrix = matrix;
-  m_lines.resize(matrix->getHeight());
+  m_rowFactors.clear();
+  m_colFactors.clear();
+
+  // Two 1D passes are faster only if the matrix is 2D
+  if (m_matrix &&
+      m_matrix->getWidth() > 1 &&
+      m_matrix->getHeight() > 1) {
+    get_separable_factors(m_matrix.get(), m_rowFactors, m_colFactors);
+  }
 }
 
 void ConvolutionMatrixFilter::setTiledMode(TiledMode tiledMode)
@@ -148,61 +295,62 @@ void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint32_t color;
-  GetPixelsDelegateRgba delegate;
+  int r, g, b, a, div;
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  std::vector<int> sums[kPlanes];
+  for (auto& sum : sums)
+    sum.resize(filterMgr->getWidth());
+
+  convolve_row<RgbTraits>(filterMgr, m_matrix.get(),
+                          m_rowFactors, m_colFactors, m_tiledMode,
+                          rgba_planes(target), nullptr, sums);
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<RgbTraits>(src, x, y,
-                                      m_matrix->getWidth(),
-                                      m_matrix->getHeight(),
-                                      m_matrix->getCenterX(),
-                                      m_matrix->getCenterY(),
-                                      m_tiledMode, delegate);
-
     color = get_pixel_fast<RgbTraits>(src, x, y);
-    if (delegate.div == 0) {
+    div = m_matrix->getDiv() - sums[kTransparentPlane][i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_RED_CHANNEL) {
-      delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-      delegate.r = MID(0, delegate.r, 255);
+      r = sums[kRedPlane][i] / div + m_matrix->getBias();
+      r = MID(0, r, 255);
     }
     else
-      delegate.r = rgba_getr(color);
+      r = rgba_getr(color);
 
     if (target & TARGET_GREEN_CHANNEL) {
-      delegate.g = delegate.g / delegate.div + m_matrix->getBias();
-      delegate.g = MID(0, delegate.g, 255);
+      g = sums[kGreenPlane][i] / div + m_matrix->getBias();
+      g = MID(0, g, 255);
     }
     else
-      delegate.g = rgba_getg(color);
+      g = rgba_getg(color);
 
     if (target & TARGET_BLUE_CHANNEL) {
-      delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-      delegate.b = MID(0, delegate.b, 255);
+      b = sums[kBluePlane][i] / div + m_matrix->getBias();
+      b = MID(0, b, 255);
     }
     else
-      delegate.b = rgba_getb(color);
+      b = rgba_getb(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = MID(0, delegate.a, 255);
+      a = sums[kAlphaPlane][i] / m_matrix->getDiv() + m_matrix->getBias();
+      a = MID(0, a, 255);
     }
     else
-      delegate.a = rgba_geta(color);
+      a = rgba_geta(color);
 
-    *(dst_address++) = rgba(delegate.r, delegate.g, delegate.b, delegate.a);
+    *(dst_address++) = rgba(r, g, b, a);
   }
 }
 
@@ -215,47 +363,52 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint16_t color;
-  GetPixelsDelegateGrayscale delegate;
+  int k, a, div;
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  std::vector<int> sums[kPlanes];
+  for (auto& sum : sums)
+    sum.resize(filterMgr->getWidth());
+
+  int planes = (1 << kTransparentPlane);
+  if (target & TARGET_GRAY_CHANNEL) planes |= (1 << kGrayPlane);
+  if (target & TARGET_ALPHA_CHANNEL) planes |= (1 << kAlphaPlane);
+
+  convolve_row<GrayscaleTraits>(filterMgr, m_matrix.get(),
+                                m_rowFactors, m_colFactors, m_tiledMode,
+                                planes, nullptr, sums);
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y,
-                                            m_matrix->getWidth(),
-                                            m_matrix->getHeight(),
-                                            m_matrix->getCenterX(),
-                                            m_matrix->getCenterY(),
-                                            m_tiledMode, delegate);
-
     color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-    if (delegate.div == 0) {
+    div = m_matrix->getDiv() - sums[kTransparentPlane][i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_GRAY_CHANNEL) {
-      delegate.v = delegate.v / delegate.div + m_matrix->getBias();
-      delegate.v = MID(0, delegate.v, 255);
+      k = sums[kGrayPlane][i] / div + m_matrix->getBias();
+      k = MID(0, k, 255);
     }
     else
-      delegate.v = graya_getv(color);
+      k = graya_getv(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = MID(0, delegate.a, 255);
+      a = sums[kAlphaPlane][i] / m_matrix->getDiv() + m_matrix->getBias();
+      a = MID(0, a, 255);
     }
     else
-      delegate.a = graya_geta(color);
+      a = graya_geta(color);
 
-    *(dst_address++) = graya(delegate.v, delegate.a);
+    *(dst_address++) = graya(k, a);
   }
 }
 
@@ -270,70 +423,74 @@ void ConvolutionMatrixFilter::applyToIndexed(FilterManager* filterMgr)
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
   uint8_t color;
-  GetPixelsDelegateIndexed delegate(pal);
+  int index, r, g, b, a, div;
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  std::vector<int> sums[kPlanes];
+  for (auto& sum : sums)
+    sum.resize(filterMgr->getWidth());
+
+  convolve_row<IndexedTraits>(filterMgr, m_matrix.get(),
+                              m_rowFactors, m_colFactors, m_tiledMode,
+                              (target & TARGET_INDEX_CHANNEL ?
+                               (1 << kTransparentPlane) | (1 << kIndexPlane):
+                               rgba_planes(target)),
+                              pal, sums);
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<IndexedTraits>(src, x, y,
-                                          m_matrix->getWidth(),
-                                          m_matrix->getHeight(),
-                                          m_matrix->getCenterX(),
-                                          m_matrix->getCenterY(),
-                                          m_tiledMode, delegate);
-
     color = get_pixel_fast<IndexedTraits>(src, x, y);
-    if (delegate.div == 0) {
+    div = m_matrix->getDiv() - sums[kTransparentPlane][i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_INDEX_CHANNEL) {
-      delegate.index = delegate.index / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.index = MID(0, delegate.index, 255);
+      index = sums[kIndexPlane][i] / m_matrix->getDiv() + m_matrix->getBias();
+      index = MID(0, index, 255);
 
-      *(dst_address++) = delegate.index;
+      *(dst_address++) = index;
     }
     else {
       color = pal->getEntry(color);
 
       if (target & TARGET_RED_CHANNEL) {
-        delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-        delegate.r = MID(0, delegate.r, 255);
+        r = sums[kRedPlane][i] / div + m_matrix->getBias();
+        r = MID(0, r, 255);
       }
       else
-        delegate.r = rgba_getr(color);
+        r = rgba_getr(color);
 
       if (target & TARGET_GREEN_CHANNEL) {
-        delegate.g =  delegate.g / delegate.div + m_matrix->getBias();
-        delegate.g = MID(0, delegate.g, 255);
+        g = sums[kGreenPlane][i] / div + m_matrix->getBias();
+        g = MID(0, g, 255);
       }
       else
-        delegate.g = rgba_getg(color);
+        g = rgba_getg(color);
 
       if (target & TARGET_BLUE_CHANNEL) {
-        delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-        delegate.b = MID(0, delegate.b, 255);
+        b = sums[kBluePlane][i] / div + m_matrix->getBias();
+        b = MID(0, b, 255);
       }
       else
-        delegate.b = rgba_getb(color);
+        b = rgba_getb(color);
 
       if (target & TARGET_ALPHA_CHANNEL) {
-        delegate.a = delegate.a / delegate.div + m_matrix->getBias();
-        delegate.a = MID(0, delegate.a, 255);
+        a = sums[kAlphaPlane][i] / div + m_matrix->getBias();
+        a = MID(0, a, 255);
       }
       else
-        delegate.a = rgba_geta(color);
+        a = rgba_geta(color);
 
-      *(dst_address++) = rgbmap->mapColor(delegate.r, delegate.g, delegate.b, delegate.a);
+      *(dst_address++) = rgbmap->mapColor(r, g, b, a);
     }
   }
 }
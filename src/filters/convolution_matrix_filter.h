@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -38,7 +38,12 @@ namespace filters {
   private:
     base::SharedPtr<ConvolutionMatrix> m_matrix;
     TiledMode m_tiledMode;
-    std::vector<uint8_t*> m_lines;
+
+    // When the matrix is separable each value is equal to
+    // m_rowFactors[y]*m_colFactors[x], so it can be applied as two 1D
+    // convolutions (these vectors are empty in other case).
+    std::vector<int> m_rowFactors;
+    std::vector<int> m_colFactors;
   };
 
 } // namespace filters
@@ -0,0 +1,261 @@
+// Aseprite
+// Copyright (C) 2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image_impl.h"
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_matrix_filter.h"
+#include "filters/neighboring_pixels.h"
+#include "filters/test_filter_manager.h"
+#include "gfx/size.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+using namespace filters;
+
+// Reference implementation: the convolution of each pixel is
+// calculated from its neighbors (get_neighboring_pixels()), one
+// pixel at a time.
+struct ReferenceSums {
+  const ConvolutionMatrix* matrix;
+  const Palette* pal;
+  const int* matrixData;
+  int div, r, g, b, a, index;
+
+  ReferenceSums(const ConvolutionMatrix* matrix, const Palette* pal)
+    : matrix(matrix), pal(pal) {
+    matrixData = &matrix->value(0, 0);
+    div = matrix->getDiv();
+    r = g = b = a = index = 0;
+  }
+
+  void add(color_t color, int k) {
+    if (rgba_geta(color) == 0)
+      div -= k;
+    else {
+      r += rgba_getr(color) * k;
+      g += rgba_getg(color) * k;
+      b += rgba_getb(color) * k;
+      a += rgba_geta(color) * k;
+    }
+  }
+
+  void operator()(RgbTraits::pixel_t color) {
+    add(color, *(matrixData++));
+  }
+
+  void operator()(GrayscaleTraits::pixel_t color) {
+    const int k = *(matrixData++);
+    if (graya_geta(color) == 0)
+      div -= k;
+    else {
+      r += graya_getv(color) * k;
+      a += graya_geta(color) * k;
+    }
+  }
+
+  void operator()(IndexedTraits::pixel_t color) {
+    const int k = *(matrixData++);
+    index += color * k;
+    add(pal->getEntry(color), k);
+  }
+
+  int channel(int sum, int div) const {
+    return MID(0, sum / div + matrix->getBias(), 255);
+  }
+};
+
+static void apply_reference(const ConvolutionMatrix* matrix,
+                            TiledMode tiledMode, Target target,
+                            TestFilterManager::SkipFunc skip,
+                            const Palette* pal, const RgbMap* rgbmap,
+                            const Image* src, Image* dst)
+{
+  copy_image(dst, src);
+
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x) {
+      if (skip && skip(x, y))
+        continue;
+
+      ReferenceSums s(matrix, pal);
+      const int mw = matrix->getWidth();
+      const int mh = matrix->getHeight();
+      const int cx = matrix->getCenterX();
+      const int cy = matrix->getCenterY();
+      const color_t color = get_pixel(src, x, y);
+
+      switch (src->pixelFormat()) {
+
+        case IMAGE_RGB: {
+          get_neighboring_pixels<RgbTraits>(src, x, y, mw, mh, cx, cy, tiledMode, s);
+          if (s.div == 0)
+            break;
+          put_pixel(
+            dst, x, y,
+            rgba((target & TARGET_RED_CHANNEL) ? s.channel(s.r, s.div): rgba_getr(color),
+                 (target & TARGET_GREEN_CHANNEL) ? s.channel(s.g, s.div): rgba_getg(color),
+                 (target & TARGET_BLUE_CHANNEL) ? s.channel(s.b, s.div): rgba_getb(color),
+                 (target & TARGET_ALPHA_CHANNEL) ? s.channel(s.a, matrix->getDiv()): rgba_geta(color)));
+          break;
+        }
+
+        case IMAGE_GRAYSCALE: {
+          get_neighboring_pixels<GrayscaleTraits>(src, x, y, mw, mh, cx, cy, tiledMode, s);
+          if (s.div == 0)
+            break;
+          put_pixel(
+            dst, x, y,
+            graya((target & TARGET_GRAY_CHANNEL) ? s.channel(s.r, s.div): graya_getv(color),
+                  (target & TARGET_ALPHA_CHANNEL) ? s.channel(s.a, matrix->getDiv()): graya_geta(color)));
+          break;
+        }
+
+        case IMAGE_INDEXED: {
+          get_neighboring_pixels<IndexedTraits>(src, x, y, mw, mh, cx, cy, tiledMode, s);
+          if (s.div == 0)
+            break;
+          if (target & TARGET_INDEX_CHANNEL) {
+            put_pixel(dst, x, y, s.channel(s.index, matrix->getDiv()));
+          }
+          else {
+            // Untargeted channels use the palette entry truncated to
+            // 8 bits (as the original implementation did).
+            const uint8_t entry = pal->getEntry(color);
+            put_pixel(
+              dst, x, y,
+              rgbmap->mapColor(
+                (target & TARGET_RED_CHANNEL) ? s.channel(s.r, s.div): rgba_getr(entry),
+                (target & TARGET_GREEN_CHANNEL) ? s.channel(s.g, s.div): rgba_getg(entry),
+                (target & TARGET_BLUE_CHANNEL) ? s.channel(s.b, s.div): rgba_getb(entry),
+                (target & TARGET_ALPHA_CHANNEL) ? s.channel(s.a, s.div): rgba_geta(entry)));
+          }
+          break;
+        }
+      }
+    }
+}
+
+static ConvolutionMatrix* create_matrix(int w, int h, bool separable)
+{
+  ConvolutionMatrix* matrix = new ConvolutionMatrix(w, h);
+  std::vector<int> rows(h), cols(w);
+  for (int& v : rows) v = std::rand() % 5 - 1;
+  for (int& v : cols) v = std::rand() % 5 - 1;
+  rows[std::rand() % h] = 2;
+  cols[std::rand() % w] = 3;
+
+  int sum = 0;
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      int k = (separable ? rows[y]*cols[x]: std::rand() % 9 - 2);
+      matrix->value(x, y) = k;
+      sum += k;
+    }
+
+  matrix->setCenterX(std::rand() % w);
+  matrix->setCenterY(std::rand() % h);
+  matrix->setDiv(sum > 0 ? sum: 1 + std::rand() % 8);
+  matrix->setBias(std::rand() % 3 == 0 ? std::rand() % 64 - 32: 0);
+  return matrix;
+}
+
+static bool skip_some_pixels(int x, int y)
+{
+  return ((x + 2*y) % 7 == 0);
+}
+
+static std::vector<Target> targets_for(PixelFormat format)
+{
+  std::vector<Target> targets;
+  switch (format) {
+    case IMAGE_RGB:
+    case IMAGE_INDEXED:
+      for (int t=1; t<16; ++t)
+        targets.push_back(t);
+      if (format == IMAGE_INDEXED)
+        targets.push_back(TARGET_INDEX_CHANNEL);
+      break;
+    case IMAGE_GRAYSCALE:
+      targets.push_back(TARGET_GRAY_CHANNEL);
+      targets.push_back(TARGET_ALPHA_CHANNEL);
+      targets.push_back(TARGET_GRAY_CHANNEL | TARGET_ALPHA_CHANNEL);
+      break;
+  }
+  return targets;
+}
+
+TEST(ConvolutionMatrixFilter, SameResultAsPerPixelConvolution)
+{
+  std::srand(1);
+
+  base::UniquePtr<Palette> pal(create_random_palette(256));
+  RgbMap rgbmap;
+  rgbmap.regenerate(pal, 0);
+
+  // Matrices smaller and bigger than the images (so the edges are
+  // clamped/wrapped several times).
+  const gfx::Size imageSizes[] = { gfx::Size(23, 17), gfx::Size(4, 3) };
+  const gfx::Size matrixSizes[] = {
+    gfx::Size(3, 3), gfx::Size(5, 3), gfx::Size(1, 5),
+    gfx::Size(4, 1), gfx::Size(7, 7) };
+
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED })
+  for (const gfx::Size& imageSize : imageSizes) {
+    ImageRef src(Image::create(format, imageSize.w, imageSize.h));
+    ImageRef dst(Image::create(format, imageSize.w, imageSize.h));
+    ImageRef expected(Image::create(format, imageSize.w, imageSize.h));
+    fill_random_pixels(src.get(), pal);
+
+    for (const gfx::Size& matrixSize : matrixSizes)
+    for (bool separable : { true, false }) {
+      base::SharedPtr<ConvolutionMatrix> matrix(
+        create_matrix(matrixSize.w, matrixSize.h, separable));
+
+      for (TiledMode tiledMode : { TiledMode::NONE, TiledMode::X_AXIS,
+                                   TiledMode::Y_AXIS, TiledMode::BOTH })
+      for (Target target : targets_for(format))
+      for (TestFilterManager::SkipFunc skip : { (TestFilterManager::SkipFunc)nullptr,
+                                                &skip_some_pixels }) {
+        ConvolutionMatrixFilter filter;
+        filter.setMatrix(matrix);
+        filter.setTiledMode(tiledMode);
+
+        TestFilterManager filterMgr(src.get(), dst.get(), target, pal, &rgbmap, skip);
+        filterMgr.apply(&filter);
+
+        apply_reference(matrix.get(), tiledMode, target, skip,
+                        pal, &rgbmap, src.get(), expected.get());
+
+        ASSERT_EQ(0, count_diff_between_images(expected.get(), dst.get()))
+          << "Format " << format
+          << ", image " << imageSize.w << "x" << imageSize.h
+          << ", matrix " << matrixSize.w << "x" << matrixSize.h
+          << (separable ? " (separable)": "")
+          << ", tiled mode " << int(tiledMode)
+          << ", target " << target;
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
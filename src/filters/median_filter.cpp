@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2015  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -10,9 +10,9 @@
 
 #include "filters/median_filter.h"
 
-#include "base/memory.h"
 #include "doc/image_impl.h"
 #include "doc/palette.h"
+#include "doc/primitives_fast.h"
 #include "doc/rgbmap.h"
 #include "filters/filter_indexed_data.h"
 #include "filters/filter_manager.h"
@@ -20,80 +20,245 @@
 #include "filters/tiled_mode.h"
 
 #include <algorithm>
+#include <climits>
+#include <vector>
 
 namespace filters {
 
 using namespace doc;
 
 namespace {
-  struct GetPixelsDelegateRgba {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
 
-    GetPixelsDelegateRgba(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+  // Histogram of one channel of the pixels inside the median window.
+  // The value at the median rank is tracked incrementally (Huang's
+  // algorithm): when the window moves one pixel only a few values
+  // change, so the median moves just a few bins up or down.
+  class ChannelHistogram {
+  public:
+    void reset() {
+      std::fill(m_bins, m_bins+256, 0);
+      m_value = 0;
+      m_below = 0;
+    }
+
+    void add(int v) {
+      ++m_bins[v];
+      if (v < m_value)
+        ++m_below;
+    }
 
-    void reset() { c = 0; }
+    void remove(int v) {
+      --m_bins[v];
+      if (v < m_value)
+        --m_below;
+    }
 
-    void operator()(RgbTraits::pixel_t color)
-    {
-      channel[0][c] = rgba_getr(color);
-      channel[1][c] = rgba_getg(color);
-      channel[2][c] = rgba_getb(color);
-      channel[3][c] = rgba_geta(color);
-      c++;
+    // Returns the element that would be in the "rank" index if we
+    // sort all the values of the histogram.
+    int valueAt(int rank) {
+      while (m_below > rank)
+        m_below -= m_bins[--m_value];
+      while (m_below + m_bins[m_value] <= rank)
+        m_below += m_bins[m_value++];
+      return m_value;
     }
+
+  private:
+    int m_bins[256];
+    int m_value;                // Current median value
+    int m_below;                // Number of values less than m_value
   };
 
-  struct GetPixelsDelegateGrayscale {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
+  // Each delegate splits pixels in channels (channel values are added
+  // to the histograms) and joins the median of each channel to create
+  // the output pixel.
+  struct RgbaDelegate {
+    typedef RgbTraits Traits;
+    Target target;
 
-    GetPixelsDelegateGrayscale(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+    RgbaDelegate(Target target) : target(target) { }
 
-    void reset() { c = 0; }
+    bool hasChannel(int i) const {
+      static const Target channels[4] = {
+        TARGET_RED_CHANNEL, TARGET_GREEN_CHANNEL,
+        TARGET_BLUE_CHANNEL, TARGET_ALPHA_CHANNEL };
+      return (target & channels[i]) ? true: false;
+    }
+
+    void split(RgbTraits::pixel_t color, int* v) const {
+      v[0] = rgba_getr(color);
+      v[1] = rgba_getg(color);
+      v[2] = rgba_getb(color);
+      v[3] = rgba_geta(color);
+    }
 
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      channel[0][c] = graya_getv(color);
-      channel[1][c] = graya_geta(color);
-      c++;
+    RgbTraits::pixel_t join(RgbTraits::pixel_t color, const int* v) const {
+      return rgba((target & TARGET_RED_CHANNEL ? v[0]: rgba_getr(color)),
+                  (target & TARGET_GREEN_CHANNEL ? v[1]: rgba_getg(color)),
+                  (target & TARGET_BLUE_CHANNEL ? v[2]: rgba_getb(color)),
+                  (target & TARGET_ALPHA_CHANNEL ? v[3]: rgba_geta(color)));
     }
   };
 
-  struct GetPixelsDelegateIndexed {
-    const Palette* pal;
-    std::vector<std::vector<uint8_t> >& channel;
+  struct GrayscaleDelegate {
+    typedef GrayscaleTraits Traits;
     Target target;
-    int c;
 
-    GetPixelsDelegateIndexed(const Palette* pal, std::vector<std::vector<uint8_t> >& channel, Target target)
-      : pal(pal), channel(channel), target(target) { }
+    GrayscaleDelegate(Target target) : target(target) { }
 
-    void reset() { c = 0; }
+    bool hasChannel(int i) const {
+      switch (i) {
+        case 0: return (target & TARGET_GRAY_CHANNEL) ? true: false;
+        case 1: return (target & TARGET_ALPHA_CHANNEL) ? true: false;
+      }
+      return false;
+    }
+
+    void split(GrayscaleTraits::pixel_t color, int* v) const {
+      v[0] = graya_getv(color);
+      v[1] = graya_geta(color);
+    }
+
+    GrayscaleTraits::pixel_t join(GrayscaleTraits::pixel_t color, const int* v) const {
+      return graya((target & TARGET_GRAY_CHANNEL ? v[0]: graya_getv(color)),
+                   (target & TARGET_ALPHA_CHANNEL ? v[1]: graya_geta(color)));
+    }
+  };
+
+  struct IndexedDelegate {
+    typedef IndexedTraits Traits;
+    const Palette* pal;
+    const RgbMap* rgbmap;
+    RgbaDelegate rgba;
 
-    void operator()(IndexedTraits::pixel_t color)
-    {
-      if (target & TARGET_INDEX_CHANNEL) {
-        channel[0][c] = color;
+    IndexedDelegate(const Palette* pal, const RgbMap* rgbmap, Target target)
+      : pal(pal), rgbmap(rgbmap), rgba(target) { }
+
+    bool hasChannel(int i) const {
+      if (rgba.target & TARGET_INDEX_CHANNEL)
+        return (i == 0);
+      else
+        return rgba.hasChannel(i);
+    }
+
+    void split(IndexedTraits::pixel_t index, int* v) const {
+      if (rgba.target & TARGET_INDEX_CHANNEL)
+        v[0] = index;
+      else
+        rgba.split(pal->getEntry(index), v);
+    }
+
+    IndexedTraits::pixel_t join(IndexedTraits::pixel_t index, const int* v) const {
+      if (rgba.target & TARGET_INDEX_CHANNEL)
+        return v[0];
+
+      color_t color = rgba.join(pal->getEntry(index), v);
+      return rgbmap->mapColor(rgba_getr(color),
+                              rgba_getg(color),
+                              rgba_getb(color),
+                              rgba_geta(color));
+    }
+  };
+
+  // Applies the median filter to the current row of the filter
+  // manager. A histogram for each channel of the window is kept, and
+  // when the window moves one pixel to the right we remove its first
+  // column and add the next one, so the cost per pixel depends on
+  // the window height only (and not on the whole window area).
+  template<typename Delegate>
+  void apply_median(FilterManager* filterMgr,
+                    TiledMode tiledMode,
+                    const int width, const int height,
+                    const Delegate& delegate)
+  {
+    typedef typename Delegate::Traits Traits;
+    typedef typename Traits::pixel_t pixel_t;
+
+    const Image* src = filterMgr->getSourceImage();
+    pixel_t* dst_address = (pixel_t*)filterMgr->getDestinationAddress();
+    const bool tiledX = (int(tiledMode) & int(TiledMode::X_AXIS)) ? true: false;
+    const bool tiledY = (int(tiledMode) & int(TiledMode::Y_AXIS)) ? true: false;
+    const int rank = width*height/2;
+    const int x1 = filterMgr->x();
+    const int x2 = x1+filterMgr->getWidth();
+    const int y = filterMgr->y();
+
+    // The window can be moved one pixel to the right replacing just
+    // one column, except when it's wider than a non-tiled image (see
+    // neighboring_pixel_x()).
+    const bool canSlide = (tiledX || width <= src->width());
+
+    std::vector<typename Traits::const_address_t> rows(height);
+    for (int dy=0; dy<height; ++dy)
+      rows[dy] = get_pixel_const_address_fast<Traits>(
+        src, 0, neighboring_pixel_y(y-height/2, dy, src->height(), tiledY));
+
+    int nchannels = 0;
+    int channels[4];
+    for (int i=0; i<4; ++i)
+      if (delegate.hasChannel(i))
+        channels[nchannels++] = i;
+
+    ChannelHistogram hist[4];
+    int v[4];
+
+    auto addColumn = [&](int col) {
+      for (int dy=0; dy<height; ++dy) {
+        delegate.split(rows[dy][col], v);
+        for (int i=0; i<nchannels; ++i)
+          hist[channels[i]].add(v[channels[i]]);
+      }
+    };
+
+    auto removeColumn = [&](int col) {
+      for (int dy=0; dy<height; ++dy) {
+        delegate.split(rows[dy][col], v);
+        for (int i=0; i<nchannels; ++i)
+          hist[channels[i]].remove(v[channels[i]]);
+      }
+    };
+
+    // First column of the window that the histograms represent
+    // (or INT_MIN if they are empty).
+    int histX0 = INT_MIN;
+
+    for (int x=x1; x<x2; ++x, ++dst_address) {
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel())
+        continue;
+
+      const int x0 = x - width/2;
+
+      // Move the window from its previous position (skipped pixels
+      // are processed lazily), or fill it from scratch if it's faster.
+      if (canSlide && histX0 != INT_MIN && x0 - histX0 < width) {
+        for (; histX0<x0; ++histX0) {
+          removeColumn(neighboring_pixel_x(histX0, 0, src->width(), tiledX));
+          addColumn(neighboring_pixel_x(histX0+1, width-1, src->width(), tiledX));
+        }
       }
       else {
-        color_t rgb = pal->getEntry(color);
-        channel[0][c] = rgba_getr(rgb);
-        channel[1][c] = rgba_getg(rgb);
-        channel[2][c] = rgba_getb(rgb);
-        channel[3][c] = rgba_geta(rgb);
+        for (int i=0; i<nchannels; ++i)
+          hist[channels[i]].reset();
+        for (int dx=0; dx<width; ++dx)
+          addColumn(neighboring_pixel_x(x0, dx, src->width(), tiledX));
+        histX0 = x0;
       }
-      c++;
+
+      for (int i=0; i<nchannels; ++i)
+        v[channels[i]] = hist[channels[i]].valueAt(rank);
+
+      *dst_address = delegate.join(get_pixel_fast<Traits>(src, x, y), v);
     }
-  };
-};
+  }
+
+}
 
 MedianFilter::MedianFilter()
   : m_tiledMode(TiledMode::NONE)
   , m_width(0)
   , m_height(0)
   , m_ncolors(0)
-  , m_channel(4)
 {
 }
 
@@ -107,9 +272,6 @@ void MedianFilter::setSize(int width, int height)
   m_width = width;
   m_height = height;
   m_ncolors = width*height;
-
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
 }
 
 const char* MedianFilter::getName()
@@ -119,166 +281,22 @@ const char* MedianFilter::getName()
 
 void MedianFilter::applyToRgba(FilterManager* filterMgr)
 {
-  const Image* src = filterMgr->getSourceImage();
-  uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
-  Target target = filterMgr->getTarget();
-  int color;
-  int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<RgbTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                      m_tiledMode, delegate);
-
-    color = get_pixel_fast<RgbTraits>(src, x, y);
-
-    if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
-    }
-    else
-      r = rgba_getr(color);
-
-    if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
-    }
-    else
-      g = rgba_getg(color);
-
-    if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
-    }
-    else
-      b = rgba_getb(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
-    }
-    else
-      a = rgba_geta(color);
-
-    *(dst_address++) = rgba(r, g, b, a);
-  }
+  apply_median(filterMgr, m_tiledMode, m_width, m_height,
+               RgbaDelegate(filterMgr->getTarget()));
 }
 
 void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
 {
-  const Image* src = filterMgr->getSourceImage();
-  uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
-  Target target = filterMgr->getTarget();
-  int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                            m_tiledMode, delegate);
-
-    color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-
-    if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
-    }
-    else
-      k = graya_getv(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
-    }
-    else
-      a = graya_geta(color);
-
-    *(dst_address++) = graya(k, a);
-  }
+  apply_median(filterMgr, m_tiledMode, m_width, m_height,
+               GrayscaleDelegate(filterMgr->getTarget()));
 }
 
 void MedianFilter::applyToIndexed(FilterManager* filterMgr)
 {
-  const Image* src = filterMgr->getSourceImage();
-  uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
-  const Palette* pal = filterMgr->getIndexedData()->getPalette();
-  const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
-  Target target = filterMgr->getTarget();
-  int color, r, g, b, a;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<IndexedTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                          m_tiledMode, delegate);
-
-    if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
-    }
-    else {
-      color = get_pixel_fast<IndexedTraits>(src, x, y);
-      color = pal->getEntry(color);
-
-      if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
-      }
-      else
-        r = rgba_getr(color);
-
-      if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
-      }
-      else
-        g = rgba_getg(pal->getEntry(color));
-
-      if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
-      }
-      else
-        b = rgba_getb(color);
-
-      if (target & TARGET_ALPHA_CHANNEL) {
-        std::sort(m_channel[3].begin(), m_channel[3].end());
-        a = m_channel[3][m_ncolors/2];
-      }
-      else
-        a = rgba_geta(color);
-
-      *(dst_address++) = rgbmap->mapColor(r, g, b, a);
-    }
-  }
+  apply_median(filterMgr, m_tiledMode, m_width, m_height,
+               IndexedDelegate(filterMgr->getIndexedData()->getPalette(),
+                               filterMgr->getIndexedData()->getRgbMap(),
+                               filterMgr->getTarget()));
 }
 
 } // namespace filters
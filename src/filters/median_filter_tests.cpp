@@ -0,0 +1,205 @@
+// Aseprite
+// Copyright (C) 2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image_impl.h"
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/median_filter.h"
+#include "filters/neighboring_pixels.h"
+#include "filters/test_filter_manager.h"
+#include "gfx/size.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+using namespace filters;
+
+// Collects the channels of all pixels of the kernel (the channels of
+// the palette entry for indexed images, or the index itself).
+struct KernelPixels {
+  const Palette* pal;
+  bool indexes;
+  std::vector<int> channel[4];
+
+  KernelPixels(const Palette* pal, bool indexes)
+    : pal(pal), indexes(indexes) { }
+
+  void addRgba(color_t color) {
+    channel[0].push_back(rgba_getr(color));
+    channel[1].push_back(rgba_getg(color));
+    channel[2].push_back(rgba_getb(color));
+    channel[3].push_back(rgba_geta(color));
+  }
+
+  void operator()(RgbTraits::pixel_t color) {
+    addRgba(color);
+  }
+
+  void operator()(GrayscaleTraits::pixel_t color) {
+    channel[0].push_back(graya_getv(color));
+    channel[1].push_back(graya_geta(color));
+  }
+
+  void operator()(IndexedTraits::pixel_t color) {
+    if (indexes)
+      channel[0].push_back(color);
+    else
+      addRgba(pal->getEntry(color));
+  }
+
+  // Returns the median of the channel sorting all its values
+  int median(int i) {
+    std::vector<int>& v = channel[i];
+    std::sort(v.begin(), v.end());
+    return v[v.size()/2];
+  }
+};
+
+// Reference implementation: sorts the values of each kernel
+static void apply_reference(const gfx::Size& size,
+                            TiledMode tiledMode, Target target,
+                            TestFilterManager::SkipFunc skip,
+                            const Palette* pal, const RgbMap* rgbmap,
+                            const Image* src, Image* dst)
+{
+  copy_image(dst, src);
+
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x) {
+      if (skip && skip(x, y))
+        continue;
+
+      KernelPixels k(pal, (target & TARGET_INDEX_CHANNEL) ? true: false);
+      const color_t color = get_pixel(src, x, y);
+
+      switch (src->pixelFormat()) {
+
+        case IMAGE_RGB:
+          get_neighboring_pixels<RgbTraits>(src, x, y, size.w, size.h, size.w/2, size.h/2, tiledMode, k);
+          put_pixel(
+            dst, x, y,
+            rgba((target & TARGET_RED_CHANNEL) ? k.median(0): rgba_getr(color),
+                 (target & TARGET_GREEN_CHANNEL) ? k.median(1): rgba_getg(color),
+                 (target & TARGET_BLUE_CHANNEL) ? k.median(2): rgba_getb(color),
+                 (target & TARGET_ALPHA_CHANNEL) ? k.median(3): rgba_geta(color)));
+          break;
+
+        case IMAGE_GRAYSCALE:
+          get_neighboring_pixels<GrayscaleTraits>(src, x, y, size.w, size.h, size.w/2, size.h/2, tiledMode, k);
+          put_pixel(
+            dst, x, y,
+            graya((target & TARGET_GRAY_CHANNEL) ? k.median(0): graya_getv(color),
+                  (target & TARGET_ALPHA_CHANNEL) ? k.median(1): graya_geta(color)));
+          break;
+
+        case IMAGE_INDEXED:
+          get_neighboring_pixels<IndexedTraits>(src, x, y, size.w, size.h, size.w/2, size.h/2, tiledMode, k);
+          if (target & TARGET_INDEX_CHANNEL) {
+            put_pixel(dst, x, y, k.median(0));
+          }
+          else {
+            const color_t entry = pal->getEntry(color);
+            put_pixel(
+              dst, x, y,
+              rgbmap->mapColor(
+                (target & TARGET_RED_CHANNEL) ? k.median(0): rgba_getr(entry),
+                (target & TARGET_GREEN_CHANNEL) ? k.median(1): rgba_getg(entry),
+                (target & TARGET_BLUE_CHANNEL) ? k.median(2): rgba_getb(entry),
+                (target & TARGET_ALPHA_CHANNEL) ? k.median(3): rgba_geta(entry)));
+          }
+          break;
+      }
+    }
+}
+
+static bool skip_some_pixels(int x, int y)
+{
+  return ((2*x + y) % 5 == 0);
+}
+
+static std::vector<Target> targets_for(PixelFormat format)
+{
+  std::vector<Target> targets;
+  switch (format) {
+    case IMAGE_RGB:
+    case IMAGE_INDEXED:
+      for (int t=1; t<16; ++t)
+        targets.push_back(t);
+      if (format == IMAGE_INDEXED)
+        targets.push_back(TARGET_INDEX_CHANNEL);
+      break;
+    case IMAGE_GRAYSCALE:
+      targets.push_back(TARGET_GRAY_CHANNEL);
+      targets.push_back(TARGET_ALPHA_CHANNEL);
+      targets.push_back(TARGET_GRAY_CHANNEL | TARGET_ALPHA_CHANNEL);
+      break;
+  }
+  return targets;
+}
+
+TEST(MedianFilter, SameResultAsSortingEachKernel)
+{
+  std::srand(1);
+
+  base::UniquePtr<Palette> pal(create_random_palette(256));
+  RgbMap rgbmap;
+  rgbmap.regenerate(pal, 0);
+
+  // Kernels smaller and bigger than the images
+  const gfx::Size imageSizes[] = { gfx::Size(21, 15), gfx::Size(4, 3) };
+  const gfx::Size kernelSizes[] = {
+    gfx::Size(3, 3), gfx::Size(5, 2), gfx::Size(1, 4),
+    gfx::Size(6, 6), gfx::Size(9, 7) };
+
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED })
+  for (const gfx::Size& imageSize : imageSizes) {
+    ImageRef src(Image::create(format, imageSize.w, imageSize.h));
+    ImageRef dst(Image::create(format, imageSize.w, imageSize.h));
+    ImageRef expected(Image::create(format, imageSize.w, imageSize.h));
+    fill_random_pixels(src.get(), pal);
+
+    for (const gfx::Size& kernelSize : kernelSizes)
+    for (TiledMode tiledMode : { TiledMode::NONE, TiledMode::X_AXIS,
+                                 TiledMode::Y_AXIS, TiledMode::BOTH })
+    for (Target target : targets_for(format))
+    for (TestFilterManager::SkipFunc skip : { (TestFilterManager::SkipFunc)nullptr,
+                                              &skip_some_pixels }) {
+      MedianFilter filter;
+      filter.setSize(kernelSize.w, kernelSize.h);
+      filter.setTiledMode(tiledMode);
+
+      TestFilterManager filterMgr(src.get(), dst.get(), target, pal, &rgbmap, skip);
+      filterMgr.apply(&filter);
+
+      apply_reference(kernelSize, tiledMode, target, skip,
+                      pal, &rgbmap, src.get(), expected.get());
+
+      ASSERT_EQ(0, count_diff_between_images(expected.get(), dst.get()))
+        << "Format " << format
+        << ", image " << imageSize.w << "x" << imageSize.h
+        << ", kernel " << kernelSize.w << "x" << kernelSize.h
+        << ", tiled mode " << int(tiledMode)
+        << ", target " << target;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2001-2015  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -12,11 +12,43 @@
 #include "doc/image.h"
 #include "doc/image_traits.h"
 
+#include <algorithm>
 #include <vector>
 
 namespace filters {
   using namespace doc;
 
+  // Returns the coordinate "i" inside the [0,size) range, wrapping it
+  // in tiled mode or clamping it to the edges in other case.
+  inline int wrap_or_clamp_coord(int i, int size, bool tiled) {
+    if (tiled) {
+      i %= size;
+      return (i < 0 ? i+size: i);
+    }
+    else
+      return std::max(0, std::min(i, size-1));
+  }
+
+  // Returns the X coordinate of the "dx" pixel that
+  // get_neighboring_pixels() gives in a row of a matrix which starts
+  // in "x0" (the first column of the matrix, can be outside the
+  // image). It's the same as wrap_or_clamp_coord(x0+dx) except when
+  // the matrix is wider than a non-tiled image and starts before its
+  // left edge (the first pixel is repeated "-x0" extra times and the
+  // last pixels are never reached).
+  inline int neighboring_pixel_x(int x0, int dx, int width, bool tiled) {
+    if (!tiled && x0 < 0)
+      return std::max(0, std::min(dx, width-1) + x0);
+    else
+      return wrap_or_clamp_coord(x0+dx, width, tiled);
+  }
+
+  // Returns the Y coordinate of the "dy" row that
+  // get_neighboring_pixels() uses for a matrix which starts in "y0".
+  inline int neighboring_pixel_y(int y0, int dy, int height, bool tiled) {
+    return wrap_or_clamp_coord(y0+dy, height, tiled);
+  }
+
   // Calls the specified "delegate" for all neighboring pixels in a 2D
   // (width*height) matrix located in (x,y) where its center is the
   // (centerX,centerY) element of the matrix.
@@ -65,7 +97,7 @@ namespace filters {
       }
 
       typename Traits::const_address_t srcAddress =
-        reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelAddress(getx, gety));
+        reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelConstAddress(getx, gety));
 
       for (int dx=0; dx<width; dx++) {
         // Call the delegate for each pixel value.
@@ -82,7 +114,7 @@ namespace filters {
         else if (int(tiledMode) & int(TiledMode::X_AXIS)) {
           getx = 0;
           srcAddress =
-            reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelAddress(getx, gety));
+            reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelConstAddress(getx, gety));
         }
       }
 
@@ -0,0 +1,119 @@
+// Aseprite
+// Copyright (C) 2017  David Capello
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef FILTERS_TEST_FILTER_MANAGER_H_INCLUDED
+#define FILTERS_TEST_FILTER_MANAGER_H_INCLUDED
+#pragma once
+
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/filter.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+
+#include <cstdlib>
+
+namespace filters {
+
+  // Applies a filter to a whole image row by row (like the
+  // FilterManagerImpl of the app does) so filters can be tested
+  // without a document. Pixels where skip(x, y) returns true are
+  // left untouched (like non-selected pixels).
+  class TestFilterManager : public FilterManager
+                          , public FilterIndexedData {
+  public:
+    typedef bool (*SkipFunc)(int x, int y);
+
+    TestFilterManager(const doc::Image* src, doc::Image* dst,
+                      Target target, doc::Palette* palette,
+                      doc::RgbMap* rgbmap, SkipFunc skip = nullptr)
+      : m_src(src)
+      , m_dst(dst)
+      , m_target(target)
+      , m_palette(palette)
+      , m_rgbmap(rgbmap)
+      , m_skip(skip)
+      , m_x(0)
+      , m_y(0) {
+    }
+
+    void apply(Filter* filter) {
+      doc::copy_image(m_dst, m_src);
+
+      for (m_y=0; m_y<m_src->height(); ++m_y) {
+        m_x = 0;
+        switch (m_src->pixelFormat()) {
+          case doc::IMAGE_RGB: filter->applyToRgba(this); break;
+          case doc::IMAGE_GRAYSCALE: filter->applyToGrayscale(this); break;
+          case doc::IMAGE_INDEXED: filter->applyToIndexed(this); break;
+        }
+      }
+    }
+
+    // FilterManager implementation
+    const void* getSourceAddress() override { return m_src->getPixelConstAddress(0, m_y); }
+    void* getDestinationAddress() override { return m_dst->getPixelAddress(0, m_y); }
+    int getWidth() override { return m_src->width(); }
+    Target getTarget() override { return m_target; }
+    FilterIndexedData* getIndexedData() override { return this; }
+    bool skipPixel() override {
+      const int x = m_x++;
+      return (m_skip && m_skip(x, m_y));
+    }
+    const doc::Image* getSourceImage() override { return m_src; }
+    int x() override { return 0; }
+    int y() override { return m_y; }
+
+    // FilterIndexedData implementation
+    doc::Palette* getPalette() override { return m_palette; }
+    doc::RgbMap* getRgbMap() override { return m_rgbmap; }
+
+  private:
+    const doc::Image* m_src;
+    doc::Image* m_dst;
+    Target m_target;
+    doc::Palette* m_palette;
+    doc::RgbMap* m_rgbmap;
+    SkipFunc m_skip;
+    int m_x, m_y;
+  };
+
+  // Fills the image with random pixels (some of them transparent).
+  inline void fill_random_pixels(doc::Image* image, const doc::Palette* palette) {
+    for (int y=0; y<image->height(); ++y)
+      for (int x=0; x<image->width(); ++x) {
+        const int a = (std::rand() % 4 == 0 ? 0: std::rand() % 256);
+        doc::color_t c = 0;
+        switch (image->pixelFormat()) {
+          case doc::IMAGE_RGB:
+            c = doc::rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, a);
+            break;
+          case doc::IMAGE_GRAYSCALE:
+            c = doc::graya(std::rand() % 256, a);
+            break;
+          case doc::IMAGE_INDEXED:
+            c = std::rand() % palette->size();
+            break;
+        }
+        doc::put_pixel(image, x, y, c);
+      }
+  }
+
+  // Creates a palette of random colors (some of them transparent).
+  inline doc::Palette* create_random_palette(int ncolors) {
+    doc::Palette* palette = new doc::Palette(doc::frame_t(0), ncolors);
+    for (int i=0; i<ncolors; ++i)
+      palette->setEntry(
+        i, doc::rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256,
+                     (i % 8 == 0 ? 0: std::rand() % 256)));
+    return palette;
+  }
+
+} // namespace filters
+
+#endif
@@ -8,6 +8,7 @@
 #define RENDER_COLOR_HISTOGRAM_H_INCLUDED
 #pragma once
 
+#include <algorithm>
 #include <limits>
 #include <vector>
 
@@ -17,6 +18,8 @@
 #include "doc/palette.h"
 
 #include "render/median_cut.h"
+#include "render/quantization_algorithm.h"
+#include "render/wu_quantizer.h"
 
 namespace render {
   using namespace doc;
@@ -37,7 +40,9 @@ namespace render {
 
     ColorHistogram()
       : m_histogram(RElements*GElements*BElements*AElements, 0)
-      , m_useHighPrecision(true) {
+      , m_useHighPrecision(true)
+      , m_lastColor(0)
+      , m_hasLastColor(false) {
     }
 
     // Returns the number of points in the specified histogram
@@ -59,8 +64,13 @@ namespace render {
 
       // Accurate colors are used only for less than 256 colors.  If the
       // image has more than 256 colors the m_histogram is used
-      // instead.
-      if (m_useHighPrecision) {
+      // instead. Consecutive samples usually have the same color, so
+      // we avoid the linear search for them.
+      if (m_useHighPrecision &&
+          (!m_hasLastColor || m_lastColor != color)) {
+        m_lastColor = color;
+        m_hasLastColor = true;
+
         std::vector<doc::color_t>::iterator it =
           std::find(m_highPrecision.begin(), m_highPrecision.end(), color);
 
@@ -77,11 +87,43 @@ namespace render {
       }
     }
 
+    // Adds all samples from other histogram (e.g. a histogram filled
+    // in other thread) to this one. The high-precision colors of
+    // "other" are appended after the ones in this histogram.
+    void merge(const ColorHistogram& other) {
+      for (std::size_t i=0; i<m_histogram.size(); ++i) {
+        std::size_t count = other.m_histogram[i];
+        if (m_histogram[i] < std::numeric_limits<std::size_t>::max()-count)
+          m_histogram[i] += count;
+        else
+          m_histogram[i] = std::numeric_limits<std::size_t>::max();
+      }
+
+      if (!other.m_useHighPrecision)
+        m_useHighPrecision = false;
+
+      if (m_useHighPrecision) {
+        for (doc::color_t color : other.m_highPrecision) {
+          if (std::find(m_highPrecision.begin(), m_highPrecision.end(), color) != m_highPrecision.end())
+            continue;
+
+          if (m_highPrecision.size() < 256)
+            m_highPrecision.push_back(color);
+          else {
+            m_useHighPrecision = false;
+            break;
+          }
+        }
+      }
+      m_hasLastColor = false;
+    }
+
     // Creates a set of entries for the given palette in the given range
     // with the more important colors in the histogram. Returns the
     // number of used entries in the palette (maybe the range [from,to]
     // is more than necessary).
-    int createOptimizedPalette(Palette* palette) {
+    int createOptimizedPalette(Palette* palette,
+                               QuantizationAlgorithm algorithm = QuantizationAlgorithm::MEDIAN_CUT) {
       // Can we use the high-precision table?
       if (m_useHighPrecision && int(m_highPrecision.size()) <= palette->size()) {
         for (int i=0; i<(int)m_highPrecision.size(); ++i)
@@ -93,7 +135,18 @@ namespace render {
       // median-cut) to quantize "optimal" colors.
       else {
         std::vector<doc::color_t> result;
-        median_cut(*this, palette->size(), result);
+
+        switch (algorithm) {
+          case QuantizationAlgorithm::MEDIAN_CUT:
+            median_cut(*this, palette->size(), result);
+            break;
+          case QuantizationAlgorithm::WU:
+            wu_quantize(*this, palette->size(), result, 0);
+            break;
+          case QuantizationAlgorithm::WU_KMEANS:
+            wu_quantize(*this, palette->size(), result, kWuKMeansIterations);
+            break;
+        }
 
         for (int i=0; i<(int)result.size(); ++i)
           palette->setEntry(i, result[i]);
@@ -131,6 +184,10 @@ namespace render {
     // True if we can use m_highPrecision still (it means that the
     // number of different samples is less than 256 colors still).
     bool m_useHighPrecision;
+
+    // Last color found in m_highPrecision.
+    doc::color_t m_lastColor;
+    bool m_hasLastColor;
   };
 
 } // namespace render
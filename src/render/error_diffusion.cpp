@@ -0,0 +1,176 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "render/error_diffusion.h"
+
+#include "base/base.h"
+#include "doc/image_impl.h"
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+
+#include <algorithm>
+
+namespace render {
+
+using namespace doc;
+
+namespace {
+
+// Horizontal padding of error rows, so kernels can write outside the
+// image bounds without checks.
+const int kPad = 2;
+
+//         X   7
+//     3   5   1     (1/16)
+const ErrorDiffusionDither::Weight kFloydSteinberg[] = {
+  { 1, 0, 7 },
+  { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 }
+};
+
+//         X   1   1
+//     1   1   1         (1/8)
+//         1
+const ErrorDiffusionDither::Weight kAtkinson[] = {
+  { 1, 0, 1 }, { 2, 0, 1 },
+  { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 },
+  { 0, 2, 1 }
+};
+
+//             X   5   3
+//     2   4   5   4   2     (1/32)
+//         2   3   2
+const ErrorDiffusionDither::Weight kSierra[] = {
+  { 1, 0, 5 }, { 2, 0, 3 },
+  { -2, 1, 2 }, { -1, 1, 4 }, { 0, 1, 5 }, { 1, 1, 4 }, { 2, 1, 2 },
+  { -1, 2, 2 }, { 0, 2, 3 }, { 1, 2, 2 }
+};
+
+} // anonymous namespace
+
+ErrorDiffusionDither::ErrorDiffusionDither(DitheringMethod method,
+                                           int transparentIndex,
+                                           int alphaThreshold,
+                                           bool opaque)
+  : m_transparentIndex(transparentIndex)
+  , m_alphaThreshold(alphaThreshold)
+  , m_opaque(opaque)
+{
+  switch (method) {
+    case DitheringMethod::ATKINSON:
+      m_weights = kAtkinson;
+      m_nweights = sizeof(kAtkinson) / sizeof(Weight);
+      m_rows = 3;
+      m_shift = 3;
+      break;
+    case DitheringMethod::SIERRA:
+      m_weights = kSierra;
+      m_nweights = sizeof(kSierra) / sizeof(Weight);
+      m_rows = 3;
+      m_shift = 5;
+      break;
+    default:
+      ASSERT(method == DitheringMethod::FLOYD_STEINBERG);
+      m_weights = kFloydSteinberg;
+      m_nweights = sizeof(kFloydSteinberg) / sizeof(Weight);
+      m_rows = 2;
+      m_shift = 4;
+      break;
+  }
+}
+
+// static
+bool ErrorDiffusionDither::isSupported(DitheringMethod method)
+{
+  return (method == DitheringMethod::FLOYD_STEINBERG ||
+          method == DitheringMethod::ATKINSON ||
+          method == DitheringMethod::SIERRA);
+}
+
+void ErrorDiffusionDither::ditherRgbImageToIndexed(const Image* srcImage,
+                                                   Image* dstImage,
+                                                   const RgbMap* rgbmap,
+                                                   const Palette* palette)
+{
+  ditherRgbImageToIndexed(srcImage, srcImage->bounds(),
+                          dstImage, rgbmap, palette);
+}
+
+void ErrorDiffusionDither::ditherRgbImageToIndexed(const Image* srcImage,
+                                                   const gfx::Rect& srcBounds,
+                                                   Image* dstImage,
+                                                   const RgbMap* rgbmap,
+                                                   const Palette* palette)
+{
+  ASSERT(srcImage->pixelFormat() == IMAGE_RGB);
+  ASSERT(dstImage->pixelFormat() == IMAGE_INDEXED);
+  ASSERT(srcImage->bounds().contains(srcBounds));
+  ASSERT(dstImage->width() == srcBounds.w);
+  ASSERT(dstImage->height() == srcBounds.h);
+
+  const int w = srcBounds.w;
+  const int h = srcBounds.h;
+  const int rowSize = 3*(w + 2*kPad);
+  const int round = (1 << m_shift) / 2;
+
+  m_errors.assign(m_rows * rowSize, 0);
+
+  for (int y=0; y<h; ++y) {
+    auto src = (RgbTraits::const_address_t)srcImage->getPixelConstAddress(srcBounds.x, srcBounds.y+y);
+    auto dst = (IndexedTraits::address_t)dstImage->getPixelAddress(0, y);
+    int* rows[3];
+    for (int i=0; i<m_rows; ++i)
+      rows[i] = &m_errors[((y+i) % m_rows) * rowSize] + 3*kPad;
+
+    for (int x=0; x<w; ++x, ++src, ++dst) {
+      const color_t color = *src;
+      int a = rgba_geta(color);
+
+      if (a < m_alphaThreshold && m_transparentIndex >= 0) {
+        *dst = m_transparentIndex;
+        continue;
+      }
+      if (m_opaque)
+        a = 255;
+
+      // Original color + accumulated error
+      const int* err = rows[0] + 3*x;
+      const int r = MID(0, int(rgba_getr(color)) + ((err[0] + round) >> m_shift), 255);
+      const int g = MID(0, int(rgba_getg(color)) + ((err[1] + round) >> m_shift), 255);
+      const int b = MID(0, int(rgba_getb(color)) + ((err[2] + round) >> m_shift), 255);
+
+      const int i =
+        (rgbmap ? rgbmap->mapColor(r, g, b, a):
+                  palette->findBestfit(r, g, b, a, m_transparentIndex));
+      *dst = i;
+
+      // Diffuse the quantization error to the next pixels
+      const color_t entry = palette->getEntry(i);
+      const int er = r - rgba_getr(entry);
+      const int eg = g - rgba_getg(entry);
+      const int eb = b - rgba_getb(entry);
+      if (er == 0 && eg == 0 && eb == 0)
+        continue;
+
+      for (int k=0; k<m_nweights; ++k) {
+        const Weight& wt = m_weights[k];
+        int* e = rows[wt.dy] + 3*(x + wt.dx);
+        e[0] += er * wt.weight;
+        e[1] += eg * wt.weight;
+        e[2] += eb * wt.weight;
+      }
+    }
+
+    // The errors of this row are not needed anymore, the same buffer
+    // will be used for the row y+m_rows.
+    std::fill(rows[0] - 3*kPad, rows[0] - 3*kPad + rowSize, 0);
+  }
+}
+
+} // namespace render
@@ -0,0 +1,83 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_ERROR_DIFFUSION_H_INCLUDED
+#define RENDER_ERROR_DIFFUSION_H_INCLUDED
+#pragma once
+
+#include "doc/dithering_method.h"
+#include "gfx/rect.h"
+
+#include <vector>
+
+namespace doc {
+  class Image;
+  class Palette;
+  class RgbMap;
+}
+
+namespace render {
+
+  // Dithers RGB images to indexed ones diffusing the quantization
+  // error of each pixel to its neighbors (Floyd-Steinberg, Atkinson
+  // and Sierra kernels). Rows are processed from top to bottom, and
+  // only the rows reached by the kernel are kept in memory (2 rows
+  // for Floyd-Steinberg, 3 rows for Atkinson and Sierra) using
+  // integer errors.
+  //
+  // An instance can be used to dither several images, but it cannot
+  // be used from several threads at the same time (create one
+  // instance for each thread).
+  class ErrorDiffusionDither {
+  public:
+    // Fraction of the error that is diffused to the pixel at (dx,dy)
+    // relative to the current one.
+    struct Weight {
+      int dx, dy, weight;
+    };
+
+    // Pixels with alpha < alphaThreshold are converted to
+    // "transparentIndex" (if it's >= 0) and don't diffuse errors. If
+    // "opaque" is true, the rest of pixels are mapped as opaque colors
+    // (e.g. for formats with 1-bit transparency like GIF).
+    ErrorDiffusionDither(doc::DitheringMethod method,
+                         int transparentIndex = -1,
+                         int alphaThreshold = 1,
+                         bool opaque = false);
+
+    // Returns true if the given method is an error diffusion method
+    // supported by this class.
+    static bool isSupported(doc::DitheringMethod method);
+
+    // Converts the "srcBounds" area of the RGB "srcImage" to the
+    // indexed "dstImage" (which must have the srcBounds size).
+    void ditherRgbImageToIndexed(const doc::Image* srcImage,
+                                 const gfx::Rect& srcBounds,
+                                 doc::Image* dstImage,
+                                 const doc::RgbMap* rgbmap,
+                                 const doc::Palette* palette);
+
+    void ditherRgbImageToIndexed(const doc::Image* srcImage,
+                                 doc::Image* dstImage,
+                                 const doc::RgbMap* rgbmap,
+                                 const doc::Palette* palette);
+
+  private:
+    const Weight* m_weights;
+    int m_nweights;
+    int m_rows;                 // Number of rows with errors
+    int m_shift;                // Divisor of the kernel weights (as a shift)
+    int m_transparentIndex;
+    int m_alphaThreshold;
+    bool m_opaque;
+
+    // Accumulated errors (RGB components) for the next m_rows rows.
+    std::vector<int> m_errors;
+  };
+
+} // namespace render
+
+#endif
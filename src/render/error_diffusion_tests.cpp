@@ -0,0 +1,182 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image_impl.h"
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+#include "doc/test_image.h"
+#include "render/error_diffusion.h"
+#include "render/quantization.h"
+
+#include <vector>
+
+using namespace doc;
+using namespace render;
+
+static const DitheringMethod kMethods[] = {
+  DitheringMethod::FLOYD_STEINBERG,
+  DitheringMethod::ATKINSON,
+  DitheringMethod::SIERRA
+};
+
+static Palette* create_bw_palette()
+{
+  Palette* pal = new Palette(frame_t(0), 3);
+  pal->setEntry(0, rgba(0, 0, 0, 0));
+  pal->setEntry(1, rgba(0, 0, 0, 255));
+  pal->setEntry(2, rgba(255, 255, 255, 255));
+  return pal;
+}
+
+TEST(ErrorDiffusion, PaletteColorsAreExact)
+{
+  Palette pal(frame_t(0), 4);
+  pal.setEntry(0, rgba(0, 0, 0, 255));
+  pal.setEntry(1, rgba(255, 0, 0, 255));
+  pal.setEntry(2, rgba(0, 255, 0, 255));
+  pal.setEntry(3, rgba(0, 0, 255, 255));
+
+  ImageRef src(Image::create(IMAGE_RGB, 16, 16));
+  for (int y=0; y<16; ++y)
+    for (int x=0; x<16; ++x)
+      put_pixel_fast<RgbTraits>(src.get(), x, y, pal.getEntry((x+y) % 4));
+
+  for (DitheringMethod method : kMethods) {
+    ImageRef dst(Image::create(IMAGE_INDEXED, 16, 16));
+    ErrorDiffusionDither dither(method);
+    dither.ditherRgbImageToIndexed(src.get(), dst.get(), nullptr, &pal);
+
+    for (int y=0; y<16; ++y)
+      for (int x=0; x<16; ++x)
+        EXPECT_EQ((x+y) % 4, int(get_pixel_fast<IndexedTraits>(dst.get(), x, y)));
+  }
+}
+
+TEST(ErrorDiffusion, GrayAverage)
+{
+  base::UniquePtr<Palette> pal(create_bw_palette());
+  RgbMap rgbmap;
+  rgbmap.regenerate(pal, 0);
+
+  const int w = 64, h = 64;
+  ImageRef src(Image::create(IMAGE_RGB, w, h));
+  src->clear(rgba(64, 64, 64, 255));
+
+  for (DitheringMethod method : kMethods) {
+    ImageRef dst(Image::create(IMAGE_INDEXED, w, h));
+    ErrorDiffusionDither dither(method, 0);
+    dither.ditherRgbImageToIndexed(src.get(), dst.get(), &rgbmap, pal);
+
+    // Around 1/4 of the pixels must be white
+    int white = 0;
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        if (get_pixel_fast<IndexedTraits>(dst.get(), x, y) == 2)
+          ++white;
+
+    // Atkinson diffuses only 3/4 of the error, so it generates less
+    // white pixels in dark areas.
+    if (method == DitheringMethod::ATKINSON) {
+      EXPECT_GT(white, 0);
+      EXPECT_LT(white, w*h/4);
+    }
+    else
+      EXPECT_NEAR(w*h/4, white, w*h/32);
+  }
+}
+
+TEST(ErrorDiffusion, TransparentPixels)
+{
+  base::UniquePtr<Palette> pal(create_bw_palette());
+
+  ImageRef src(Image::create(IMAGE_RGB, 8, 4));
+  src->clear(rgba(128, 128, 128, 255));
+  for (int x=0; x<8; ++x)
+    put_pixel_fast<RgbTraits>(src.get(), x, 1, rgba(128, 128, 128, 64));
+
+  for (DitheringMethod method : kMethods) {
+    ImageRef dst(Image::create(IMAGE_INDEXED, 8, 4));
+    ErrorDiffusionDither dither(method, 0, 128, true);
+    dither.ditherRgbImageToIndexed(src.get(), dst.get(), nullptr, pal);
+
+    for (int y=0; y<4; ++y)
+      for (int x=0; x<8; ++x) {
+        int i = get_pixel_fast<IndexedTraits>(dst.get(), x, y);
+        if (y == 1)
+          EXPECT_EQ(0, i);
+        else
+          EXPECT_NE(0, i);
+      }
+  }
+}
+
+TEST(ErrorDiffusion, SubRectangle)
+{
+  base::UniquePtr<Palette> pal(create_bw_palette());
+
+  ImageRef src(Image::create(IMAGE_RGB, 32, 32));
+  src->clear(rgba(0, 0, 0, 255));
+  const gfx::Rect bounds(8, 4, 10, 6);
+  for (int y=bounds.y; y<bounds.y2(); ++y)
+    for (int x=bounds.x; x<bounds.x2(); ++x)
+      put_pixel_fast<RgbTraits>(src.get(), x, y, rgba(255, 255, 255, 255));
+
+  ImageRef dst(Image::create(IMAGE_INDEXED, bounds.w, bounds.h));
+  ErrorDiffusionDither dither(DitheringMethod::FLOYD_STEINBERG, 0);
+  dither.ditherRgbImageToIndexed(src.get(), bounds, dst.get(), nullptr, pal);
+
+  for (int y=0; y<bounds.h; ++y)
+    for (int x=0; x<bounds.w; ++x)
+      EXPECT_EQ(2, int(get_pixel_fast<IndexedTraits>(dst.get(), x, y)));
+}
+
+TEST(ErrorDiffusion, DISABLED_Benchmark)
+{
+  const int w = 1024, h = 1024, nframes = 8;
+
+  // Palette with 8x8x4 levels of red, green and blue
+  Palette pal(frame_t(0), 256);
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba((i & 7) * 255 / 7,
+                         ((i >> 3) & 7) * 255 / 7,
+                         (i >> 6) * 255 / 3, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal, -1);
+
+  std::vector<ImageRef> frames;
+  for (int i=0; i<nframes; ++i)
+    frames.push_back(create_random_image(IMAGE_RGB, w, h));
+  ImageRef dst(Image::create(IMAGE_INDEXED, w, h));
+
+  const char* names[] = { "None", "Ordered", "Floyd-Steinberg", "Atkinson", "Sierra" };
+  for (DitheringMethod method : { DitheringMethod::ORDERED,
+                                  DitheringMethod::FLOYD_STEINBERG,
+                                  DitheringMethod::ATKINSON,
+                                  DitheringMethod::SIERRA }) {
+    print_benchmark(
+      std::string(names[int(method)]) + " " + std::to_string(nframes) +
+      " frames of " + std::to_string(w) + "x" + std::to_string(h),
+      [&]{
+        for (const ImageRef& frame : frames)
+          convert_pixel_format(frame.get(), dst.get(), IMAGE_INDEXED,
+                               method, &rgbmap, &pal, false, 0);
+      });
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
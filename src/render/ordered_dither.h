@@ -12,6 +12,7 @@
 #include "doc/image_impl.h"
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
+#include "doc/thread_pool.h"
 
 namespace render {
 
@@ -145,6 +146,8 @@ namespace render {
                               nearest1idx);
     }
 
+    // Rows are processed in parallel (the result doesn't depend on
+    // the processing order).
     template<typename Matrix>
     void ditherRgbImageToIndexed(const Matrix& matrix,
                                  const doc::Image* srcImage,
@@ -152,20 +155,24 @@ namespace render {
                                  int u, int v,
                                  const doc::RgbMap* rgbmap,
                                  const doc::Palette* palette) {
-      const doc::LockImageBits<doc::RgbTraits> srcBits(srcImage);
-      doc::LockImageBits<doc::IndexedTraits> dstBits(dstImage);
-      auto srcIt = srcBits.begin();
-      auto dstIt = dstBits.begin();
-      int w = srcImage->width();
-      int h = srcImage->height();
-
-      for (int y=0; y<h; ++y) {
-        for (int x=0; x<w; ++x, ++srcIt, ++dstIt) {
-          ASSERT(srcIt != srcBits.end());
-          ASSERT(dstIt != dstBits.end());
-          *dstIt = ditherRgbPixelToIndex(matrix, *srcIt, x+u, y+v, rgbmap, palette);
-        }
-      }
+      ASSERT(srcImage->pixelFormat() == doc::IMAGE_RGB);
+      ASSERT(dstImage->pixelFormat() == doc::IMAGE_INDEXED);
+      ASSERT(srcImage->width() == dstImage->width());
+      ASSERT(srcImage->height() == dstImage->height());
+
+      const int w = srcImage->width();
+      const int h = srcImage->height();
+
+      doc::parallel_for(
+        0, h, MAX(1, 16*1024 / MAX(1, w)),
+        [&](int y1, int y2) {
+          for (int y=y1; y<y2; ++y) {
+            auto srcIt = (doc::RgbTraits::const_address_t)srcImage->getPixelConstAddress(0, y);
+            auto dstIt = (doc::IndexedTraits::address_t)dstImage->getPixelAddress(0, y);
+            for (int x=0; x<w; ++x, ++srcIt, ++dstIt)
+              *dstIt = ditherRgbPixelToIndex(matrix, *srcIt, x+u, y+v, rgbmap, palette);
+          }
+        });
     }
 
   private:
@@ -19,14 +19,17 @@
 #include "doc/remap.h"
 #include "doc/rgbmap.h"
 #include "doc/sprite.h"
+#include "doc/thread_pool.h"
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
+#include "render/error_diffusion.h"
 #include "render/ordered_dither.h"
 #include "render/render.h"
 
 #include <algorithm>
 #include <limits>
 #include <map>
+#include <mutex>
 #include <vector>
 
 namespace render {
@@ -40,31 +43,61 @@ Palette* create_palette_from_sprite(
   frame_t toFrame,
   bool withAlpha,
   Palette* palette,
-  PaletteOptimizerDelegate* delegate)
+  PaletteOptimizerDelegate* delegate,
+  QuantizationAlgorithm algorithm)
 {
-  PaletteOptimizer optimizer;
-
-  if (!palette)
-    palette = new Palette(fromFrame, 256);
+  const int nframes = toFrame-fromFrame+1;
+  const int nslots = MAX(1, MIN(nframes, doc::ThreadPool::instance()->concurrency()));
+
+  // Each slot renders a contiguous range of frames and feeds its own
+  // optimizer, so merging them in order gives the same result as
+  // feeding one optimizer with all frames sequentially.
+  std::vector<PaletteOptimizer> optimizers(nslots, PaletteOptimizer(algorithm));
+  std::mutex delegateMutex;
+  int framesDone = 0;
+  bool canceled = false;
+
+  doc::parallel_for(
+    0, nslots, 1,
+    [&](int from, int to) {
+      // Add a flat image with the current sprite's frame rendered
+      ImageRef flat_image(Image::create(IMAGE_RGB,
+          sprite->width(), sprite->height()));
+      render::Render render;
+
+      for (int slot=from; slot<to; ++slot) {
+        frame_t first = fromFrame + frame_t(nframes * slot / nslots);
+        frame_t last = fromFrame + frame_t(nframes * (slot+1) / nslots);
+
+        // Feed the optimizer with all rendered frames
+        for (frame_t frame=first; frame<last; ++frame) {
+          render.renderSprite(flat_image.get(), sprite, frame);
+          optimizers[slot].feedWithImage(flat_image.get(), withAlpha);
+
+          if (delegate) {
+            std::unique_lock<std::mutex> lock(delegateMutex);
+            if (canceled || !delegate->onPaletteOptimizerContinue()) {
+              canceled = true;
+              return;
+            }
 
-  // Add a flat image with the current sprite's frame rendered
-  ImageRef flat_image(Image::create(IMAGE_RGB,
-      sprite->width(), sprite->height()));
+            ++framesDone;
+            delegate->onPaletteOptimizerProgress(
+              double(framesDone) / double(nframes));
+          }
+        }
+      }
+    });
 
-  // Feed the optimizer with all rendered frames
-  render::Render render;
-  for (frame_t frame=fromFrame; frame<=toFrame; ++frame) {
-    render.renderSprite(flat_image.get(), sprite, frame);
-    optimizer.feedWithImage(flat_image.get(), withAlpha);
+  if (canceled)
+    return nullptr;
 
-    if (delegate) {
-      if (!delegate->onPaletteOptimizerContinue())
-        return nullptr;
+  PaletteOptimizer& optimizer = optimizers[0];
+  for (int slot=1; slot<nslots; ++slot)
+    optimizer.merge(optimizers[slot]);
 
-      delegate->onPaletteOptimizerProgress(
-        double(frame-fromFrame+1) / double(toFrame-fromFrame+1));
-    }
-  }
+  if (!palette)
+    palette = new Palette(fromFrame, 256);
 
   // Generate an optimized palette
   optimizer.calculate(
@@ -77,6 +110,131 @@ Palette* create_palette_from_sprite(
   return palette;
 }
 
+namespace {
+
+// Minimum number of pixels processed by each thread in
+// convert_pixel_format() (smaller images are converted in the
+// calling thread).
+const int kMinPixelsPerTask = 64*1024;
+
+// Table to convert the max RGB component of a color to a gray level.
+// It gives the same results as "255 * Hsv(Rgb(r, g, b)).valueInt() /
+// 100" without floating point operations for each pixel.
+class ValueToGrayTable {
+public:
+  ValueToGrayTable() {
+    for (int i=0; i<256; ++i)
+      m_table[i] = 255 * Hsv(Rgb(i, i, i)).valueInt() / 100;
+  }
+
+  static const ValueToGrayTable& instance() {
+    static ValueToGrayTable table;
+    return table;
+  }
+
+  int operator()(int r, int g, int b) const {
+    return m_table[MAX(r, MAX(g, b))];
+  }
+
+private:
+  uint8_t m_table[256];
+};
+
+// Span kernels, each one converts "w" pixels from "src" to "dst".
+// They're simple loops over contiguous pixels so the compiler can
+// vectorize them.
+
+void rgb_to_gray_span(const uint32_t* src, uint16_t* dst, int w,
+                      const ValueToGrayTable& table)
+{
+  for (int x=0; x<w; ++x) {
+    const uint32_t c = src[x];
+    dst[x] = graya(table(rgba_getr(c), rgba_getg(c), rgba_getb(c)),
+                   rgba_geta(c));
+  }
+}
+
+void rgb_to_indexed_span(const uint32_t* src, uint8_t* dst, int w,
+                         const RgbMap* rgbmap, color_t maskColor)
+{
+  // Cache the last mapped color (adjacent pixels usually share the
+  // same color).
+  uint32_t lastColor = 0;
+  uint8_t lastIndex = maskColor;
+
+  for (int x=0; x<w; ++x) {
+    const uint32_t c = src[x];
+    if (c != lastColor) {
+      lastColor = c;
+      if (rgba_geta(c) == 0)
+        lastIndex = maskColor;
+      else
+        lastIndex = rgbmap->mapColor(rgba_getr(c),
+                                     rgba_getg(c),
+                                     rgba_getb(c),
+                                     rgba_geta(c));
+    }
+    dst[x] = lastIndex;
+  }
+}
+
+void gray_to_rgb_span(const uint16_t* src, uint32_t* dst, int w)
+{
+  for (int x=0; x<w; ++x) {
+    const uint16_t c = src[x];
+    const uint8_t v = graya_getv(c);
+    dst[x] = rgba(v, v, v, graya_geta(c));
+  }
+}
+
+void gray_to_indexed_span(const uint16_t* src, uint8_t* dst, int w,
+                          const RgbMap* rgbmap, color_t maskColor)
+{
+  uint16_t lastColor = 0;
+  uint8_t lastIndex = maskColor;
+
+  for (int x=0; x<w; ++x) {
+    const uint16_t c = src[x];
+    if (c != lastColor) {
+      lastColor = c;
+      const int a = graya_geta(c);
+      const int v = graya_getv(c);
+      if (a == 0)
+        lastIndex = maskColor;
+      else
+        lastIndex = rgbmap->mapColor(v, v, v, a);
+    }
+    dst[x] = lastIndex;
+  }
+}
+
+// Converts indexed pixels through a 256 entries table (it's used for
+// indexed -> rgb/grayscale/indexed conversions).
+template<typename DstPixel>
+void indexed_lut_span(const uint8_t* src, DstPixel* dst, int w,
+                      const DstPixel* table)
+{
+  for (int x=0; x<w; ++x)
+    dst[x] = table[src[x]];
+}
+
+template<typename SrcTraits, typename DstTraits, typename SpanFunc>
+void convert_rows(const Image* src, Image* dst, SpanFunc spanFunc)
+{
+  const int w = src->width();
+  doc::parallel_for(
+    0, src->height(), MAX(1, kMinPixelsPerTask / MAX(1, w)),
+    [src, dst, w, &spanFunc](int y1, int y2) {
+      for (int y=y1; y<y2; ++y) {
+        spanFunc(
+          (typename SrcTraits::const_address_t)src->getPixelConstAddress(0, y),
+          (typename DstTraits::address_t)dst->getPixelAddress(0, y), w);
+      }
+    });
+}
+
+} // anonymous namespace
+
 Image* convert_pixel_format(
   const Image* image,
   Image* new_image,
@@ -91,6 +249,9 @@ Image* convert_pixel_format(
     new_image = Image::create(pixelFormat, image->width(), image->height());
   new_image->setMaskColor(new_mask_color);
 
+  ASSERT(image->width() == new_image->width());
+  ASSERT(image->height() == new_image->height());
+
   // RGB -> Indexed with ordered dithering
   if (image->pixelFormat() == IMAGE_RGB &&
       pixelFormat == IMAGE_INDEXED &&
@@ -101,15 +262,21 @@ Image* convert_pixel_format(
     return new_image;
   }
 
-  color_t c;
-  int r, g, b, a;
+  // RGB -> Indexed with error diffusion
+  if (image->pixelFormat() == IMAGE_RGB &&
+      pixelFormat == IMAGE_INDEXED &&
+      ErrorDiffusionDither::isSupported(ditheringMethod)) {
+    ErrorDiffusionDither dither(ditheringMethod, new_mask_color);
+    dither.ditherRgbImageToIndexed(image, new_image, rgbmap, palette);
+    return new_image;
+  }
+
+  const ValueToGrayTable& grayTable = ValueToGrayTable::instance();
+  const color_t maskColor = new_mask_color;
 
   switch (image->pixelFormat()) {
 
     case IMAGE_RGB: {
-      const LockImageBits<RgbTraits> srcBits(image);
-      LockImageBits<RgbTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-
       switch (new_image->pixelFormat()) {
 
         // RGB -> RGB
@@ -118,81 +285,34 @@ Image* convert_pixel_format(
           break;
 
         // RGB -> Grayscale
-        case IMAGE_GRAYSCALE: {
-          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock);
-          LockImageBits<GrayscaleTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-          LockImageBits<GrayscaleTraits>::iterator dst_end = dstBits.end();
-#endif
-
-          for (; src_it != src_end; ++src_it, ++dst_it) {
-            ASSERT(dst_it != dst_end);
-            c = *src_it;
-
-            g = 255 * Hsv(Rgb(rgba_getr(c),
-                              rgba_getg(c),
-                              rgba_getb(c))).valueInt() / 100;
-
-            *dst_it = graya(g, rgba_geta(c));
-          }
-          ASSERT(dst_it == dst_end);
+        case IMAGE_GRAYSCALE:
+          convert_rows<RgbTraits, GrayscaleTraits>(
+            image, new_image,
+            [&grayTable](const uint32_t* src, uint16_t* dst, int w) {
+              rgb_to_gray_span(src, dst, w, grayTable);
+            });
           break;
-        }
 
         // RGB -> Indexed
-        case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
-          LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-          LockImageBits<IndexedTraits>::iterator dst_end = dstBits.end();
-#endif
-
-          for (; src_it != src_end; ++src_it, ++dst_it) {
-            ASSERT(dst_it != dst_end);
-            c = *src_it;
-
-            r = rgba_getr(c);
-            g = rgba_getg(c);
-            b = rgba_getb(c);
-            a = rgba_geta(c);
-
-            if (a == 0)
-              *dst_it = new_mask_color;
-            else
-              *dst_it = rgbmap->mapColor(r, g, b, a);
-          }
-          ASSERT(dst_it == dst_end);
+        case IMAGE_INDEXED:
+          convert_rows<RgbTraits, IndexedTraits>(
+            image, new_image,
+            [rgbmap, maskColor](const uint32_t* src, uint8_t* dst, int w) {
+              rgb_to_indexed_span(src, dst, w, rgbmap, maskColor);
+            });
           break;
-        }
       }
       break;
     }
 
     case IMAGE_GRAYSCALE: {
-      const LockImageBits<GrayscaleTraits> srcBits(image);
-      LockImageBits<GrayscaleTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-
       switch (new_image->pixelFormat()) {
 
         // Grayscale -> RGB
-        case IMAGE_RGB: {
-          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock);
-          LockImageBits<RgbTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-          LockImageBits<RgbTraits>::iterator dst_end = dstBits.end();
-#endif
-
-          for (; src_it != src_end; ++src_it, ++dst_it) {
-            ASSERT(dst_it != dst_end);
-            c = *src_it;
-
-            g = graya_getv(c);
-
-            *dst_it = rgba(g, g, g, graya_geta(c));
-          }
-          ASSERT(dst_it == dst_end);
+        case IMAGE_RGB:
+          convert_rows<GrayscaleTraits, RgbTraits>(
+            image, new_image, gray_to_rgb_span);
           break;
-        }
 
         // Grayscale -> Grayscale
         case IMAGE_GRAYSCALE:
@@ -200,111 +320,89 @@ Image* convert_pixel_format(
           break;
 
         // Grayscale -> Indexed
-        case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
-          LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-          LockImageBits<IndexedTraits>::iterator dst_end = dstBits.end();
-#endif
-
-          for (; src_it != src_end; ++src_it, ++dst_it) {
-            ASSERT(dst_it != dst_end);
-            c = *src_it;
-            a = graya_geta(c);
-            c = graya_getv(c);
-
-            if (a == 0)
-              *dst_it = new_mask_color;
-            else
-              *dst_it = rgbmap->mapColor(c, c, c, a);
-          }
-          ASSERT(dst_it == dst_end);
+        case IMAGE_INDEXED:
+          convert_rows<GrayscaleTraits, IndexedTraits>(
+            image, new_image,
+            [rgbmap, maskColor](const uint16_t* src, uint8_t* dst, int w) {
+              gray_to_indexed_span(src, dst, w, rgbmap, maskColor);
+            });
           break;
-        }
       }
       break;
     }
 
     case IMAGE_INDEXED: {
-      const LockImageBits<IndexedTraits> srcBits(image);
-      LockImageBits<IndexedTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
+      // All indexed conversions use a table with the result for each
+      // one of the 256 possible source indexes. Indexes outside the
+      // palette are converted as transparent pixels (like the mask
+      // color).
+      const color_t srcMaskColor = image->maskColor();
+      const int ncolors = std::min(256, palette->size());
+      auto isTransparent = [=](int c) -> bool {
+        return ((!is_background && color_t(c) == srcMaskColor) ||
+                c >= ncolors);
+      };
 
       switch (new_image->pixelFormat()) {
 
         // Indexed -> RGB
         case IMAGE_RGB: {
-          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock);
-          LockImageBits<RgbTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-          LockImageBits<RgbTraits>::iterator dst_end = dstBits.end();
-#endif
-
-          for (; src_it != src_end; ++src_it, ++dst_it) {
-            ASSERT(dst_it != dst_end);
-            c = *src_it;
-
-            if (!is_background && c == image->maskColor())
-              *dst_it = rgba(0, 0, 0, 0);
+          uint32_t table[256];
+          for (int c=0; c<256; ++c) {
+            if (isTransparent(c))
+              table[c] = rgba(0, 0, 0, 0);
             else
-              *dst_it = palette->getEntry(c);
+              table[c] = palette->getEntry(c);
           }
-          ASSERT(dst_it == dst_end);
+          convert_rows<IndexedTraits, RgbTraits>(
+            image, new_image,
+            [&table](const uint8_t* src, uint32_t* dst, int w) {
+              indexed_lut_span(src, dst, w, table);
+            });
           break;
         }
 
         // Indexed -> Grayscale
         case IMAGE_GRAYSCALE: {
-          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock);
-          LockImageBits<GrayscaleTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-          LockImageBits<GrayscaleTraits>::iterator dst_end = dstBits.end();
-#endif
-
-          for (; src_it != src_end; ++src_it, ++dst_it) {
-            ASSERT(dst_it != dst_end);
-            c = *src_it;
-
-            if (!is_background && c == image->maskColor())
-              *dst_it = graya(0, 0);
+          uint16_t table[256];
+          for (int c=0; c<256; ++c) {
+            if (isTransparent(c))
+              table[c] = graya(0, 0);
             else {
-              c = palette->getEntry(c);
-              r = rgba_getr(c);
-              g = rgba_getg(c);
-              b = rgba_getb(c);
-              a = rgba_geta(c);
-
-              g = 255 * Hsv(Rgb(r, g, b)).valueInt() / 100;
-              *dst_it = graya(g, a);
+              color_t rgb = palette->getEntry(c);
+              table[c] = graya(grayTable(rgba_getr(rgb),
+                                         rgba_getg(rgb),
+                                         rgba_getb(rgb)),
+                               rgba_geta(rgb));
             }
           }
-          ASSERT(dst_it == dst_end);
+          convert_rows<IndexedTraits, GrayscaleTraits>(
+            image, new_image,
+            [&table](const uint8_t* src, uint16_t* dst, int w) {
+              indexed_lut_span(src, dst, w, table);
+            });
           break;
         }
 
         // Indexed -> Indexed
         case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
-          LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-          LockImageBits<IndexedTraits>::iterator dst_end = dstBits.end();
-#endif
-
-          for (; src_it != src_end; ++src_it, ++dst_it) {
-            ASSERT(dst_it != dst_end);
-            c = *src_it;
-
-            if (!is_background && c == image->maskColor())
-              *dst_it = new_mask_color;
+          uint8_t table[256];
+          for (int c=0; c<256; ++c) {
+            if (isTransparent(c))
+              table[c] = new_mask_color;
             else {
-              c = palette->getEntry(c);
-              r = rgba_getr(c);
-              g = rgba_getg(c);
-              b = rgba_getb(c);
-              a = rgba_geta(c);
-              *dst_it = rgbmap->mapColor(r, g, b, a);
+              color_t rgb = palette->getEntry(c);
+              table[c] = rgbmap->mapColor(rgba_getr(rgb),
+                                          rgba_getg(rgb),
+                                          rgba_getb(rgb),
+                                          rgba_geta(rgb));
             }
           }
-          ASSERT(dst_it == dst_end);
+          convert_rows<IndexedTraits, IndexedTraits>(
+            image, new_image,
+            [&table](const uint8_t* src, uint8_t* dst, int w) {
+              indexed_lut_span(src, dst, w, table);
+            });
           break;
         }
 
@@ -320,6 +418,11 @@ Image* convert_pixel_format(
 // Creation of optimized palette for RGB images
 // by David Capello
 
+PaletteOptimizer::PaletteOptimizer(QuantizationAlgorithm algorithm)
+  : m_algorithm(algorithm)
+{
+}
+
 void PaletteOptimizer::feedWithImage(Image* image, bool withAlpha)
 {
   uint32_t color;
@@ -377,6 +480,11 @@ void PaletteOptimizer::feedWithRgbaColor(color_t color)
   m_histogram.addSamples(color, 1);
 }
 
+void PaletteOptimizer::merge(const PaletteOptimizer& other)
+{
+  m_histogram.merge(other.m_histogram);
+}
+
 void PaletteOptimizer::calculate(Palette* palette, int maskIndex,
                                  PaletteOptimizerDelegate* delegate)
 {
@@ -394,7 +502,7 @@ void PaletteOptimizer::calculate(Palette* palette, int maskIndex,
   // used, in other case the 0 indexed will be the mask color, so it
   // will not be used later in the color conversion (from RGB to
   // Indexed).
-  int usedColors = m_histogram.createOptimizedPalette(palette);
+  int usedColors = m_histogram.createOptimizedPalette(palette, m_algorithm);
 
   if (addMask) {
     palette->resize(usedColors+1);
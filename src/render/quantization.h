@@ -13,6 +13,7 @@
 #include "doc/pixel_format.h"
 
 #include "render/color_histogram.h"
+#include "render/quantization_algorithm.h"
 
 #include <vector>
 
@@ -35,25 +36,39 @@ namespace render {
 
   class PaletteOptimizer {
   public:
+    PaletteOptimizer(QuantizationAlgorithm algorithm = QuantizationAlgorithm::WU);
+
     void feedWithImage(Image* image, bool withAlpha);
     void feedWithRgbaColor(color_t color);
+
+    // Adds all the samples fed to "other" optimizer (e.g. an
+    // optimizer used in other thread) to this one.
+    void merge(const PaletteOptimizer& other);
+
     void calculate(Palette* palette, int maskIndex, PaletteOptimizerDelegate* delegate);
 
   private:
+    QuantizationAlgorithm m_algorithm;
     ColorHistogram<5, 6, 5, 5> m_histogram;
   };
 
-  // Creates a new palette suitable to quantize the given RGB sprite to Indexed color.
+  // Creates a new palette suitable to quantize the given RGB sprite to
+  // Indexed color. Frames are rendered and added to the histogram in
+  // parallel.
   Palette* create_palette_from_sprite(
     const Sprite* sprite,
     frame_t fromFrame,
     frame_t toFrame,
     bool withAlpha,
     Palette* newPalette, // Can be NULL to create a new palette
-    PaletteOptimizerDelegate* delegate);
+    PaletteOptimizerDelegate* delegate,
+    QuantizationAlgorithm algorithm = QuantizationAlgorithm::WU);
 
   // Changes the image pixel format. The dithering method is used only
-  // when you want to convert from RGB to Indexed.
+  // when you want to convert from RGB to Indexed. Error diffusion
+  // methods process the image sequentially, so several images should
+  // be converted in parallel to use all cores (e.g. all cels of a
+  // sprite).
   Image* convert_pixel_format(
     const Image* src,
     Image* dst,         // Can be NULL to create a new image
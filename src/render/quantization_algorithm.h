@@ -0,0 +1,22 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_QUANTIZATION_ALGORITHM_H_INCLUDED
+#define RENDER_QUANTIZATION_ALGORITHM_H_INCLUDED
+#pragma once
+
+namespace render {
+
+  // Algorithms to create an optimized palette from a color histogram
+  enum class QuantizationAlgorithm {
+    MEDIAN_CUT,                 // See median_cut.h
+    WU,                         // See wu_quantizer.h
+    WU_KMEANS,                  // Wu + some k-means iterations to refine colors
+  };
+
+} // namespace render
+
+#endif
@@ -0,0 +1,69 @@
+// Aseprite Render Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "render/quantization.h"
+
+using namespace doc;
+using namespace render;
+
+// Indexes outside the palette are converted as transparent pixels
+TEST(Quantization, IndexesOutsideThePalette)
+{
+  Palette palette(frame_t(0), 4);
+  palette.setEntry(0, rgba(0, 0, 0, 0));
+  palette.setEntry(1, rgba(255, 0, 0, 255));
+  palette.setEntry(2, rgba(0, 255, 0, 255));
+  palette.setEntry(3, rgba(0, 0, 255, 255));
+
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, 0);
+
+  ImageRef src(Image::create(IMAGE_INDEXED, 4, 1));
+  src->setMaskColor(0);
+  put_pixel(src.get(), 0, 0, 1);
+  put_pixel(src.get(), 1, 0, 3);
+  put_pixel(src.get(), 2, 0, 4);
+  put_pixel(src.get(), 3, 0, 255);
+
+  ImageRef rgb(convert_pixel_format(src.get(), nullptr, IMAGE_RGB,
+                                    DitheringMethod::NONE, &rgbmap,
+                                    &palette, false, 0));
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(rgb.get(), 0, 0));
+  EXPECT_EQ(rgba(0, 0, 255, 255), get_pixel(rgb.get(), 1, 0));
+  EXPECT_EQ(rgba(0, 0, 0, 0), get_pixel(rgb.get(), 2, 0));
+  EXPECT_EQ(rgba(0, 0, 0, 0), get_pixel(rgb.get(), 3, 0));
+
+  ImageRef gray(convert_pixel_format(src.get(), nullptr, IMAGE_GRAYSCALE,
+                                     DitheringMethod::NONE, &rgbmap,
+                                     &palette, false, 0));
+  EXPECT_EQ(graya(0, 0), get_pixel(gray.get(), 2, 0));
+  EXPECT_EQ(graya(0, 0), get_pixel(gray.get(), 3, 0));
+
+  ImageRef indexed(convert_pixel_format(src.get(), nullptr, IMAGE_INDEXED,
+                                        DitheringMethod::NONE, &rgbmap,
+                                        &palette, false, 0));
+  EXPECT_EQ(1, get_pixel(indexed.get(), 0, 0));
+  EXPECT_EQ(3, get_pixel(indexed.get(), 1, 0));
+  EXPECT_EQ(0, get_pixel(indexed.get(), 2, 0));
+  EXPECT_EQ(0, get_pixel(indexed.get(), 3, 0));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
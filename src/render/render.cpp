@@ -435,7 +435,7 @@ void composite_image_general(
     ASSERT(srcY >= 0 && srcY < src->height());
 
     auto dstPtr = get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstY);
-    auto srcPtr = get_pixel_address_fast<SrcTraits>(src, int(srcX), srcY);
+    auto srcPtr = get_pixel_const_address_fast<SrcTraits>(src, int(srcX), srcY);
 
 #if _DEBUG
     int dstX = dstBounds.x;
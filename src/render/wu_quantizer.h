@@ -0,0 +1,454 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_WU_QUANTIZER_H_INCLUDED
+#define RENDER_WU_QUANTIZER_H_INCLUDED
+#pragma once
+
+#include "base/debug.h"
+#include "doc/color.h"
+#include "doc/thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace render {
+
+  // Number of k-means iterations used to refine the Wu palette when
+  // QuantizationAlgorithm::WU_KMEANS is used.
+  const int kWuKMeansIterations = 3;
+
+  // Color quantizer based on Xiaolin Wu's "Efficient Statistical
+  // Computations for Optimal Color Quantization" (Graphics Gems II),
+  // extended to RGBA. The color space is divided in boxes minimizing
+  // the sum of squared errors of each box, using 4D tables of
+  // cumulative moments so the statistics of any box can be
+  // calculated in constant time (instead of re-scanning the
+  // histogram like median_cut() does).
+  template<class Histogram>
+  class WuQuantizer {
+  public:
+    // Maximum number of levels for each component in the tables of
+    // moments (the histogram can have more precision, but the
+    // moments are calculated with the original histogram values).
+    enum {
+      MaxLevels = 32,
+      MaxAlphaLevels = 16
+    };
+
+    WuQuantizer(const Histogram& histogram)
+      : m_histogram(histogram) {
+      initLevels();
+      calculateMoments();
+    }
+
+    // Generates at most "maxColors" colors in "result".
+    void quantize(std::size_t maxColors, std::vector<doc::color_t>& result) const {
+      result.clear();
+      if (maxColors == 0)
+        return;
+
+      std::vector<Cube> cubes(maxColors);
+      std::vector<double> variances(maxColors, 0.0);
+      std::size_t ncubes = 1;
+
+      Cube& first = cubes[0];
+      first.r0 = first.g0 = first.b0 = first.a0 = 0;
+      first.r1 = m_rLevels;
+      first.g1 = m_gLevels;
+      first.b1 = m_bLevels;
+      first.a1 = m_aLevels;
+
+      // Empty histogram
+      if (volume(first).w == 0)
+        return;
+
+      std::size_t next = 0;
+      for (std::size_t i=1; i<maxColors; ++i) {
+        if (cut(cubes[next], cubes[i])) {
+          variances[next] = (cubes[next].volume() > 1 ? variance(cubes[next]): 0.0);
+          variances[i] = (cubes[i].volume() > 1 ? variance(cubes[i]): 0.0);
+          ncubes = i+1;
+        }
+        else {
+          // This cube cannot be split anymore
+          variances[next] = 0.0;
+          --i;
+        }
+
+        // Select the cube with the biggest variance to split it
+        next = 0;
+        double maxVariance = variances[0];
+        for (std::size_t k=1; k<ncubes; ++k) {
+          if (variances[k] > maxVariance) {
+            maxVariance = variances[k];
+            next = k;
+          }
+        }
+        if (maxVariance <= 0.0)
+          break;
+      }
+
+      for (std::size_t i=0; i<ncubes; ++i) {
+        Moments m = volume(cubes[i]);
+        if (m.w > 0)
+          result.push_back(meanColor(m.w, m.r, m.g, m.b, m.a));
+      }
+    }
+
+    // Moves each color of the palette to the centroid of the
+    // histogram samples that are nearest to it (Lloyd's algorithm).
+    void refine(std::vector<doc::color_t>& colors, int iterations) const {
+      if (colors.empty() || iterations <= 0)
+        return;
+
+      std::vector<Sample> samples;
+      collectSamples(samples);
+
+      const int n = int(colors.size());
+      std::vector<Sums> sums(n);
+      std::mutex sumsMutex;
+
+      for (int iter=0; iter<iterations; ++iter) {
+        std::fill(sums.begin(), sums.end(), Sums());
+
+        doc::parallel_for(
+          0, int(samples.size()), 4096,
+          [&](int from, int to) {
+            std::vector<Sums> localSums(n);
+            for (int i=from; i<to; ++i) {
+              const Sample& s = samples[i];
+              Sums& dst = localSums[nearestColor(colors, s.r, s.g, s.b, s.a)];
+              dst.w += s.w;
+              dst.r += s.w * s.r;
+              dst.g += s.w * s.g;
+              dst.b += s.w * s.b;
+              dst.a += s.w * s.a;
+            }
+
+            std::unique_lock<std::mutex> lock(sumsMutex);
+            for (int j=0; j<n; ++j) {
+              sums[j].w += localSums[j].w;
+              sums[j].r += localSums[j].r;
+              sums[j].g += localSums[j].g;
+              sums[j].b += localSums[j].b;
+              sums[j].a += localSums[j].a;
+            }
+          });
+
+        bool changed = false;
+        for (int j=0; j<n; ++j) {
+          if (sums[j].w == 0)
+            continue;
+
+          doc::color_t c = meanColor(sums[j].w, sums[j].r, sums[j].g, sums[j].b, sums[j].a);
+          if (c != colors[j]) {
+            colors[j] = c;
+            changed = true;
+          }
+        }
+        if (!changed)
+          break;
+      }
+    }
+
+  private:
+    struct Moments {
+      int64_t w, r, g, b, a;
+      double m2;
+
+      Moments() : w(0), r(0), g(0), b(0), a(0), m2(0.0) { }
+
+      Moments& operator+=(const Moments& o) {
+        w += o.w; r += o.r; g += o.g; b += o.b; a += o.a; m2 += o.m2;
+        return *this;
+      }
+
+      Moments& operator-=(const Moments& o) {
+        w -= o.w; r -= o.r; g -= o.g; b -= o.b; a -= o.a; m2 -= o.m2;
+        return *this;
+      }
+    };
+
+    // A box in the tables of moments, lower bounds (r0, g0, etc.)
+    // are exclusive and upper bounds (r1, g1, etc.) are inclusive.
+    struct Cube {
+      int r0, r1, g0, g1, b0, b1, a0, a1;
+
+      int volume() const {
+        return (r1-r0) * (g1-g0) * (b1-b0) * (a1-a0);
+      }
+    };
+
+    struct Sample {
+      int r, g, b, a;
+      int64_t w;
+    };
+
+    struct Sums {
+      int64_t w, r, g, b, a;
+      Sums() : w(0), r(0), g(0), b(0), a(0) { }
+    };
+
+    // Values of each histogram entry in the [0,255] range.
+    static int rValue(int i) { return 255 * i / (Histogram::RElements-1); }
+    static int gValue(int i) { return 255 * i / (Histogram::GElements-1); }
+    static int bValue(int i) { return 255 * i / (Histogram::BElements-1); }
+    static int aValue(int i) { return 255 * i / (Histogram::AElements-1); }
+
+    static doc::color_t meanColor(int64_t w, int64_t r, int64_t g, int64_t b, int64_t a) {
+      ASSERT(w > 0);
+      return doc::rgba(int((r + w/2) / w),
+                       int((g + w/2) / w),
+                       int((b + w/2) / w),
+                       int((a + w/2) / w));
+    }
+
+    static int nearestColor(const std::vector<doc::color_t>& colors,
+                            int r, int g, int b, int a) {
+      int best = 0;
+      int bestDist = std::numeric_limits<int>::max();
+      for (int i=0; i<int(colors.size()); ++i) {
+        doc::color_t c = colors[i];
+        int dr = int(doc::rgba_getr(c)) - r;
+        int dg = int(doc::rgba_getg(c)) - g;
+        int db = int(doc::rgba_getb(c)) - b;
+        int da = int(doc::rgba_geta(c)) - a;
+        int dist = dr*dr + dg*dg + db*db + da*da;
+        if (dist < bestDist) {
+          bestDist = dist;
+          best = i;
+          if (dist == 0)
+            break;
+        }
+      }
+      return best;
+    }
+
+    // Calculates the levels used for each component in the tables of
+    // moments. The alpha component is compacted to the used alpha
+    // values only (e.g. only one level for opaque images).
+    void initLevels() {
+      m_rLevels = std::min<int>(Histogram::RElements, MaxLevels);
+      m_gLevels = std::min<int>(Histogram::GElements, MaxLevels);
+      m_bLevels = std::min<int>(Histogram::BElements, MaxLevels);
+
+      std::vector<bool> usedAlpha(Histogram::AElements, false);
+      for (int a=0; a<Histogram::AElements; ++a)
+        for (int b=0; b<Histogram::BElements && !usedAlpha[a]; ++b)
+          for (int g=0; g<Histogram::GElements && !usedAlpha[a]; ++g)
+            for (int r=0; r<Histogram::RElements; ++r)
+              if (m_histogram.at(r, g, b, a) > 0) {
+                usedAlpha[a] = true;
+                break;
+              }
+
+      const int used = int(std::count(usedAlpha.begin(), usedAlpha.end(), true));
+      m_alphaLevel.resize(Histogram::AElements);
+      if (used <= MaxAlphaLevels) {
+        int level = 0;
+        for (int a=0; a<Histogram::AElements; ++a) {
+          if (usedAlpha[a])
+            ++level;
+          m_alphaLevel[a] = std::max(level, 1);
+        }
+        m_aLevels = std::max(1, used);
+      }
+      else {
+        for (int a=0; a<Histogram::AElements; ++a)
+          m_alphaLevel[a] = a * MaxAlphaLevels / Histogram::AElements + 1;
+        m_aLevels = MaxAlphaLevels;
+      }
+
+      // The first index of each axis is used for zeros (so we can
+      // calculate cube volumes without special cases).
+      m_rStride = (m_gLevels+1) * (m_bLevels+1) * (m_aLevels+1);
+      m_gStride = (m_bLevels+1) * (m_aLevels+1);
+      m_bStride = (m_aLevels+1);
+    }
+
+    int index(int r, int g, int b, int a) const {
+      return r*m_rStride + g*m_gStride + b*m_bStride + a;
+    }
+
+    void calculateMoments() {
+      m_moments.clear();
+      m_moments.resize((m_rLevels+1) * m_rStride);
+
+      for (int a=0; a<Histogram::AElements; ++a) {
+        const int av = aValue(a);
+        const int ai = m_alphaLevel[a];
+        for (int b=0; b<Histogram::BElements; ++b) {
+          const int bv = bValue(b);
+          const int bi = 1 + b * m_bLevels / Histogram::BElements;
+          for (int g=0; g<Histogram::GElements; ++g) {
+            const int gv = gValue(g);
+            const int gi = 1 + g * m_gLevels / Histogram::GElements;
+            for (int r=0; r<Histogram::RElements; ++r) {
+              const int64_t w = int64_t(m_histogram.at(r, g, b, a));
+              if (w == 0)
+                continue;
+
+              const int rv = rValue(r);
+              const int ri = 1 + r * m_rLevels / Histogram::RElements;
+              Moments& m = m_moments[index(ri, gi, bi, ai)];
+              m.w += w;
+              m.r += w * rv;
+              m.g += w * gv;
+              m.b += w * bv;
+              m.a += w * av;
+              m.m2 += double(w) * (rv*rv + gv*gv + bv*bv + av*av);
+            }
+          }
+        }
+      }
+
+      // Convert the moments to cumulative moments along each axis
+      // (each entry will contain the sum of all entries in the box
+      // from the origin to it).
+      accumulate(m_rStride, m_rLevels+1);
+      accumulate(m_gStride, m_gLevels+1);
+      accumulate(m_bStride, m_bLevels+1);
+      accumulate(1, m_aLevels+1);
+    }
+
+    void accumulate(int stride, int levels) {
+      const int n = int(m_moments.size());
+      for (int i=stride; i<n; ++i) {
+        if ((i / stride) % levels != 0)
+          m_moments[i] += m_moments[i-stride];
+      }
+    }
+
+    // Returns the sum of moments inside the given cube using the
+    // inclusion-exclusion principle over its 16 corners.
+    Moments volume(const Cube& c) const {
+      Moments m;
+      for (int corner=0; corner<16; ++corner) {
+        const Moments& v = m_moments[
+          index((corner & 1 ? c.r0: c.r1),
+                (corner & 2 ? c.g0: c.g1),
+                (corner & 4 ? c.b0: c.b1),
+                (corner & 8 ? c.a0: c.a1))];
+
+        const int lowerBounds =
+          (corner & 1) + ((corner >> 1) & 1) + ((corner >> 2) & 1) + ((corner >> 3) & 1);
+        if (lowerBounds & 1)
+          m -= v;
+        else
+          m += v;
+      }
+      return m;
+    }
+
+    double variance(const Cube& c) const {
+      Moments m = volume(c);
+      if (m.w == 0)
+        return 0.0;
+
+      double r = double(m.r), g = double(m.g), b = double(m.b), a = double(m.a);
+      return m.m2 - (r*r + g*g + b*b + a*a) / double(m.w);
+    }
+
+    static double score(const Moments& m) {
+      double r = double(m.r), g = double(m.g), b = double(m.b), a = double(m.a);
+      return (r*r + g*g + b*b + a*a) / double(m.w);
+    }
+
+    // Finds the best position to cut the cube along the given axis
+    // (pointer to the cube member of the upper bound). Returns the
+    // score of the best cut (or a negative value if the cube cannot
+    // be cut along this axis).
+    double maximize(const Cube& cube, int Cube::*lower, int Cube::*upper,
+                    const Moments& whole, int& cutPos) const {
+      double best = -1.0;
+      cutPos = -1;
+
+      Cube half = cube;
+      for (int i=cube.*lower+1; i<cube.*upper; ++i) {
+        half.*upper = i;
+        Moments m1 = volume(half);
+        if (m1.w == 0)
+          continue;
+
+        Moments m2 = whole;
+        m2 -= m1;
+        if (m2.w == 0)
+          break;
+
+        double s = score(m1) + score(m2);
+        if (s > best) {
+          best = s;
+          cutPos = i;
+        }
+      }
+      return best;
+    }
+
+    bool cut(Cube& cube1, Cube& cube2) const {
+      static int Cube::* const lowers[] = { &Cube::r0, &Cube::g0, &Cube::b0, &Cube::a0 };
+      static int Cube::* const uppers[] = { &Cube::r1, &Cube::g1, &Cube::b1, &Cube::a1 };
+
+      const Moments whole = volume(cube1);
+      double best = -1.0;
+      int bestAxis = -1, bestPos = -1;
+
+      for (int axis=0; axis<4; ++axis) {
+        int pos;
+        double s = maximize(cube1, lowers[axis], uppers[axis], whole, pos);
+        if (pos >= 0 && s > best) {
+          best = s;
+          bestAxis = axis;
+          bestPos = pos;
+        }
+      }
+      if (bestAxis < 0)
+        return false;
+
+      cube2 = cube1;
+      cube1.*uppers[bestAxis] = bestPos;
+      cube2.*lowers[bestAxis] = bestPos;
+      return true;
+    }
+
+    void collectSamples(std::vector<Sample>& samples) const {
+      for (int a=0; a<Histogram::AElements; ++a)
+        for (int b=0; b<Histogram::BElements; ++b)
+          for (int g=0; g<Histogram::GElements; ++g)
+            for (int r=0; r<Histogram::RElements; ++r) {
+              std::size_t w = m_histogram.at(r, g, b, a);
+              if (w > 0) {
+                Sample s = { rValue(r), gValue(g), bValue(b), aValue(a), int64_t(w) };
+                samples.push_back(s);
+              }
+            }
+    }
+
+    const Histogram& m_histogram;
+    int m_rLevels, m_gLevels, m_bLevels, m_aLevels;
+    int m_rStride, m_gStride, m_bStride;
+    std::vector<int> m_alphaLevel;
+    std::vector<Moments> m_moments;
+  };
+
+  // Creates a palette of "maxColors" in "result" using Wu's algorithm
+  // and refines it with "kmeansIterations" iterations of k-means.
+  template<class Histogram>
+  void wu_quantize(const Histogram& histogram, std::size_t maxColors,
+                   std::vector<doc::color_t>& result,
+                   int kmeansIterations)
+  {
+    WuQuantizer<Histogram> quantizer(histogram);
+    quantizer.quantize(maxColors, result);
+    quantizer.refine(result, kmeansIterations);
+  }
+
+} // namespace render
+
+#endif
@@ -0,0 +1,83 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "render/color_histogram.h"
+#include "render/wu_quantizer.h"
+
+#include <algorithm>
+
+using namespace doc;
+using namespace render;
+
+typedef ColorHistogram<5, 6, 5, 5> Histogram;
+
+static bool contains(const std::vector<color_t>& colors, color_t color)
+{
+  return std::find(colors.begin(), colors.end(), color) != colors.end();
+}
+
+TEST(WuQuantizer, EmptyHistogram)
+{
+  Histogram histogram;
+  std::vector<color_t> result;
+  wu_quantize(histogram, 256, result, 0);
+  EXPECT_TRUE(result.empty());
+}
+
+TEST(WuQuantizer, SeparatedClusters)
+{
+  Histogram histogram;
+  const color_t colors[] = {
+    rgba(0, 0, 0, 255),
+    rgba(255, 0, 0, 255),
+    rgba(0, 255, 0, 255),
+    rgba(0, 0, 255, 255),
+    rgba(255, 255, 255, 255),
+    rgba(255, 255, 255, 0)
+  };
+  for (color_t c : colors)
+    histogram.addSamples(c, 1000);
+
+  for (int kmeans=0; kmeans<2; ++kmeans) {
+    std::vector<color_t> result;
+    wu_quantize(histogram, 6, result, kmeans ? kWuKMeansIterations: 0);
+    ASSERT_EQ(6, int(result.size()));
+    for (color_t c : colors)
+      EXPECT_TRUE(contains(result, c));
+  }
+}
+
+TEST(WuQuantizer, MaxColors)
+{
+  Histogram histogram;
+  for (int r=0; r<256; r+=8)
+    for (int g=0; g<256; g+=4)
+      for (int b=0; b<256; b+=8)
+        histogram.addSamples(rgba(r, g, b, 255), 1);
+
+  std::vector<color_t> result;
+  wu_quantize(histogram, 16, result, 0);
+  EXPECT_EQ(16, int(result.size()));
+
+  wu_quantize(histogram, 256, result, 1);
+  EXPECT_EQ(256, int(result.size()));
+
+  // Opaque input generates an opaque palette
+  for (color_t c : result)
+    EXPECT_EQ(255, int(rgba_geta(c)));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
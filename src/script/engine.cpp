@@ -1,5 +1,5 @@
 // Aseprite Scripting Library
-// Copyright (c) 2015-2016 David Capello
+// Copyright (c) 2015-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -15,6 +15,7 @@
 #include "base/file_handle.h"
 #include "base/memory.h"
 #include "script/engine_delegate.h"
+#include "script/profiler.h"
 
 #include <map>
 #include <iostream>
@@ -34,11 +35,23 @@ const char* kPtrId = "\xFF" "\xFF" "ptr";
 
 namespace {
 
+// Hidden properties of instrumented native functions
+const char* kFuncId = "\xFF" "\xFF" "func";
+const char* kStatsId = "\xFF" "\xFF" "stats";
+
 // TODO classes in modules isn't supported yet
 std::map<std::string, Module*> g_modules;
 
+void add_allocation(void* udata, duk_size_t size)
+{
+  Profiler* profiler = ((Engine*)udata)->profiler();
+  if (profiler)
+    profiler->addAllocation(size);
+}
+
 void* on_alloc_function(void* udata, duk_size_t size)
 {
+  add_allocation(udata, size);
   if (size)
     return base_malloc(size);
   else
@@ -47,6 +60,7 @@ void* on_alloc_function(void* udata, duk_size_t size)
 
 void* on_realloc_function(void* udata, void* ptr, duk_size_t size)
 {
+  add_allocation(udata, size);
   if (!ptr) {
     if (size)
       return base_malloc(size);
@@ -96,6 +110,49 @@ void on_fatal_handler(duk_context* ctx, duk_errcode_t code, const char* msg)
   throw ScriptEngineException(code, msg);
 }
 
+Profiler* get_profiler(duk_context* ctx)
+{
+  duk_memory_functions funcs;
+  duk_get_memory_functions(ctx, &funcs);
+  return ((Engine*)funcs.udata)->profiler();
+}
+
+// Function used to call native functions when the engine has a
+// profiler. We cannot use a ProfilerScope here because Duktape
+// errors are longjmp()s that would skip its destructor, so an
+// interrupted call is only counted (without time/bytes).
+duk_ret_t on_profiled_function(duk_context* ctx)
+{
+  duk_push_current_function(ctx);
+  duk_get_prop_string(ctx, -1, kFuncId);
+  duk_get_prop_string(ctx, -2, kStatsId);
+  auto func = (Function)duk_get_pointer(ctx, -2);
+  auto stats = (Profiler::Stats*)duk_get_pointer(ctx, -1);
+  duk_pop_3(ctx);
+
+  Profiler* profiler = get_profiler(ctx);
+  const std::size_t bytes = profiler->allocatedBytes();
+  const double start = Profiler::now();
+  ++stats->calls;
+
+  duk_ret_t result = func(ctx);
+
+  stats->time += Profiler::now() - start;
+  stats->bytes += profiler->allocatedBytes() - bytes;
+  return result;
+}
+
+std::string make_func_name(const char* prefix, const char* id)
+{
+  std::string name;
+  if (prefix) {
+    name = prefix;
+    name.push_back('.');
+  }
+  name += id;
+  return name;
+}
+
 }
 
 void Context::dump()
@@ -239,6 +296,15 @@ void* Context::requireObject(index_t i, const char* className)
   return result;
 }
 
+void* Context::requireBuffer(index_t i, std::size_t* size)
+{
+  duk_size_t bufSize = 0;
+  void* result = duk_require_buffer_data(m_handle, i, &bufSize);
+  if (size)
+    *size = bufSize;
+  return result;
+}
+
 void Context::pushUndefined()
 {
   duk_push_undefined(m_handle);
@@ -302,6 +368,31 @@ void Context::pushPointer(void* ptr)
   duk_push_pointer(m_handle, ptr);
 }
 
+void* Context::pushTypedArray(ArrayType type, std::size_t n)
+{
+  std::size_t elemSize = 1;
+  duk_uint_t flags = DUK_BUFOBJ_UINT8ARRAY;
+  switch (type) {
+    case ArrayType::Uint8:
+      break;
+    case ArrayType::Uint16:
+      elemSize = 2;
+      flags = DUK_BUFOBJ_UINT16ARRAY;
+      break;
+    case ArrayType::Uint32:
+      elemSize = 4;
+      flags = DUK_BUFOBJ_UINT32ARRAY;
+      break;
+  }
+
+  // Create the plain buffer and replace it with the typed array
+  // that references it
+  void* data = duk_push_fixed_buffer(m_handle, n*elemSize);
+  duk_push_buffer_object(m_handle, -1, 0, n*elemSize, flags);
+  duk_remove(m_handle, -2);
+  return data;
+}
+
 index_t Context::pushObject()
 {
   return duk_push_object(m_handle);
@@ -322,6 +413,11 @@ index_t Context::pushObject(void* ptr, const char* className)
   return obj;
 }
 
+index_t Context::pushArray()
+{
+  return duk_push_array(m_handle);
+}
+
 void Context::pushGlobalObject()
 {
   duk_push_global_object(m_handle);
@@ -338,37 +434,12 @@ void Context::registerProp(index_t idx,
                            Function getter,
                            Function setter)
 {
-  duk_push_string(m_handle, id);
-  if (idx < 0)
-    --idx;
-
-  duk_uint_t flags = 0;
-
-  if (getter) {
-    flags |= DUK_DEFPROP_HAVE_GETTER;
-    duk_push_c_function(m_handle, getter, 0);
-    if (idx < 0)
-      --idx;
-  }
-
-  if (setter) {
-    flags |= DUK_DEFPROP_HAVE_SETTER;
-    duk_push_c_function(m_handle, setter, 1);
-    if (idx < 0)
-      --idx;
-  }
-
-  duk_def_prop(m_handle, idx, flags);
+  putProp(idx, nullptr, id, getter, setter);
 }
 
 void Context::registerProps(index_t idx, const PropertyEntry* props)
 {
-  for (int i=0; props[i].id; ++i) {
-    registerProp(idx,
-                 props[i].id,
-                 props[i].getter,
-                 props[i].setter);
-  }
+  putProps(idx, nullptr, props);
 }
 
 void Context::registerFunc(index_t idx,
@@ -376,13 +447,13 @@ void Context::registerFunc(index_t idx,
                            const Function func,
                            index_t nargs)
 {
-  duk_push_c_function(m_handle, func, nargs);
+  pushFunction(id, func, nargs);
   duk_put_prop_string(m_handle, idx, id);
 }
 
 void Context::registerFuncs(index_t idx, const FunctionEntry* methods)
 {
-  duk_put_function_list(m_handle, idx, (const duk_function_list_entry*)methods);
+  putFunctions(idx, nullptr, methods);
 }
 
 void Context::registerObject(index_t idx,
@@ -395,9 +466,9 @@ void Context::registerObject(index_t idx,
     --idx;
 
   if (methods)
-    registerFuncs(-1, methods);
+    putFunctions(-1, id, methods);
   if (props)
-    registerProps(-1, props);
+    putProps(-1, id, props);
 
   duk_put_prop_string(m_handle, idx, id);
 }
@@ -409,18 +480,89 @@ void Context::registerClass(index_t idx,
                             const PropertyEntry* props)
 {
   ASSERT(ctorFunc);
-  duk_push_c_function(m_handle, ctorFunc, ctorNargs);
+  pushFunction(id, ctorFunc, ctorNargs);
 
   duk_push_object(m_handle); // Prototype object
- if (methods)
-    duk_put_function_list(m_handle, -1, (const duk_function_list_entry*)methods);
+  if (methods)
+    putFunctions(-1, id, methods);
   if (props)
-    registerProps(-1, props);
+    putProps(-1, id, props);
 
   duk_set_prototype(m_handle, -2);
   duk_put_prop_string(m_handle, idx-1, id);
 }
 
+void Context::pushFunction(const char* id, Function func, index_t nargs)
+{
+  Profiler* profiler = get_profiler(m_handle);
+  if (!profiler) {
+    duk_push_c_function(m_handle, func, nargs);
+    return;
+  }
+
+  auto& stats = profiler->stats(Profiler::Category::Native, id);
+  duk_push_c_function(m_handle, &on_profiled_function, nargs);
+  duk_push_pointer(m_handle, (void*)func);
+  duk_put_prop_string(m_handle, -2, kFuncId);
+  duk_push_pointer(m_handle, (void*)&stats);
+  duk_put_prop_string(m_handle, -2, kStatsId);
+}
+
+void Context::putFunctions(index_t idx, const char* prefix,
+                           const FunctionEntry* methods)
+{
+  if (!get_profiler(m_handle)) {
+    duk_put_function_list(m_handle, idx, (const duk_function_list_entry*)methods);
+    return;
+  }
+
+  for (int i=0; methods[i].id; ++i) {
+    pushFunction(make_func_name(prefix, methods[i].id).c_str(),
+                 methods[i].value,
+                 methods[i].nargs);
+    duk_put_prop_string(m_handle, (idx < 0 ? idx-1: idx), methods[i].id);
+  }
+}
+
+void Context::putProps(index_t idx, const char* prefix,
+                       const PropertyEntry* props)
+{
+  for (int i=0; props[i].id; ++i) {
+    putProp(idx,
+            prefix,
+            props[i].id,
+            props[i].getter,
+            props[i].setter);
+  }
+}
+
+void Context::putProp(index_t idx, const char* prefix, const char* id,
+                      Function getter, Function setter)
+{
+  duk_push_string(m_handle, id);
+  if (idx < 0)
+    --idx;
+
+  duk_uint_t flags = 0;
+  const std::string name = make_func_name(prefix, id);
+
+  if (getter) {
+    flags |= DUK_DEFPROP_HAVE_GETTER;
+    pushFunction(("get " + name).c_str(), getter, 0);
+    if (idx < 0)
+      --idx;
+  }
+
+  if (setter) {
+    flags |= DUK_DEFPROP_HAVE_SETTER;
+    pushFunction(("set " + name).c_str(), setter, 1);
+    if (idx < 0)
+      --idx;
+  }
+
+  duk_def_prop(m_handle, idx, flags);
+}
+
 void* Context::getThis()
 {
   duk_push_this(m_handle);
@@ -445,8 +587,14 @@ void Context::setProp(index_t i, const char* propName)
   duk_put_prop_string(m_handle, i, propName);
 }
 
-Engine::Engine(EngineDelegate* delegate)
-  : m_ctx(duk_create_heap(&on_alloc_function,
+void Context::setPropIndex(index_t i, unsigned int arrayIndex)
+{
+  duk_put_prop_index(m_handle, i, arrayIndex);
+}
+
+Engine::Engine(EngineDelegate* delegate, Profiler* profiler)
+  : m_profiler(profiler)
+  , m_ctx(duk_create_heap(&on_alloc_function,
                           &on_realloc_function,
                           &on_free_function,
                           (void*)this,
@@ -478,6 +626,7 @@ void Engine::eval(const std::string& jsCode)
   onBeforeEval();
   try {
     ContextHandle handle = m_ctx.handle();
+    ProfilerScope scope(m_profiler, Profiler::Category::Script, "<eval>");
 
     duk_eval_string(handle, jsCode.c_str());
 
@@ -527,6 +676,7 @@ void Engine::evalFile(const std::string& file)
     fclose(f);
     f = nullptr;
 
+    ProfilerScope scope(m_profiler, Profiler::Category::Script, file);
     duk_push_string(handle, duk_to_string(handle, -1));
     duk_eval_raw(handle, nullptr, 0, DUK_COMPILE_EVAL);
 
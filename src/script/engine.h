@@ -1,5 +1,5 @@
 // Aseprite Scripting Library
-// Copyright (c) 2015-2016 David Capello
+// Copyright (c) 2015-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,6 +8,7 @@
 #define SCRIPT_ENGINE_H_INCLUDED
 #pragma once
 
+#include <cstddef>
 #include <string>
 
 struct duk_hthread;
@@ -15,6 +16,7 @@ struct duk_hthread;
 namespace script {
   class Context;
   class EngineDelegate;
+  class Profiler;
 
   typedef int result_t;
   typedef int index_t;
@@ -40,6 +42,14 @@ namespace script {
     double value;
   };
 
+  // Types of typed arrays that can be pushed with
+  // Context::pushTypedArray()
+  enum class ArrayType {
+    Uint8,
+    Uint16,
+    Uint32
+  };
+
   class Module {
   public:
     virtual ~Module() { }
@@ -82,6 +92,7 @@ namespace script {
     bool hasProp(index_t i, const char* propName);
     void getProp(index_t i, const char* propName);
     void setProp(index_t i, const char* propName);
+    void setPropIndex(index_t i, unsigned int arrayIndex);
 
     bool requireBool(index_t i);
     double requireNumber(index_t i);
@@ -90,6 +101,10 @@ namespace script {
     const char* requireString(index_t i);
     void* requireObject(index_t i, const char* className);
 
+    // Returns the data of a buffer or typed array (e.g. Uint8Array)
+    // and its size in bytes.
+    void* requireBuffer(index_t i, std::size_t* size);
+
     void pushUndefined();
     void pushNull();
     void pushBool(bool val);
@@ -101,8 +116,14 @@ namespace script {
     void pushThis();
     void pushThis(void* ptr, const char* className);
     void pushPointer(void* ptr);
+
+    // Pushes a new typed array of "n" elements (initialized to zero)
+    // and returns a pointer to its data, so it can be filled from
+    // native code.
+    void* pushTypedArray(ArrayType type, std::size_t n);
     index_t pushObject();
     index_t pushObject(void* ptr, const char* className);
+    index_t pushArray();
     void pushGlobalObject();
 
     void registerConstants(index_t idx,
@@ -130,12 +151,22 @@ namespace script {
                        const PropertyEntry* props);
 
   private:
+    void pushFunction(const char* id, Function func, index_t nargs);
+    void putFunctions(index_t idx, const char* prefix,
+                      const FunctionEntry* methods);
+    void putProps(index_t idx, const char* prefix,
+                  const PropertyEntry* props);
+    void putProp(index_t idx, const char* prefix, const char* id,
+                 Function getter, Function setter);
+
     ContextHandle m_handle;
   };
 
   class Engine {
   public:
-    Engine(EngineDelegate* delegate);
+    // If a profiler is given, all native functions registered in
+    // this engine will be instrumented to measure their calls.
+    Engine(EngineDelegate* delegate, Profiler* profiler = nullptr);
     ~Engine();
 
     void printLastResult();
@@ -143,6 +174,7 @@ namespace script {
     void evalFile(const std::string& file);
 
     Context& context() { return m_ctx; }
+    Profiler* profiler() const { return m_profiler; }
 
     void registerModule(Module* module);
 
@@ -151,6 +183,9 @@ namespace script {
     virtual void onAfterEval(bool err) { }
 
   private:
+    // The profiler is the first member because it's used by the
+    // allocation functions of the heap created for m_ctx.
+    Profiler* m_profiler;
     Context m_ctx;
     EngineDelegate* m_delegate;
     bool m_printLastResult;
@@ -0,0 +1,116 @@
+// Aseprite Scripting Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "script/profiler.h"
+
+#include "base/replace_string.h"
+
+#include <chrono>
+#include <iostream>
+
+namespace script {
+
+namespace {
+
+std::string escape_for_json(const std::string& str)
+{
+  std::string res = str;
+  base::replace_string(res, "\\", "\\\\");
+  base::replace_string(res, "\"", "\\\"");
+  return res;
+}
+
+void write_stats(std::ostream& os,
+                 const char* id,
+                 const Profiler::StatsMap& map,
+                 bool last)
+{
+  os << "  \"" << id << "\": {";
+  bool first = true;
+  for (const auto& it : map) {
+    const Profiler::Stats& stats = it.second;
+    os << (first ? "\n": ",\n")
+       << "    \"" << escape_for_json(it.first) << "\": { "
+       << "\"calls\": " << stats.calls << ", "
+       << "\"time\": " << stats.time << ", "
+       << "\"bytes\": " << stats.bytes << " }";
+    first = false;
+  }
+  os << (first ? "}": "\n  }") << (last ? "\n": ",\n");
+}
+
+} // anonymous namespace
+
+Profiler::Profiler()
+  : m_allocatedBytes(0)
+{
+}
+
+Profiler::Stats& Profiler::stats(Category category, const std::string& name)
+{
+  switch (category) {
+    case Category::Script: return m_scripts[name];
+    case Category::Native: return m_natives[name];
+    default: return m_sections[name];
+  }
+}
+
+// static
+double Profiler::now()
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double Profiler::nativeTime() const
+{
+  double time = 0.0;
+  for (const auto& it : m_natives)
+    time += it.second.time;
+  return time;
+}
+
+void Profiler::writeJson(std::ostream& os) const
+{
+  double scriptTime = 0.0;
+  for (const auto& it : m_scripts)
+    scriptTime += it.second.time;
+
+  os << "{\n";
+  write_stats(os, "scripts", m_scripts, false);
+  write_stats(os, "natives", m_natives, false);
+  write_stats(os, "sections", m_sections, false);
+  os << "  \"totals\": { "
+     << "\"time\": " << scriptTime << ", "
+     << "\"nativeTime\": " << nativeTime() << ", "
+     << "\"bytes\": " << m_allocatedBytes << " }\n"
+     << "}\n";
+}
+
+ProfilerScope::ProfilerScope(Profiler* profiler,
+                             Profiler::Category category,
+                             const std::string& name)
+  : m_profiler(profiler)
+  , m_stats(profiler ? &profiler->stats(category, name): nullptr)
+  , m_bytes(profiler ? profiler->allocatedBytes(): 0)
+  , m_start(profiler ? Profiler::now(): 0.0)
+{
+}
+
+ProfilerScope::~ProfilerScope()
+{
+  if (m_profiler) {
+    ++m_stats->calls;
+    m_stats->time += Profiler::now() - m_start;
+    m_stats->bytes += m_profiler->allocatedBytes() - m_bytes;
+  }
+}
+
+} // namespace script
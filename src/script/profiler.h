@@ -0,0 +1,91 @@
+// Aseprite Scripting Library
+// Copyright (c) 2017 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef SCRIPT_PROFILER_H_INCLUDED
+#define SCRIPT_PROFILER_H_INCLUDED
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+namespace script {
+
+  // Collects statistics of the scripts executed by an Engine: the
+  // time spent and the bytes allocated in each evaluated script, in
+  // each native function/property called from JavaScript, and in
+  // other sections of the host application (e.g. committing the
+  // changes to the document).
+  //
+  // The profiler must be given to the Engine constructor so native
+  // functions are registered with the instrumentation code.
+  class Profiler {
+  public:
+    struct Stats {
+      int calls = 0;
+      double time = 0.0;        // In seconds
+      std::size_t bytes = 0;    // Bytes allocated in the script heap
+    };
+
+    enum class Category {
+      Script,                   // Evaluated scripts/files
+      Native,                   // Native functions and properties
+      Section,                  // Other parts of the host app
+    };
+
+    typedef std::map<std::string, Stats> StatsMap;
+
+    Profiler();
+
+    // Returns the statistics of the given item. The returned
+    // reference is valid until the profiler is destroyed.
+    Stats& stats(Category category, const std::string& name);
+
+    const StatsMap& scripts() const { return m_scripts; }
+    const StatsMap& natives() const { return m_natives; }
+    const StatsMap& sections() const { return m_sections; }
+
+    // Total number of bytes allocated in the script heap since the
+    // profiler was created.
+    std::size_t allocatedBytes() const { return m_allocatedBytes; }
+    void addAllocation(std::size_t size) { m_allocatedBytes += size; }
+
+    // Time spent inside native functions (it's used to know the time
+    // spent running JavaScript code).
+    double nativeTime() const;
+
+    void writeJson(std::ostream& os) const;
+
+    // Current time in seconds (only useful to calculate intervals).
+    static double now();
+
+  private:
+    StatsMap m_scripts;
+    StatsMap m_natives;
+    StatsMap m_sections;
+    std::size_t m_allocatedBytes;
+  };
+
+  // Adds the elapsed time and allocated bytes between the
+  // constructor and the destructor to the given stats.
+  class ProfilerScope {
+  public:
+    ProfilerScope(Profiler* profiler,
+                  Profiler::Category category,
+                  const std::string& name);
+    ~ProfilerScope();
+
+  private:
+    Profiler* m_profiler;
+    Profiler::Stats* m_stats;
+    std::size_t m_bytes;
+    double m_start;
+  };
+
+}
+
+#endif
@@ -22,6 +22,7 @@
 #include "she/surface.h"
 #include "she/system.h"
 #include "ui/intern.h"
+#include "ui/message_queue.h"
 #include "ui/ui.h"
 
 #ifdef DEBUG_PAINT_EVENTS
@@ -56,14 +57,13 @@ struct Filter {
     , widget(widget) { }
 };
 
-typedef std::list<Message*> Messages;
 typedef std::list<Filter*> Filters;
 
 Manager* Manager::m_defaultManager = NULL;
 gfx::Region Manager::m_dirtyRegion;
 
 static WidgetsList mouse_widgets_list; // List of widgets to send mouse events
-static Messages msg_queue;             // Messages queue
+static MessageQueue msg_queue;         // Messages queue
 static Filters msg_filters[NFILTERS]; // Filters for every enqueued message
 static int filter_locks = 0;
 
@@ -604,7 +604,53 @@ void Manager::addToGarbage(Widget* widget)
 void Manager::enqueueMessage(Message* msg)
 {
   ASSERT(msg);
-  msg_queue.push_back(msg);
+
+  switch (msg->type()) {
+
+    // Replace the last mouse movement (if it wasn't dispatched yet)
+    // when no button is pressed. Movements with pressed buttons are
+    // kept because tools (e.g. freehand) need every position.
+    case kMouseMoveMessage: {
+      Message* last = msg_queue.back();
+      if (last &&
+          !last->isUsed() &&
+          last->type() == kMouseMoveMessage &&
+          last->recipients() == msg->recipients() &&
+          last->modifiers() == msg->modifiers()) {
+        auto mouseMsg = static_cast<MouseMessage*>(msg);
+        auto lastMouseMsg = static_cast<MouseMessage*>(last);
+        if (mouseMsg->buttons() == kButtonNone &&
+            lastMouseMsg->buttons() == kButtonNone &&
+            mouseMsg->pointerType() == lastMouseMsg->pointerType()) {
+          msg_queue.erase(last);
+          delete last;
+        }
+      }
+      break;
+    }
+
+    // Discard paint messages that are already covered by a
+    // pending paint message for the same widget.
+    case kPaintMessage:
+      if (msg->recipients().size() == 1 &&
+          msg_queue.hasMessagesFor(msg->recipients().front())) {
+        auto paintMsg = static_cast<PaintMessage*>(msg);
+        for (auto pos=msg_queue.end(); pos!=msg_queue.begin(); ) {
+          Message* other = msg_queue.at(--pos);
+          if (other &&
+              !other->isUsed() &&
+              other->type() == kPaintMessage &&
+              other->recipients() == msg->recipients() &&
+              static_cast<PaintMessage*>(other)->rect().contains(paintMsg->rect())) {
+            delete msg;
+            return;
+          }
+        }
+      }
+      break;
+  }
+
+  msg_queue.push(msg);
 }
 
 Window* Manager::getTopWindow()
@@ -866,37 +912,43 @@ void Manager::freeWidget(Widget* widget)
 
 void Manager::removeMessage(Message* msg)
 {
-  auto it = std::find(msg_queue.begin(), msg_queue.end(), msg);
-  ASSERT(it != msg_queue.end());
-  msg_queue.erase(it);
+  msg_queue.erase(msg);
 }
 
 void Manager::removeMessagesFor(Widget* widget)
 {
-  for (Message* msg : msg_queue)
-    removeWidgetFromRecipients(widget, msg);
+  if (!msg_queue.hasMessagesFor(widget))
+    return;
+
+  for (auto pos=msg_queue.begin(); pos!=msg_queue.end(); ++pos)
+    if (Message* msg = msg_queue.at(pos))
+      removeWidgetFromRecipients(widget, msg);
 }
 
 void Manager::removeMessagesFor(Widget* widget, MessageType type)
 {
-  for (Message* msg : msg_queue)
-    if (msg->type() == type)
+  if (!msg_queue.hasMessagesFor(widget))
+    return;
+
+  for (auto pos=msg_queue.begin(); pos!=msg_queue.end(); ++pos) {
+    Message* msg = msg_queue.at(pos);
+    if (msg && msg->type() == type)
       removeWidgetFromRecipients(widget, msg);
+  }
 }
 
 void Manager::removeMessagesForTimer(Timer* timer)
 {
-  for (auto it=msg_queue.begin(); it != msg_queue.end(); ) {
-    Message* msg = *it;
+  for (auto pos=msg_queue.begin(); pos!=msg_queue.end(); ++pos) {
+    Message* msg = msg_queue.at(pos);
 
-    if (!msg->isUsed() &&
+    if (msg &&
+        !msg->isUsed() &&
         msg->type() == kTimerMessage &&
         static_cast<TimerMessage*>(msg)->timer() == timer) {
+      msg_queue.erase(msg);
       delete msg;
-      it = msg_queue.erase(it);
     }
-    else
-      ++it;
   }
 }
 
@@ -1206,19 +1258,20 @@ int Manager::pumpQueue()
 #endif
 
   int count = 0;                // Number of processed messages
-  auto it = msg_queue.begin();
-  while (it != msg_queue.end()) {
+  auto pos = msg_queue.begin();
+  while (pos < msg_queue.end()) {
 #ifdef LIMIT_DISPATCH_TIME
     if (base::current_tick()-t > 250)
       break;
 #endif
 
     // The message to process
-    Message* msg = *it;
+    Message* msg = msg_queue.at(pos);
 
-    // Go to next message
-    if (msg->isUsed()) {
-      ++it;
+    // Go to next message (removed messages are nullptr, and used
+    // messages are being dispatched by an outer pumpQueue() call)
+    if (!msg || msg->isUsed()) {
+      ++pos;
       continue;
     }
 
@@ -1265,8 +1318,10 @@ int Manager::pumpQueue()
       }
     }
 
-    // Remove the message from the msg_queue
-    it = msg_queue.erase(it);
+    // Remove the message from the msg_queue (its position could be
+    // changed by new messages added while it was dispatched)
+    pos = msg_queue.position(first_msg) + 1;
+    msg_queue.erase(first_msg);
 
     // Destroy the message
     delete first_msg;
@@ -1435,7 +1490,7 @@ void Manager::collectGarbage()
 // static
 void Manager::removeWidgetFromRecipients(Widget* widget, Message* msg)
 {
-  msg->removeRecipient(widget);
+  msg_queue.removeRecipient(msg, widget);
 }
 
 // static
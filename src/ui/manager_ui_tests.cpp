@@ -0,0 +1,160 @@
+// Aseprite UI Library
+// Copyright (C) 2017  David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#define TEST_GUI
+#include "tests/test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+using namespace ui;
+
+namespace {
+
+  typedef std::chrono::high_resolution_clock Clock;
+
+  class CountWidget : public Widget {
+  public:
+    int received = 0;
+    gfx::Point lastPos;
+    std::function<void()> onMessage;
+
+  protected:
+    bool onProcessMessage(Message* msg) override {
+      ++received;
+      if (msg->type() == kMouseMoveMessage)
+        lastPos = static_cast<MouseMessage*>(msg)->position();
+      if (onMessage)
+        onMessage();
+      return true;
+    }
+  };
+
+  void enqueue_mouse_move(Widget* widget, const gfx::Point& pos,
+                          MouseButtons buttons = kButtonNone)
+  {
+    Message* msg = new MouseMessage(
+      kMouseMoveMessage, PointerType::Mouse, buttons,
+      kKeyNoneModifier, pos);
+    msg->addRecipient(widget);
+    Manager::getDefault()->enqueueMessage(msg);
+  }
+
+}
+
+TEST(Manager, DispatchInOrder)
+{
+  CountWidget a, b;
+  for (int i=0; i<1000; ++i) {
+    Message* msg = new Message(kMouseDownMessage, kKeyNoneModifier);
+    msg->addRecipient(i & 1 ? &b: &a);
+    Manager::getDefault()->enqueueMessage(msg);
+  }
+
+  Manager::getDefault()->dispatchMessages();
+  EXPECT_EQ(500, a.received);
+  EXPECT_EQ(500, b.received);
+}
+
+TEST(Manager, CoalesceMouseMoves)
+{
+  CountWidget a;
+  for (int i=0; i<10; ++i)
+    enqueue_mouse_move(&a, gfx::Point(i, 0));
+
+  Manager::getDefault()->dispatchMessages();
+  EXPECT_EQ(1, a.received);
+  EXPECT_EQ(gfx::Point(9, 0), a.lastPos);
+
+  // Movements with pressed buttons are not coalesced
+  for (int i=0; i<10; ++i)
+    enqueue_mouse_move(&a, gfx::Point(i, 0), kButtonLeft);
+
+  Manager::getDefault()->dispatchMessages();
+  EXPECT_EQ(11, a.received);
+}
+
+TEST(Manager, RemoveMessagesFor)
+{
+  CountWidget a;
+  {
+    CountWidget b;
+    for (int i=0; i<10; ++i) {
+      enqueue_mouse_move(&a, gfx::Point(i, 0), kButtonLeft);
+      enqueue_mouse_move(&b, gfx::Point(i, 0), kButtonLeft);
+    }
+    // ~Widget() removes "b" from the recipients of queued messages
+  }
+
+  Manager::getDefault()->dispatchMessages();
+  EXPECT_EQ(10, a.received);
+}
+
+TEST(Manager, NestedMessageLoop)
+{
+  CountWidget a, b;
+  int nested = 0;
+
+  // The first message received by "a" enqueues messages for "b" and
+  // dispatches them from a nested loop (like a modal window).
+  a.onMessage = [&]{
+    if (nested++ == 0) {
+      for (int i=0; i<1000; ++i)
+        enqueue_mouse_move(&b, gfx::Point(i, 0), kButtonLeft);
+      Manager::getDefault()->dispatchMessages();
+    }
+  };
+
+  for (int i=0; i<10; ++i)
+    enqueue_mouse_move(&a, gfx::Point(i, 0), kButtonLeft);
+
+  Manager::getDefault()->dispatchMessages();
+  EXPECT_EQ(10, a.received);
+  EXPECT_EQ(1000, b.received);
+}
+
+// Measures the message throughput and the time each message waits in
+// the queue until it's dispatched.
+TEST(Manager, DISABLED_MessageThroughputBenchmark)
+{
+  const int kBatches = 1000;
+  const int kMessagesPerBatch = 1000;
+
+  CountWidget a;
+  std::vector<Clock::time_point> times(kMessagesPerBatch);
+  std::vector<double> latencies;
+  latencies.reserve(kBatches*kMessagesPerBatch);
+
+  int i = 0;
+  a.onMessage = [&]{
+    latencies.push_back(
+      std::chrono::duration<double, std::micro>(
+        Clock::now() - times[i++]).count());
+  };
+
+  const Clock::time_point t0 = Clock::now();
+  for (int batch=0; batch<kBatches; ++batch) {
+    for (int j=0; j<kMessagesPerBatch; ++j) {
+      times[j] = Clock::now();
+      enqueue_mouse_move(&a, gfx::Point(j, batch), kButtonLeft);
+    }
+    i = 0;
+    Manager::getDefault()->dispatchMessages();
+  }
+  const double secs =
+    std::chrono::duration<double>(Clock::now() - t0).count();
+
+  ASSERT_EQ(kBatches*kMessagesPerBatch, a.received);
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << "Messages/sec: " << (a.received / secs) << "\n"
+            << "Latency (us): "
+            << "p50=" << latencies[latencies.size()/2] << " "
+            << "p99=" << latencies[latencies.size()*99/100] << " "
+            << "max=" << latencies.back() << "\n";
+}
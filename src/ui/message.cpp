@@ -15,14 +15,95 @@
 #include "ui/manager.h"
 #include "ui/widget.h"
 
+#include <algorithm>
 #include <cstring>
+#include <new>
 
 namespace ui {
 
+namespace {
+
+// Pool of memory blocks used to allocate messages. Freed blocks are
+// kept in a list for each size (multiple of kGranularity bytes), so
+// the next message of the same size reuses them.
+class MessagePool {
+public:
+  MessagePool() {
+    std::fill(m_free, m_free+kSizes, nullptr);
+  }
+
+  ~MessagePool() {
+    for (FreeBlock*& block : m_free) {
+      while (block) {
+        FreeBlock* next = block->next;
+        base_free(block);
+        block = next;
+      }
+    }
+  }
+
+  void* allocate(std::size_t size) {
+    const std::size_t i = sizeIndex(size);
+    if (i < kSizes && m_free[i]) {
+      FreeBlock* block = m_free[i];
+      m_free[i] = block->next;
+      return block;
+    }
+
+    void* ptr = base_malloc(i < kSizes ? (i+1)*kGranularity: size);
+    if (!ptr)
+      throw std::bad_alloc();
+    return ptr;
+  }
+
+  void deallocate(void* ptr, std::size_t size) {
+    const std::size_t i = sizeIndex(size);
+    if (i < kSizes) {
+      FreeBlock* block = (FreeBlock*)ptr;
+      block->next = m_free[i];
+      m_free[i] = block;
+    }
+    else
+      base_free(ptr);
+  }
+
+private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static const std::size_t kGranularity = 16;
+  static const std::size_t kSizes = 16; // Blocks up to 256 bytes
+
+  static std::size_t sizeIndex(std::size_t size) {
+    return (size+kGranularity-1) / kGranularity - 1;
+  }
+
+  FreeBlock* m_free[kSizes];
+};
+
+MessagePool pool;
+
+} // anonymous namespace
+
+// static
+void* Message::operator new(std::size_t size)
+{
+  return pool.allocate(size);
+}
+
+// static
+void Message::operator delete(void* ptr, std::size_t size)
+{
+  if (ptr)
+    pool.deallocate(ptr, size);
+}
+
 Message::Message(MessageType type, KeyModifiers modifiers)
   : m_type(type)
   , m_used(false)
   , m_fromFilter(false)
+  , m_queuePos(0)
 {
   if (modifiers == kKeyUninitializedModifier && she::instance())
     m_modifiers = she::instance()->keyModifiers();
@@ -1,5 +1,5 @@
 // Aseprite UI Library
-// Copyright (C) 2001-2016  David Capello
+// Copyright (C) 2001-2017  David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -17,11 +17,13 @@
 #include "ui/pointer_type.h"
 #include "ui/widgets_list.h"
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
 namespace ui {
 
+  class MessageQueue;
   class Timer;
   class Widget;
 
@@ -33,6 +35,11 @@ namespace ui {
             KeyModifiers modifiers = kKeyUninitializedModifier);
     virtual ~Message();
 
+    // Messages are created/deleted continuously (mouse movement,
+    // paint messages, etc.) so they are allocated from a pool.
+    static void* operator new(std::size_t size);
+    static void operator delete(void* ptr, std::size_t size);
+
     MessageType type() const { return m_type; }
     const WidgetsList& recipients() const { return m_recipients; }
     bool hasRecipients() const { return !m_recipients.empty(); }
@@ -64,6 +71,9 @@ namespace ui {
     bool m_used;              // Was used
     bool m_fromFilter;        // Sent from pre-filter
     KeyModifiers m_modifiers; // Key modifiers pressed when message was created
+    std::size_t m_queuePos;   // Position in the MessageQueue
+
+    friend class MessageQueue;
   };
 
   class KeyMessage : public Message {
@@ -0,0 +1,130 @@
+// Aseprite UI Library
+// Copyright (C) 2017  David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ui/message_queue.h"
+
+#include "base/debug.h"
+#include "ui/message.h"
+
+namespace ui {
+
+static const std::size_t kInitialCapacity = 256;
+
+MessageQueue::MessageQueue()
+  : m_items(kInitialCapacity, nullptr)
+  , m_head(0)
+  , m_tail(0)
+  , m_mask(kInitialCapacity-1)
+  , m_count(0)
+{
+}
+
+Message* MessageQueue::back() const
+{
+  if (m_head != m_tail)
+    return at(m_tail-1);
+  else
+    return nullptr;
+}
+
+MessageQueue::Position MessageQueue::position(const Message* msg) const
+{
+  ASSERT(at(msg->m_queuePos) == msg);
+  return msg->m_queuePos;
+}
+
+void MessageQueue::push(Message* msg)
+{
+  ASSERT(msg);
+
+  if (m_tail - m_head == m_items.size())
+    resize();
+
+  msg->m_queuePos = m_tail;
+  m_items[m_tail & m_mask] = msg;
+  ++m_tail;
+  ++m_count;
+
+  for (Widget* widget : msg->recipients())
+    if (widget)
+      addRecipient(widget);
+}
+
+void MessageQueue::erase(Message* msg)
+{
+  ASSERT(msg);
+  ASSERT(at(msg->m_queuePos) == msg);
+
+  m_items[msg->m_queuePos & m_mask] = nullptr;
+  --m_count;
+
+  // Skip removed messages at the beginning of the queue
+  while (m_head != m_tail && !at(m_head))
+    ++m_head;
+
+  for (Widget* widget : msg->recipients())
+    if (widget)
+      decRecipient(widget);
+}
+
+void MessageQueue::removeRecipient(Message* msg, Widget* widget)
+{
+  for (Widget* recipient : msg->recipients())
+    if (recipient == widget)
+      decRecipient(widget);
+
+  msg->removeRecipient(widget);
+}
+
+// Called when the ring buffer is full. If there are a lot of removed
+// messages in the queue (e.g. messages processed by a nested message
+// loop while the first message is still being dispatched) we just
+// compact the queue, in other case the buffer size is duplicated.
+void MessageQueue::resize()
+{
+  const std::size_t capacity = m_items.size();
+
+  if (m_count <= capacity/2) {
+    Position dst = m_head;
+    for (Position pos=m_head; pos!=m_tail; ++pos) {
+      Message* msg = at(pos);
+      if (msg) {
+        m_items[pos & m_mask] = nullptr;
+        m_items[dst & m_mask] = msg;
+        msg->m_queuePos = dst;
+        ++dst;
+      }
+    }
+    m_tail = dst;
+  }
+  else {
+    std::vector<Message*> items(2*capacity, nullptr);
+    const std::size_t mask = items.size()-1;
+    for (Position pos=m_head; pos!=m_tail; ++pos)
+      items[pos & mask] = at(pos);
+    m_items.swap(items);
+    m_mask = mask;
+  }
+}
+
+void MessageQueue::addRecipient(Widget* widget)
+{
+  ++m_recipients[widget];
+}
+
+void MessageQueue::decRecipient(Widget* widget)
+{
+  auto it = m_recipients.find(widget);
+  ASSERT(it != m_recipients.end());
+  if (it != m_recipients.end() && --it->second == 0)
+    m_recipients.erase(it);
+}
+
+} // namespace ui
@@ -0,0 +1,86 @@
+// Aseprite UI Library
+// Copyright (C) 2017  David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef UI_MESSAGE_QUEUE_H_INCLUDED
+#define UI_MESSAGE_QUEUE_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace ui {
+
+  class Message;
+  class Widget;
+
+  // Queue of messages to be dispatched by the Manager. It's a ring
+  // buffer where each message knows its own position (see
+  // Message::m_queuePos), so a message can be removed in O(1) (its
+  // slot is set to nullptr and skipped when we iterate the queue).
+  //
+  // It keeps a counter of queued messages for each recipient too, so
+  // we can know if a widget has pending messages without iterating
+  // the whole queue (e.g. when a widget is destroyed).
+  class MessageQueue {
+  public:
+    typedef std::size_t Position;
+
+    MessageQueue();
+
+    bool empty() const { return m_count == 0; }
+    std::size_t size() const { return m_count; }
+
+    // Range of positions to iterate the queue. Removed messages
+    // return nullptr in at(). The range is valid until a message is
+    // added.
+    Position begin() const { return m_head; }
+    Position end() const { return m_tail; }
+    Message* at(Position pos) const { return m_items[pos & m_mask]; }
+
+    // Returns the current position of the given queued message.
+    Position position(const Message* msg) const;
+
+    // Returns the last message of the queue (or nullptr if the last
+    // message was removed).
+    Message* back() const;
+
+    // Adds the message at the end of the queue. All the message
+    // recipients must be added before calling this function.
+    void push(Message* msg);
+
+    // Removes the given message from the queue (the message is not
+    // deleted).
+    void erase(Message* msg);
+
+    // Removes the widget from the recipients of the given message.
+    void removeRecipient(Message* msg, Widget* widget);
+
+    // Returns true if the widget is a recipient of a queued message.
+    bool hasMessagesFor(Widget* widget) const {
+      return (m_recipients.find(widget) != m_recipients.end());
+    }
+
+  private:
+    void resize();
+    void addRecipient(Widget* widget);
+    void decRecipient(Widget* widget);
+
+    std::vector<Message*> m_items;
+    Position m_head;
+    Position m_tail;
+    std::size_t m_mask;
+    std::size_t m_count;
+    std::unordered_map<Widget*, int> m_recipients;
+
+    DISABLE_COPYING(MessageQueue);
+  };
+
+} // namespace ui
+
+#endif